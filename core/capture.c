@@ -0,0 +1,193 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "capture.h"
+
+#define FRAME_PIXELS    (SCREEN_WIDTH * SCREEN_HEIGHT)
+#define SLOT_SIZE       (FRAME_PIXELS + SCREEN_HEIGHT)
+
+/* 2C02 frame rate, 39375000 / 655171 = 60.0988 Hz, and pixel aspect ratio */
+#define Y4M_HEADER      "YUV4MPEG2 W256 H240 F39375000:655171 Ip A8:7 C444\n"
+
+/* Single producer(the emulation thread), single consumer(the writer)
+   ring: head is only stored by the producer and tail by the consumer, a
+   slot belongs to the writer from head to tail. */
+struct capture {
+    uint8_t *slots;
+    unsigned count;
+    _Atomic unsigned head;
+    _Atomic unsigned tail;
+    sem_t ready;
+    _Atomic bool quit;
+
+    pthread_t thread;
+    FILE *fp;
+    capture_format_t format;
+    uint8_t yuv[8][64][3];
+    uint8_t *planes;            /* one Y4M frame or delta record */
+    struct delta_encoder *encoder;
+    bool error;
+
+    uint64_t frames;
+    uint64_t dropped;
+    _Atomic uint64_t written;
+};
+
+/* BT.601, studio range */
+static void build_yuv(struct capture *cap, const struct palette_lut *lut)
+{
+    const uint8_t *rgb;
+
+    for (int e = 0; e < 8; e++) {
+        for (int i = 0; i < 64; i++) {
+            rgb = lut->rgb[e][i];
+            cap->yuv[e][i][0] = ((66 * rgb[0] + 129 * rgb[1] + 25 * rgb[2] + 128) >> 8) + 16;
+            cap->yuv[e][i][1] = ((-38 * rgb[0] - 74 * rgb[1] + 112 * rgb[2] + 128) >> 8) + 128;
+            cap->yuv[e][i][2] = ((112 * rgb[0] - 94 * rgb[1] - 18 * rgb[2] + 128) >> 8) + 128;
+        }
+    }
+}
+
+static bool write_frame(struct capture *cap, const uint8_t *slot)
+{
+    const uint8_t *frame = slot, *emphasis = slot + FRAME_PIXELS, *yuv;
+    uint8_t *y = cap->planes, *u = y + FRAME_PIXELS, *v = u + FRAME_PIXELS;
+    size_t size;
+
+    if (cap->format == CAPTURE_RAW)
+        return fwrite(slot, SLOT_SIZE, 1, cap->fp) == 1;
+    if (cap->format == CAPTURE_DELTA) {
+        size = delta_encode(cap->encoder, frame, emphasis, cap->planes);
+        return fwrite(cap->planes, size, 1, cap->fp) == 1;
+    }
+
+    for (int line = 0; line < SCREEN_HEIGHT; line++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++, frame++) {
+            yuv = cap->yuv[emphasis[line] & 0x07][*frame & 0x3f];
+            *y++ = yuv[0];
+            *u++ = yuv[1];
+            *v++ = yuv[2];
+        }
+    }
+    return fputs("FRAME\n", cap->fp) >= 0 && fwrite(cap->planes, FRAME_PIXELS * 3, 1, cap->fp) == 1;
+}
+
+static void *writer(void *arg)
+{
+    struct capture *cap = arg;
+    unsigned tail = atomic_load_explicit(&cap->tail, memory_order_relaxed), head;
+
+    for (;;) {
+        sem_wait(&cap->ready);
+        head = atomic_load_explicit(&cap->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            if (!cap->error && !write_frame(cap, cap->slots + (size_t)(tail % cap->count) * SLOT_SIZE))
+                cap->error = true;
+            if (!cap->error)
+                atomic_fetch_add_explicit(&cap->written, 1, memory_order_relaxed);
+            atomic_store_explicit(&cap->tail, tail + 1, memory_order_release);
+        }
+        if (atomic_load_explicit(&cap->quit, memory_order_acquire) &&
+            tail == atomic_load_explicit(&cap->head, memory_order_acquire))
+            break;
+    }
+    return NULL;
+}
+
+struct capture *capture_open(const char *path, capture_format_t format, int slots,
+                             const struct palette_lut *lut)
+{
+    struct capture *cap;
+
+    if (!(cap = calloc(1, sizeof(*cap))))
+        return NULL;
+    cap->count = (slots > 0) ? slots : 1;
+    cap->format = format;
+    if (!(cap->slots = malloc((size_t)cap->count * SLOT_SIZE)) ||
+        (format == CAPTURE_Y4M && !(cap->planes = malloc(FRAME_PIXELS * 3))) ||
+        (format == CAPTURE_DELTA && (!(cap->planes = malloc(DELTA_MAX_RECORD)) ||
+                                     !(cap->encoder = malloc(sizeof(*cap->encoder)))))) {
+        fprintf(stderr, "Capture: out of memory for %d frames\n", cap->count);
+        goto fail;
+    }
+    if (!(cap->fp = fopen(path, "wb"))) {
+        fprintf(stderr, "Capture: failed to open %s\n", path);
+        goto fail;
+    }
+    // a few frames per write() call
+    setvbuf(cap->fp, NULL, _IOFBF, 1024 * KB);
+    if (format == CAPTURE_Y4M) {
+        build_yuv(cap, lut);
+        fputs(Y4M_HEADER, cap->fp);
+    } else if (format == CAPTURE_DELTA) {
+        delta_encoder_init(cap->encoder, DELTA_KEYFRAME_INTERVAL);
+        delta_header(cap->encoder, cap->planes);
+        fwrite(cap->planes, DELTA_HEADER_SIZE, 1, cap->fp);
+    }
+
+    sem_init(&cap->ready, 0, 0);
+    if (pthread_create(&cap->thread, NULL, writer, cap)) {
+        fprintf(stderr, "Capture: failed to start the writer\n");
+        sem_destroy(&cap->ready);
+        goto fail;
+    }
+    return cap;
+
+fail:
+    if (cap->fp)
+        fclose(cap->fp);
+    free(cap->encoder);
+    free(cap->planes);
+    free(cap->slots);
+    free(cap);
+    return NULL;
+}
+
+/* emulation thread, false if the frame was dropped */
+bool capture_frame(struct capture *cap, const uint8_t *frame, const uint8_t *emphasis)
+{
+    unsigned head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+    uint8_t *slot;
+
+    cap->frames++;
+    if (head - atomic_load_explicit(&cap->tail, memory_order_acquire) == cap->count) {
+        cap->dropped++;
+        return false;
+    }
+    slot = cap->slots + (size_t)(head % cap->count) * SLOT_SIZE;
+    memcpy(slot, frame, FRAME_PIXELS);
+    memcpy(slot + FRAME_PIXELS, emphasis, SCREEN_HEIGHT);
+    atomic_store_explicit(&cap->head, head + 1, memory_order_release);
+    sem_post(&cap->ready);
+    return true;
+}
+
+/* emulation thread */
+void capture_get_stats(struct capture *cap, struct capture_stats *stats)
+{
+    stats->frames = cap->frames;
+    stats->dropped = cap->dropped;
+    stats->written = atomic_load_explicit(&cap->written, memory_order_relaxed);
+}
+
+/* waits for the frames in the ring to be written */
+int capture_close(struct capture *cap, struct capture_stats *stats)
+{
+    int ret;
+
+    atomic_store_explicit(&cap->quit, true, memory_order_release);
+    sem_post(&cap->ready);
+    pthread_join(cap->thread, NULL);
+    sem_destroy(&cap->ready);
+    ret = (fclose(cap->fp) || cap->error) ? -1 : 0;
+    if (ret)
+        fprintf(stderr, "Capture: write error, %llu frames written\n",
+                (unsigned long long)atomic_load(&cap->written));
+    if (stats)
+        capture_get_stats(cap, stats);
+    free(cap->encoder);
+    free(cap->planes);
+    free(cap->slots);
+    free(cap);
+    return ret;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+#include "deltacodec.h"
+
+/* Video capture of indexed frames(see PIXEL_INDEXED8) on a writer thread.
+
+   capture_frame() copies the frame into a free slot of a ring allocated up
+   front and never waits: with the ring full the frame is dropped and
+   counted. The writer thread turns the slots into a file:
+
+   CAPTURE_Y4M     YUV4MPEG2, 4:4:4 BT.601, colors from the palette given to
+                   capture_open()
+   CAPTURE_RAW     per frame 256x240 colors then the 240 line emphasis bytes
+   CAPTURE_DELTA   the same frames delta coded, lossless(see deltacodec.h)
+*/
+typedef enum CAPTURE_FORMAT {
+    CAPTURE_Y4M,
+    CAPTURE_RAW,
+    CAPTURE_DELTA,
+} capture_format_t;
+
+struct capture_stats {
+    uint64_t frames;    /* given to capture_frame() */
+    uint64_t written;
+    uint64_t dropped;
+};
+
+struct capture;
+
+struct capture *capture_open(const char *path, capture_format_t format, int slots,
+                             const struct palette_lut *lut);
+bool capture_frame(struct capture *cap, const uint8_t *frame, const uint8_t *emphasis);
+void capture_get_stats(struct capture *cap, struct capture_stats *stats);
+int capture_close(struct capture *cap, struct capture_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,22 +1,129 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cart.h"
+#include "ppulog.h"
 
 enum CART_REGION {
     ROM = 1,
     UNMAP = 2,
+    RAM = 4,
 };
 
 static uint8_t get_cart_region(uint16_t addr)
 {
     return (((addr >= 0x8000 && addr <= 0xffff) << 0) |
-            ((addr >= 0x4020 && addr <= 0x7fff) << 1));
+            ((addr >= 0x4020 && addr <= 0x5fff) << 1) |
+            ((addr >= 0x6000 && addr <= 0x7fff) << 2));
+}
+
+static void prg_ram_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
+{
+    struct cart *cart = &nes->cart;
+
+    if (!cart->prg_ram_enabled) {
+        if (mode == READ)
+            *val = 0xff;
+        return;
+    }
+    if (mode == READ) {
+        *val = cart->prg_ram_map[addr & 0x1fff];
+    } else if (!cart->prg_ram_protected) {
+        cart->prg_ram_map[addr & 0x1fff] = *val;
+        cart->save_dirty = true;
+    }
 }
 
 void cart_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
 {
-    if (get_cart_region(addr) == ROM)
+    switch (get_cart_region(addr)) {
+    case ROM:
+        if (nes->ppu_log && mode == WRITE)
+            ppulog_mapper(nes->ppu_log, nes->ppu.clock, addr, *val);
         mapper_rw(nes, addr, val, mode);
-    else if ((get_cart_region(addr) == UNMAP) && (mode == READ))
-        *val = 0xff;
+        break;
+    case RAM:
+        prg_ram_rw(nes, addr, val, mode);
+        break;
+    case UNMAP:
+        if (mode == READ)
+            *val = 0xff;
+        break;
+    default:
+        break;
+    }
+}
+
+/* <rom>.nes -> <rom>.sav */
+static void get_save_path(char *save_path, size_t size, const char *rom_path)
+{
+    const char *ext = strrchr(rom_path, '.');
+    int len = (ext && !strchr(ext, '/')) ? ext - rom_path : (int)strlen(rom_path);
+
+    snprintf(save_path, size, "%.*s.sav", len, rom_path);
+}
+
+static int map_save_file(struct cart *cart, const char *rom_path)
+{
+    char save_path[4096];
+    struct stat st;
+    void *ram;
+    int fd;
+
+    get_save_path(save_path, sizeof(save_path), rom_path);
+    fd = open(save_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open the save file %s\n", save_path);
+        return 1;
+    }
+    if (fstat(fd, &st) || (st.st_size < cart->info.prg_ram_size &&
+        ftruncate(fd, cart->info.prg_ram_size))) {
+        fprintf(stderr, "Can't resize the save file %s\n", save_path);
+        close(fd);
+        return 1;
+    }
+    ram = mmap(NULL, cart->info.prg_ram_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ram == MAP_FAILED) {
+        fprintf(stderr, "Can't map the save file %s\n", save_path);
+        return 1;
+    }
+    cart->prg_ram = ram;
+    cart->prg_ram_mapped = true;
+    return 0;
+}
+
+static int prg_ram_setup(struct cart *cart, const char *rom_path)
+{
+    // iNES 1.0 says 0 for the 8 KB most boards have
+    if (cart->info.prg_ram_size < 8 * KB)
+        cart->info.prg_ram_size = 8 * KB;
+    cart->prg_ram_enabled = true;
+    cart->prg_ram_protected = false;
+    cart->prg_ram_mapped = false;
+    cart->save_dirty = false;
+
+    // without a usable save file the game still runs, it just won't save
+    if (cart->info.battery && !cart->no_save && !map_save_file(cart, rom_path))
+        return 0;
+    cart->prg_ram = calloc(cart->info.prg_ram_size, sizeof(uint8_t));
+    if (!cart->prg_ram) {
+        fprintf(stderr, "can't allocate PRGRAM\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* called at the start of every vblank, and on unload */
+void cart_sync(struct nes *nes, bool wait)
+{
+    struct cart *cart = &nes->cart;
+
+    if (!cart->prg_ram_mapped || !cart->save_dirty)
+        return;
+    msync(cart->prg_ram, cart->info.prg_ram_size, (wait) ? MS_SYNC : MS_ASYNC);
+    cart->save_dirty = false;
 }
 
 // TODO: parse other informations from the header
@@ -32,58 +139,99 @@ int cart_parse_header(struct nes *nes, uint8_t *header)
     nes->cart.info.prg_ram_size = 8 * KB * header[8];
     nes->cart.info.type = (header[7] >> 2) & 0x03;
     nes->cart.info.mapper = (header[7] & 0xf0) | (header[6] >> 4);
-    nes->cart.info.mirroring = header[6] & 0x01;
+    nes->cart.info.mirroring = (header[6] & 0x08) ? FOUR_SCREEN : header[6] & 0x01;
+    nes->cart.info.trainer = (header[6] >> 2) & 0x01;
+    nes->cart.info.battery = (header[6] >> 1) & 0x01;
     return 0;
 }
 
 void cart_print_info(struct rom_info *info)
 {
+    static const char *mirroring[] = {
+        [HORIZONTAL] = "HORIZONTAL",
+        [VERTICAL] = "VERTICAL",
+        [SINGLE_SCREEN_LOW] = "SINGLE SCREEN",
+        [SINGLE_SCREEN_HIGH] = "SINGLE SCREEN",
+        [FOUR_SCREEN] = "FOUR SCREEN",
+    };
+
     printf("--------cart info--------\n");
     printf("Type: %s\n", (info->type == 2) ? "NES2.0" : "iNES");
     printf("PRGcart size: %d\n", info->prg_size);
     printf("CHRcart size: %d\n", info->chr_size);
+    printf("PRGRAM size: %d%s\n", info->prg_ram_size, (info->battery) ? " (battery)" : "");
     printf("Mapper: %d\n", info->mapper);
-    printf("Mirroring type: %s\n", (!info->mirroring) ? "HORIZONTAL" : "VERTICAL");
+    printf("Mirroring type: %s\n", mirroring[info->mirroring]);
 }
 
-void cart_load(struct nes *nes, char *cart_path)
+/* The cart is loaded from a plain .nes file, or from a .gz/.zip archive
+   holding one. PRG/CHR ROM point into the shared image, see romstore.h.
+*/
+int cart_load(struct nes *nes, char *cart_path)
 {
     struct cart *cart = &(nes->cart);
-    FILE *fp = fopen(cart_path, "r");
-    uint8_t header[16];
+    const struct rom_image *image;
+    size_t offset = 16;
 
-    if (!fp) {
+    cart->prg_rom = cart->chr_rom = cart->prg_ram = NULL;
+    cart->prg_ram_mapped = false;
+    cart->chr_ram = false;
+    cart->image = image = romstore_open(cart_path);
+    if (!image) {
         fprintf(stderr, "Can't open the cart file\n");
-        exit(EXIT_FAILURE);
-    } 
-    fread(header, sizeof(uint8_t), 16, fp);
-    cart_parse_header(nes, header);
-
-    cart->prg_rom = malloc(sizeof(uint8_t) * cart->info.prg_size);
-    if (!cart->prg_rom) {
-        fprintf(stderr, "can't allocate PRGROM\n");
-        goto malloc_error;
+        return 1;
     }
-    fread(cart->prg_rom, sizeof(uint8_t), cart->info.prg_size, fp);
+    if (image->size < 16 || cart_parse_header(nes, image->data))
+        goto load_error;
+    // the mappers wrap bank numbers around the PRG ROM size
+    if (!cart->info.prg_size) {
+        fprintf(stderr, "The cart has no PRG ROM\n");
+        goto load_error;
+    }
+    if (cart->info.trainer)
+        offset += 512;
+    if (offset + cart->info.prg_size + cart->info.chr_size > image->size) {
+        fprintf(stderr, "The cart file is truncated\n");
+        goto load_error;
+    }
+    cart->prg_rom = image->data + offset;
 
-    cart->chr_rom = malloc(sizeof(uint8_t) * cart->info.chr_size);
-    if (!cart->chr_rom) {
-        fprintf(stderr, "can't allocate CHRROM\n");
-        goto malloc_error;
+    // no CHR ROM means the board carries 8 KB of CHR RAM instead
+    cart->chr_ram = !cart->info.chr_size;
+    if (cart->chr_ram) {
+        cart->info.chr_size = 8 * KB;
+        cart->chr_rom = calloc(cart->info.chr_size, sizeof(uint8_t));
+        if (!cart->chr_rom) {
+            fprintf(stderr, "can't allocate CHRRAM\n");
+            goto load_error;
+        }
+    } else {
+        cart->chr_rom = image->data + offset + cart->info.prg_size;
     }
-    fread(cart->chr_rom, sizeof(uint8_t), cart->info.chr_size, fp);
 
-    fclose(fp);
-    return;
+    if (prg_ram_setup(cart, cart_path) || mapper_init(nes))
+        goto load_error;
+    return 0;
 
-malloc_error:
-    free(cart->prg_rom);
-    free(cart->chr_rom);
-    fclose(fp);
+load_error:
+    cart_unload(nes);
+    return 1;
 }
 
 void cart_unload(struct nes *nes)
 {
-    free(nes->cart.chr_rom);
-    free(nes->cart.prg_rom);
+    struct cart *cart = &nes->cart;
+
+    if (cart->prg_ram_mapped) {
+        cart_sync(nes, true);
+        munmap(cart->prg_ram, cart->info.prg_ram_size);
+    } else {
+        free(cart->prg_ram);
+    }
+    if (cart->chr_ram)
+        free(cart->chr_rom);
+    romstore_close(cart->image);
+    cart->image = NULL;
+    cart->prg_rom = cart->chr_rom = cart->prg_ram = NULL;
+    cart->prg_ram_mapped = false;
 }
@@ -21,9 +21,7 @@ uint16_t cache_get_nth_element(struct nes *nes, int n)
 /* cycle/tick functions */
 void cpu_cycle(struct nes *nes)
 {
-    ppu_tick(nes);
-    ppu_tick(nes);
-    ppu_tick(nes);
+    ppu_run(nes, 3);
 }
 
 /* The NMI input is connected to an edge detector, the IRQ input is connected
@@ -36,6 +34,9 @@ void cpu_cycle(struct nes *nes)
 
 void cycle_top_half(struct nes *nes)
 {
+    // interrupts are polled on the second to last cycle of an instruction
+    nes->cpu.prev_nmi_pending = nes->cpu.nmi_pending;
+    nes->cpu.prev_irq_pending = nes->cpu.irq_pending;
     nes->cpu.prev_nmi = nes->cpu.nmi;
     nes->cpu.prev_irq = nes->cpu.irq;
 
@@ -1726,6 +1727,9 @@ void cpu_at_power_up(struct nes *nes)
 
     nes->cache_index = 0;
     nes->cache_size = 0;
+    memset(nes->pad, 0, sizeof(nes->pad));
+    nes->strobe = false;
+    nes->cart.no_save = false;
 
     // TODO: APU registers state
 
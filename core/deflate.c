@@ -0,0 +1,214 @@
+#include <pthread.h>
+#include "deflate.h"
+
+#define MIN_MATCH       3
+#define MAX_MATCH       258
+#define WINDOW_SIZE     32768
+#define HASH_BITS       14
+#define MAX_STORED      65535
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* fixed Huffman codes, bit reversed since deflate writes the LSB first */
+struct code {
+    uint16_t bits;
+    uint8_t len;
+};
+
+static struct code literal_codes[288];
+static uint8_t length_code[MAX_MATCH + 1];     /* length -> code - 257 */
+static uint8_t dist_code[512];                 /* see get_dist_code() */
+static uint8_t dist_bits[30];                  /* code -> its 5 bits, reversed */
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static uint16_t reverse(uint16_t code, int len)
+{
+    uint16_t ret = 0;
+
+    for (int i = 0; i < len; i++, code >>= 1)
+        ret = (ret << 1) | (code & 0x01);
+    return ret;
+}
+
+static void build_tables(void)
+{
+    int sym, code;
+
+    for (sym = 0; sym < 288; sym++) {
+        if (sym < 144)
+            literal_codes[sym] = (struct code){ reverse(0x30 + sym, 8), 8 };
+        else if (sym < 256)
+            literal_codes[sym] = (struct code){ reverse(0x190 + sym - 144, 9), 9 };
+        else if (sym < 280)
+            literal_codes[sym] = (struct code){ reverse(sym - 256, 7), 7 };
+        else
+            literal_codes[sym] = (struct code){ reverse(0xc0 + sym - 280, 8), 8 };
+    }
+    for (code = 0; code < 29; code++)
+        for (int len = length_base[code]; len <= MAX_MATCH && len < length_base[code] + (1 << length_extra[code]);
+             len++)
+            length_code[len] = code;
+    // 258 has a code of its own rather than being 227 + 31
+    length_code[MAX_MATCH] = 28;
+    // distances up to 256 by themselves, the longer ones by 128s
+    for (code = 0; code < 30; code++) {
+        dist_bits[code] = reverse(code, 5);
+        for (int dist = dist_base[code]; dist < dist_base[code] + (1 << dist_extra[code]); dist++) {
+            if (dist <= 256)
+                dist_code[dist - 1] = code;
+            else
+                dist_code[256 + ((dist - 1) >> 7)] = code;
+        }
+    }
+}
+
+static inline int get_dist_code(int dist)
+{
+    return (dist <= 256) ? dist_code[dist - 1] : dist_code[256 + ((dist - 1) >> 7)];
+}
+
+struct bit_writer {
+    uint8_t *out;
+    uint64_t bits;
+    int count;
+};
+
+/* n is at most 32 */
+static inline void put_bits(struct bit_writer *w, uint32_t bits, int n)
+{
+    w->bits |= (uint64_t)bits << w->count;
+    w->count += n;
+    if (w->count >= 32) {
+        for (int i = 0; i < 4; i++)
+            *w->out++ = w->bits >> (i * 8);
+        w->bits >>= 32;
+        w->count -= 32;
+    }
+}
+
+static inline void put_literal(struct bit_writer *w, uint8_t c)
+{
+    put_bits(w, literal_codes[c].bits, literal_codes[c].len);
+}
+
+static inline void put_match(struct bit_writer *w, int len, int dist)
+{
+    int code = length_code[len];
+    const struct code *lit = &literal_codes[257 + code];
+
+    put_bits(w, lit->bits | ((len - length_base[code]) << lit->len), lit->len + length_extra[code]);
+    code = get_dist_code(dist);
+    put_bits(w, dist_bits[code] | ((dist - dist_base[code]) << 5), 5 + dist_extra[code]);
+}
+
+static inline uint32_t hash(const uint8_t *p)
+{
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static size_t deflate_fixed(const uint8_t *src, size_t src_len, uint8_t *dst)
+{
+    struct bit_writer w = { dst, 0, 0 };
+    int32_t head[1 << HASH_BITS];
+    size_t i = 0, len, max, end;
+    int32_t cand;
+    uint32_t h;
+
+    for (int j = 0; j < (1 << HASH_BITS); j++)
+        head[j] = -WINDOW_SIZE - 1;
+    put_bits(&w, 0x03, 3);          /* last block, fixed Huffman */
+    while (i + MIN_MATCH <= src_len) {
+        h = hash(src + i);
+        cand = head[h];
+        head[h] = i;
+        if ((int64_t)i - cand > WINDOW_SIZE || memcmp(src + cand, src + i, MIN_MATCH)) {
+            put_literal(&w, src[i++]);
+            continue;
+        }
+        max = (src_len - i < MAX_MATCH) ? src_len - i : MAX_MATCH;
+        for (len = MIN_MATCH; len < max && src[cand + len] == src[i + len]; len++)
+            ;
+        put_match(&w, len, i - cand);
+        // the positions inside the match can start later ones
+        for (end = i + len, i++; i < end; i++)
+            if (i + MIN_MATCH <= src_len)
+                head[hash(src + i)] = i;
+    }
+    while (i < src_len)
+        put_literal(&w, src[i++]);
+    put_bits(&w, literal_codes[256].bits, literal_codes[256].len);
+    for (; w.count > 0; w.count -= 8, w.bits >>= 8)
+        *w.out++ = w.bits;
+    return w.out - dst;
+}
+
+static size_t deflate_stored(const uint8_t *src, size_t src_len, uint8_t *dst)
+{
+    uint8_t *out = dst;
+    size_t len;
+
+    do {
+        len = (src_len < MAX_STORED) ? src_len : MAX_STORED;
+        *out++ = (len == src_len);  /* last block, stored */
+        *out++ = LSB(len);
+        *out++ = MSB(len);
+        *out++ = LSB(~len);
+        *out++ = MSB(~len);
+        memcpy(out, src, len);
+        out += len;
+        src += len;
+        src_len -= len;
+    } while (src_len);
+    return out - dst;
+}
+
+size_t deflate_bound(size_t src_len)
+{
+    // 9 bits for the worst literal, 5 bytes per stored block
+    return src_len + src_len / 8 + 5 * (src_len / MAX_STORED + 1) + 16;
+}
+
+size_t deflate_raw(const uint8_t *src, size_t src_len, uint8_t *dst)
+{
+    size_t size;
+
+    pthread_once(&tables_once, build_tables);
+    size = deflate_fixed(src, src_len, dst);
+    if (size > src_len + 5 * (src_len / MAX_STORED + 1))
+        size = deflate_stored(src, src_len, dst);
+    return size;
+}
+
+/* Adler-32 of zlib streams, 5552 bytes at most between the modulos */
+uint32_t deflate_adler32(uint32_t adler, const uint8_t *buf, size_t len)
+{
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    size_t n;
+
+    while (len) {
+        n = (len < 5552) ? len : 5552;
+        len -= n;
+        while (n--) {
+            a += *buf++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
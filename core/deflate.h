@@ -0,0 +1,21 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "common.h"
+
+/* Raw deflate(RFC 1951) for the images the tools write: one fixed Huffman
+   block with a single candidate LZ77 match per position, or stored blocks
+   when that doesn't pay. Fast rather than small.
+
+   dst must hold deflate_bound(src_len) bytes, the compressed size is
+   returned. */
+size_t deflate_bound(size_t src_len);
+size_t deflate_raw(const uint8_t *src, size_t src_len, uint8_t *dst);
+uint32_t deflate_adler32(uint32_t adler, const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
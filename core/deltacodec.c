@@ -0,0 +1,262 @@
+#include "deltacodec.h"
+#include "pixel.h"
+
+#define DELTA_VERSION   1
+#define MIN_RUN         3
+#define MAX_RUN         0xffff
+#define MAX_LITERALS    128
+
+struct delta_reader {
+    FILE *fp;
+    const char *path;
+    int interval;
+    uint64_t frame;                 /* the next one read */
+    uint8_t state[DELTA_FRAME_SIZE];
+    uint8_t data[DELTA_MAX_RECORD - DELTA_RECORD_HEADER_SIZE];
+};
+
+static void put32(uint8_t *out, uint32_t n)
+{
+    for (int i = 0; i < 4; i++)
+        out[i] = n >> (i * 8);
+}
+
+static uint32_t get32(const uint8_t *in)
+{
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+void delta_encoder_init(struct delta_encoder *enc, int keyframe_interval)
+{
+    enc->interval = (keyframe_interval > 0 && keyframe_interval <= 0xffff) ? keyframe_interval :
+                                                                            DELTA_KEYFRAME_INTERVAL;
+    enc->frames = 0;
+}
+
+void delta_header(const struct delta_encoder *enc, uint8_t *out)
+{
+    memcpy(out, "NESV", 4);
+    out[4] = DELTA_VERSION;
+    out[5] = 0;
+    out[6] = LSB(enc->interval);
+    out[7] = MSB(enc->interval);
+}
+
+static size_t put_literals(const uint8_t *in, int n, uint8_t *out)
+{
+    size_t size = 0;
+    int len;
+
+    for (; n > 0; n -= len, in += len) {
+        len = (n < MAX_LITERALS) ? n : MAX_LITERALS;
+        out[size++] = len - 1;
+        memcpy(out + size, in, len);
+        size += len;
+    }
+    return size;
+}
+
+static size_t put_run(uint8_t value, int len, uint8_t *out)
+{
+    if (len - MIN_RUN < 0x7f) {
+        out[0] = 0x80 | (len - MIN_RUN);
+        out[1] = value;
+        return 2;
+    }
+    out[0] = 0xff;
+    out[1] = LSB(len);
+    out[2] = MSB(len);
+    out[3] = value;
+    return 4;
+}
+
+/* Most of a delta is zeros: the run kernel skips them 16/32 bytes at a
+   time. It's only called where 3 equal bytes start a run, literals are
+   scanned byte by byte. */
+static size_t encode_runs(const struct pixel_kernels *kernels, const uint8_t *in, int n, uint8_t *out)
+{
+    size_t size = 0;
+    int literals = 0, run;
+
+    for (int i = 0; i < n; i += run) {
+        if (i + MIN_RUN > n || in[i] != in[i + 1] || in[i] != in[i + 2]) {
+            run = 1;
+            continue;
+        }
+        run = kernels->run(in + i, (n - i < MAX_RUN) ? n - i : MAX_RUN);
+        size += put_literals(in + literals, i - literals, out + size);
+        size += put_run(in[i], run, out + size);
+        literals = i + run;
+    }
+    return size + put_literals(in + literals, n - literals, out + size);
+}
+
+/* a record of at most DELTA_MAX_RECORD bytes */
+size_t delta_encode(struct delta_encoder *enc, const uint8_t *frame, const uint8_t *emphasis, uint8_t *out)
+{
+    const struct pixel_kernels *kernels = pixel_kernels();
+    bool key = enc->frames++ % enc->interval == 0;
+    size_t size;
+
+    if (key)
+        memset(enc->prev, 0, sizeof(enc->prev));
+    kernels->delta(frame, enc->prev, enc->residual, SCREEN_WIDTH * SCREEN_HEIGHT);
+    kernels->delta(emphasis, enc->prev + SCREEN_WIDTH * SCREEN_HEIGHT,
+                   enc->residual + SCREEN_WIDTH * SCREEN_HEIGHT, SCREEN_HEIGHT);
+    size = encode_runs(kernels, enc->residual, DELTA_FRAME_SIZE, out + DELTA_RECORD_HEADER_SIZE);
+    out[0] = (key) ? 'K' : 'D';
+    put32(out + 1, size);
+    return DELTA_RECORD_HEADER_SIZE + size;
+}
+
+/* XORs the coded data of a record into state(zeros for a keyframe), -1 if
+   it's corrupted */
+int delta_decode(const uint8_t *in, size_t size, uint8_t *state)
+{
+    const uint8_t *end = in + size;
+    int i = 0, len;
+    uint8_t c;
+
+    while (in < end) {
+        c = *in++;
+        if (c < 0x80) {
+            len = c + 1;
+            if (end - in < len || i + len > DELTA_FRAME_SIZE)
+                return -1;
+            for (int j = 0; j < len; j++)
+                state[i + j] ^= in[j];
+            in += len;
+        } else {
+            if (end - in < ((c == 0xff) ? 3 : 1))
+                return -1;
+            if (c == 0xff) {
+                len = TO_U16(in[0], in[1]);
+                in += 2;
+            } else {
+                len = (c & 0x7f) + MIN_RUN;
+            }
+            if (i + len > DELTA_FRAME_SIZE)
+                return -1;
+            // zero runs, unchanged pixels, cost nothing
+            if (*in)
+                for (int j = 0; j < len; j++)
+                    state[i + j] ^= *in;
+            in++;
+        }
+        i += len;
+    }
+    return (i == DELTA_FRAME_SIZE) ? 0 : -1;
+}
+
+struct delta_reader *delta_open(const char *path)
+{
+    struct delta_reader *reader;
+    uint8_t header[DELTA_HEADER_SIZE];
+
+    if (!(reader = calloc(1, sizeof(*reader)))) {
+        fprintf(stderr, "can't allocate a reader for %s\n", path);
+        return NULL;
+    }
+    reader->path = path;
+    if (!(reader->fp = fopen(path, "rb"))) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        free(reader);
+        return NULL;
+    }
+    if (fread(header, sizeof(header), 1, reader->fp) != 1 || memcmp(header, "NESV", 4) ||
+        header[4] != DELTA_VERSION) {
+        fprintf(stderr, "%s isn't a version %d .nesv file\n", path, DELTA_VERSION);
+        delta_close(reader);
+        return NULL;
+    }
+    reader->interval = TO_U16(header[6], header[7]);
+    return reader;
+}
+
+/* reads the next record into data, 1 if it's a keyframe, 0 if not and -1
+   at the end */
+static int read_record(struct delta_reader *reader, size_t *size)
+{
+    uint8_t header[DELTA_RECORD_HEADER_SIZE];
+
+    if (fread(header, sizeof(header), 1, reader->fp) != 1)
+        return -1;
+    *size = get32(header + 1);
+    if ((header[0] != 'K' && header[0] != 'D') || *size > DELTA_MAX_RECORD - DELTA_RECORD_HEADER_SIZE ||
+        fread(reader->data, *size, 1, reader->fp) != 1) {
+        fprintf(stderr, "%s: frame %llu is corrupted\n", reader->path, (unsigned long long)reader->frame);
+        return -1;
+    }
+    return header[0] == 'K';
+}
+
+/* 1 with the next frame(either can be NULL), 0 at the end of the file and
+   -1 on corrupted data */
+int delta_read(struct delta_reader *reader, uint8_t *frame, uint8_t *emphasis)
+{
+    size_t size;
+    int key = read_record(reader, &size);
+
+    if (key < 0)
+        return (feof(reader->fp)) ? 0 : -1;
+    if (key)
+        memset(reader->state, 0, sizeof(reader->state));
+    else if (!reader->frame)
+        key = -1;
+    if (key < 0 || delta_decode(reader->data, size, reader->state)) {
+        fprintf(stderr, "%s: frame %llu is corrupted\n", reader->path, (unsigned long long)reader->frame);
+        return -1;
+    }
+    reader->frame++;
+    if (frame)
+        memcpy(frame, reader->state, SCREEN_WIDTH * SCREEN_HEIGHT);
+    if (emphasis)
+        memcpy(emphasis, reader->state + SCREEN_WIDTH * SCREEN_HEIGHT, SCREEN_HEIGHT);
+    return 1;
+}
+
+/* Positions the reader so the next delta_read() returns frame: the record
+   headers are skipped through to the last keyframe before it, which is
+   decoded with the deltas after it. */
+int delta_seek(struct delta_reader *reader, uint64_t frame)
+{
+    uint8_t header[DELTA_RECORD_HEADER_SIZE];
+    long offset = DELTA_HEADER_SIZE, key_offset = -1;
+    uint64_t key_frame = 0;
+
+    if (fseek(reader->fp, offset, SEEK_SET)) {
+        fprintf(stderr, "%s: can't seek\n", reader->path);
+        return -1;
+    }
+    for (uint64_t i = 0; i <= frame; i++) {
+        if (fread(header, sizeof(header), 1, reader->fp) != 1) {
+            fprintf(stderr, "%s: no frame %llu\n", reader->path, (unsigned long long)frame);
+            return -1;
+        }
+        if (header[0] == 'K') {
+            key_offset = offset;
+            key_frame = i;
+        }
+        offset += sizeof(header) + get32(header + 1);
+        if (fseek(reader->fp, offset, SEEK_SET))
+            return -1;
+    }
+    if (key_offset < 0 || fseek(reader->fp, key_offset, SEEK_SET))
+        return -1;
+    reader->frame = key_frame;
+    for (uint64_t i = key_frame; i < frame; i++)
+        if (delta_read(reader, NULL, NULL) != 1)
+            return -1;
+    return 0;
+}
+
+int delta_keyframe_interval(const struct delta_reader *reader)
+{
+    return reader->interval;
+}
+
+void delta_close(struct delta_reader *reader)
+{
+    fclose(reader->fp);
+    free(reader);
+}
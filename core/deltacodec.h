@@ -0,0 +1,53 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+/* Lossless delta coding of indexed frames(see PIXEL_INDEXED8), the .nesv
+   container.
+
+   A frame is its 256x240 colors followed by its 240 line emphasis bytes.
+   Each one is XORed with the previous frame, or with zeros on a keyframe
+   (every keyframe interval frames), and the result is run length coded:
+
+   0x00-0x7f       c + 1 literal bytes follow
+   0x80-0xfe       a run of (c & 0x7f) + 3 times the byte that follows
+   0xff            a run of a 16 bit little endian length then the byte
+
+   File: "NESV", version, 0, keyframe interval(16 bit little endian), then
+   per frame 'K'(keyframe) or 'D', the 32 bit little endian size of the
+   coded data and the data.
+*/
+#define DELTA_FRAME_SIZE            (SCREEN_WIDTH * SCREEN_HEIGHT + SCREEN_HEIGHT)
+#define DELTA_HEADER_SIZE           8
+#define DELTA_RECORD_HEADER_SIZE    5
+/* a frame that doesn't compress at all */
+#define DELTA_MAX_RECORD            (DELTA_RECORD_HEADER_SIZE + DELTA_FRAME_SIZE + DELTA_FRAME_SIZE / 128 + 1)
+#define DELTA_KEYFRAME_INTERVAL     300
+
+struct delta_encoder {
+    int interval;
+    uint64_t frames;
+    uint8_t prev[DELTA_FRAME_SIZE];
+    uint8_t residual[DELTA_FRAME_SIZE];
+};
+
+struct delta_reader;
+
+void delta_encoder_init(struct delta_encoder *enc, int keyframe_interval);
+void delta_header(const struct delta_encoder *enc, uint8_t *out);
+size_t delta_encode(struct delta_encoder *enc, const uint8_t *frame, const uint8_t *emphasis, uint8_t *out);
+int delta_decode(const uint8_t *in, size_t size, uint8_t *state);
+
+struct delta_reader *delta_open(const char *path);
+int delta_read(struct delta_reader *reader, uint8_t *frame, uint8_t *emphasis);
+int delta_seek(struct delta_reader *reader, uint64_t frame);
+int delta_keyframe_interval(const struct delta_reader *reader);
+void delta_close(struct delta_reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,368 @@
+/* DEFLATE(RFC 1951) decoder
+
+   Decodes a raw deflate stream from memory straight into its final
+   destination, which also serves as the 32 KB history window, so there is
+   no intermediate buffer and no copy. Huffman codes up to FAST_BITS long
+   are decoded with one table lookup, longer ones bit by bit.
+*/
+#include <pthread.h>
+#include "inflate.h"
+
+#define MAX_BITS        15
+#define FAST_BITS       10
+#define FAST_MASK       ((1U << FAST_BITS) - 1)
+#define MAX_LIT_CODES   288
+#define MAX_DIST_CODES  30
+
+struct huffman {
+    uint16_t fast[1 << FAST_BITS];  /* (length << 9) | symbol, 0 if longer */
+    uint16_t count[MAX_BITS + 1];   /* number of codes of each length */
+    uint16_t symbol[MAX_LIT_CODES]; /* symbols ordered by code */
+};
+
+struct inflate_state {
+    const uint8_t *src;
+    size_t src_len;
+    size_t src_pos;
+    uint64_t bitbuf;
+    int bitcnt;
+
+    uint8_t *dst;
+    size_t dst_len;
+    size_t dst_pos;
+};
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* the bit buffer is refilled a byte at a time, past the end of the input
+   with zeros. bytes_consumed() tells if those were actually used.
+*/
+static void refill(struct inflate_state *s)
+{
+    while (s->bitcnt <= 56) {
+        uint64_t byte = (s->src_pos < s->src_len) ? s->src[s->src_pos] : 0;
+
+        s->src_pos++;
+        s->bitbuf |= byte << s->bitcnt;
+        s->bitcnt += 8;
+    }
+}
+
+static size_t bytes_consumed(struct inflate_state *s)
+{
+    return s->src_pos - s->bitcnt / 8;
+}
+
+static uint32_t bits(struct inflate_state *s, int n)
+{
+    uint32_t val;
+
+    if (s->bitcnt < n)
+        refill(s);
+    val = s->bitbuf & ((1ULL << n) - 1);
+    s->bitbuf >>= n;
+    s->bitcnt -= n;
+    return val;
+}
+
+static int build(struct huffman *h, const uint8_t *lengths, int n)
+{
+    uint16_t offset[MAX_BITS + 2], next_code[MAX_BITS + 1];
+    int left = 1, code = 0;
+
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++)
+        h->count[lengths[i]]++;
+    h->count[0] = 0;
+
+    // over-subscribed sets are invalid, incomplete ones are allowed
+    for (int len = 1; len <= MAX_BITS; len++) {
+        left = (left << 1) - h->count[len];
+        if (left < 0)
+            return INFLATE_BAD_DATA;
+    }
+
+    offset[1] = 0;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        offset[len + 1] = offset[len] + h->count[len];
+        code = (code + h->count[len - 1]) << 1;
+        next_code[len] = code;
+    }
+
+    memset(h->fast, 0, sizeof(h->fast));
+    for (int sym = 0; sym < n; sym++) {
+        int len = lengths[sym], rev = 0, c;
+
+        if (!len)
+            continue;
+        h->symbol[offset[len]++] = sym;
+        if (len > FAST_BITS) {
+            next_code[len]++;
+            continue;
+        }
+        // codes are sent MSB first, the bit buffer is LSB first
+        c = next_code[len]++;
+        for (int i = 0; i < len; i++)
+            rev |= ((c >> i) & 0x01) << (len - 1 - i);
+        for (int j = rev; j < (1 << FAST_BITS); j += 1 << len)
+            h->fast[j] = (len << 9) | sym;
+    }
+    return INFLATE_OK;
+}
+
+static int decode(struct inflate_state *s, const struct huffman *h)
+{
+    int code = 0, first = 0, index = 0;
+    uint16_t entry;
+
+    if (s->bitcnt < MAX_BITS)
+        refill(s);
+    entry = h->fast[s->bitbuf & FAST_MASK];
+    if (entry) {
+        s->bitbuf >>= entry >> 9;
+        s->bitcnt -= entry >> 9;
+        return entry & 0x1ff;
+    }
+
+    // canonical decoding of the long codes, one bit at a time
+    for (int len = 1; len <= MAX_BITS; len++) {
+        code |= (s->bitbuf >> (len - 1)) & 0x01;
+        if (code - h->count[len] < first) {
+            s->bitbuf >>= len;
+            s->bitcnt -= len;
+            return h->symbol[index + (code - first)];
+        }
+        index += h->count[len];
+        first = (first + h->count[len]) << 1;
+        code <<= 1;
+    }
+    return INFLATE_BAD_DATA;
+}
+
+static int stored(struct inflate_state *s)
+{
+    uint16_t len, nlen;
+
+    // drop the rest of the current byte, hand the buffered bytes back
+    bits(s, s->bitcnt & 0x07);
+    s->src_pos = bytes_consumed(s);
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+
+    if (s->src_pos + 4 > s->src_len)
+        return INFLATE_TRUNCATED;
+    len = TO_U16(s->src[s->src_pos], s->src[s->src_pos + 1]);
+    nlen = TO_U16(s->src[s->src_pos + 2], s->src[s->src_pos + 3]);
+    s->src_pos += 4;
+    if ((len ^ nlen) != 0xffff)
+        return INFLATE_BAD_DATA;
+    if (s->src_pos + len > s->src_len)
+        return INFLATE_TRUNCATED;
+    if (s->dst_pos + len > s->dst_len)
+        return INFLATE_OVERFLOW;
+    memcpy(s->dst + s->dst_pos, s->src + s->src_pos, len);
+    s->src_pos += len;
+    s->dst_pos += len;
+    return INFLATE_OK;
+}
+
+static int codes(struct inflate_state *s, const struct huffman *lencode, const struct huffman *distcode)
+{
+    int sym, len;
+    size_t dist;
+
+    for (;;) {
+        if (bytes_consumed(s) > s->src_len)
+            return INFLATE_TRUNCATED;
+        sym = decode(s, lencode);
+        if (sym < 0)
+            return sym;
+        if (sym < 256) {
+            if (s->dst_pos >= s->dst_len)
+                return INFLATE_OVERFLOW;
+            s->dst[s->dst_pos++] = sym;
+            continue;
+        }
+        if (sym == 256)
+            return INFLATE_OK;
+
+        sym -= 257;
+        if (sym >= 29)
+            return INFLATE_BAD_DATA;
+        len = length_base[sym] + bits(s, length_extra[sym]);
+        sym = decode(s, distcode);
+        if (sym < 0 || sym >= MAX_DIST_CODES)
+            return INFLATE_BAD_DATA;
+        dist = dist_base[sym] + bits(s, dist_extra[sym]);
+        if (dist > s->dst_pos)
+            return INFLATE_BAD_DATA;
+        if (s->dst_pos + len > s->dst_len)
+            return INFLATE_OVERFLOW;
+
+        // the source may overlap the destination, byte copy on purpose
+        for (int i = 0; i < len; i++, s->dst_pos++)
+            s->dst[s->dst_pos] = s->dst[s->dst_pos - dist];
+    }
+}
+
+/* fixed tables: literal/length 0-143 -> 8 bits, 144-255 -> 9, 256-279 -> 7,
+   280-287 -> 8, all distances 5 bits
+*/
+static struct huffman fixed_lencode, fixed_distcode;
+static pthread_once_t fixed_once = PTHREAD_ONCE_INIT;
+
+static void build_fixed(void)
+{
+    uint8_t lengths[MAX_LIT_CODES];
+    int sym;
+
+    for (sym = 0; sym < 144; sym++)
+        lengths[sym] = 8;
+    for (; sym < 256; sym++)
+        lengths[sym] = 9;
+    for (; sym < 280; sym++)
+        lengths[sym] = 7;
+    for (; sym < MAX_LIT_CODES; sym++)
+        lengths[sym] = 8;
+    build(&fixed_lencode, lengths, MAX_LIT_CODES);
+
+    memset(lengths, 5, MAX_DIST_CODES);
+    build(&fixed_distcode, lengths, MAX_DIST_CODES);
+}
+
+static int fixed(struct inflate_state *s)
+{
+    pthread_once(&fixed_once, build_fixed);
+    return codes(s, &fixed_lencode, &fixed_distcode);
+}
+
+static int dynamic(struct inflate_state *s)
+{
+    static const uint8_t order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    struct huffman lencode, distcode;
+    uint8_t lengths[MAX_LIT_CODES + MAX_DIST_CODES];
+    int nlen, ndist, ncode, index, sym, len, ret;
+
+    nlen = bits(s, 5) + 257;
+    ndist = bits(s, 5) + 1;
+    ncode = bits(s, 4) + 4;
+    if (nlen > MAX_LIT_CODES || ndist > MAX_DIST_CODES)
+        return INFLATE_BAD_DATA;
+
+    // code length code lengths, then the literal/length and distance code
+    // lengths encoded with them
+    memset(lengths, 0, 19);
+    for (index = 0; index < ncode; index++)
+        lengths[order[index]] = bits(s, 3);
+    if ((ret = build(&lencode, lengths, 19)))
+        return ret;
+
+    index = 0;
+    while (index < nlen + ndist) {
+        sym = decode(s, &lencode);
+        if (sym < 0)
+            return sym;
+        if (sym < 16) {
+            lengths[index++] = sym;
+            continue;
+        }
+        len = 0;
+        if (sym == 16) {
+            if (!index)
+                return INFLATE_BAD_DATA;
+            len = lengths[index - 1];
+            sym = 3 + bits(s, 2);
+        } else if (sym == 17) {
+            sym = 3 + bits(s, 3);
+        } else {
+            sym = 11 + bits(s, 7);
+        }
+        if (index + sym > nlen + ndist)
+            return INFLATE_BAD_DATA;
+        while (sym--)
+            lengths[index++] = len;
+    }
+
+    // a block without end-of-block code can't terminate
+    if (!lengths[256])
+        return INFLATE_BAD_DATA;
+    if ((ret = build(&lencode, lengths, nlen)) ||
+        (ret = build(&distcode, lengths + nlen, ndist)))
+        return ret;
+    return codes(s, &lencode, &distcode);
+}
+
+int inflate_raw(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len, size_t *out_len)
+{
+    struct inflate_state s = {
+        .src = src, .src_len = src_len,
+        .dst = dst, .dst_len = dst_len,
+    };
+    int last, ret;
+
+    do {
+        last = bits(&s, 1);
+        switch (bits(&s, 2)) {
+        case 0:
+            ret = stored(&s);
+            break;
+        case 1:
+            ret = fixed(&s);
+            break;
+        case 2:
+            ret = dynamic(&s);
+            break;
+        default:
+            ret = INFLATE_BAD_DATA;
+            break;
+        }
+        if (ret)
+            return ret;
+    } while (!last);
+
+    if (bytes_consumed(&s) > src_len)
+        return INFLATE_TRUNCATED;
+    if (out_len)
+        *out_len = s.dst_pos;
+    return INFLATE_OK;
+}
+
+/* CRC-32 as used by gzip and zip */
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+uint32_t inflate_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    pthread_once(&crc_once, build_crc_table);
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "common.h"
+
+enum INFLATE_ERROR {
+    INFLATE_OK = 0,
+    INFLATE_TRUNCATED = -1,     /* ran out of input */
+    INFLATE_OVERFLOW = -2,      /* output doesn't fit in the buffer */
+    INFLATE_BAD_DATA = -3,      /* invalid block type, code or distance */
+};
+
+int inflate_raw(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len, size_t *out_len);
+uint32_t inflate_crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -13,7 +13,8 @@ void interrupt_handler(struct nes *nes, interrupt_t interrupt)
     cpu_read(nes, nes->cpu.pc);
     cpu_read(nes, nes->cpu.pc);
     stack_push_16(nes, nes->cpu.pc);
-    if (interrupt == IRQ && nes->cpu.nmi_pending) {
+    // an NMI coming in while an IRQ is pushed hijacks it
+    if (interrupt == NMI || nes->cpu.nmi_pending) {
         base_addr = NMI_VECTOR_BASE;
         nes->cpu.nmi_pending = 0;
     } else {
@@ -1,21 +1,426 @@
 #include "mapper.h"
+#include "ppu.h"
 
 enum SUPPORTED_MAPPER {
-    MAPPER_000
+    MAPPER_000 = 0,     /* NROM */
+    MAPPER_001 = 1,     /* MMC1 */
+    MAPPER_002 = 2,     /* UxROM */
+    MAPPER_003 = 3,     /* CNROM */
+    MAPPER_004 = 4,     /* MMC3 */
+    MAPPER_007 = 7,     /* AxROM */
 };
 
-static void m000_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
+/* bank table helpers
+
+   A bank switch only points the affected windows of prg_map/ppu.page at a
+   different part of the ROM, nothing is copied. Bank numbers wrap around
+   the ROM size like the unconnected upper address lines do on the boards.
+*/
+static void map_prg(struct cart *cart, int slot, int size_kb, int bank)
+{
+    uint32_t offset = (uint32_t)bank * size_kb * KB;
+
+    for (int i = 0; i < size_kb / 8; i++)
+        cart->prg_map[slot + i] = cart->prg_rom + (offset + i * 8 * KB) % cart->info.prg_size;
+}
+
+static void map_chr(struct nes *nes, int slot, int size_kb, int bank)
+{
+    struct cart *cart = &nes->cart;
+    uint32_t offset = (uint32_t)bank * size_kb * KB;
+    uint8_t *page;
+
+    for (int i = 0; i < size_kb; i++) {
+        page = cart->chr_rom + (offset + i * KB) % cart->info.chr_size;
+        if (nes->ppu.page[slot + i] != page) {
+            render_log_pages(nes);
+            nes->ppu.page[slot + i] = page;
+            tilecache_invalidate_page(&nes->ppu, slot + i);
+        }
+    }
+}
+
+static void map_prg_ram(struct cart *cart, int bank)
+{
+    if (cart->prg_ram)
+        cart->prg_ram_map = cart->prg_ram + (uint32_t)bank * 8 * KB % cart->info.prg_ram_size;
+}
+
+static int last_prg_bank(struct cart *cart, int size_kb)
+{
+    return cart->info.prg_size / (size_kb * KB) - 1;
+}
+
+/* Boards without a bus conflict prevention see the ROM driving the data bus
+   while the CPU writes, the written value becomes (val & rom[addr]).
+*/
+static uint8_t bus_conflict(struct nes *nes, uint16_t addr, uint8_t val)
+{
+    return val & nes->cart.prg_map[(addr >> 13) & 0x03][addr & 0x1fff];
+}
+
+void mapper_set_mirroring(struct nes *nes, enum MIRRORING mirroring)
+{
+    nes->cart.info.mirroring = mirroring;
+    ppu_map_nametables(nes);
+}
+
+/* mapper 000 - NROM */
+static void m000_init(struct nes *nes)
+{
+    map_prg(&nes->cart, 0, 32, 0);
+    map_chr(nes, 0, 8, 0);
+}
+
+/* mapper 001 - MMC1
+
+   Registers are loaded serially through a 5 bit shift register, bit 7 of
+   any write resets it. The fifth write selects the destination by A14-A13:
+
+   $8000-$9fff     control: CPPMM (CHR mode, PRG mode, mirroring)
+   $a000-$bfff     CHR bank 0
+   $c000-$dfff     CHR bank 1
+   $e000-$ffff     PRG bank(bit 4 disables PRG RAM)
+
+   SOROM(16 KB PRG RAM) takes the 8 KB RAM bank from bit 3 of CHR bank 0,
+   SXROM(32 KB) from bits 2-3.
+*/
+static void m001_update_banks(struct nes *nes)
+{
+    struct cart *cart = &nes->cart;
+    struct mmc1 *mmc1 = &cart->mapper.mmc1;
+    static const enum MIRRORING mirroring[] = {
+        SINGLE_SCREEN_LOW, SINGLE_SCREEN_HIGH, VERTICAL, HORIZONTAL
+    };
+
+    mapper_set_mirroring(nes, mirroring[mmc1->control & 0x03]);
+    cart->prg_ram_enabled = !(mmc1->prg_bank & 0x10);
+    if (cart->info.prg_ram_size > 16 * KB)
+        map_prg_ram(cart, (mmc1->chr_bank[0] >> 2) & 0x03);
+    else
+        map_prg_ram(cart, (mmc1->chr_bank[0] >> 3) & 0x01);
+
+    switch ((mmc1->control >> 2) & 0x03) {
+    case 0:
+    case 1:
+        map_prg(cart, 0, 32, (mmc1->prg_bank & 0x0f) >> 1);
+        break;
+    case 2:
+        map_prg(cart, 0, 16, 0);
+        map_prg(cart, 2, 16, mmc1->prg_bank & 0x0f);
+        break;
+    case 3:
+        map_prg(cart, 0, 16, mmc1->prg_bank & 0x0f);
+        map_prg(cart, 2, 16, last_prg_bank(cart, 16));
+        break;
+    }
+
+    if (mmc1->control & 0x10) {
+        map_chr(nes, 0, 4, mmc1->chr_bank[0]);
+        map_chr(nes, 4, 4, mmc1->chr_bank[1]);
+    } else {
+        map_chr(nes, 0, 8, mmc1->chr_bank[0] >> 1);
+    }
+}
+
+static void m001_init(struct nes *nes)
+{
+    struct mmc1 *mmc1 = &nes->cart.mapper.mmc1;
+
+    mmc1->shift = 0x10;
+    mmc1->control = 0x0c;
+    mmc1->chr_bank[0] = mmc1->chr_bank[1] = 0;
+    mmc1->prg_bank = 0;
+    m001_update_banks(nes);
+}
+
+static void m001_write(struct nes *nes, uint16_t addr, uint8_t val)
+{
+    struct mmc1 *mmc1 = &nes->cart.mapper.mmc1;
+    bool full;
+
+    if (val & 0x80) {
+        mmc1->shift = 0x10;
+        mmc1->control |= 0x0c;
+        m001_update_banks(nes);
+        return;
+    }
+
+    // the initial 1 reaches bit 0 once four bits have been shifted in
+    full = mmc1->shift & 0x01;
+    mmc1->shift = (mmc1->shift >> 1) | ((val & 0x01) << 4);
+    if (!full)
+        return;
+
+    switch ((addr >> 13) & 0x03) {
+    case 0:
+        mmc1->control = mmc1->shift;
+        break;
+    case 1:
+        mmc1->chr_bank[0] = mmc1->shift;
+        break;
+    case 2:
+        mmc1->chr_bank[1] = mmc1->shift;
+        break;
+    case 3:
+        mmc1->prg_bank = mmc1->shift;
+        break;
+    }
+    mmc1->shift = 0x10;
+    m001_update_banks(nes);
+}
+
+/* mapper 002 - UxROM: switchable 16 KB at $8000, last 16 KB fixed at $c000 */
+static void m002_init(struct nes *nes)
+{
+    map_prg(&nes->cart, 0, 16, 0);
+    map_prg(&nes->cart, 2, 16, last_prg_bank(&nes->cart, 16));
+    map_chr(nes, 0, 8, 0);
+}
+
+static void m002_write(struct nes *nes, uint16_t addr, uint8_t val)
+{
+    map_prg(&nes->cart, 0, 16, bus_conflict(nes, addr, val));
+}
+
+/* mapper 003 - CNROM: fixed PRG, switchable 8 KB CHR */
+static void m003_write(struct nes *nes, uint16_t addr, uint8_t val)
+{
+    map_chr(nes, 0, 8, bus_conflict(nes, addr, val));
+}
+
+/* mapper 004 - MMC3
+
+   $8000-$9fff     even: bank select, odd: bank data
+   $a000-$bfff     even: mirroring, odd: PRG RAM protect
+   $c000-$dfff     even: IRQ latch, odd: IRQ reload
+   $e000-$ffff     even: IRQ disable/acknowledge, odd: IRQ enable
+
+   The scanline counter is clocked by rising edges of PPU A12. With 8x8
+   sprites and the background and sprites on different pattern tables
+   there is exactly one rise per rendered line, at dot 260(sprites at
+   $1000) or dot 324(background at $1000), so the counter is clocked by a
+   PPU event scheduled at that dot instead of watching the bus. Any other
+   setup, or a PPUADDR write with A12 set while rendering, falls back to
+   the edge detector fed with every fetch address.
+*/
+#define MMC3_A12_FILTER     10      /* dots A12 has to stay low (~3 M2) */
+
+static void m004_update_banks(struct nes *nes)
+{
+    struct cart *cart = &nes->cart;
+    struct mmc3 *mmc3 = &cart->mapper.mmc3;
+    int chr_invert = (mmc3->bank_select & 0x80) ? 4 : 0;
+    int prg_swap = (mmc3->bank_select & 0x40) ? 2 : 0;
+
+    map_chr(nes, 0 ^ chr_invert, 2, mmc3->bank[0] >> 1);
+    map_chr(nes, 2 ^ chr_invert, 2, mmc3->bank[1] >> 1);
+    for (int i = 0; i < 4; i++)
+        map_chr(nes, (4 + i) ^ chr_invert, 1, mmc3->bank[2 + i]);
+
+    map_prg(cart, 0 ^ prg_swap, 8, mmc3->bank[6] & 0x3f);
+    map_prg(cart, 1, 8, mmc3->bank[7] & 0x3f);
+    map_prg(cart, 2 ^ prg_swap, 8, last_prg_bank(cart, 8) - 1);
+    map_prg(cart, 3, 8, last_prg_bank(cart, 8));
+}
+
+static void m004_init(struct nes *nes)
 {
-    addr = (nes->cart.info.prg_size == 16384) ? addr & 0xbfff : addr;
-    if (mode == READ)
-        *val = nes->cart.prg_rom[addr - 0x8000];
+    struct mmc3 *mmc3 = &nes->cart.mapper.mmc3;
+
+    memset(mmc3, 0, sizeof(*mmc3));
+    for (int i = 0; i < 8; i++)
+        mmc3->bank[i] = i;
+    m004_update_banks(nes);
 }
 
-void (*mapper_handler[])(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode) = {
-    [MAPPER_000] = m000_rw
+static void m004_clock_counter(struct nes *nes)
+{
+    struct mmc3 *mmc3 = &nes->cart.mapper.mmc3;
+
+    if (!mmc3->irq_counter || mmc3->irq_reload) {
+        mmc3->irq_counter = mmc3->irq_latch;
+        mmc3->irq_reload = false;
+    } else {
+        mmc3->irq_counter--;
+    }
+    if (!mmc3->irq_counter && mmc3->irq_enabled)
+        nes->cpu.irq = 0;
+}
+
+static void m004_write(struct nes *nes, uint16_t addr, uint8_t val)
+{
+    struct mmc3 *mmc3 = &nes->cart.mapper.mmc3;
+
+    switch (addr & 0xe001) {
+    case 0x8000:
+        mmc3->bank_select = val;
+        m004_update_banks(nes);
+        break;
+    case 0x8001:
+        mmc3->bank[mmc3->bank_select & 0x07] = val;
+        m004_update_banks(nes);
+        break;
+    case 0xa000:
+        if (nes->cart.info.mirroring != FOUR_SCREEN)
+            mapper_set_mirroring(nes, (val & 0x01) ? HORIZONTAL : VERTICAL);
+        break;
+    case 0xa001:
+        nes->cart.prg_ram_enabled = val & 0x80;
+        nes->cart.prg_ram_protected = val & 0x40;
+        break;
+    case 0xc000:
+        mmc3->irq_latch = val;
+        break;
+    case 0xc001:
+        mmc3->irq_counter = 0;
+        mmc3->irq_reload = true;
+        break;
+    case 0xe000:
+        mmc3->irq_enabled = false;
+        nes->cpu.irq = 1;
+        break;
+    case 0xe001:
+        mmc3->irq_enabled = true;
+        break;
+    }
+}
+
+/* start of a scanline: predict where A12 rises on this line */
+static void m004_scanline(struct nes *nes)
+{
+    struct mmc3 *mmc3 = &nes->cart.mapper.mmc3;
+    struct ppu *ppu = &nes->ppu;
+
+    ppu->event_cycle = -1;
+    if (ppu->scanlines == 261)
+        mmc3->exact_a12 = false;
+    if (ppu->scanlines >= 240 && ppu->scanlines != 261)
+        return;
+
+    if (!mmc3->exact_a12 && !ppu->H && ppu->BG != ppu->S) {
+        ppu->event_cycle = (ppu->BG) ? 324 : 260;
+        ppu->a12_watch = false;
+        return;
+    }
+    // 8x8 sprites with both tables at $0000 never raise A12
+    mmc3->exact_a12 = mmc3->exact_a12 || ppu->H || ppu->BG;
+    ppu->a12_watch = mmc3->exact_a12;
+}
+
+static void m004_ppu_event(struct nes *nes)
+{
+    struct mmc3 *mmc3 = &nes->cart.mapper.mmc3;
+
+    // the fetches only happen while rendering is enabled
+    if (!(nes->ppu.ppumask & 0x18))
+        return;
+    m004_clock_counter(nes);
+    mmc3->a12 = 0;
+    mmc3->a12_low_clock = nes->ppu.clock;
+}
+
+static void m004_ppu_addr(struct nes *nes, uint16_t addr)
+{
+    struct mmc3 *mmc3 = &nes->cart.mapper.mmc3;
+    uint8_t a12 = (addr >> 12) & 0x01;
+
+    if (a12 && !mmc3->a12 && nes->ppu.clock - mmc3->a12_low_clock >= MMC3_A12_FILTER)
+        m004_clock_counter(nes);
+    else if (!a12 && mmc3->a12)
+        mmc3->a12_low_clock = nes->ppu.clock;
+    mmc3->a12 = a12;
+
+    // A12 toggled by the CPU in the middle of the picture, stop predicting
+    // for the rest of the frame
+    if (a12 && !mmc3->exact_a12 && (nes->ppu.ppumask & 0x18) &&
+        (nes->ppu.scanlines < 240 || nes->ppu.scanlines == 261)) {
+        mmc3->exact_a12 = true;
+        nes->ppu.a12_watch = true;
+        nes->ppu.event_cycle = -1;
+    }
+}
+
+/* mapper 007 - AxROM: switchable 32 KB PRG (bits 0-2), one screen
+   mirroring selected by bit 4
+*/
+static void m007_init(struct nes *nes)
+{
+    map_prg(&nes->cart, 0, 32, 0);
+    map_chr(nes, 0, 8, 0);
+    mapper_set_mirroring(nes, SINGLE_SCREEN_LOW);
+}
+
+static void m007_write(struct nes *nes, uint16_t addr, uint8_t val)
+{
+    (void)addr;
+    map_prg(&nes->cart, 0, 32, val & 0x07);
+    mapper_set_mirroring(nes, (val & 0x10) ? SINGLE_SCREEN_HIGH : SINGLE_SCREEN_LOW);
+}
+
+struct mapper_handler {
+    void (*init)(struct nes *nes);
+    void (*write)(struct nes *nes, uint16_t addr, uint8_t val);
+
+    /* PPU hooks, see struct ppu */
+    void (*scanline)(struct nes *nes);
+    void (*ppu_event)(struct nes *nes);
+    void (*ppu_addr)(struct nes *nes, uint16_t addr);
 };
 
+static const struct mapper_handler mapper_handler[] = {
+    [MAPPER_000] = { m000_init, NULL },
+    [MAPPER_001] = { m001_init, m001_write },
+    [MAPPER_002] = { m002_init, m002_write },
+    [MAPPER_003] = { m000_init, m003_write },
+    [MAPPER_004] = { m004_init, m004_write, m004_scanline, m004_ppu_event, m004_ppu_addr },
+    [MAPPER_007] = { m007_init, m007_write },
+};
+
+int mapper_init(struct nes *nes)
+{
+    uint8_t mapper = nes->cart.info.mapper;
+
+    if (mapper >= sizeof(mapper_handler) / sizeof(mapper_handler[0]) ||
+        !mapper_handler[mapper].init) {
+        fprintf(stderr, "Mapper %d isn't supported\n", mapper);
+        return 1;
+    }
+    mapper_set_mirroring(nes, nes->cart.info.mirroring);
+    tilecache_invalidate_all(&nes->ppu);
+    map_prg_ram(&nes->cart, 0);
+    mapper_handler[mapper].init(nes);
+    return 0;
+}
+
 void mapper_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
 {
-    mapper_handler[nes->cart.info.mapper](nes, addr, val, mode);
-}
\ No newline at end of file
+    if (mode == READ) {
+        *val = nes->cart.prg_map[(addr >> 13) & 0x03][addr & 0x1fff];
+    } else if (mapper_handler[nes->cart.info.mapper].write) {
+        mapper_handler[nes->cart.info.mapper].write(nes, addr, *val);
+    }
+}
+
+/* called by the PPU at dot 0 of every scanline */
+void mapper_scanline(struct nes *nes)
+{
+    if (mapper_handler[nes->cart.info.mapper].scanline)
+        mapper_handler[nes->cart.info.mapper].scanline(nes);
+}
+
+/* called by the PPU when it reaches ppu.event_cycle */
+void mapper_ppu_event(struct nes *nes)
+{
+    if (mapper_handler[nes->cart.info.mapper].ppu_event)
+        mapper_handler[nes->cart.info.mapper].ppu_event(nes);
+}
+
+/* called with every address the PPU puts on its bus from PPUADDR/PPUDATA,
+   and with every pattern fetch address while ppu.a12_watch is set
+*/
+void mapper_ppu_addr(struct nes *nes, uint16_t addr)
+{
+    if (mapper_handler[nes->cart.info.mapper].ppu_addr)
+        mapper_handler[nes->cart.info.mapper].ppu_addr(nes, addr);
+}
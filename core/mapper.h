@@ -6,8 +6,13 @@
 
 #include "nes.h"
 
+int mapper_init(struct nes *nes);
 void mapper_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode);
+void mapper_set_mirroring(struct nes *nes, enum MIRRORING mirroring);
+void mapper_scanline(struct nes *nes);
+void mapper_ppu_event(struct nes *nes);
+void mapper_ppu_addr(struct nes *nes, uint16_t addr);
 
 #ifdef __cplusplus
     }
-#endif
\ No newline at end of file
+#endif
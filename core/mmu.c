@@ -1,4 +1,6 @@
 #include "mmu.h"
+#include "cpu.h"
+#include "ppulog.h"
 
 /* memory i/o */
 void mem_io(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
@@ -36,10 +38,62 @@ void ram_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
     mem_io(nes, addr, val, mode);
 }
 
+enum IO_REGISTERS {
+    OAMDMA = 0x4014,
+    JOY1 = 0x4016,
+    JOY2 = 0x4017,
+};
+
+/* OAM DMA: the CPU is halted while page $xx00-$xxff is copied to OAMDATA,
+   a read and a write cycle per byte after one alignment cycle(two on odd
+   CPU cycles, which aren't tracked yet).
+*/
+static void oam_dma(struct nes *nes, uint8_t page)
+{
+    // the OAMDATA writes are logged as one record
+    if (nes->ppu_log)
+        ppulog_oam_dma(nes->ppu_log, nes->ppu.clock);
+    cpu_read(nes, nes->cpu.pc);
+    for (int i = 0; i < 256; i++)
+        cpu_write(nes, 0x2004, cpu_read(nes, TO_U16(i, page)));
+}
+
+/* A write to $4016 sets the strobe of both controllers, reads shift out
+   A, B, Select, Start, Up, Down, Left, Right and then 1s. The upper bits
+   are open bus, $40 from the address of the usual LDA $4016. */
+static void controller_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
+{
+    struct controller *pad = &nes->pad[addr - JOY1];
+
+    if (mode == WRITE) {
+        // the buttons are reloaded until the strobe goes low
+        if (nes->strobe || (*val & 0x01))
+            for (int i = 0; i < 2; i++)
+                nes->pad[i].shift = nes->pad[i].buttons;
+        nes->strobe = *val & 0x01;
+        return;
+    }
+    if (nes->strobe)
+        pad->shift = pad->buttons;
+    *val = 0x40 | (pad->shift & 0x01);
+    if (!nes->strobe)
+        pad->shift = (pad->shift >> 1) | 0x80;
+}
+
+void io_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
+{
+    if (addr == OAMDMA && mode == WRITE)
+        oam_dma(nes, *val);
+    else if (addr == JOY1 || (addr == JOY2 && mode == READ))
+        controller_rw(nes, addr, val, mode);
+    else
+        apu_rw(nes, addr, val, mode);
+}
+
 void (*mem_callback[])(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode) = {
     [RAM]  = ram_rw,
     [PPU]  = ppu_rw,
-    [APU]  = apu_rw,
+    [APU]  = io_rw,
     [CART] = cart_rw,
 };
 
@@ -20,6 +20,18 @@ typedef enum RUN_MODE {
     PAUSE,
 } run_mode_t;
 
+typedef enum RENDER_MODE {
+    RENDER_SCANLINE,    /* whole visible lines at dot 256 */
+    RENDER_DOT,         /* dot by dot, for timing sensitive games */
+} render_mode_t;
+
+typedef enum PIXEL_FORMAT {
+    PIXEL_INDEXED8,     /* the PPU color(0-63), emphasis in ppu.emphasis */
+    PIXEL_RGBA8888,     /* 0xRRGGBBAA, the SDL texture */
+    PIXEL_ARGB8888,
+    PIXEL_RGB565,
+} pixel_format_t;
+
 typedef enum MEM_MODE {
     READ,
     WRITE
@@ -91,22 +103,156 @@ struct cpu {
     uint16_t current_pc;
 };
 
+enum MIRRORING {
+    HORIZONTAL,
+    VERTICAL,
+    SINGLE_SCREEN_LOW,
+    SINGLE_SCREEN_HIGH,
+    FOUR_SCREEN
+};
+
 struct rom_info {
     uint32_t prg_size;
     uint32_t chr_size;
     uint32_t prg_ram_size;
     uint8_t mapper;
-    enum MIRRORING {
-        HORIZONTAL,
-        VERTICAL
-    } mirroring;
+    enum MIRRORING mirroring;
     uint8_t type : 2;
+    uint8_t trainer : 1;
+    uint8_t battery : 1;
+};
+
+/* mapper registers, only the member of the loaded mapper is valid */
+struct mmc1 {
+    uint8_t shift;
+    uint8_t control;
+    uint8_t chr_bank[2];
+    uint8_t prg_bank;
 };
 
+struct mmc3 {
+    uint8_t bank_select;
+    uint8_t bank[8];
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+
+    /* A12 edge detector, fed from PPUADDR/PPUDATA and, while exact
+       tracking is on, from the pattern fetches */
+    bool exact_a12;
+    uint8_t a12;
+    uint64_t a12_low_clock;
+};
+
+struct rom_image;
+struct render_thread;
+struct ppu_log;
+
 struct cart {
+    const struct rom_image *image;
     uint8_t *prg_rom;
     uint8_t *chr_rom;
+    bool chr_ram;
     struct rom_info info;
+
+    /* PRG bank table, prg_map[i] is the 8 KB window at $8000 + i * $2000.
+       Reads are served straight from these pointers, a bank switch only
+       rewrites them. CHR banks live in the PPU page table(ppu.page).
+    */
+    uint8_t *prg_map[4];
+
+    /* PRG RAM at $6000-$7fff. On battery backed carts it is a shared
+       mapping of the save file, writes land in the page cache and are
+       flushed with msync() once per frame(when dirty) and on unload.
+       More than 8 KB is banked by the mapper into prg_ram_map.
+    */
+    uint8_t *prg_ram;
+    uint8_t *prg_ram_map;
+    bool prg_ram_enabled;
+    bool prg_ram_protected;
+    bool prg_ram_mapped;
+    bool save_dirty;
+    bool no_save;       /* battery RAM stays in memory, set after cpu_at_power_up() */
+
+    union {
+        struct mmc1 mmc1;
+        struct mmc3 mmc3;
+    } mapper;
+};
+
+/* the rendering registers right after a write in the middle of a visible
+   line, replayed by the scanline renderer to draw raster splits */
+#define WRITE_LOG_SIZE          32
+
+struct ppu_write_record {
+    uint16_t cycle;
+    uint16_t v;
+    uint8_t x;
+    uint8_t ppuctrl;
+    uint8_t ppumask;
+    bool v_loaded;      /* the write was the second PPUADDR write */
+};
+
+/* the pattern table and nametable pages right before a CHR bank or
+   mirroring switch in the middle of a visible line, the fetches made
+   before cycle still see them */
+#define PAGE_LOG_SIZE           24
+
+struct ppu_page_record {
+    uint16_t cycle;
+    uint8_t *page[12];
+};
+
+/* one of the 8 sprite output units, loaded on dots 257-320 for the next
+   line. The pattern is already flipped, attr bit 2(unused in OAM) marks
+   sprite 0.
+*/
+struct sprite_unit {
+    uint8_t lo;
+    uint8_t hi;
+    uint8_t attr;
+    uint8_t x;
+};
+
+/* Pattern tables decoded to one byte per pixel, per 1 KB window of the
+   PPU page table. A tile is decoded on first use, bank switches and CHR
+   RAM writes only clear valid bits. See tilecache.h.
+*/
+struct tile_cache {
+    uint64_t valid[2][8];               /* [flipped][page], a bit per tile */
+    uint8_t pixels[2][8][64][64];       /* [flipped][page][tile][row * 8 + x] */
+    uint32_t version;                   /* bumped by every invalidation */
+};
+
+/* OAM indexes of the sprites on each line(in OAM order, at most 8),
+   rebuilt from OAM only after it was written or the sprite height changed.
+   Lines past 239 are kept for the evaluation on line 239. */
+struct sprite_index {
+    uint8_t oam[256][8];
+    uint8_t count[256];
+    bool overflow[256];
+    uint8_t height;
+    bool dirty;
+};
+
+/* The 64 PPU colors under each of the 8 emphasis combinations(ppumask
+   bits 5-7, [0] is none) as framebuffer pixels, RGB565 in the low 16 bits,
+   the color itself if indexed. Built from rgb when the palette or the
+   format changes. */
+struct palette_lut {
+    uint8_t rgb[8][64][3];
+    pixel_format_t format;
+    uint32_t colors[8][64];
+};
+
+/* What the debug viewers(see ppuview.h) haven't copied yet, set by the
+   PPU on writes and cleared by ppuview_submit(). */
+struct ppu_view_dirty {
+    uint32_t vram_rows[4];      /* a bit per tile row(0-29) of each KB of vram */
+    bool oam;
+    bool palette;
+    bool chr;                   /* CHR RAM writes and bank switches */
 };
 
 struct ppu {
@@ -160,10 +306,29 @@ struct ppu {
     /* internal data bus */
     uint8_t io_db;
 
+    /* PPU address space in 1 KB pages, page[addr >> 10][addr & 0x3ff].
+
+       page[0-7]       pattern tables, pointed into CHR ROM/RAM by the mapper
+       page[8-11]      nametables, pointed into vram by the mirroring
+       page[12-15]     mirrors of page[8-11]($3f00-$3fff is the palette)
+    */
+    uint8_t *page[16];
+    struct tile_cache tiles;
+
     /* internal memories(including OAM), not exposed with CPU */
-    uint8_t mem[0x4000];
+    uint8_t palette[32];
+    uint32_t palette_version;   /* bumped by every palette write */
     uint8_t oam[256];
-    uint8_t vram[2 * KB];
+    uint8_t oam2[32];   /* secondary OAM, sprites of the next line */
+    int oam2_count;
+    bool sprite0_next;  /* oam2 starts with sprite 0 */
+    struct sprite_index sprite_index;
+    uint8_t vram[4 * KB];    /* the upper 2 KB is only used by four screen carts */
+    /* palette select(bits 2-3 of the palette address) of every tile of the
+       4 nametables in vram, [nametable][coarse Y * 32 + coarse X]. Rows
+       30-31 are what the PPU gets when coarse Y runs into the attribute
+       bytes. Follows the attribute bytes written through PPUDATA. */
+    uint8_t attr_cache[4][32 * 32];
 
     /* NMI registers */
     bool nmi_occured;
@@ -172,18 +337,101 @@ struct ppu {
     /* timing - related */
     int cycles;
     int scanlines;
+    uint64_t clock;     /* dots since power up */
+
+    /* mapper hooks. event_cycle is a dot of the current line at which the
+       mapper wants to be called back(-1 if none), a12_watch asks for
+       every pattern table fetch address instead.
+    */
+    int event_cycle;
+    bool a12_watch;
+
+    /* renderer. framebuffer is 256x240 pixels in lut.format(indexed by
+       default) owned by the front end, NULL if nobody looks at the picture.
+       emphasis is the one of each line, the last one if it changed in the
+       line. frames counts the vblanks. no_video skips the pixels of the frames that start(on the
+       pre-render line) while it's set, frame_no_video is the current
+       frame's; everything but the framebuffer stays the same.
+    */
+    render_mode_t render_mode;
+    void *framebuffer;
+    struct render_thread *render_thread;    /* see renderthread.h */
+    uint8_t emphasis[SCREEN_HEIGHT];
+    bool no_video;
+    bool frame_no_video;
+
+    /* frame_hash and dirty_bands describe the last frame with video: a
+       hash of its pixels and one bit per 16 lines that changed since the
+       frame before. Set on vblank, dirty_bands is 0 after frames without
+       video. */
+    uint64_t frame_hash;
+    uint16_t dirty_bands;
+    /* v and fine X when the frame started(the pre-render line copy) */
+    uint16_t frame_scroll_v;
+    uint8_t frame_scroll_x;
+    struct ppu_view_dirty view_dirty;
+    uint64_t line_hash[SCREEN_HEIGHT];
+    uint64_t hash_next;
+    uint16_t dirty_next;
+    uint8_t dot_line[SCREEN_WIDTH];     /* colors of the line, dot renderer */
+    struct palette_lut lut;
+    uint64_t frames;
+    struct ppu_write_record line_start;
+    struct ppu_write_record write_log[WRITE_LOG_SIZE];
+    int write_log_len;
+    struct ppu_page_record page_log[PAGE_LOG_SIZE];
+    int page_log_len;
+    int sprite0_dot;    /* of the line's sprite 0 hit, 0 if none */
+
+    /* dot renderer: background latches, 16 bit shift registers(the high
+       byte is the tile being drawn) and the sprite units of this line */
+    uint8_t nt_latch;
+    uint8_t at_latch;
+    uint8_t pt_lo_latch;
+    uint8_t pt_hi_latch;
+    uint16_t bg_lo;
+    uint16_t bg_hi;
+    uint16_t at_lo;
+    uint16_t at_hi;
+    struct sprite_unit sprite_units[8];
+    int sprite_count;
 
     /* others */
     uint8_t scroll_offset[2];
     uint8_t read_buffer;
 };
 
+/* standard controller buttons, in the order they're read */
+enum BUTTON {
+    BUTTON_A = (1U << 0),
+    BUTTON_B = (1U << 1),
+    BUTTON_SELECT = (1U << 2),
+    BUTTON_START = (1U << 3),
+    BUTTON_UP = (1U << 4),
+    BUTTON_DOWN = (1U << 5),
+    BUTTON_LEFT = (1U << 6),
+    BUTTON_RIGHT = (1U << 7),
+};
+
+/* a standard controller on $4016/$4017: buttons is what the front end
+   holds down, latched into shift while the strobe($4016 bit 0) is set */
+struct controller {
+    uint8_t buttons;
+    uint8_t shift;
+};
+
 struct nes {
     run_mode_t run_mode;
     bool step;
     struct cpu cpu;
     struct cart cart;
     struct ppu ppu;
+    struct controller pad[2];
+    bool strobe;
+
+    /* the PPU accesses are logged to it while set(after ppu_at_power_up()),
+       see ppulog.h */
+    struct ppu_log *ppu_log;
 
     /* for disassembler */
     uint16_t instr_addr_cache[CACHE_SIZE];
@@ -0,0 +1,186 @@
+#include <math.h>
+#include "ntsc.h"
+#include "pixel.h"
+
+#define SAMPLES         8           /* a pixel, 2/3 of a subcarrier cycle */
+#define PHASES          3           /* a pixel starts 0, 4 or 8 samples in */
+#define TAPS            3
+#define RADIUS          8.0f        /* luma and chroma low pass, in samples */
+#define HUE             4.0f        /* decoder phase, in samples */
+#define SATURATION      0.75f
+
+struct ntsc_filter {
+    int scale;
+    bool merge_fields;
+    int entry_size;                 /* TAPS * scale 4 channel outputs */
+    int16_t *kernels;               /* [8 emphasis][64 colors][PHASES] */
+};
+
+/* 2C02 composite levels: 4 low, 4 high, black is 0.312 and white 1.100 */
+static const float levels[8] = { 0.228f, 0.312f, 0.552f, 0.880f, 0.616f, 0.840f, 1.100f, 1.100f };
+
+static bool in_color_phase(int hue, int phase)
+{
+    return (hue + phase) % 12 < 6;
+}
+
+/* color(0-63) at a subcarrier phase, black 0 and white 1 */
+static float composite(int color, int emphasis, int phase)
+{
+    int hue = color & 0x0f, level = (hue > 13) ? 1 : (color >> 4) & 0x03;
+    float low = levels[level], high = levels[4 + level], v;
+
+    if (hue == 0)
+        low = high;
+    if (hue > 12)
+        high = low;
+    v = (in_color_phase(hue, phase)) ? high : low;
+    // each emphasis bit attenuates the signal during a third of the cycle
+    if (hue < 0x0e && (((emphasis & 0x01) && in_color_phase(0, phase)) ||
+                       ((emphasis & 0x02) && in_color_phase(4, phase)) ||
+                       ((emphasis & 0x04) && in_color_phase(8, phase))))
+        v *= 0.746f;
+    return (v - levels[1]) / (levels[6] - levels[1]);
+}
+
+static float window(float x)
+{
+    return (fabsf(x) < RADIUS) ? 0.5f + 0.5f * cosf((float)M_PI * x / RADIUS) : 0.0f;
+}
+
+/* RGB(0-255) that a pixel starting at phase adds to output k of the pixel
+   d(-1, 0, 1) away */
+static void contribution(int scale, int color, int emphasis, int phase, int d, int k, float *rgb)
+{
+    float center = 8 * d + (2 * k + 1) * 4.0f / scale, sum = 0, dc_i = 0, dc_q = 0, w, v, angle;
+    float y = 0, i = 0, q = 0;
+
+    // Unit gain: the weights of every sample the output sees. The window
+    // isn't a whole number of cycles, the demodulator takes out what it
+    // would find in a flat gray so that only luma edges bleed into color.
+    for (int t = -2 * SAMPLES; t < 3 * SAMPLES; t++) {
+        w = window(t - center);
+        sum += w;
+        dc_i += w * cosf((float)M_PI * (phase + t + HUE) / 6);
+        dc_q += w * sinf((float)M_PI * (phase + t + HUE) / 6);
+    }
+    for (int s = 0; s < SAMPLES; s++) {
+        v = composite(color, emphasis, (phase + s) % 12) * window(s - center) / sum;
+        angle = (float)M_PI * (phase + s + HUE) / 6;
+        y += v;
+        i += 2 * v * (cosf(angle) - dc_i / sum) * SATURATION;
+        q += 2 * v * (sinf(angle) - dc_q / sum) * SATURATION;
+    }
+    rgb[0] = (y + 0.946882f * i + 0.623557f * q) * 255;
+    rgb[1] = (y - 0.274788f * i - 0.635691f * q) * 255;
+    rgb[2] = (y - 1.108545f * i + 1.709007f * q) * 255;
+}
+
+/* where R, G, B and A go in an output pixel */
+static void channel_order(pixel_format_t format, int *pos)
+{
+    uint32_t probe = (format == PIXEL_RGBA8888) ? 0x01020304 : 0x04010203;
+    uint8_t bytes[4];
+
+    memcpy(bytes, &probe, sizeof(bytes));
+    for (int i = 0; i < 4; i++)
+        pos[bytes[i] - 1] = i;
+}
+
+static void build(struct ntsc_filter *ntsc, pixel_format_t format)
+{
+    float rgb[PHASES][TAPS * 4][3], v;
+    int pos[4], n = ntsc->scale * TAPS;
+    int16_t *entry;
+
+    channel_order(format, pos);
+    for (int color = 0; color < 8 * 64; color++) {
+        for (int p = 0; p < PHASES; p++)
+            for (int j = 0; j < n; j++)
+                contribution(ntsc->scale, color & 0x3f, color >> 6, p * 4, j / ntsc->scale - 1,
+                             j % ntsc->scale, rgb[p][j]);
+        for (int p = 0; p < PHASES; p++) {
+            entry = ntsc->kernels + (color * PHASES + p) * ntsc->entry_size;
+            for (int j = 0; j < n; j++) {
+                for (int c = 0; c < 3; c++) {
+                    v = rgb[p][j][c];
+                    // the other field is a line later in the cycle
+                    if (ntsc->merge_fields)
+                        v = (v + rgb[(p + 1) % PHASES][j][c]) / 2;
+                    // rounding and alpha go with the pixel's own output
+                    if (j / ntsc->scale == 1)
+                        v += 0.5f;
+                    entry[j * 4 + pos[c]] = lrintf(v * (1 << NTSC_FRAC_BITS));
+                }
+                entry[j * 4 + pos[3]] = (j / ntsc->scale == 1) ? 255 << NTSC_FRAC_BITS : 0;
+            }
+        }
+    }
+}
+
+/* 32 bit RGBA8888 or ARGB8888 output only */
+struct ntsc_filter *ntsc_create(int scale, bool merge_fields, pixel_format_t format)
+{
+    struct ntsc_filter *ntsc;
+
+    if ((scale != 2 && scale != 4) || (format != PIXEL_RGBA8888 && format != PIXEL_ARGB8888)) {
+        fprintf(stderr, "NTSC: scale %d in format %d isn't supported\n", scale, format);
+        return NULL;
+    }
+    if (!(ntsc = calloc(1, sizeof(*ntsc))))
+        return NULL;
+    ntsc->scale = scale;
+    ntsc->merge_fields = merge_fields;
+    ntsc->entry_size = TAPS * scale * 4;
+    if (!(ntsc->kernels = malloc(8 * 64 * PHASES * ntsc->entry_size * sizeof(int16_t)))) {
+        free(ntsc);
+        return NULL;
+    }
+    build(ntsc, format);
+    return ntsc;
+}
+
+void ntsc_destroy(struct ntsc_filter *ntsc)
+{
+    if (!ntsc)
+        return;
+    free(ntsc->kernels);
+    free(ntsc);
+}
+
+int ntsc_width(const struct ntsc_filter *ntsc)
+{
+    return SCREEN_WIDTH * ntsc->scale;
+}
+
+bool ntsc_merge_fields(const struct ntsc_filter *ntsc)
+{
+    return ntsc->merge_fields;
+}
+
+/* Lines first..first + count - 1 of an indexed frame to pixels(the first
+   line's), pitch bytes apart. Without merged fields the output depends on
+   the frame count too. */
+void ntsc_filter_lines(const struct ntsc_filter *ntsc, const uint8_t *frame, const uint8_t *emphasis,
+                       uint64_t frame_count, int first, int count, void *pixels, int pitch)
+{
+    const struct pixel_kernels *kernels = pixel_kernels();
+    const int16_t *entries[SCREEN_WIDTH + 2], *table;
+    const uint8_t *line;
+    int phase;
+
+    // black around the picture
+    entries[0] = entries[SCREEN_WIDTH + 1] = ntsc->kernels + 0x0f * PHASES * ntsc->entry_size;
+    for (int y = first; y < first + count; y++) {
+        table = ntsc->kernels + (emphasis[y] & 0x07) * 64 * PHASES * ntsc->entry_size;
+        line = frame + y * SCREEN_WIDTH;
+        // 4 samples later every line, frames alternate between two phases
+        phase = (ntsc->merge_fields) ? y % PHASES : (y + (frame_count & 0x01)) % PHASES;
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            entries[x + 1] = table + ((line[x] & 0x3f) * PHASES + phase) * ntsc->entry_size;
+            phase = (phase + 2 < PHASES) ? phase + 2 : phase + 2 - PHASES;
+        }
+        kernels->ntsc(entries, ntsc->scale, (uint32_t *)((uint8_t *)pixels + (y - first) * pitch),
+                      SCREEN_WIDTH);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+/* NTSC composite video filter for indexed frames(see PIXEL_INDEXED8).
+
+   The 2C02 draws each pixel as 8 samples of a square wave at the color
+   subcarrier(12 samples a cycle), the TV low passes the luma out of it
+   and demodulates the chroma. Decoding is linear, so each color, emphasis
+   and subcarrier phase(a pixel starts on one of 3) has a precomputed
+   kernel: its RGB contribution to the outputs of its own pixel and of its
+   two neighbors. A filtered pixel is the sum of 3 kernels, clamped.
+
+   scale           output pixels per NES pixel, 2(512 wide) or 4(1024)
+   merge_fields    average the two frame phases: no dot crawl and the
+                   output only changes where the frame does, at the cost
+                   of a little more blur
+*/
+struct ntsc_filter;
+
+struct ntsc_filter *ntsc_create(int scale, bool merge_fields, pixel_format_t format);
+void ntsc_destroy(struct ntsc_filter *ntsc);
+int ntsc_width(const struct ntsc_filter *ntsc);
+bool ntsc_merge_fields(const struct ntsc_filter *ntsc);
+void ntsc_filter_lines(const struct ntsc_filter *ntsc, const uint8_t *frame, const uint8_t *emphasis,
+                       uint64_t frame_count, int first, int count, void *pixels, int pitch);
+
+#ifdef __cplusplus
+}
+#endif
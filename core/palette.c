@@ -0,0 +1,126 @@
+#include "palette.h"
+#include "renderer.h"
+#include "pixel.h"
+
+/* Emphasis darkens the channels that aren't emphasized, by about 18% for
+   each bit that is set. */
+static void emphasize(struct palette_lut *lut)
+{
+    int scale;
+
+    for (int e = 1; e < 8; e++) {
+        for (int i = 0; i < 64; i++) {
+            for (int c = 0; c < 3; c++) {
+                scale = 256;
+                for (int bit = 0; bit < 3; bit++)
+                    if (((e >> bit) & 0x01) && bit != c)
+                        scale = scale * 13 / 16;
+                lut->rgb[e][i][c] = lut->rgb[0][i][c] * scale / 256;
+            }
+        }
+    }
+}
+
+static void build(struct palette_lut *lut)
+{
+    const uint8_t *rgb;
+
+    for (int e = 0; e < 8; e++) {
+        for (int i = 0; i < 64; i++) {
+            rgb = lut->rgb[e][i];
+            switch (lut->format) {
+            case PIXEL_INDEXED8:
+                lut->colors[e][i] = i;
+                break;
+            case PIXEL_RGBA8888:
+                lut->colors[e][i] = (rgb[0] << 24) | (rgb[1] << 16) | (rgb[2] << 8) | 0xff;
+                break;
+            case PIXEL_ARGB8888:
+                lut->colors[e][i] = 0xff000000 | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+                break;
+            case PIXEL_RGB565:
+                lut->colors[e][i] = ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+                break;
+            }
+        }
+    }
+}
+
+/* the 2C02 colors */
+void palette_reset(struct palette_lut *lut, pixel_format_t format)
+{
+    for (int i = 0; i < 64; i++) {
+        lut->rgb[0][i][0] = ppu_palette_rgba[i] >> 24;
+        lut->rgb[0][i][1] = ppu_palette_rgba[i] >> 16;
+        lut->rgb[0][i][2] = ppu_palette_rgba[i] >> 8;
+    }
+    emphasize(lut);
+    lut->format = format;
+    build(lut);
+}
+
+/* A .pal file: 64 RGB triplets, or 512 with the emphasized colors of every
+   combination in ppumask order. */
+int palette_load(struct palette_lut *lut, const char *path)
+{
+    uint8_t rgb[8 * 64 * 3];
+    size_t size;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "rb"))) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return -1;
+    }
+    size = fread(rgb, 1, sizeof(rgb), fp);
+    fclose(fp);
+    if (size != 64 * 3 && size != sizeof(rgb)) {
+        fprintf(stderr, "%s: %zu bytes, expected %d or %zu\n", path, size, 64 * 3, sizeof(rgb));
+        return -1;
+    }
+
+    memcpy(lut->rgb, rgb, size);
+    if (size == 64 * 3)
+        emphasize(lut);
+    build(lut);
+    return 0;
+}
+
+void palette_set_format(struct palette_lut *lut, pixel_format_t format)
+{
+    if (lut->format == format)
+        return;
+    lut->format = format;
+    build(lut);
+}
+
+/* n colors(0-63) to framebuffer pixels offset..offset + n - 1 */
+void palette_convert(const struct palette_lut *lut, const uint8_t *in, uint8_t emphasis,
+                     void *framebuffer, int offset, int n)
+{
+    uint16_t *out;
+
+    switch (lut->format) {
+    case PIXEL_INDEXED8:
+        memcpy((uint8_t *)framebuffer + offset, in, n);
+        break;
+    case PIXEL_RGB565:
+        out = (uint16_t *)framebuffer + offset;
+        for (int i = 0; i < n; i++)
+            out[i] = lut->colors[emphasis][in[i] & 0x3f];
+        break;
+    default:
+        pixel_to_rgba(in, lut->colors[emphasis], (uint32_t *)framebuffer + offset, n);
+        break;
+    }
+}
+
+/* An indexed frame and the emphasis of its lines to pixels in lut's
+   format, for front ends that keep the PPU output indexed and only need
+   RGB when they show it. */
+void palette_expand(const struct palette_lut *lut, const uint8_t *frame, const uint8_t *emphasis,
+                    void *framebuffer)
+{
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+        palette_convert(lut, frame + y * SCREEN_WIDTH, emphasis[y] & 0x07, framebuffer,
+                        y * SCREEN_WIDTH, SCREEN_WIDTH);
+}
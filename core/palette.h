@@ -0,0 +1,31 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+void palette_reset(struct palette_lut *lut, pixel_format_t format);
+int palette_load(struct palette_lut *lut, const char *path);
+void palette_set_format(struct palette_lut *lut, pixel_format_t format);
+void palette_convert(const struct palette_lut *lut, const uint8_t *in, uint8_t emphasis,
+                     void *framebuffer, int offset, int n);
+void palette_expand(const struct palette_lut *lut, const uint8_t *frame, const uint8_t *emphasis,
+                    void *framebuffer);
+
+/* one color(0-63) to framebuffer pixel offset, emphasis is ppumask >> 5 */
+static inline void palette_put(const struct palette_lut *lut, uint8_t color, uint8_t emphasis,
+                               void *framebuffer, int offset)
+{
+    if (lut->format == PIXEL_INDEXED8)
+        ((uint8_t *)framebuffer)[offset] = color;
+    else if (lut->format == PIXEL_RGB565)
+        ((uint16_t *)framebuffer)[offset] = lut->colors[emphasis][color];
+    else
+        ((uint32_t *)framebuffer)[offset] = lut->colors[emphasis][color];
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,776 @@
+#include <pthread.h>
+#include "pixel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_X86       1
+#endif
+
+/* scalar
+
+   A multiply spreads the 8 bits of a byte over the 8 bytes of a word:
+   b * 0x8040201008040201 puts a copy of b every 9 bits, so bit 7 of byte
+   k is bit 7 - k of b, without carries.
+*/
+static uint64_t spread_bits(uint8_t b)
+{
+    return ((b * 0x8040201008040201ULL) & 0x8080808080808080ULL) >> 7;
+}
+
+static void decode_tile_scalar(const uint8_t *chr, uint8_t *out, bool flip)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bool swap = !flip;
+#else
+    bool swap = flip;
+#endif
+    uint64_t row;
+
+    for (int i = 0; i < 8; i++) {
+        row = spread_bits(chr[i]) | (spread_bits(chr[i + 8]) << 1);
+        if (swap)
+            row = __builtin_bswap64(row);
+        memcpy(out + i * 8, &row, 8);
+    }
+}
+
+static void lookup_scalar(const uint8_t *in, const uint8_t *table, uint8_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+        out[i] = table[in[i] & 0x1f];
+}
+
+static void to_rgba_scalar(const uint8_t *in, const uint32_t *lut, uint32_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+        out[i] = lut[in[i] & 0x3f];
+}
+
+static int composite_scalar(const uint8_t *bg, const uint8_t *spr, uint8_t *out, int n)
+{
+    int hit = -1;
+
+    for (int i = 0; i < n; i++) {
+        if (bg[i] && (spr[i] & SPRITE_0) && hit < 0)
+            hit = i;
+        out[i] = ((spr[i] & 0x03) && (!(spr[i] & BEHIND_BG) || !bg[i])) ? spr[i] & 0x1f : bg[i];
+    }
+    return hit;
+}
+
+static void delta_scalar(const uint8_t *cur, uint8_t *prev, uint8_t *out, int n)
+{
+    for (int i = 0; i < n; i++) {
+        out[i] = cur[i] ^ prev[i];
+        prev[i] = cur[i];
+    }
+}
+
+static int run_scalar(const uint8_t *in, int n)
+{
+    int i;
+
+    for (i = 1; i < n && in[i] == in[0]; i++)
+        ;
+    return i;
+}
+
+static void ntsc_scalar(const int16_t *const *entries, int scale, uint32_t *out, int n)
+{
+    const int16_t *left, *center, *right;
+    uint8_t *bytes = (uint8_t *)out;
+    int width = scale * 4, v;
+
+    for (int i = 0; i < n; i++) {
+        left = entries[i] + 2 * width;
+        center = entries[i + 1] + width;
+        right = entries[i + 2];
+        for (int j = 0; j < width; j++) {
+            v = (left[j] + center[j] + right[j]) >> NTSC_FRAC_BITS;
+            *bytes++ = (v < 0) ? 0 : (v > 255) ? 255 : v;
+        }
+    }
+}
+
+/* Scale2x: a corner of E takes the color of the two neighbors it touches
+   when they're equal and the other two aren't, a corner of a shape. xbr2x
+   also leaves it alone when the diagonal pixel is E, a line of E going
+   through the corner.
+
+       A B C
+       D E F
+       G H I
+*/
+static void corners_scalar(const uint8_t *const *rows, uint8_t *const *out, int n, bool diagonals)
+{
+    const uint8_t *above = rows[0], *line = rows[1], *below = rows[2];
+    uint8_t b, d, e, f, h;
+
+    for (int i = 0; i < n; i++) {
+        b = above[i];
+        d = line[i - 1];
+        e = line[i];
+        f = line[i + 1];
+        h = below[i];
+        out[0][i * 2] = (d == b && b != f && d != h && (!diagonals || above[i - 1] != e)) ? d : e;
+        out[0][i * 2 + 1] = (b == f && b != d && f != h && (!diagonals || above[i + 1] != e)) ? f : e;
+        out[1][i * 2] = (d == h && d != b && h != f && (!diagonals || below[i - 1] != e)) ? d : e;
+        out[1][i * 2 + 1] = (h == f && d != h && b != f && (!diagonals || below[i + 1] != e)) ? f : e;
+    }
+}
+
+static void scale2x_scalar(const uint8_t *const *rows, uint8_t *const *out, int n)
+{
+    corners_scalar(rows, out, n, false);
+}
+
+static void xbr2x_scalar(const uint8_t *const *rows, uint8_t *const *out, int n)
+{
+    corners_scalar(rows, out, n, true);
+}
+
+/* Scale3x: the corners as in Scale2x, an edge takes the color of its
+   neighbor when a corner next to it does and the pixel across that corner
+   isn't E */
+static void scale3x_scalar(const uint8_t *const *rows, uint8_t *const *out, int n)
+{
+    const uint8_t *above = rows[0], *line = rows[1], *below = rows[2];
+    uint8_t a, b, c, d, e, f, g, h, i;
+    bool c0, c1, c2, c3;
+
+    for (int x = 0; x < n; x++) {
+        a = above[x - 1];
+        b = above[x];
+        c = above[x + 1];
+        d = line[x - 1];
+        e = line[x];
+        f = line[x + 1];
+        g = below[x - 1];
+        h = below[x];
+        i = below[x + 1];
+        c0 = d == b && b != f && d != h;
+        c1 = b == f && b != d && f != h;
+        c2 = d == h && d != b && h != f;
+        c3 = h == f && d != h && b != f;
+        out[0][x * 3] = (c0) ? d : e;
+        out[0][x * 3 + 1] = ((c0 && e != c) || (c1 && e != a)) ? b : e;
+        out[0][x * 3 + 2] = (c1) ? f : e;
+        out[1][x * 3] = ((c0 && e != g) || (c2 && e != a)) ? d : e;
+        out[1][x * 3 + 1] = e;
+        out[1][x * 3 + 2] = ((c1 && e != i) || (c3 && e != c)) ? f : e;
+        out[2][x * 3] = (c2) ? d : e;
+        out[2][x * 3 + 1] = ((c2 && e != i) || (c3 && e != g)) ? h : e;
+        out[2][x * 3 + 2] = (c3) ? f : e;
+    }
+}
+
+/* (a + b + 1) >> 1 in every byte without carries between them */
+static void blend_scalar(const uint32_t *a, const uint32_t *b, uint32_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+        out[i] = (a[i] | b[i]) - (((a[i] ^ b[i]) & 0xfefefefe) >> 1);
+}
+
+#ifdef PIXEL_X86
+
+/* SSE2
+
+   Priority as masks: the sprite wins where it's opaque and either in front
+   or over a clear background. Sprite 0 hits are a movemask, the first one
+   is its lowest set bit.
+*/
+__attribute__((target("sse2")))
+static int composite_sse2(const uint8_t *bg, const uint8_t *spr, uint8_t *out, int n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i b, s, b_clear, use_spr, hit;
+    int first = -1, i, ret, mask;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        b = _mm_loadu_si128((const __m128i *)(bg + i));
+        s = _mm_loadu_si128((const __m128i *)(spr + i));
+        b_clear = _mm_cmpeq_epi8(b, zero);
+        use_spr = _mm_or_si128(_mm_cmpeq_epi8(_mm_and_si128(s, _mm_set1_epi8(BEHIND_BG)), zero), b_clear);
+        use_spr = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_and_si128(s, _mm_set1_epi8(0x03)), zero), use_spr);
+        _mm_storeu_si128((__m128i *)(out + i),
+                         _mm_or_si128(_mm_and_si128(use_spr, _mm_and_si128(s, _mm_set1_epi8(0x1f))),
+                                      _mm_andnot_si128(use_spr, b)));
+        hit = _mm_andnot_si128(b_clear, s);
+        mask = _mm_movemask_epi8(hit);      // bit 7 is SPRITE_0
+        if (mask && first < 0)
+            first = i + __builtin_ctz(mask);
+    }
+    ret = composite_scalar(bg + i, spr + i, out + i, n - i);
+    return (first < 0 && ret >= 0) ? i + ret : first;
+}
+
+__attribute__((target("sse2")))
+static void delta_sse2(const uint8_t *cur, uint8_t *prev, uint8_t *out, int n)
+{
+    __m128i c;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        c = _mm_loadu_si128((const __m128i *)(cur + i));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(c, _mm_loadu_si128((const __m128i *)(prev + i))));
+        _mm_storeu_si128((__m128i *)(prev + i), c);
+    }
+    delta_scalar(cur + i, prev + i, out + i, n - i);
+}
+
+/* the run ends at the first byte that isn't in[0], the lowest clear bit of
+   the compare mask */
+__attribute__((target("sse2")))
+static int run_sse2(const uint8_t *in, int n)
+{
+    __m128i value = _mm_set1_epi8(in[0]);
+    unsigned mask;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(in + i)), value));
+        if (mask != 0xffff)
+            return i + __builtin_ctz(~mask);
+    }
+    for (; i < n && in[i] == in[0]; i++)
+        ;
+    return i;
+}
+
+/* 2 outputs of 4 channels per register, packus clamps */
+__attribute__((target("sse2")))
+static void ntsc_sse2(const int16_t *const *entries, int scale, uint32_t *out, int n)
+{
+    int width = scale * 4;
+    __m128i sum;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < width; j += 8, out += 2) {
+            sum = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(entries[i] + 2 * width + j)),
+                                _mm_loadu_si128((const __m128i *)(entries[i + 1] + width + j)));
+            sum = _mm_add_epi16(sum, _mm_loadu_si128((const __m128i *)(entries[i + 2] + j)));
+            sum = _mm_srai_epi16(sum, NTSC_FRAC_BITS);
+            _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(sum, sum));
+        }
+    }
+}
+
+/* mask ? a : b */
+__attribute__((target("sse2")))
+static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/* the Scale2x conditions as compare masks, 16 pixels a register, the two
+   outputs of a row interleaved by unpack */
+__attribute__((target("sse2")))
+static void corners_sse2(const uint8_t *const *rows, uint8_t *const *out, int n, bool diagonals)
+{
+    const uint8_t *above = rows[0], *line = rows[1], *below = rows[2];
+    const uint8_t *tail[3];
+    uint8_t *tail_out[2];
+    __m128i b, d, e, f, h, db, bf, dh, hf, c0, c1, c2, c3, o0, o1, o2, o3;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        b = _mm_loadu_si128((const __m128i *)(above + i));
+        d = _mm_loadu_si128((const __m128i *)(line + i - 1));
+        e = _mm_loadu_si128((const __m128i *)(line + i));
+        f = _mm_loadu_si128((const __m128i *)(line + i + 1));
+        h = _mm_loadu_si128((const __m128i *)(below + i));
+        db = _mm_cmpeq_epi8(d, b);
+        bf = _mm_cmpeq_epi8(b, f);
+        dh = _mm_cmpeq_epi8(d, h);
+        hf = _mm_cmpeq_epi8(h, f);
+        c0 = _mm_andnot_si128(_mm_or_si128(bf, dh), db);
+        c1 = _mm_andnot_si128(_mm_or_si128(db, hf), bf);
+        c2 = _mm_andnot_si128(_mm_or_si128(db, hf), dh);
+        c3 = _mm_andnot_si128(_mm_or_si128(dh, bf), hf);
+        if (diagonals) {
+            c0 = _mm_andnot_si128(_mm_cmpeq_epi8(e, _mm_loadu_si128((const __m128i *)(above + i - 1))), c0);
+            c1 = _mm_andnot_si128(_mm_cmpeq_epi8(e, _mm_loadu_si128((const __m128i *)(above + i + 1))), c1);
+            c2 = _mm_andnot_si128(_mm_cmpeq_epi8(e, _mm_loadu_si128((const __m128i *)(below + i - 1))), c2);
+            c3 = _mm_andnot_si128(_mm_cmpeq_epi8(e, _mm_loadu_si128((const __m128i *)(below + i + 1))), c3);
+        }
+        o0 = select_sse2(c0, d, e);
+        o1 = select_sse2(c1, f, e);
+        o2 = select_sse2(c2, d, e);
+        o3 = select_sse2(c3, f, e);
+        _mm_storeu_si128((__m128i *)(out[0] + i * 2), _mm_unpacklo_epi8(o0, o1));
+        _mm_storeu_si128((__m128i *)(out[0] + i * 2 + 16), _mm_unpackhi_epi8(o0, o1));
+        _mm_storeu_si128((__m128i *)(out[1] + i * 2), _mm_unpacklo_epi8(o2, o3));
+        _mm_storeu_si128((__m128i *)(out[1] + i * 2 + 16), _mm_unpackhi_epi8(o2, o3));
+    }
+    for (int r = 0; r < 3; r++)
+        tail[r] = rows[r] + i;
+    tail_out[0] = out[0] + i * 2;
+    tail_out[1] = out[1] + i * 2;
+    corners_scalar(tail, tail_out, n - i, diagonals);
+}
+
+__attribute__((target("sse2")))
+static void scale2x_sse2(const uint8_t *const *rows, uint8_t *const *out, int n)
+{
+    corners_sse2(rows, out, n, false);
+}
+
+__attribute__((target("sse2")))
+static void xbr2x_sse2(const uint8_t *const *rows, uint8_t *const *out, int n)
+{
+    corners_sse2(rows, out, n, true);
+}
+
+__attribute__((target("sse2")))
+static void blend_sse2(const uint32_t *a, const uint32_t *b, uint32_t *out, int n)
+{
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(out + i), _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                            _mm_loadu_si128((const __m128i *)(b + i))));
+    blend_scalar(a + i, b + i, out + i, n - i);
+}
+
+/* SSSE3
+
+   pshufb broadcasts each bitplane byte over 8 lanes, a compare against the
+   lane's bit gives 0/-1. Two rows per register. Palette lookups are pshufb
+   on two 16 byte halves of the table.
+*/
+__attribute__((target("ssse3")))
+static void decode_tile_ssse3(const uint8_t *chr, uint8_t *out, bool flip)
+{
+    __m128i planes = _mm_loadu_si128((const __m128i *)chr);
+    __m128i bits = (flip) ? _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128) :
+                            _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    __m128i idx = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+    __m128i lo, hi;
+
+    for (int i = 0; i < 8; i += 2) {
+        lo = _mm_shuffle_epi8(planes, idx);
+        hi = _mm_shuffle_epi8(planes, _mm_add_epi8(idx, _mm_set1_epi8(8)));
+        lo = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), _mm_set1_epi8(1));
+        hi = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), _mm_set1_epi8(2));
+        _mm_storeu_si128((__m128i *)(out + i * 8), _mm_or_si128(lo, hi));
+        idx = _mm_add_epi8(idx, _mm_set1_epi8(2));
+    }
+}
+
+__attribute__((target("ssse3")))
+static void lookup_ssse3(const uint8_t *in, const uint8_t *table, uint8_t *out, int n)
+{
+    __m128i low = _mm_loadu_si128((const __m128i *)table);
+    __m128i high = _mm_loadu_si128((const __m128i *)(table + 16));
+    __m128i idx, upper;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        idx = _mm_and_si128(_mm_loadu_si128((const __m128i *)(in + i)), _mm_set1_epi8(0x1f));
+        upper = _mm_cmpgt_epi8(idx, _mm_set1_epi8(15));
+        idx = _mm_and_si128(idx, _mm_set1_epi8(0x0f));
+        _mm_storeu_si128((__m128i *)(out + i),
+                         _mm_or_si128(_mm_andnot_si128(upper, _mm_shuffle_epi8(low, idx)),
+                                      _mm_and_si128(upper, _mm_shuffle_epi8(high, idx))));
+    }
+    lookup_scalar(in + i, table, out + i, n - i);
+}
+
+/* byte k of x, y and z to bytes 3k, 3k + 1 and 3k + 2: a pshufb of each
+   per 16 output bytes */
+static const int8_t interleave3[3][3][16] = {
+    { { 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+      { -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+      { -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 } },
+    { { -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+      { 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+      { -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 } },
+    { { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+      { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+      { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 } },
+};
+
+__attribute__((target("ssse3")))
+static void store3_ssse3(uint8_t *out, __m128i x, __m128i y, __m128i z)
+{
+    __m128i v;
+
+    for (int k = 0; k < 3; k++) {
+        v = _mm_or_si128(_mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i *)interleave3[k][0])),
+                         _mm_shuffle_epi8(y, _mm_loadu_si128((const __m128i *)interleave3[k][1])));
+        v = _mm_or_si128(v, _mm_shuffle_epi8(z, _mm_loadu_si128((const __m128i *)interleave3[k][2])));
+        _mm_storeu_si128((__m128i *)(out + k * 16), v);
+    }
+}
+
+/* the 9 outputs as in scale3x_scalar, 16 pixels a register */
+__attribute__((target("ssse3")))
+static void scale3x_ssse3(const uint8_t *const *rows, uint8_t *const *out, int n)
+{
+    const uint8_t *above = rows[0], *line = rows[1], *below = rows[2];
+    const uint8_t *tail[3];
+    uint8_t *tail_out[3];
+    __m128i a, b, c, d, e, f, g, h, k, db, bf, dh, hf, c0, c1, c2, c3, ea, ec, eg, ei;
+    int x;
+
+    for (x = 0; x + 16 <= n; x += 16) {
+        a = _mm_loadu_si128((const __m128i *)(above + x - 1));
+        b = _mm_loadu_si128((const __m128i *)(above + x));
+        c = _mm_loadu_si128((const __m128i *)(above + x + 1));
+        d = _mm_loadu_si128((const __m128i *)(line + x - 1));
+        e = _mm_loadu_si128((const __m128i *)(line + x));
+        f = _mm_loadu_si128((const __m128i *)(line + x + 1));
+        g = _mm_loadu_si128((const __m128i *)(below + x - 1));
+        h = _mm_loadu_si128((const __m128i *)(below + x));
+        k = _mm_loadu_si128((const __m128i *)(below + x + 1));
+        db = _mm_cmpeq_epi8(d, b);
+        bf = _mm_cmpeq_epi8(b, f);
+        dh = _mm_cmpeq_epi8(d, h);
+        hf = _mm_cmpeq_epi8(h, f);
+        c0 = _mm_andnot_si128(_mm_or_si128(bf, dh), db);
+        c1 = _mm_andnot_si128(_mm_or_si128(db, hf), bf);
+        c2 = _mm_andnot_si128(_mm_or_si128(db, hf), dh);
+        c3 = _mm_andnot_si128(_mm_or_si128(dh, bf), hf);
+        ea = _mm_cmpeq_epi8(e, a);
+        ec = _mm_cmpeq_epi8(e, c);
+        eg = _mm_cmpeq_epi8(e, g);
+        ei = _mm_cmpeq_epi8(e, k);
+        store3_ssse3(out[0] + x * 3, select_sse2(c0, d, e),
+                     select_sse2(_mm_or_si128(_mm_andnot_si128(ec, c0), _mm_andnot_si128(ea, c1)), b, e),
+                     select_sse2(c1, f, e));
+        store3_ssse3(out[1] + x * 3,
+                     select_sse2(_mm_or_si128(_mm_andnot_si128(eg, c0), _mm_andnot_si128(ea, c2)), d, e), e,
+                     select_sse2(_mm_or_si128(_mm_andnot_si128(ei, c1), _mm_andnot_si128(ec, c3)), f, e));
+        store3_ssse3(out[2] + x * 3, select_sse2(c2, d, e),
+                     select_sse2(_mm_or_si128(_mm_andnot_si128(ei, c2), _mm_andnot_si128(eg, c3)), h, e),
+                     select_sse2(c3, f, e));
+    }
+    for (int r = 0; r < 3; r++) {
+        tail[r] = rows[r] + x;
+        tail_out[r] = out[r] + x * 3;
+    }
+    scale3x_scalar(tail, tail_out, n - x);
+}
+
+/* AVX2
+
+   Same as SSSE3 with 4 rows / 32 indexes per register, RGBA conversion is
+   a gather of 8 LUT entries.
+*/
+__attribute__((target("avx2")))
+static void decode_tile_avx2(const uint8_t *chr, uint8_t *out, bool flip)
+{
+    __m256i planes = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)chr));
+    __m256i bits = (flip) ? _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                             1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128) :
+                            _mm256_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1,
+                                             -128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    __m256i idx = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                   2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    __m256i lo, hi;
+
+    for (int i = 0; i < 8; i += 4) {
+        lo = _mm256_shuffle_epi8(planes, idx);
+        hi = _mm256_shuffle_epi8(planes, _mm256_add_epi8(idx, _mm256_set1_epi8(8)));
+        lo = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), _mm256_set1_epi8(1));
+        hi = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), _mm256_set1_epi8(2));
+        _mm256_storeu_si256((__m256i *)(out + i * 8), _mm256_or_si256(lo, hi));
+        idx = _mm256_add_epi8(idx, _mm256_set1_epi8(4));
+    }
+}
+
+__attribute__((target("avx2")))
+static void lookup_avx2(const uint8_t *in, const uint8_t *table, uint8_t *out, int n)
+{
+    __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table));
+    __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(table + 16)));
+    __m256i idx, upper;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        idx = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(in + i)), _mm256_set1_epi8(0x1f));
+        upper = _mm256_cmpgt_epi8(idx, _mm256_set1_epi8(15));
+        idx = _mm256_and_si256(idx, _mm256_set1_epi8(0x0f));
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_blendv_epi8(_mm256_shuffle_epi8(low, idx),
+                                               _mm256_shuffle_epi8(high, idx), upper));
+    }
+    lookup_ssse3(in + i, table, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void to_rgba_avx2(const uint8_t *in, const uint32_t *lut, uint32_t *out, int n)
+{
+    __m256i idx;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + i)));
+        idx = _mm256_and_si256(idx, _mm256_set1_epi32(0x3f));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_i32gather_epi32((const int *)lut, idx, 4));
+    }
+    to_rgba_scalar(in + i, lut, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int composite_avx2(const uint8_t *bg, const uint8_t *spr, uint8_t *out, int n)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i b, s, b_clear, use_spr;
+    int first = -1, i, ret;
+    uint32_t mask;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        b = _mm256_loadu_si256((const __m256i *)(bg + i));
+        s = _mm256_loadu_si256((const __m256i *)(spr + i));
+        b_clear = _mm256_cmpeq_epi8(b, zero);
+        use_spr = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_and_si256(s, _mm256_set1_epi8(BEHIND_BG)), zero),
+                                  b_clear);
+        use_spr = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_and_si256(s, _mm256_set1_epi8(0x03)), zero),
+                                      use_spr);
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_blendv_epi8(b, _mm256_and_si256(s, _mm256_set1_epi8(0x1f)), use_spr));
+        mask = _mm256_movemask_epi8(_mm256_andnot_si256(b_clear, s));
+        if (mask && first < 0)
+            first = i + __builtin_ctz(mask);
+    }
+    ret = composite_sse2(bg + i, spr + i, out + i, n - i);
+    return (first < 0 && ret >= 0) ? i + ret : first;
+}
+
+__attribute__((target("avx2")))
+static void delta_avx2(const uint8_t *cur, uint8_t *prev, uint8_t *out, int n)
+{
+    __m256i c;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        c = _mm256_loadu_si256((const __m256i *)(cur + i));
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_xor_si256(c, _mm256_loadu_si256((const __m256i *)(prev + i))));
+        _mm256_storeu_si256((__m256i *)(prev + i), c);
+    }
+    delta_sse2(cur + i, prev + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int run_avx2(const uint8_t *in, int n)
+{
+    __m256i value = _mm256_set1_epi8(in[0]);
+    uint32_t mask;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(in + i)), value));
+        if (mask != 0xffffffff)
+            return i + __builtin_ctz(~mask);
+    }
+    for (; i < n && in[i] == in[0]; i++)
+        ;
+    return i;
+}
+
+/* 4 outputs per register: a pixel's at scale 4, two pixels' at scale 2 */
+__attribute__((target("avx2")))
+static __m256i load_halves(const int16_t *low, const int16_t *high)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)low)),
+                                   _mm_loadu_si128((const __m128i *)high), 1);
+}
+
+__attribute__((target("avx2")))
+static void ntsc_avx2(const int16_t *const *entries, int scale, uint32_t *out, int n)
+{
+    int width = scale * 4, i;
+    __m256i sum;
+
+    for (i = 0; i + 4 / scale <= n; i += 4 / scale, out += 4) {
+        if (scale == 4) {
+            sum = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)(entries[i] + 2 * width)),
+                                   _mm256_loadu_si256((const __m256i *)(entries[i + 1] + width)));
+            sum = _mm256_add_epi16(sum, _mm256_loadu_si256((const __m256i *)entries[i + 2]));
+        } else {
+            sum = _mm256_add_epi16(load_halves(entries[i] + 2 * width, entries[i + 1] + 2 * width),
+                                   load_halves(entries[i + 1] + width, entries[i + 2] + width));
+            sum = _mm256_add_epi16(sum, load_halves(entries[i + 2], entries[i + 3]));
+        }
+        sum = _mm256_srai_epi16(sum, NTSC_FRAC_BITS);
+        sum = _mm256_packus_epi16(sum, sum);
+        // packus works per lane, the results are quadwords 0 and 2
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(_mm256_permute4x64_epi64(sum, 0x08)));
+    }
+    ntsc_sse2(entries + i, scale, out, n - i);
+}
+
+/* as corners_sse2, unpack works per 128 bit lane: the lanes of the low
+   and high halves are swapped back into order */
+__attribute__((target("avx2")))
+static void corners_avx2(const uint8_t *const *rows, uint8_t *const *out, int n, bool diagonals)
+{
+    const uint8_t *above = rows[0], *line = rows[1], *below = rows[2];
+    const uint8_t *tail[3];
+    uint8_t *tail_out[2];
+    __m256i b, d, e, f, h, db, bf, dh, hf, c0, c1, c2, c3, diag, o0, o1, o2, o3, lo, hi;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        b = _mm256_loadu_si256((const __m256i *)(above + i));
+        d = _mm256_loadu_si256((const __m256i *)(line + i - 1));
+        e = _mm256_loadu_si256((const __m256i *)(line + i));
+        f = _mm256_loadu_si256((const __m256i *)(line + i + 1));
+        h = _mm256_loadu_si256((const __m256i *)(below + i));
+        db = _mm256_cmpeq_epi8(d, b);
+        bf = _mm256_cmpeq_epi8(b, f);
+        dh = _mm256_cmpeq_epi8(d, h);
+        hf = _mm256_cmpeq_epi8(h, f);
+        c0 = _mm256_andnot_si256(_mm256_or_si256(bf, dh), db);
+        c1 = _mm256_andnot_si256(_mm256_or_si256(db, hf), bf);
+        c2 = _mm256_andnot_si256(_mm256_or_si256(db, hf), dh);
+        c3 = _mm256_andnot_si256(_mm256_or_si256(dh, bf), hf);
+        if (diagonals) {
+            diag = _mm256_loadu_si256((const __m256i *)(above + i - 1));
+            c0 = _mm256_andnot_si256(_mm256_cmpeq_epi8(e, diag), c0);
+            diag = _mm256_loadu_si256((const __m256i *)(above + i + 1));
+            c1 = _mm256_andnot_si256(_mm256_cmpeq_epi8(e, diag), c1);
+            diag = _mm256_loadu_si256((const __m256i *)(below + i - 1));
+            c2 = _mm256_andnot_si256(_mm256_cmpeq_epi8(e, diag), c2);
+            diag = _mm256_loadu_si256((const __m256i *)(below + i + 1));
+            c3 = _mm256_andnot_si256(_mm256_cmpeq_epi8(e, diag), c3);
+        }
+        o0 = _mm256_blendv_epi8(e, d, c0);
+        o1 = _mm256_blendv_epi8(e, f, c1);
+        o2 = _mm256_blendv_epi8(e, d, c2);
+        o3 = _mm256_blendv_epi8(e, f, c3);
+        lo = _mm256_unpacklo_epi8(o0, o1);
+        hi = _mm256_unpackhi_epi8(o0, o1);
+        _mm256_storeu_si256((__m256i *)(out[0] + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(out[0] + i * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+        lo = _mm256_unpacklo_epi8(o2, o3);
+        hi = _mm256_unpackhi_epi8(o2, o3);
+        _mm256_storeu_si256((__m256i *)(out[1] + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(out[1] + i * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    for (int r = 0; r < 3; r++)
+        tail[r] = rows[r] + i;
+    tail_out[0] = out[0] + i * 2;
+    tail_out[1] = out[1] + i * 2;
+    corners_sse2(tail, tail_out, n - i, diagonals);
+}
+
+__attribute__((target("avx2")))
+static void scale2x_avx2(const uint8_t *const *rows, uint8_t *const *out, int n)
+{
+    corners_avx2(rows, out, n, false);
+}
+
+__attribute__((target("avx2")))
+static void xbr2x_avx2(const uint8_t *const *rows, uint8_t *const *out, int n)
+{
+    corners_avx2(rows, out, n, true);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(const uint32_t *a, const uint32_t *b, uint32_t *out, int n)
+{
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                            _mm256_loadu_si256((const __m256i *)(b + i))));
+    blend_sse2(a + i, b + i, out + i, n - i);
+}
+#endif
+
+/* best first */
+static const struct pixel_kernels kernel_sets[] = {
+#ifdef PIXEL_X86
+    { "avx2",   decode_tile_avx2,   lookup_avx2,   to_rgba_avx2,   composite_avx2,   delta_avx2,
+      run_avx2,   ntsc_avx2,   scale2x_avx2,   scale3x_ssse3,  xbr2x_avx2,   blend_avx2 },
+    { "ssse3",  decode_tile_ssse3,  lookup_ssse3,  to_rgba_scalar, composite_sse2,   delta_sse2,
+      run_sse2,   ntsc_sse2,   scale2x_sse2,   scale3x_ssse3,  xbr2x_sse2,   blend_sse2 },
+#endif
+    { "scalar", decode_tile_scalar, lookup_scalar, to_rgba_scalar, composite_scalar, delta_scalar,
+      run_scalar, ntsc_scalar, scale2x_scalar, scale3x_scalar, xbr2x_scalar, blend_scalar },
+};
+
+static const struct pixel_kernels *kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static bool is_supported(const struct pixel_kernels *set)
+{
+#ifdef PIXEL_X86
+    __builtin_cpu_init();
+    if (!strcmp(set->name, "avx2"))
+        return __builtin_cpu_supports("avx2");
+    if (!strcmp(set->name, "ssse3"))
+        return __builtin_cpu_supports("ssse3");
+#endif
+    return true;
+}
+
+static void select_best(void)
+{
+    for (int i = 0; !kernels; i++)
+        if (is_supported(&kernel_sets[i]))
+            kernels = &kernel_sets[i];
+}
+
+const struct pixel_kernels *pixel_kernels(void)
+{
+    pthread_once(&kernels_once, select_best);
+    return kernels;
+}
+
+/* a given set(NULL if unknown or unsupported), for tests and benchmarks */
+const struct pixel_kernels *pixel_kernels_by_name(const char *name)
+{
+    for (int i = 0; i < sizeof(kernel_sets) / sizeof(kernel_sets[0]); i++)
+        if (!strcmp(kernel_sets[i].name, name))
+            return (is_supported(&kernel_sets[i])) ? &kernel_sets[i] : NULL;
+    return NULL;
+}
+
+/* force a set for the whole process */
+int pixel_select(const char *name)
+{
+    const struct pixel_kernels *set = pixel_kernels_by_name(name);
+
+    if (!set) {
+        fprintf(stderr, "pixel kernels %s aren't supported\n", name);
+        return 1;
+    }
+    pthread_once(&kernels_once, select_best);
+    kernels = set;
+    return 0;
+}
+
+void pixel_decode_tile(const uint8_t *chr, uint8_t *out, bool flip)
+{
+    pixel_kernels()->decode_tile(chr, out, flip);
+}
+
+void pixel_lookup(const uint8_t *in, const uint8_t *table, uint8_t *out, int n)
+{
+    pixel_kernels()->lookup(in, table, out, n);
+}
+
+void pixel_to_rgba(const uint8_t *in, const uint32_t *lut, uint32_t *out, int n)
+{
+    pixel_kernels()->to_rgba(in, lut, out, n);
+}
+
+int pixel_composite(const uint8_t *bg, const uint8_t *spr, uint8_t *out, int n)
+{
+    return pixel_kernels()->composite(bg, spr, out, n);
+}
+
+void pixel_delta(const uint8_t *cur, uint8_t *prev, uint8_t *out, int n)
+{
+    pixel_kernels()->delta(cur, prev, out, n);
+}
+
+int pixel_run(const uint8_t *in, int n)
+{
+    return pixel_kernels()->run(in, n);
+}
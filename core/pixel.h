@@ -0,0 +1,78 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "common.h"
+
+/* Pixel kernels, the innermost loops of the renderers and viewers. Every
+   set computes the same thing, the best one the CPU supports is picked on
+   first use.
+
+   decode_tile     16 bytes of CHR(2 bitplanes) to 64 pixels(0-3), row by
+                   row, mirrored left to right if flip
+   lookup          n indexes(0-31) through a 32 byte table, e.g. palette
+                   addresses through the palette RAM
+   to_rgba         n colors(0-63) through a 64 entry 32 bit LUT
+   composite       n background pixels(palette address, 0 if clear) under n
+                   sprite pixels(see SPRITE_PIXEL) to palette addresses,
+                   returns the first pixel where sprite 0 hits the
+                   background or -1
+   delta           n bytes of cur XOR prev to out, then cur is copied to prev
+                   (frame deltas, see deltacodec.h)
+   run             the length(1-n) of the run of equal bytes at the start of
+                   n bytes
+   ntsc            n NES pixels to scale(2 or 4) 32 bit pixels each, every
+                   byte the clamped sum >> NTSC_FRAC_BITS of 3 kernel taps:
+                   tap 2 of entries[i], 1 of entries[i + 1], 0 of entries[i
+                   + 2], each tap scale 4 channel outputs(see ntsc.c)
+   scale2x         n pixels of rows[1] to 2x2 pixels each(Scale2x, see
+                   upscale.h) in out[0] and out[1], rows[0] and rows[2]
+                   are the lines above and below, all three readable from
+                   [-1] to [n]
+   scale3x         the same to 3x3 pixels(Scale3x) in out[0-2]
+   xbr2x           the same as scale2x, each output the color to blend
+                   with the center pixel, the center itself if none
+   blend           n 32 bit pixels, every byte the average of a and b
+                   rounded up
+*/
+struct pixel_kernels {
+    const char *name;
+    void (*decode_tile)(const uint8_t *chr, uint8_t *out, bool flip);
+    void (*lookup)(const uint8_t *in, const uint8_t *table, uint8_t *out, int n);
+    void (*to_rgba)(const uint8_t *in, const uint32_t *lut, uint32_t *out, int n);
+    int (*composite)(const uint8_t *bg, const uint8_t *spr, uint8_t *out, int n);
+    void (*delta)(const uint8_t *cur, uint8_t *prev, uint8_t *out, int n);
+    int (*run)(const uint8_t *in, int n);
+    void (*ntsc)(const int16_t *const *entries, int scale, uint32_t *out, int n);
+    void (*scale2x)(const uint8_t *const *rows, uint8_t *const *out, int n);
+    void (*scale3x)(const uint8_t *const *rows, uint8_t *const *out, int n);
+    void (*xbr2x)(const uint8_t *const *rows, uint8_t *const *out, int n);
+    void (*blend)(const uint32_t *a, const uint32_t *b, uint32_t *out, int n);
+};
+
+/* sprite line buffer pixels: bits 0-4 palette address(0 if clear), bit 6
+   behind the background, bit 7 sprite 0 */
+enum SPRITE_PIXEL {
+    BEHIND_BG = 0x40,
+    SPRITE_0 = 0x80,
+};
+
+/* fixed point NTSC kernel channels */
+#define NTSC_FRAC_BITS  4
+
+const struct pixel_kernels *pixel_kernels(void);
+const struct pixel_kernels *pixel_kernels_by_name(const char *name);
+int pixel_select(const char *name);
+
+void pixel_decode_tile(const uint8_t *chr, uint8_t *out, bool flip);
+void pixel_lookup(const uint8_t *in, const uint8_t *table, uint8_t *out, int n);
+void pixel_to_rgba(const uint8_t *in, const uint32_t *lut, uint32_t *out, int n);
+int pixel_composite(const uint8_t *bg, const uint8_t *spr, uint8_t *out, int n);
+void pixel_delta(const uint8_t *cur, uint8_t *prev, uint8_t *out, int n);
+int pixel_run(const uint8_t *in, int n);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,67 @@
+#include "png.h"
+#include "deflate.h"
+#include "inflate.h"
+
+static void put32be(uint8_t *out, uint32_t n)
+{
+    for (int i = 0; i < 4; i++)
+        out[i] = n >> (24 - i * 8);
+}
+
+/* length, type, data and the CRC of type and data */
+static int put_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t size)
+{
+    uint8_t header[8], crc[4];
+
+    put32be(header, size);
+    memcpy(header + 4, type, 4);
+    put32be(crc, inflate_crc32(inflate_crc32(0, header + 4, 4), data, size));
+    return (fwrite(header, sizeof(header), 1, fp) != 1 || (size && fwrite(data, size, 1, fp) != 1) ||
+            fwrite(crc, sizeof(crc), 1, fp) != 1) ? -1 : 0;
+}
+
+int png_write(const char *path, const uint8_t *rgb, int width, int height, int pitch)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    size_t row = 1 + width * 3, raw_size = row * height, size;
+    uint8_t ihdr[13], *raw, *zlib;
+    FILE *fp;
+    int ret = -1;
+
+    raw = malloc(raw_size);
+    zlib = malloc(2 + deflate_bound(raw_size) + 4);
+    if (!raw || !zlib) {
+        fprintf(stderr, "can't allocate a %dx%d PNG\n", width, height);
+        goto out;
+    }
+    // no filter on every row
+    for (int y = 0; y < height; y++) {
+        raw[y * row] = 0;
+        memcpy(raw + y * row + 1, rgb + y * pitch, width * 3);
+    }
+    zlib[0] = 0x78;     /* deflate, 32 KB window */
+    zlib[1] = 0x01;     /* fastest, no dictionary */
+    size = 2 + deflate_raw(raw, raw_size, zlib + 2);
+    put32be(zlib + size, deflate_adler32(1, raw, raw_size));
+    size += 4;
+
+    put32be(ihdr, width);
+    put32be(ihdr + 4, height);
+    ihdr[8] = 8;        /* bit depth */
+    ihdr[9] = 2;        /* RGB */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    if (!(fp = fopen(path, "wb"))) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        goto out;
+    }
+    ret = (fwrite(signature, sizeof(signature), 1, fp) != 1 || put_chunk(fp, "IHDR", ihdr, sizeof(ihdr)) ||
+           put_chunk(fp, "IDAT", zlib, size) || put_chunk(fp, "IEND", NULL, 0)) ? -1 : 0;
+    if (fclose(fp) || ret) {
+        fprintf(stderr, "can't write %s\n", path);
+        ret = -1;
+    }
+out:
+    free(raw);
+    free(zlib);
+    return ret;
+}
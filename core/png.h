@@ -0,0 +1,15 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "common.h"
+
+/* An 8 bit RGB PNG of width x height pixels, 3 bytes each, rows pitch
+   bytes apart. The image data is coded with deflate_raw(). */
+int png_write(const char *path, const uint8_t *rgb, int width, int height, int pitch);
+
+#ifdef __cplusplus
+}
+#endif
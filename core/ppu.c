@@ -1,4 +1,5 @@
 #include "ppu.h"
+#include "ppulog.h"
 
 enum PPU_REGISTERS {
     PPUCTRL = 0x2000,
@@ -19,51 +20,6 @@ enum SCANLINE_STAGE {
     DUMMY_FETCH = 16,
 };
 
-/* Nametable region based on the return value of this function
-   
-   1 -> $2000 - $23ff
-   2 -> $2400 - $27ff
-   4 -> $2800 - $2bff
-   8 -> $2c00 - $2fff
-*/
-static int get_nametable_region(uint16_t addr)
-{
-    return (((addr >= 0x2000 && addr <= 0x23ff) << 0) |
-            ((addr >= 0x2400 && addr <= 0x27ff) << 1) |
-            ((addr >= 0x2800 && addr <= 0x2bff) << 2) |
-            ((addr >= 0x2c00 && addr <= 0x2fff) << 3));
-}
-
-static void vram_io(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
-{
-    switch (nes->cart.info.mirroring) {
-    case HORIZONTAL:
-        if (get_nametable_region(addr) == 1 || get_nametable_region(addr) == 2)
-            addr = (addr & 0x23ff) - 0x2000;
-        else if (get_nametable_region(addr) == 4 || get_nametable_region(addr) == 8)
-            addr = (addr & 0x2bff) - 0x2400;
-        break;
-    case VERTICAL:
-        if (get_nametable_region(addr) == 1 || get_nametable_region(addr) == 3)
-            addr = (addr & 0x23ff) - 0x2000;
-        else if (get_nametable_region(addr) == 2 || get_nametable_region(addr) == 4)
-            addr = (addr & 0x27ff) - 0x2000;
-    default:
-        break;
-    }
-
-    switch (mode) {
-    case READ:
-        nes->ppu.vram[addr] = *val;
-        break;
-    case WRITE:
-        *val = nes->ppu.vram[addr];
-        break; 
-    default:
-        break;
-    }
-}
-
 /* PPU memory map
 
    Address range   | Size    | Description
@@ -77,34 +33,95 @@ static void vram_io(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mod
    $3f00-$3f1f     | $0020   | Palette RAM indexes 
    $3f20-$3fff     | $00e0   | Mirrors of $3f00-$3f1f 
 
+   Everything below $3f00 goes through ppu.page, see ppu_bus_read().
 */
 
-static void mem_io(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
+/* nametable(1 KB of vram) seen in each quadrant of $2000-$2fff */
+static const uint8_t nametable_layout[][4] = {
+    [HORIZONTAL]         = { 0, 0, 1, 1 },
+    [VERTICAL]           = { 0, 1, 0, 1 },
+    [SINGLE_SCREEN_LOW]  = { 0, 0, 0, 0 },
+    [SINGLE_SCREEN_HIGH] = { 1, 1, 1, 1 },
+    [FOUR_SCREEN]        = { 0, 1, 2, 3 },
+};
+
+void ppu_map_nametables(struct nes *nes)
 {
-    addr = (addr >= 0x3000 && addr <= 0x3eff) ? addr & 0x2eff : addr;
-    addr = (addr >= 0x3f20 && addr <= 0x3fff) ? addr & 0x3f1f : addr;
+    const uint8_t *layout = nametable_layout[nes->cart.info.mirroring];
+    uint8_t *page;
 
-    if (addr >= 0x2000 && addr <= 0x2c00) {
-        vram_io(nes, addr, val, mode);
-    } else {
-        switch (mode) {
-        case READ:
-            if (addr >= 0x3f00 && addr <= 0x3f1f) {
-                *val = nes->ppu.mem[addr];
-            } else {
-                *val = nes->ppu.read_buffer;
-                nes->ppu.read_buffer = nes->ppu.mem[addr];
-            }
-            break;
-        case WRITE:
-            nes->ppu.mem[addr] = nes->ppu.io_db = *val;
-            break;
-        default:
-            break;
+    for (int i = 0; i < 4; i++) {
+        page = &nes->ppu.vram[layout[i] * KB];
+        if (nes->ppu.page[8 + i] != page)
+            render_log_pages(nes);
+        nes->ppu.page[8 + i] = page;
+        nes->ppu.page[12 + i] = nes->ppu.page[8 + i];
+    }
+}
+
+/* an attribute byte covers 4x4 tiles, 2x2 per palette select */
+void ppu_update_attr_cache(struct ppu *ppu, int nametable, int offset)
+{
+    uint8_t attr = ppu->vram[nametable * KB + offset];
+    int x = (offset & 0x07) * 4, y = ((offset >> 3) & 0x07) * 4, shift;
+
+    for (int row = y; row < y + 4; row++) {
+        for (int col = x; col < x + 4; col++) {
+            shift = ((row & 0x02) << 1) | (col & 0x02);
+            ppu->attr_cache[nametable][row * 32 + col] = ((attr >> shift) & 0x03) << 2;
         }
     }
 }
 
+void ppu_build_attr_cache(struct ppu *ppu)
+{
+    for (int nametable = 0; nametable < 4; nametable++)
+        for (int offset = 0x3c0; offset < 0x400; offset++)
+            ppu_update_attr_cache(ppu, nametable, offset);
+}
+
+static uint8_t mem_read(struct nes *nes, uint16_t addr)
+{
+    addr &= 0x3fff;
+    if (addr >= 0x3f00)
+        return nes->ppu.palette[ppu_palette_index(addr)];
+    return ppu_bus_read(&nes->ppu, addr);
+}
+
+static void mem_write(struct nes *nes, uint16_t addr, uint8_t val)
+{
+    int nametable;
+
+    addr &= 0x3fff;
+    if (addr >= 0x3f00) {
+        nes->ppu.palette[ppu_palette_index(addr)] = val & 0x3f;
+        nes->ppu.palette_version++;
+        nes->ppu.view_dirty.palette = true;
+        if (nes->ppu.render_thread)
+            render_thread_write(&nes->ppu, RENDER_WRITE_PALETTE, ppu_palette_index(addr), val & 0x3f);
+    } else if (addr >= 0x2000) {
+        nes->ppu.page[addr >> 10][addr & 0x3ff] = val;
+        nametable = (nes->ppu.page[addr >> 10] - nes->ppu.vram) >> 10;
+        if ((addr & 0x3ff) >= 0x3c0) {
+            ppu_update_attr_cache(&nes->ppu, nametable, addr & 0x3ff);
+            // an attribute byte covers 4 tile rows
+            nes->ppu.view_dirty.vram_rows[nametable] |= (0x0fU << (((addr & 0x3ff) - 0x3c0) / 8 * 4)) &
+                                                        0x3fffffff;
+        } else {
+            nes->ppu.view_dirty.vram_rows[nametable] |= 1U << ((addr & 0x3ff) / 32);
+        }
+        if (nes->ppu.render_thread)
+            render_thread_write(&nes->ppu, RENDER_WRITE_VRAM,
+                                nes->ppu.page[addr >> 10] - nes->ppu.vram + (addr & 0x3ff), val);
+    } else if (nes->cart.chr_ram) {
+        nes->ppu.page[addr >> 10][addr & 0x3ff] = val;
+        tilecache_invalidate_tile(&nes->ppu, addr);
+        if (nes->ppu.render_thread)
+            render_thread_write(&nes->ppu, RENDER_WRITE_CHR,
+                                nes->ppu.page[addr >> 10] - nes->cart.chr_rom + (addr & 0x3ff), val);
+    }
+}
+
 void ppu_read(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
 {
     switch (addr) {
@@ -113,12 +130,22 @@ void ppu_read(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
                             ((uint8_t)nes->ppu.nmi_occured << 7);
         nes->ppu.w = 0;
         nes->ppu.nmi_occured = false;
+        nes->cpu.nmi = 1;
         break;
     case OAMDATA:
         nes->ppu.io_db = nes->ppu.oam[nes->ppu.oamaddr];
         break;
     case PPUDATA:
-        mem_io(nes, nes->ppu.v, &nes->ppu.io_db, READ);
+        mapper_ppu_addr(nes, nes->ppu.v);
+        // palette reads aren't buffered, the buffer gets the nametable
+        // byte "under" the palette instead
+        if ((nes->ppu.v & 0x3fff) >= 0x3f00) {
+            nes->ppu.io_db = (nes->ppu.io_db & 0xc0) | mem_read(nes, nes->ppu.v);
+            nes->ppu.read_buffer = ppu_bus_read(&nes->ppu, nes->ppu.v & 0x2fff);
+        } else {
+            nes->ppu.io_db = nes->ppu.read_buffer;
+            nes->ppu.read_buffer = mem_read(nes, nes->ppu.v);
+        }
         nes->ppu.v += (nes->ppu.I) ? 32 : 1;
         break;
     default:
@@ -132,19 +159,25 @@ void ppu_write(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
     case PPUCTRL:
         nes->ppu.ppuctrl = nes->ppu.io_db = *val;
         nes->ppu.nmi_output = nes->ppu.ppuctrl & 0x80;
-        if (nes->ppu.nmi_occured && nes->ppu.nmi_output)
-            nes->cpu.nmi = 0;
+        // the NMI line is low while both are set
+        nes->cpu.nmi = !(nes->ppu.nmi_occured && nes->ppu.nmi_output);
 
         nes->ppu.t = (nes->ppu.t & 0x73ff) | ((uint16_t)(*val & 0x03) << 10);
+        render_log_write(nes, false);
         break;
     case PPUMASK:
         nes->ppu.ppumask = nes->ppu.io_db = *val; 
+        render_log_write(nes, false);
         break;
     case OAMADDR:
         nes->ppu.oamaddr = nes->ppu.io_db = *val;
         break;
     case OAMDATA:
+        if (nes->ppu.render_thread)
+            render_thread_write(&nes->ppu, RENDER_WRITE_OAM, nes->ppu.oamaddr, *val);
         nes->ppu.oam[nes->ppu.oamaddr++] = nes->ppu.io_db = *val;
+        nes->ppu.sprite_index.dirty = true;
+        nes->ppu.view_dirty.oam = true;
         break;
     case PPUSCROLL:
         if (!nes->ppu.w) {
@@ -157,6 +190,7 @@ void ppu_write(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
             nes->ppu.w = 0;
         }
         nes->ppu.io_db = *val;
+        render_log_write(nes, false);
         break;
     case PPUADDR:
         if (!nes->ppu.w) {
@@ -166,11 +200,15 @@ void ppu_write(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
             nes->ppu.t = (nes->ppu.t & 0x7f00) | (uint16_t)(*val);
             nes->ppu.v = nes->ppu.t;
             nes->ppu.w = 0;
+            mapper_ppu_addr(nes, nes->ppu.v);
+            render_log_write(nes, true);
         }
         nes->ppu.io_db = *val;
         break;
     case PPUDATA:
-        mem_io(nes, nes->ppu.v, val, WRITE);
+        mapper_ppu_addr(nes, nes->ppu.v);
+        mem_write(nes, nes->ppu.v, *val);
+        nes->ppu.io_db = *val;
         nes->ppu.v += (!nes->ppu.I) ? 1 : 32;
         break;
     default:
@@ -187,42 +225,368 @@ void (*callback[])(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode
 void ppu_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode)
 {
     addr &= 0x2007;
+    if (nes->ppu_log)
+        ppulog_access(nes->ppu_log, nes->ppu.clock, addr, *val, mode);
     callback[mode](nes, addr, val, mode);
     *val = nes->ppu.io_db;
 }
 
+/* stage of every dot, one load instead of a chain of compares per tick */
+static const uint8_t cycle_stage[341] = {
+    [0]          = IDLE,
+    [1 ... 256]  = GET_TILE_DATA,
+    [257 ... 320] = GET_SPRITE_DATA,
+    [321 ... 336] = GET_TWO_TILES_NEXT_LINE,
+    [337 ... 340] = DUMMY_FETCH,
+};
+
 static int get_cycle_stage(int cycles)
 {
-    return (((!cycles) << 0) |
-           ((cycles >= 1 && cycles <= 256) << 1) |
-           ((cycles >= 257 && cycles <= 320) << 2) |
-           ((cycles >= 321 && cycles <= 336) << 3) |
-           ((cycles >= 337 && cycles <= 340) << 4));
+    return cycle_stage[cycles];
+}
+
+static void increment_y(struct nes *nes)
+{
+    uint16_t v = nes->ppu.v;
+
+    if ((v & 0x7000) != 0x7000) {
+        v += 0x1000;
+    } else {
+        v &= ~0x7000;
+        if ((v & 0x03e0) == 29 << 5)
+            v = (v & ~0x03e0) ^ 0x0800;
+        else if ((v & 0x03e0) == 31 << 5)
+            v &= ~0x03e0;
+        else
+            v += 0x20;
+    }
+    nes->ppu.v = v;
+}
+
+static bool is_rendering(struct nes *nes)
+{
+    return (nes->ppu.ppumask & 0x18) && (nes->ppu.scanlines < 240 || nes->ppu.scanlines == 261);
+}
+
+/* Bucket the sprites by the lines they cover(a sprite at Y shows on lines
+   Y+1..Y+height), instead of scanning the 64 of them on every line.
+*/
+void ppu_build_sprite_index(struct ppu *ppu)
+{
+    struct sprite_index *index = &ppu->sprite_index;
+    int height = (ppu->H) ? 16 : 8, line;
+
+    memset(index->count, 0, sizeof(index->count));
+    memset(index->overflow, 0, sizeof(index->overflow));
+    for (int i = 0; i < 64; i++) {
+        for (line = ppu->oam[i * 4] + 1; line <= ppu->oam[i * 4] + height && line < 256; line++) {
+            if (index->count[line] < 8)
+                index->oam[line][index->count[line]++] = i;
+            else
+                index->overflow[line] = true;
+        }
+    }
+    index->height = height;
+    index->dirty = false;
+}
+
+/* Fill the secondary OAM with the first 8 sprites of the next line, a 9th
+   one sets the overflow flag(without the hardware's diagonal scan bug).
+*/
+static void evaluate_sprites(struct nes *nes)
+{
+    const uint8_t *sprites;
+    int n = 0, line = nes->ppu.scanlines + 1;
+
+    memset(nes->ppu.oam2, 0xff, sizeof(nes->ppu.oam2));
+    nes->ppu.oam2_count = 0;
+    nes->ppu.sprite0_next = false;
+    // only the visible lines evaluate, the sprite index ends at line 255
+    if (nes->ppu.scanlines >= 240)
+        return;
+    sprites = ppu_sprites_on_line(&nes->ppu, line, &n);
+    for (int i = 0; i < n; i++)
+        memcpy(&nes->ppu.oam2[4 * i], &nes->ppu.oam[sprites[i] * 4], 4);
+    if (nes->ppu.sprite_index.overflow[line] && (nes->ppu.ppumask & 0x18))
+        nes->ppu.O = 1;
+    nes->ppu.sprite0_next = n && !sprites[0];
+    nes->ppu.oam2_count = n;
+}
+
+/* The scanline renderer's sprite evaluation: only the overflow flag of the
+   next line, set like evaluate_sprites() does while rendering is on */
+static void evaluate_overflow(struct nes *nes)
+{
+    int n, line = nes->ppu.scanlines + 1;
+
+    if (nes->ppu.scanlines >= 240 || !(nes->ppu.ppumask & 0x18))
+        return;
+    ppu_sprites_on_line(&nes->ppu, line, &n);
+    if (nes->ppu.sprite_index.overflow[line])
+        nes->ppu.O = 1;
+}
+
+/* Report A12 of the fetch started on this(odd) dot to the mapper.
+
+   dots 1-256, 321-340: NT, AT, pattern low, pattern high(background)
+   dots 257-320:        two garbage NT fetches, pattern low/high(sprites)
+
+   The dot renderer reports its real fetch addresses instead.
+*/
+static void report_a12(struct nes *nes)
+{
+    int cycles = nes->ppu.cycles;
+    uint8_t a12, tile;
+
+    if (cycles >= 257 && cycles <= 320) {
+        tile = nes->ppu.oam2[((cycles - 257) >> 3) * 4 + 1];
+        if (((cycles - 257) & 0x07) < 4)
+            a12 = 0;
+        else
+            a12 = (nes->ppu.H) ? tile & 0x01 : nes->ppu.S;
+    } else {
+        a12 = ((cycles & 0x07) >= 5) ? nes->ppu.BG : 0;
+    }
+    mapper_ppu_addr(nes, (uint16_t)a12 << 12);
+}
+
+static uint8_t fetch(struct nes *nes, uint16_t addr)
+{
+    if (nes->ppu.a12_watch)
+        mapper_ppu_addr(nes, addr);
+    return ppu_bus_read(&nes->ppu, addr);
+}
+
+/* One dot of the background pipeline(dots 1-256, 321-336). The registers
+   shift on every dot, and every 8 dots: reload of the low byte, NT, AT,
+   pattern low and high fetches, coarse X increment. The first tile of a
+   line is reloaded on dot 1 rather than 337, it's the same latch.
+*/
+static void background_step(struct nes *nes)
+{
+    struct ppu *ppu = &nes->ppu;
+    uint16_t v = ppu->v, addr;
+
+    ppu->bg_lo <<= 1;
+    ppu->bg_hi <<= 1;
+    ppu->at_lo <<= 1;
+    ppu->at_hi <<= 1;
+    switch ((ppu->cycles - 1) & 0x07) {
+    case 0:
+        ppu->bg_lo = (ppu->bg_lo & 0xff00) | ppu->pt_lo_latch;
+        ppu->bg_hi = (ppu->bg_hi & 0xff00) | ppu->pt_hi_latch;
+        ppu->at_lo = (ppu->at_lo & 0xff00) | (0xff * (ppu->at_latch & 0x01));
+        ppu->at_hi = (ppu->at_hi & 0xff00) | (0xff * (ppu->at_latch >> 1));
+        ppu->nt_latch = fetch(nes, 0x2000 | (v & 0x0fff));
+        break;
+    case 2:
+        ppu->at_latch = fetch(nes, 0x23c0 | (v & 0x0c00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+        ppu->at_latch = (ppu->at_latch >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03;
+        break;
+    case 4:
+        addr = ((uint16_t)ppu->BG << 12) | ((uint16_t)ppu->nt_latch << 4) | (v >> 12);
+        ppu->pt_lo_latch = fetch(nes, addr);
+        break;
+    case 6:
+        addr = ((uint16_t)ppu->BG << 12) | ((uint16_t)ppu->nt_latch << 4) | (v >> 12);
+        ppu->pt_hi_latch = fetch(nes, addr + 8);
+        break;
+    case 7:
+        ppu->v = ppu_increment_x(v);
+        break;
+    default:
+        break;
+    }
+}
+
+static uint8_t flip_byte(uint8_t b)
+{
+    b = (b >> 4) | (b << 4);
+    b = ((b & 0xcc) >> 2) | ((b & 0x33) << 2);
+    return ((b & 0xaa) >> 1) | ((b & 0x55) << 1);
+}
+
+/* One dot of the sprite fetches(dots 257-320), slot n on dots 257+8n..:
+   two garbage NT fetches, then the pattern of the n-th sprite of oam2.
+   Empty slots fetch tile $ff.
+*/
+static void sprite_step(struct nes *nes)
+{
+    struct ppu *ppu = &nes->ppu;
+    int slot = (ppu->cycles - 257) >> 3;
+    const uint8_t *sprite = &ppu->oam2[slot * 4];
+    struct sprite_unit *unit = &ppu->sprite_units[slot];
+    int row = (ppu->scanlines - sprite[0]) & 0x0f;
+    uint16_t addr;
+
+    if (slot < ppu->oam2_count && (sprite[2] & 0x80))
+        row = ((ppu->H) ? 15 : 7) - row;
+    if (ppu->H)
+        addr = ((uint16_t)(sprite[1] & 0x01) << 12) | ((uint16_t)(sprite[1] & 0xfe) << 4) |
+               ((row & 0x08) << 1) | (row & 0x07);
+    else
+        addr = ((uint16_t)ppu->S << 12) | ((uint16_t)sprite[1] << 4) | (row & 0x07);
+
+    switch ((ppu->cycles - 257) & 0x07) {
+    case 0:
+    case 2:
+        fetch(nes, 0x2000 | (ppu->v & 0x0fff));
+        break;
+    case 4:
+        unit->lo = fetch(nes, addr);
+        break;
+    case 6:
+        unit->hi = fetch(nes, addr + 8);
+        if (sprite[2] & 0x40) {
+            unit->lo = flip_byte(unit->lo);
+            unit->hi = flip_byte(unit->hi);
+        }
+        unit->attr = (sprite[2] & 0xe3) | ((!slot && ppu->sprite0_next) ? 0x04 : 0);
+        unit->x = sprite[3];
+        if (ppu->cycles == 319)
+            ppu->sprite_count = ppu->oam2_count;
+        break;
+    default:
+        break;
+    }
+}
+
+/* output the pixel of this dot(dots 1-256 of the visible lines) */
+static void render_dot(struct nes *nes)
+{
+    struct ppu *ppu = &nes->ppu;
+    int x = ppu->cycles - 1, fine = ppu->x;
+    uint8_t mask = ppu->ppumask, bg = 0, spr = 0, color;
+    struct sprite_unit *unit;
+    int offset;
+    bool behind = false, video = ppu->framebuffer && !ppu->frame_no_video;
+
+    // without video only a sprite 0 hit matters
+    if (!video && (ppu->SPR || !ppu->sprite_count || !(ppu->sprite_units[0].attr & 0x04)))
+        return;
+    if (!(mask & 0x18)) {
+        // rendering off: backdrop, or the palette entry v points to
+        color = ((ppu->v & 0x3f00) == 0x3f00) ? ppu_palette_index(ppu->v) : 0;
+        goto output;
+    }
+    if ((mask & 0x08) && (x >= 8 || (mask & 0x02))) {
+        bg = (((ppu->bg_lo << fine) >> 15) & 0x01) | (((ppu->bg_hi << fine) >> 14) & 0x02);
+        bg |= ((((ppu->at_lo << fine) >> 15) & 0x01) | (((ppu->at_hi << fine) >> 14) & 0x02)) << 2;
+        bg &= -(uint8_t)((bg & 0x03) != 0);
+    }
+    if ((mask & 0x10) && (x >= 8 || (mask & 0x04))) {
+        for (int i = 0; i < ppu->sprite_count; i++) {
+            unit = &ppu->sprite_units[i];
+            // a sprite at X 249-255 doesn't wrap around to the left edge
+            offset = x - unit->x;
+            if (offset < 0 || offset >= 8)
+                continue;
+            spr = ((unit->lo >> (7 - offset)) & 0x01) | (((unit->hi >> (7 - offset)) & 0x01) << 1);
+            if (!spr)
+                continue;
+            if ((unit->attr & 0x04) && bg && x != 255)
+                ppu->SPR = 1;
+            spr |= 0x10 | ((unit->attr & 0x03) << 2);
+            behind = unit->attr & 0x20;
+            break;
+        }
+    }
+    color = (spr && (!behind || !bg)) ? spr : bg;
+
+output:
+    if (video) {
+        color = ppu->palette[color] & ((mask & 0x01) ? 0x30 : 0x3f);
+        palette_put(&ppu->lut, color, mask >> 5, ppu->framebuffer, ppu->scanlines * SCREEN_WIDTH + x);
+        ppu->emphasis[ppu->scanlines] = mask >> 5;
+        ppu->dot_line[x] = color;
+        if (x == 255)
+            render_line_done(ppu, ppu->dot_line);
+    }
 }
 
 void ppu_tick(struct nes *nes)
 {
+    bool scanline_mode = nes->ppu.render_mode == RENDER_SCANLINE;
+    bool rendering = is_rendering(nes);
+
     switch (get_cycle_stage(nes->ppu.cycles)) {
     case IDLE:
+        if (scanline_mode && nes->ppu.scanlines < 240)
+            render_line_start(nes);
         break;
     case GET_TILE_DATA:
         if (nes->ppu.cycles == 1 && nes->ppu.scanlines == 241) {
             nes->ppu.VBL = 1;
             nes->ppu.nmi_occured = true;
+            nes->cpu.nmi = !nes->ppu.nmi_output;
+            nes->ppu.frames++;
+            render_frame_done(&nes->ppu);
+            if (nes->ppu_log)
+                ppulog_frame(nes->ppu_log, nes->ppu.frame_hash);
+            if (nes->cart.save_dirty)
+                cart_sync(nes, false);
         } else if (nes->ppu.cycles == 1 && nes->ppu.scanlines == 261) {
             nes->ppu.VBL = 0;
+            nes->ppu.SPR = 0;
+            nes->ppu.O = 0;
             nes->ppu.nmi_occured = false;
+            nes->cpu.nmi = 1;
+            nes->ppu.frame_no_video = nes->ppu.no_video;
+        }
+        if (!scanline_mode) {
+            if (rendering)
+                background_step(nes);
+            if (nes->ppu.scanlines < 240)
+                render_dot(nes);
+        } else if (nes->ppu.cycles == nes->ppu.sprite0_dot && nes->ppu.scanlines < 240) {
+            nes->ppu.SPR = 1;
+        }
+        if (nes->ppu.cycles == 256) {
+            if (scanline_mode && nes->ppu.scanlines < 240)
+                render_scanline(nes);
+            if (rendering)
+                increment_y(nes);
         }
         break;
     case GET_SPRITE_DATA:
+        if (nes->ppu.cycles == 257) {
+            if (!scanline_mode || (nes->ppu.a12_watch && nes->ppu.H))
+                evaluate_sprites(nes);
+            else
+                evaluate_overflow(nes);
+            nes->ppu.sprite_count = 0;
+        }
+        if (!rendering)
+            break;
+        // horizontal position from t, and on the pre-render line the
+        // vertical one too(dots 280-304, the last copy wins)
+        if (nes->ppu.cycles == 257)
+            nes->ppu.v = (nes->ppu.v & 0x7be0) | (nes->ppu.t & 0x041f);
+        else if (nes->ppu.cycles == 304 && nes->ppu.scanlines == 261) {
+            nes->ppu.v = (nes->ppu.v & 0x041f) | (nes->ppu.t & 0x7be0);
+            nes->ppu.frame_scroll_v = nes->ppu.v;
+            nes->ppu.frame_scroll_x = nes->ppu.x;
+        }
+        if (!scanline_mode)
+            sprite_step(nes);
         break;
     case GET_TWO_TILES_NEXT_LINE:
+        if (!scanline_mode && rendering)
+            background_step(nes);
         break;
     case DUMMY_FETCH:
-        break; 
+        if (!scanline_mode && rendering && (nes->ppu.cycles & 0x01))
+            fetch(nes, 0x2000 | (nes->ppu.v & 0x0fff));
+        break;
     default:
         break;
     }
+    if (nes->ppu.cycles == nes->ppu.event_cycle)
+        mapper_ppu_event(nes);
+    if (nes->ppu.a12_watch && scanline_mode && (nes->ppu.cycles & 0x01) && rendering)
+        report_a12(nes);
+
+    nes->ppu.clock++;
     if (nes->ppu.cycles == 340) {
         if (nes->ppu.scanlines == 261) {
             nes->ppu.scanlines = 0;
@@ -230,13 +594,86 @@ void ppu_tick(struct nes *nes)
             nes->ppu.scanlines++;
         }
         nes->ppu.cycles = 0;
+        mapper_scanline(nes);
     } else {
         nes->ppu.cycles++;
     }
 }
 
+/* the next dot from each one on which the scanline mode has work: line
+   start, vblank flags, the line drawn, sprite evaluation and the copies of
+   t, the end of the line */
+static const uint16_t next_event[341] = {
+    [0]           = 0,
+    [1]           = 1,
+    [2 ... 256]   = 256,
+    [257]         = 257,
+    [258 ... 304] = 304,
+    [305 ... 340] = 340,
+};
+
+/* Dots from the current one on that ppu_tick() would only count, 0 if it
+   has work to do on this one. Only in scanline mode, while the mapper
+   doesn't watch the pattern fetches. */
+static int quiet_dots(const struct ppu *ppu)
+{
+    int cycles = ppu->cycles, next = next_event[cycles];
+
+    if (ppu->render_mode != RENDER_SCANLINE || ppu->a12_watch)
+        return 0;
+    if (ppu->sprite0_dot >= cycles && ppu->sprite0_dot < next)
+        next = ppu->sprite0_dot;
+    if (ppu->event_cycle >= cycles && ppu->event_cycle < next)
+        next = ppu->event_cycle;
+    return next - cycles;
+}
+
+/* Runs the PPU for some dots, the ones with nothing to do in scanline mode
+   are skipped in one go. */
+void ppu_run(struct nes *nes, int dots)
+{
+    int n;
+
+    while (dots > 0) {
+        n = quiet_dots(&nes->ppu);
+        if (!n) {
+            ppu_tick(nes);
+            dots--;
+            continue;
+        }
+        if (n > dots)
+            n = dots;
+        nes->ppu.cycles += n;
+        nes->ppu.clock += n;
+        dots -= n;
+    }
+}
+
 void ppu_at_power_up(struct nes *nes)
 {
     nes->ppu.cycles = 0;
     nes->ppu.scanlines = 0;
+    nes->ppu.clock = 0;
+    nes->ppu.event_cycle = -1;
+    nes->ppu.a12_watch = false;
+    nes->ppu.render_mode = RENDER_SCANLINE;
+    nes->ppu.framebuffer = NULL;
+    nes->ppu.render_thread = NULL;
+    nes->ppu_log = NULL;
+    nes->ppu.no_video = false;
+    nes->ppu.frame_no_video = false;
+    palette_reset(&nes->ppu.lut, PIXEL_INDEXED8);
+    memset(nes->ppu.emphasis, 0, sizeof(nes->ppu.emphasis));
+    nes->ppu.frame_hash = 0;
+    nes->ppu.dirty_bands = 0;
+    nes->ppu.frame_scroll_v = 0;
+    nes->ppu.frame_scroll_x = 0;
+    memset(&nes->ppu.view_dirty, 0, sizeof(nes->ppu.view_dirty));
+    nes->ppu.hash_next = 0;
+    nes->ppu.dirty_next = (1 << (SCREEN_HEIGHT / DIRTY_BAND_LINES)) - 1;  // the first frame is new
+    nes->ppu.frames = 0;
+    nes->ppu.write_log_len = 0;
+    nes->ppu.sprite_count = 0;
+    nes->ppu.sprite_index.dirty = true;
+    ppu_build_attr_cache(&nes->ppu);
 }
\ No newline at end of file
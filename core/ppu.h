@@ -5,9 +5,55 @@ extern "C" {
 #endif
 
 #include "nes.h"
+#include "mapper.h"
+#include "cart.h"
+#include "renderer.h"
+#include "tilecache.h"
+#include "palette.h"
+#include "renderthread.h"
+
+/* one shift, one index and one load, valid for $0000-$3eff */
+static inline uint8_t ppu_bus_read(struct ppu *ppu, uint16_t addr)
+{
+    return ppu->page[addr >> 10][addr & 0x3ff];
+}
+
+/* $3f10/$3f14/$3f18/$3f1c are mirrors of $3f00/$3f04/$3f08/$3f0c */
+static inline uint8_t ppu_palette_index(uint16_t addr)
+{
+    addr &= 0x1f;
+    return ((addr & 0x13) == 0x10) ? addr & 0x0f : addr;
+}
+
+/* next tile of v, wrapping into the horizontally adjacent nametable */
+static inline uint16_t ppu_increment_x(uint16_t v)
+{
+    return ((v & 0x001f) == 0x001f) ? (v & ~0x001f) ^ 0x0400 : v + 1;
+}
+
+/* palette select of the tile v points to, same as the attribute fetch */
+static inline uint8_t ppu_attr_bits(const struct ppu *ppu, uint16_t v)
+{
+    return ppu->attr_cache[(ppu->page[8 + ((v >> 10) & 0x03)] - ppu->vram) >> 10][v & 0x3ff];
+}
+
+void ppu_update_attr_cache(struct ppu *ppu, int nametable, int offset);
+void ppu_build_attr_cache(struct ppu *ppu);
+void ppu_build_sprite_index(struct ppu *ppu);
+
+/* OAM indexes of the sprites on a line, count is at most 8 */
+static inline const uint8_t *ppu_sprites_on_line(struct ppu *ppu, int line, int *count)
+{
+    if (ppu->sprite_index.dirty || ppu->sprite_index.height != ((ppu->H) ? 16 : 8))
+        ppu_build_sprite_index(ppu);
+    *count = ppu->sprite_index.count[line];
+    return ppu->sprite_index.oam[line];
+}
 
 void ppu_rw(struct nes *nes, uint16_t addr, uint8_t *val, mem_mode_t mode);
+void ppu_map_nametables(struct nes *nes);
 void ppu_tick(struct nes *nes);
+void ppu_run(struct nes *nes, int dots);
 void ppu_at_power_up(struct nes *nes);
 
 #ifdef __cplusplus
@@ -0,0 +1,283 @@
+#include "ppulog.h"
+#include "ppu.h"
+#include "cart.h"
+#include "inflate.h"
+
+#define PPULOG_VERSION  1
+
+enum PPU_REGISTERS {
+    PPUSTATUS = 0x2002,
+    OAMDATA = 0x2004,
+    PPUDATA = 0x2007,
+};
+
+struct ppu_log {
+    FILE *fp;
+    const char *path;
+    uint64_t clock;             /* the dot of the last record */
+
+    /* the OAM DMA being logged: its dot and the OAMDATA writes so far */
+    uint64_t dma_clock;
+    int dma_bytes;
+    uint8_t dma_data[256];
+};
+
+uint32_t ppulog_rom_crc(const struct cart *cart)
+{
+    uint32_t crc = inflate_crc32(0, cart->prg_rom, cart->info.prg_size);
+
+    return (cart->chr_ram) ? crc : inflate_crc32(crc, cart->chr_rom, cart->info.chr_size);
+}
+
+static void put_record(struct ppu_log *log, uint8_t type, uint64_t clock)
+{
+    uint64_t delta = clock - log->clock;
+
+    putc(type, log->fp);
+    do {
+        putc((delta & 0x7f) | ((delta > 0x7f) ? 0x80 : 0), log->fp);
+        delta >>= 7;
+    } while (delta);
+    log->clock = clock;
+}
+
+/* at power up, with the cart loaded */
+struct ppu_log *ppulog_open(const char *path, const struct nes *nes)
+{
+    struct ppu_log *log;
+    uint32_t crc = ppulog_rom_crc(&nes->cart);
+    uint8_t header[PPULOG_HEADER_SIZE] = { 'N', 'E', 'S', 'P', PPULOG_VERSION,
+                                          crc, crc >> 8, crc >> 16, crc >> 24 };
+
+    if (!(log = calloc(1, sizeof(*log)))) {
+        fprintf(stderr, "can't allocate a PPU log for %s\n", path);
+        return NULL;
+    }
+    log->path = path;
+    log->dma_bytes = 256;
+    if (!(log->fp = fopen(path, "wb")) || fwrite(header, sizeof(header), 1, log->fp) != 1) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        if (log->fp)
+            fclose(log->fp);
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+/* only the reads that change something: PPUSTATUS clears the w latch and
+   vblank, PPUDATA moves v and the read buffer */
+void ppulog_access(struct ppu_log *log, uint64_t clock, uint16_t addr, uint8_t val, mem_mode_t mode)
+{
+    addr &= 0x07;
+    if (log->dma_bytes < 256 && mode == WRITE && addr == (OAMDATA & 0x07)) {
+        log->dma_data[log->dma_bytes++] = val;
+        if (log->dma_bytes == 256) {
+            put_record(log, PPULOG_OAM_DMA, log->dma_clock);
+            fwrite(log->dma_data, 256, 1, log->fp);
+        }
+    } else if (mode == WRITE) {
+        put_record(log, PPULOG_WRITE | addr, clock);
+        putc(val, log->fp);
+    } else if (addr == (PPUSTATUS & 0x07) || addr == (PPUDATA & 0x07)) {
+        put_record(log, PPULOG_READ | addr, clock);
+    }
+}
+
+/* The record is written with the last of the 256 OAMDATA writes that
+   follow, the CPU is halted in between. The vblanks on the way are written
+   before it, they have no dot. */
+void ppulog_oam_dma(struct ppu_log *log, uint64_t clock)
+{
+    log->dma_clock = clock;
+    log->dma_bytes = 0;
+}
+
+void ppulog_mapper(struct ppu_log *log, uint64_t clock, uint16_t addr, uint8_t val)
+{
+    put_record(log, PPULOG_MAPPER, clock);
+    putc(addr & 0xff, log->fp);
+    putc(addr >> 8, log->fp);
+    putc(val, log->fp);
+}
+
+void ppulog_frame(struct ppu_log *log, uint64_t hash)
+{
+    putc(PPULOG_FRAME, log->fp);
+    for (int i = 0; i < 8; i++)
+        putc(hash >> (i * 8), log->fp);
+}
+
+int ppulog_close(struct ppu_log *log, uint64_t clock)
+{
+    int ret;
+
+    put_record(log, PPULOG_END, clock);
+    ret = (ferror(log->fp) | fclose(log->fp)) ? -1 : 0;
+    if (ret)
+        fprintf(stderr, "Failed to write %s\n", log->path);
+    free(log);
+    return ret;
+}
+
+static size_t payload_size(int type)
+{
+    switch (type) {
+    case PPULOG_OAM_DMA:
+        return 256;
+    case PPULOG_MAPPER:
+        return 3;
+    case PPULOG_FRAME:
+        return 8;
+    case PPULOG_END:
+        return 0;
+    default:
+        return type < PPULOG_READ;
+    }
+}
+
+/* the record at data[*pos]: its type and dot, *pos moved to its payload,
+   -1 past the end or if it's cut short */
+static int next_record(const uint8_t *data, size_t size, size_t *pos, uint64_t *clock)
+{
+    uint64_t delta = 0;
+    uint8_t type;
+    int shift = 0;
+
+    if (*pos >= size)
+        return -1;
+    type = data[(*pos)++];
+    if (type > PPULOG_END || (type & 0x0f) > 7 || ((type & 0x0f) && type > PPULOG_READ + 7))
+        return -1;
+    if (type != PPULOG_FRAME) {
+        do {
+            if (*pos >= size || shift > 63)
+                return -1;
+            delta |= (uint64_t)(data[*pos] & 0x7f) << shift;
+            shift += 7;
+        } while (data[(*pos)++] & 0x80);
+        *clock += delta;
+    }
+    return (size - *pos < payload_size(type)) ? -1 : type;
+}
+
+/* Reads the whole log and checks every record. */
+int ppulog_load(struct ppu_replay *replay, const char *path)
+{
+    FILE *fp;
+    long size;
+    size_t pos = PPULOG_HEADER_SIZE;
+    uint64_t clock = 0, *hashes;
+    int type;
+
+    memset(replay, 0, sizeof(*replay));
+    if (!(fp = fopen(path, "rb"))) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return -1;
+    }
+    if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < PPULOG_HEADER_SIZE || fseek(fp, 0, SEEK_SET) ||
+        !(replay->data = malloc(size)) || fread(replay->data, size, 1, fp) != 1 ||
+        memcmp(replay->data, "NESP", 4) || replay->data[4] != PPULOG_VERSION) {
+        fprintf(stderr, "%s isn't a version %d .nesp file\n", path, PPULOG_VERSION);
+        fclose(fp);
+        ppulog_free(replay);
+        return -1;
+    }
+    fclose(fp);
+    replay->size = size;
+    replay->rom_crc = replay->data[5] | (replay->data[6] << 8) | (replay->data[7] << 16) |
+                      ((uint32_t)replay->data[8] << 24);
+
+    while ((type = next_record(replay->data, replay->size, &pos, &clock)) >= 0 && type != PPULOG_END) {
+        if (type == PPULOG_FRAME) {
+            // room for 1, 3, 7, 15... hashes
+            if (!(replay->frames & (replay->frames + 1))) {
+                if (!(hashes = realloc(replay->hashes, (replay->frames * 2 + 1) * sizeof(*hashes)))) {
+                    fprintf(stderr, "can't allocate the frame hashes of %s\n", path);
+                    ppulog_free(replay);
+                    return -1;
+                }
+                replay->hashes = hashes;
+            }
+            replay->hashes[replay->frames] = 0;
+            for (int i = 0; i < 8; i++)
+                replay->hashes[replay->frames] |= (uint64_t)replay->data[pos + i] << (i * 8);
+            replay->frames++;
+        } else {
+            replay->accesses++;
+        }
+        pos += payload_size(type);
+    }
+    if (type != PPULOG_END) {
+        fprintf(stderr, "%s is corrupted at byte %zu\n", path, pos);
+        ppulog_free(replay);
+        return -1;
+    }
+    replay->dots = clock;
+    return 0;
+}
+
+void ppulog_free(struct ppu_replay *replay)
+{
+    free(replay->data);
+    free(replay->hashes);
+    memset(replay, 0, sizeof(*replay));
+}
+
+/* runs up to a dot, checking the hash of every vblank on the way: a line
+   at a time at most, there's never more than one vblank in between */
+static void run_to(struct nes *nes, const struct ppu_replay *replay, uint64_t clock, int64_t *mismatch)
+{
+    uint64_t frames = nes->ppu.frames;
+
+    while (nes->ppu.clock < clock) {
+        ppu_run(nes, (clock - nes->ppu.clock < 341) ? clock - nes->ppu.clock : 341);
+        if (nes->ppu.frames == frames)
+            continue;
+        frames = nes->ppu.frames;
+        if (!*mismatch && (frames > replay->frames || nes->ppu.frame_hash != replay->hashes[frames - 1]))
+            *mismatch = frames;
+    }
+}
+
+/* Replays the log on a PPU at power up, with its cart loaded, and no CPU:
+   0 if every frame hash matched, the first frame that didn't if not. */
+int64_t ppulog_replay(struct nes *nes, const struct ppu_replay *replay)
+{
+    const uint8_t *data = replay->data;
+    size_t pos = PPULOG_HEADER_SIZE;
+    uint64_t clock = 0;
+    int64_t mismatch = 0;
+    uint8_t val;
+    int type;
+
+    while ((type = next_record(data, replay->size, &pos, &clock)) != PPULOG_END) {
+        if (type != PPULOG_FRAME)
+            run_to(nes, replay, clock, &mismatch);
+        switch (type) {
+        case PPULOG_FRAME:
+            break;
+        case PPULOG_OAM_DMA:
+            // a byte every 2 CPU cycles after the alignment cycle
+            for (int i = 0; i < 256; i++) {
+                run_to(nes, replay, clock + 9 + i * 6, &mismatch);
+                val = data[pos + i];
+                ppu_rw(nes, OAMDATA, &val, WRITE);
+            }
+            break;
+        case PPULOG_MAPPER:
+            val = data[pos + 2];
+            cart_rw(nes, TO_U16(data[pos], data[pos + 1]), &val, WRITE);
+            break;
+        default:
+            val = (type < PPULOG_READ) ? data[pos] : 0;
+            ppu_rw(nes, 0x2000 | (type & 0x07), &val, (type < PPULOG_READ) ? WRITE : READ);
+            break;
+        }
+        pos += payload_size(type);
+    }
+    run_to(nes, replay, clock, &mismatch);
+    if (!mismatch && nes->ppu.frames < replay->frames)
+        mismatch = nes->ppu.frames + 1;
+    return mismatch;
+}
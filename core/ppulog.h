@@ -0,0 +1,69 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+/* PPU register logs(.nesp): what the CPU did to the PPU, with the dot it
+   did it on(ppu.clock, the master clock / 4), to replay the PPU alone.
+
+   The log starts at power up and has the accesses that change the PPU:
+   writes to $2000-$2007, reads of PPUSTATUS and PPUDATA, OAM DMA(one
+   record for the 256 bytes) and the mapper writes that switch CHR banks
+   and mirroring. The frame hash of every vblank is in it too, to check
+   the replay against: both renderers draw the same frames, so a log
+   replays with either, record without the render thread.
+
+   File: "NESP", version, the CRC-32 of PRG and CHR ROM(32 bit little
+   endian), then records. The dot of a record is a LEB128 delta from the
+   previous one:
+
+   0x00-0x07       write of register r: delta, value
+   0x10-0x17       read of register r: delta
+   0x20            OAM DMA from the write to $4014: delta, 256 bytes
+   0x30            mapper write: delta, 16 bit little endian address, value
+   0x40            a vblank: its 64 bit little endian frame hash, no dot
+   0x50            the end: delta to the last dot
+*/
+#define PPULOG_HEADER_SIZE      9
+
+enum PPULOG_RECORD {
+    PPULOG_WRITE = 0x00,
+    PPULOG_READ = 0x10,
+    PPULOG_OAM_DMA = 0x20,
+    PPULOG_MAPPER = 0x30,
+    PPULOG_FRAME = 0x40,
+    PPULOG_END = 0x50,
+};
+
+struct ppu_log;
+
+/* a loaded log, to replay as many times as needed */
+struct ppu_replay {
+    uint8_t *data;
+    size_t size;
+    uint32_t rom_crc;
+    uint64_t *hashes;           /* the frame hash of every vblank */
+    uint64_t frames;
+    uint64_t dots;              /* the last dot */
+    uint64_t accesses;
+};
+
+uint32_t ppulog_rom_crc(const struct cart *cart);
+
+struct ppu_log *ppulog_open(const char *path, const struct nes *nes);
+void ppulog_access(struct ppu_log *log, uint64_t clock, uint16_t addr, uint8_t val, mem_mode_t mode);
+void ppulog_oam_dma(struct ppu_log *log, uint64_t clock);
+void ppulog_mapper(struct ppu_log *log, uint64_t clock, uint16_t addr, uint8_t val);
+void ppulog_frame(struct ppu_log *log, uint64_t hash);
+int ppulog_close(struct ppu_log *log, uint64_t clock);
+
+int ppulog_load(struct ppu_replay *replay, const char *path);
+void ppulog_free(struct ppu_replay *replay);
+int64_t ppulog_replay(struct nes *nes, const struct ppu_replay *replay);
+
+#ifdef __cplusplus
+}
+#endif
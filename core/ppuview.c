@@ -0,0 +1,246 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "ppuview.h"
+#include "ppu.h"
+#include "tilecache.h"
+
+#define ALL_ROWS        0x3fffffff
+
+/* what the emulation thread copies for the worker, only while it's idle */
+struct view_input {
+    uint8_t vram[4 * KB];
+    uint32_t vram_rows[4];
+    int screens[4];             /* the KB of vram each nametable is */
+    uint8_t chr[8][KB];
+    bool chr_changed;
+    uint8_t palette[32];
+    bool palette_changed;
+    uint8_t oam[256];
+    bool oam_changed;
+    uint16_t bg_table;
+    uint16_t sprite_table;
+    bool tall_sprites;
+    uint16_t scroll_v;
+    uint8_t scroll_x;
+    uint64_t frames;
+};
+
+struct ppu_view {
+    pthread_t thread;
+    sem_t wake;
+    _Atomic bool busy;
+    _Atomic bool quit;
+    bool submitted;
+    uint32_t colors[64];
+    struct view_input in;
+
+    /* the worker's: what it drew last and a PPU decoding in.chr tiles */
+    struct ppu ppu;
+    bool drawn;
+    int screens[4];
+    uint16_t bg_table;
+    uint16_t sprite_table;
+    bool tall_sprites;
+    uint8_t oam[256];
+
+    pthread_mutex_t lock;
+    struct ppu_view_images images;
+};
+
+static void draw_nametable_row(struct ppu_view *view, int screen, int row)
+{
+    const struct view_input *in = &view->in;
+    const uint8_t *nt = in->vram + in->screens[screen] * KB;
+    int x0 = (screen & 0x01) * SCREEN_WIDTH, y0 = (screen >> 1) * SCREEN_HEIGHT + row * 8, attr;
+    uint32_t colors[4];
+
+    colors[0] = view->colors[in->palette[0]];
+    for (int col = 0; col < 32; col++) {
+        attr = (nt[0x3c0 + (row / 4) * 8 + col / 4] >> (((row & 0x02) << 1) | (col & 0x02))) & 0x03;
+        for (int i = 1; i < 4; i++)
+            colors[i] = view->colors[in->palette[attr * 4 + i]];
+        tilecache_blit(&view->ppu, in->bg_table + nt[row * 32 + col] * 16, false, false, colors,
+                       &view->images.nametables[y0][x0 + col * 8], PPUVIEW_NAMETABLE_WIDTH);
+    }
+    view->images.nametable_rows |= 1ULL << (y0 / 8);
+}
+
+/* 8x16 sprites take their pattern table from bit 0 of the tile, the top
+   and bottom tiles trade places when flipped vertically */
+static void draw_sprite(struct ppu_view *view, int sprite)
+{
+    const struct view_input *in = &view->in;
+    const uint8_t *oam = in->oam + sprite * 4;
+    int x0 = (sprite % 8) * 8, y0 = (sprite / 8) * 16;
+    bool flip_x = oam[2] & 0x40, flip_y = oam[2] & 0x80;
+    uint32_t colors[4] = { 0 };
+    uint16_t addr;
+
+    for (int i = 1; i < 4; i++)
+        colors[i] = view->colors[in->palette[0x10 + (oam[2] & 0x03) * 4 + i]];
+    for (int y = 0; y < 16; y++)
+        memset(view->images.sprites[y0 + y] + x0, 0, 8 * sizeof(uint32_t));
+    for (int t = 0; t < ((in->tall_sprites) ? 2 : 1); t++) {
+        if (in->tall_sprites)
+            addr = ((oam[1] & 0x01) << 12) + ((oam[1] & 0xfe) + (t ^ flip_y)) * 16;
+        else
+            addr = in->sprite_table + oam[1] * 16;
+        tilecache_blit(&view->ppu, addr, flip_x, flip_y, colors, &view->images.sprites[y0 + t * 8][x0],
+                       PPUVIEW_SPRITES_WIDTH);
+    }
+    view->images.sprites_changed |= 1ULL << sprite;
+}
+
+/* A CHR or palette change redraws everything, a VRAM write its tile row
+   in the nametables that show it, an OAM write the sprites it changed. */
+static void draw(struct ppu_view *view)
+{
+    const struct view_input *in = &view->in;
+    struct ppu_view_images *images = &view->images;
+    bool all = !view->drawn || in->chr_changed || in->palette_changed, all_sprites;
+    uint32_t rows;
+
+    if (in->chr_changed)
+        tilecache_invalidate_all(&view->ppu);
+    for (int screen = 0; screen < 4; screen++) {
+        rows = in->vram_rows[in->screens[screen]];
+        if (all || in->bg_table != view->bg_table || in->screens[screen] != view->screens[screen])
+            rows = ALL_ROWS;
+        for (int row = 0; rows; row++, rows >>= 1)
+            if (rows & 0x01)
+                draw_nametable_row(view, screen, row);
+        view->screens[screen] = in->screens[screen];
+    }
+
+    all_sprites = all || in->sprite_table != view->sprite_table || in->tall_sprites != view->tall_sprites;
+    for (int i = 0; i < 64; i++)
+        if (all_sprites || (in->oam_changed && memcmp(in->oam + i * 4, view->oam + i * 4, 4)))
+            draw_sprite(view, i);
+    memcpy(view->oam, in->oam, sizeof(view->oam));
+    memcpy(images->oam, in->oam, sizeof(images->oam));
+
+    if (all) {
+        for (int i = 0; i < 32; i++)
+            images->palette[i] = view->colors[in->palette[ppu_palette_index(i)]];
+        images->palette_changed = true;
+    }
+    images->scroll_x = ((in->scroll_v >> 10) & 0x01) * SCREEN_WIDTH + (in->scroll_v & 0x1f) * 8 + in->scroll_x;
+    images->scroll_y = ((in->scroll_v >> 11) & 0x01) * SCREEN_HEIGHT + ((in->scroll_v >> 5) & 0x1f) * 8 +
+                       ((in->scroll_v >> 12) & 0x07);
+    images->frames = in->frames;
+    view->bg_table = in->bg_table;
+    view->sprite_table = in->sprite_table;
+    view->tall_sprites = in->tall_sprites;
+    view->drawn = true;
+}
+
+static void *worker(void *arg)
+{
+    struct ppu_view *view = arg;
+
+    for (;;) {
+        sem_wait(&view->wake);
+        if (atomic_load_explicit(&view->quit, memory_order_acquire))
+            break;
+        pthread_mutex_lock(&view->lock);
+        draw(view);
+        // idle before the images are handed out: whoever locks them can
+        // submit the next frame
+        atomic_store_explicit(&view->busy, false, memory_order_release);
+        pthread_mutex_unlock(&view->lock);
+    }
+    return NULL;
+}
+
+/* colors from the palette without emphasis */
+struct ppu_view *ppuview_create(const struct palette_lut *lut)
+{
+    struct ppu_view *view;
+    const uint8_t *rgb;
+
+    if (!(view = calloc(1, sizeof(*view)))) {
+        fprintf(stderr, "PPU view: out of memory\n");
+        return NULL;
+    }
+    for (int i = 0; i < 64; i++) {
+        rgb = lut->rgb[0][i];
+        view->colors[i] = ((uint32_t)rgb[0] << 24) | (rgb[1] << 16) | (rgb[2] << 8) | 0xff;
+    }
+    for (int i = 0; i < 8; i++)
+        view->ppu.page[i] = view->in.chr[i];
+    pthread_mutex_init(&view->lock, NULL);
+    sem_init(&view->wake, 0, 0);
+    if (pthread_create(&view->thread, NULL, worker, view)) {
+        fprintf(stderr, "PPU view: failed to start the worker\n");
+        sem_destroy(&view->wake);
+        pthread_mutex_destroy(&view->lock);
+        free(view);
+        return NULL;
+    }
+    return view;
+}
+
+void ppuview_destroy(struct ppu_view *view)
+{
+    if (!view)
+        return;
+    atomic_store_explicit(&view->quit, true, memory_order_release);
+    sem_post(&view->wake);
+    pthread_join(view->thread, NULL);
+    sem_destroy(&view->wake);
+    pthread_mutex_destroy(&view->lock);
+    free(view);
+}
+
+/* emulation thread, never waits */
+void ppuview_submit(struct ppu_view *view, struct ppu *ppu)
+{
+    struct ppu_view_dirty dirty = ppu->view_dirty;
+    struct view_input *in = &view->in;
+
+    if (atomic_load_explicit(&view->busy, memory_order_acquire))
+        return;
+    if (!view->submitted) {
+        for (int i = 0; i < 4; i++)
+            dirty.vram_rows[i] = ALL_ROWS;
+        dirty.chr = dirty.palette = dirty.oam = true;
+        view->submitted = true;
+    }
+    // the whole 4 KB if any of it changed, it's cheaper than picking rows
+    memcpy(in->vram_rows, dirty.vram_rows, sizeof(in->vram_rows));
+    if (dirty.vram_rows[0] | dirty.vram_rows[1] | dirty.vram_rows[2] | dirty.vram_rows[3])
+        memcpy(in->vram, ppu->vram, sizeof(in->vram));
+    for (int i = 0; i < 4; i++)
+        in->screens[i] = (ppu->page[8 + i] - ppu->vram) >> 10;
+    if ((in->chr_changed = dirty.chr))
+        for (int i = 0; i < 8; i++)
+            memcpy(in->chr[i], ppu->page[i], KB);
+    if ((in->palette_changed = dirty.palette))
+        memcpy(in->palette, ppu->palette, sizeof(in->palette));
+    if ((in->oam_changed = dirty.oam))
+        memcpy(in->oam, ppu->oam, sizeof(in->oam));
+    in->bg_table = (ppu->BG) ? 0x1000 : 0;
+    in->sprite_table = (ppu->S) ? 0x1000 : 0;
+    in->tall_sprites = ppu->H;
+    in->scroll_v = ppu->frame_scroll_v;
+    in->scroll_x = ppu->frame_scroll_x;
+    in->frames = ppu->frames;
+    memset(&ppu->view_dirty, 0, sizeof(ppu->view_dirty));
+    atomic_store_explicit(&view->busy, true, memory_order_release);
+    sem_post(&view->wake);
+}
+
+/* GUI thread, NULL while the worker draws */
+struct ppu_view_images *ppuview_lock(struct ppu_view *view)
+{
+    return (pthread_mutex_trylock(&view->lock)) ? NULL : &view->images;
+}
+
+void ppuview_unlock(struct ppu_view *view)
+{
+    view->images.nametable_rows = 0;
+    view->images.sprites_changed = 0;
+    view->images.palette_changed = false;
+    pthread_mutex_unlock(&view->lock);
+}
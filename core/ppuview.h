@@ -0,0 +1,57 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+#define PPUVIEW_NAMETABLE_WIDTH     (2 * SCREEN_WIDTH)
+#define PPUVIEW_NAMETABLE_HEIGHT    (2 * SCREEN_HEIGHT)
+#define PPUVIEW_SPRITES_WIDTH       (8 * 8)
+#define PPUVIEW_SPRITES_HEIGHT      (8 * 16)
+
+/* Nametable, sprite and palette debug views, drawn on a worker thread.
+
+   ppuview_submit() is called by the emulation thread, once a frame. When
+   the worker is idle it copies what the PPU marked as changed(see
+   ppu.view_dirty) and wakes it up, when it's busy the changes wait for the
+   next call: the emulation never waits. The worker redraws only what the
+   changes touch into RGBA8888 images:
+
+   nametables      $2000-$2fff as 2x2 screens of 32x30 tiles
+   sprites         the 64 OAM entries, 8 a row in 8x16 cells, transparent
+                   where the sprite is
+   palette         the 32 palette RAM entries
+
+   ppuview_lock() hands them to the front end with what changed since the
+   last ppuview_unlock(), NULL while the worker is drawing(try again on
+   the next GUI frame).
+*/
+struct ppu_view_images {
+    uint32_t nametables[PPUVIEW_NAMETABLE_HEIGHT][PPUVIEW_NAMETABLE_WIDTH];
+    uint32_t sprites[PPUVIEW_SPRITES_HEIGHT][PPUVIEW_SPRITES_WIDTH];
+    uint32_t palette[32];
+    uint8_t oam[256];
+
+    /* top left of the picture in the nametables at the start of the frame */
+    int scroll_x;
+    int scroll_y;
+    uint64_t frames;
+
+    uint64_t nametable_rows;    /* a bit per 8 lines */
+    uint64_t sprites_changed;   /* a bit per sprite */
+    bool palette_changed;
+};
+
+struct ppu_view;
+
+struct ppu_view *ppuview_create(const struct palette_lut *lut);
+void ppuview_destroy(struct ppu_view *view);
+void ppuview_submit(struct ppu_view *view, struct ppu *ppu);
+struct ppu_view_images *ppuview_lock(struct ppu_view *view);
+void ppuview_unlock(struct ppu_view *view);
+
+#ifdef __cplusplus
+}
+#endif
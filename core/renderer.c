@@ -0,0 +1,317 @@
+#include "renderer.h"
+#include "ppu.h"
+#include "pixel.h"
+#include "renderthread.h"
+
+/* 2C02 colors, 0xRRGGBBAA like the SDL texture */
+const uint32_t ppu_palette_rgba[64] = {
+    0x545454ff, 0x001e74ff, 0x081090ff, 0x300088ff, 0x440064ff, 0x5c0030ff, 0x540400ff, 0x3c1800ff,
+    0x202a00ff, 0x083a00ff, 0x004000ff, 0x003c00ff, 0x00323cff, 0x000000ff, 0x000000ff, 0x000000ff,
+    0x989698ff, 0x084cc4ff, 0x3032ecff, 0x5c1ee4ff, 0x8814b0ff, 0xa01464ff, 0x982220ff, 0x783c00ff,
+    0x545a00ff, 0x287200ff, 0x087c00ff, 0x007628ff, 0x006678ff, 0x000000ff, 0x000000ff, 0x000000ff,
+    0xeceeecff, 0x4c9aecff, 0x787cecff, 0xb062ecff, 0xe454ecff, 0xec58b4ff, 0xec6a64ff, 0xd48820ff,
+    0xa0aa00ff, 0x74c400ff, 0x4cd020ff, 0x38cc6cff, 0x38b4ccff, 0x3c3c3cff, 0x000000ff, 0x000000ff,
+    0xeceeecff, 0xa8ccecff, 0xbcbcecff, 0xd4b2ecff, 0xecaeecff, 0xecaed4ff, 0xecb4b0ff, 0xe4c490ff,
+    0xccd278ff, 0xb4de78ff, 0xa8e290ff, 0x98e2b4ff, 0xa0d6e4ff, 0xa0a2a0ff, 0x000000ff, 0x000000ff,
+};
+
+static void snapshot(struct ppu *ppu, struct ppu_write_record *rec, bool v_loaded)
+{
+    rec->cycle = ppu->cycles;
+    rec->v = ppu->v;
+    rec->x = ppu->x;
+    rec->ppuctrl = ppu->ppuctrl;
+    rec->ppumask = ppu->ppumask;
+    rec->v_loaded = v_loaded;
+}
+
+/* The sprite 0 hit of the line is found ahead of time, compositing the
+   line with what is logged so far, and raised by ppu_tick() on its dot. A
+   write only changes the pixels after its own dot, so the hit is looked
+   for again after each one until it happens. */
+static void predict_sprite0(struct ppu *ppu)
+{
+    if (!ppu->SPR)
+        ppu->sprite0_dot = render_line(ppu, false);
+}
+
+void render_line_start(struct nes *nes)
+{
+    snapshot(&nes->ppu, &nes->ppu.line_start, false);
+    nes->ppu.write_log_len = 0;
+    nes->ppu.page_log_len = 0;
+    predict_sprite0(&nes->ppu);
+}
+
+/* Called by ppu_write() once the register has changed. A CPU cycle is 3
+   dots and a write takes at least 4 cycles, so a line never holds more than
+   28 writes.
+*/
+void render_log_write(struct nes *nes, bool v_loaded)
+{
+    struct ppu *ppu = &nes->ppu;
+
+    if (ppu->render_mode != RENDER_SCANLINE || ppu->scanlines >= 240 ||
+        ppu->cycles < 1 || ppu->cycles > 256 || ppu->write_log_len == WRITE_LOG_SIZE)
+        return;
+    snapshot(ppu, &ppu->write_log[ppu->write_log_len++], v_loaded);
+    predict_sprite0(ppu);
+}
+
+/* Called by the mapper before it points pages of the pattern tables or
+   nametables somewhere else. A mapper write takes at least 4 CPU cycles,
+   12 dots, and all the switches of one write share a record.
+*/
+void render_log_pages(struct nes *nes)
+{
+    struct ppu *ppu = &nes->ppu;
+    struct ppu_page_record *rec;
+
+    if (ppu->render_mode != RENDER_SCANLINE || ppu->scanlines >= 240 ||
+        ppu->cycles < 1 || ppu->cycles > 256 || ppu->page_log_len == PAGE_LOG_SIZE ||
+        (ppu->page_log_len && ppu->page_log[ppu->page_log_len - 1].cycle == ppu->cycles))
+        return;
+    rec = &ppu->page_log[ppu->page_log_len++];
+    rec->cycle = ppu->cycles;
+    memcpy(rec->page, ppu->page, sizeof(rec->page));
+    predict_sprite0(ppu);
+}
+
+/* the pages a fetch on the given dot sees: the ones before the first
+   switch after it, the current ones if there is none */
+static uint8_t *const *pages_at(const struct ppu *ppu, int *i, int dot)
+{
+    for (; *i < ppu->page_log_len && ppu->page_log[*i].cycle <= dot; (*i)++)
+        ;
+    return (*i < ppu->page_log_len) ? ppu->page_log[*i].page : ppu->page;
+}
+
+/* apply the logged writes made before the given dot, returns the next one */
+static int replay(const struct ppu *ppu, int i, int dot, struct ppu_write_record *state,
+                  uint16_t *v)
+{
+    for (; i < ppu->write_log_len && ppu->write_log[i].cycle <= dot; i++) {
+        *state = ppu->write_log[i];
+        if (state->v_loaded)
+            *v = state->v;
+    }
+    return i;
+}
+
+/* one background tile row as 8 pixels(palette address, 0 if clear). Pages
+   switched out later in the line aren't in the tile cache, their tiles are
+   decoded on the spot. */
+static void fetch_tile(struct ppu *ppu, uint8_t *const *pages, uint16_t v, uint8_t ppuctrl, uint8_t *out)
+{
+    const uint8_t *nametable = pages[8 + ((v >> 10) & 0x03)];
+    uint8_t tile = nametable[v & 0x3ff];
+    uint8_t pal = ppu->attr_cache[(nametable - ppu->vram) >> 10][v & 0x3ff];
+    uint16_t addr = ((uint16_t)(ppuctrl & 0x10) << 8) | ((uint16_t)tile << 4);
+    uint8_t decoded[64];
+    const uint8_t *row;
+
+    if (pages == ppu->page) {
+        row = tilecache_tile(ppu, addr, false);
+    } else {
+        pixel_decode_tile(pages[addr >> 10] + (addr & 0x3f0), decoded, false);
+        row = decoded;
+    }
+    row += (v >> 12) * 8;
+    for (int i = 0; i < 8; i++)
+        out[i] = (row[i]) ? pal | row[i] : 0;
+}
+
+/* Background of the whole line, following the fetch schedule: tiles 0-1
+   were fetched at the end of the previous line, tile n + 2 on dots
+   8n+1..8n+8 followed by a coarse X increment. A new v from PPUADDR or a
+   bank switch is only seen by the fetches after the write.
+*/
+static void render_background(struct ppu *ppu, uint8_t *bg)
+{
+    struct ppu_write_record state = ppu->line_start;
+    uint16_t v = state.v;
+    int i = 0, j = 0;
+
+    fetch_tile(ppu, pages_at(ppu, &j, 0), v, state.ppuctrl, bg);
+    v = ppu_increment_x(v);
+    fetch_tile(ppu, pages_at(ppu, &j, 0), v, state.ppuctrl, bg + 8);
+    v = ppu_increment_x(v);
+    for (int n = 0; n < 31; n++) {
+        i = replay(ppu, i, 8 * n + 1, &state, &v);
+        fetch_tile(ppu, pages_at(ppu, &j, 8 * n + 1), v, state.ppuctrl, bg + 8 * (n + 2));
+        i = replay(ppu, i, 8 * n + 8, &state, &v);
+        v = ppu_increment_x(v);
+    }
+}
+
+/* sprites of this line from the sprite index, in OAM order so that the
+   first opaque pixel wins. Their patterns were fetched at the end of the
+   previous line, before any switch made during this one. */
+static void render_sprites(struct ppu *ppu, uint8_t ppuctrl, uint8_t *spr)
+{
+    int height, n, row, j = 0;
+    const uint8_t *sprites, *sprite, *pixels;
+    uint8_t *const *pages = pages_at(ppu, &j, 0);
+    uint8_t flags, decoded[64];
+    uint16_t addr;
+
+    memset(spr, 0, SCREEN_WIDTH);
+    sprites = ppu_sprites_on_line(ppu, ppu->scanlines, &n);
+    height = ppu->sprite_index.height;
+    for (int i = 0; i < n; i++) {
+        sprite = &ppu->oam[sprites[i] * 4];
+        row = ppu->scanlines - sprite[0] - 1;
+        if (sprite[2] & 0x80)
+            row = height - 1 - row;
+        if (height == 16)
+            addr = ((uint16_t)(sprite[1] & 0x01) << 12) | ((uint16_t)(sprite[1] & 0xfe) << 4) |
+                   ((row & 0x08) << 1) | (row & 0x07);
+        else
+            addr = ((uint16_t)(ppuctrl & 0x08) << 9) | ((uint16_t)sprite[1] << 4) | row;
+        if (pages == ppu->page) {
+            pixels = tilecache_tile(ppu, addr, sprite[2] & 0x40);
+        } else {
+            pixel_decode_tile(pages[addr >> 10] + (addr & 0x3f0), decoded, sprite[2] & 0x40);
+            pixels = decoded;
+        }
+        pixels += (addr & 0x07) * 8;
+        flags = 0x10 | ((sprite[2] & 0x03) << 2) | ((sprite[2] & 0x20) ? BEHIND_BG : 0) |
+                ((!sprites[i]) ? SPRITE_0 : 0);
+        for (int j = 0; j < 8 && sprite[3] + j < SCREEN_WIDTH; j++)
+            if (pixels[j] && !(spr[sprite[3] + j] & 0x03))
+                spr[sprite[3] + j] = flags | pixels[j];
+    }
+}
+
+/* Draw the current line in one pass at dot 256. Register writes and bank
+   switches made during the line are replayed at their dot, so mid-line
+   changes of PPUMASK, fine X, PPUADDR(raster splits) or CHR banks land on
+   the right pixels.
+   Each span between writes is composited with the pixel kernels, the
+   hidden left column or layers are cleared in a copy first.
+   Returns the dot of the sprite 0 hit, 0 if there is none. Without video
+   only the lines with sprite 0 are composited, and nothing is output.
+*/
+int render_line(struct ppu *ppu, bool video)
+{
+    struct ppu_write_record state = ppu->line_start;
+    uint8_t bg[33 * 8], spr[SCREEN_WIDTH], line[SCREEN_WIDTH];
+    uint8_t bg_masked[SCREEN_WIDTH], spr_masked[SCREEN_WIDTH];
+    const uint8_t *b, *s, *sprites;
+    uint8_t mask, grey, backdrop;
+    uint16_t v = state.v;
+    int i = 0, end, hit, left, n, hit_dot = 0;
+
+    if (!video) {
+        sprites = ppu_sprites_on_line(ppu, ppu->scanlines, &n);
+        if (!n || sprites[0])
+            return 0;
+    }
+
+    render_background(ppu, bg);
+    render_sprites(ppu, state.ppuctrl, spr);
+
+    // with rendering off the PPU shows the backdrop, or the palette entry
+    // v points to
+    backdrop = ((ppu->v & 0x3f00) == 0x3f00) ? ppu_palette_index(ppu->v) : 0;
+
+    for (int p = 0; p < SCREEN_WIDTH; p = end) {
+        i = replay(ppu, i, p + 1, &state, &v);
+        end = (i < ppu->write_log_len && ppu->write_log[i].cycle <= SCREEN_WIDTH) ?
+                ppu->write_log[i].cycle - 1 : SCREEN_WIDTH;
+        mask = state.ppumask;
+        grey = (mask & 0x01) ? 0x30 : 0x3f;
+        if (!(mask & 0x18)) {
+            memset(line + p, ppu->palette[backdrop] & grey, end - p);
+            goto output;
+        }
+
+        b = bg + p + state.x;
+        s = spr + p;
+        left = (p < 8) ? ((end < 8) ? end : 8) - p : 0;
+        if (!(mask & 0x08) || (left && !(mask & 0x02))) {
+            memcpy(bg_masked + p, b, end - p);
+            memset(bg_masked + p, 0, (mask & 0x08) ? left : end - p);
+            b = bg_masked + p;
+        }
+        if (!(mask & 0x10) || (left && !(mask & 0x04))) {
+            memcpy(spr_masked + p, s, end - p);
+            memset(spr_masked + p, 0, (mask & 0x10) ? left : end - p);
+            s = spr_masked + p;
+        }
+        // no hit on the last pixel
+        hit = pixel_composite(b, s, line + p, end - p);
+        if (hit >= 0 && p + hit != 255 && !hit_dot)
+            hit_dot = p + hit + 1;
+        if (!video)
+            continue;
+        pixel_lookup(line + p, ppu->palette, line + p, end - p);
+        if (grey != 0x3f)
+            for (int j = p; j < end; j++)
+                line[j] &= grey;
+output:
+        if (video) {
+            palette_convert(&ppu->lut, line + p, mask >> 5, ppu->framebuffer,
+                            ppu->scanlines * SCREEN_WIDTH + p, end - p);
+            ppu->emphasis[ppu->scanlines] = mask >> 5;
+        }
+    }
+    if (video)
+        render_line_done(ppu, line);
+    return hit_dot;
+}
+
+/* at dot 256 of the visible lines, on a render thread if there is one. The
+   sprite 0 hit is already raised by then. */
+void render_scanline(struct nes *nes)
+{
+    struct ppu *ppu = &nes->ppu;
+
+    if (!ppu->framebuffer || ppu->frame_no_video)
+        return;
+    if (ppu->render_thread)
+        render_thread_line(ppu);
+    else
+        render_line(ppu, true);
+}
+
+static uint64_t mix(uint64_t h, uint64_t w)
+{
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 32);
+}
+
+/* Hash of a drawn line(colors 0-63 and the emphasis, so the same for any
+   output format and renderer) into the frame hash, and the band marked
+   dirty if it differs from the same line in the last frame. */
+void render_line_done(struct ppu *ppu, const uint8_t *line)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ ppu->emphasis[ppu->scanlines], w;
+
+    for (int i = 0; i < SCREEN_WIDTH; i += 8) {
+        memcpy(&w, line + i, 8);
+        h = mix(h, w);
+    }
+    if (h != ppu->line_hash[ppu->scanlines]) {
+        ppu->line_hash[ppu->scanlines] = h;
+        ppu->dirty_next |= 1 << (ppu->scanlines / DIRTY_BAND_LINES);
+    }
+    ppu->hash_next = mix(ppu->hash_next, h);
+}
+
+/* on vblank */
+void render_frame_done(struct ppu *ppu)
+{
+    if (ppu->render_thread) {
+        render_thread_frame(ppu);
+        return;
+    }
+    if (!ppu->frame_no_video && ppu->framebuffer) {
+        ppu->frame_hash = ppu->hash_next;
+        ppu->dirty_bands = ppu->dirty_next;
+    } else {
+        ppu->dirty_bands = 0;
+    }
+    ppu->hash_next = 0;
+    ppu->dirty_next = 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+#define DIRTY_BAND_LINES        16
+
+extern const uint32_t ppu_palette_rgba[64];
+
+void render_line_start(struct nes *nes);
+void render_log_write(struct nes *nes, bool v_loaded);
+void render_log_pages(struct nes *nes);
+void render_scanline(struct nes *nes);
+int render_line(struct ppu *ppu, bool video);
+void render_line_done(struct ppu *ppu, const uint8_t *line);
+void render_frame_done(struct ppu *ppu);
+
+#ifdef __cplusplus
+}
+#endif
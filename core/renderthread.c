@@ -0,0 +1,396 @@
+#include <pthread.h>
+#include "renderthread.h"
+#include "ppu.h"
+
+/* A CPU write takes at least 4 cycles, a frame(29781 cycles) can't hold
+   more than ~7500 of them. */
+#define MAX_WRITES      8192
+
+/* mid-line bank switches of a frame, more are rare */
+#define MAX_PAGE_RECORDS        2048
+
+struct render_write {
+    uint16_t addr;
+    uint8_t type;
+    uint8_t val;
+};
+
+/* what render_line() reads besides the memories */
+struct render_job_line {
+    int writes;         /* writes to apply before drawing the line */
+    int scanline;
+    uint16_t v;
+    uint8_t ppuctrl;
+    struct ppu_write_record line_start;
+    struct ppu_write_record write_log[WRITE_LOG_SIZE];
+    int write_log_len;
+    int page_records;   /* first of the line's page log in the job */
+    int page_log_len;
+    uint8_t *page[12];
+};
+
+/* A job that runs out of writes or page records isn't shown, and the
+   next one starts from a copy of the PPU memories taken on its vblank:
+   the writes lost would leave the worker's memories wrong for good. */
+struct render_job {
+    bool video;
+    bool overflow;
+    bool resync;
+    uint8_t vram[4 * KB];
+    uint8_t palette[32];
+    uint8_t oam[256];
+    uint8_t *chr;                   /* for the CHR RAM copy, NULL if ROM */
+    struct palette_lut lut;
+    int line_count;
+    struct render_job_line lines[SCREEN_HEIGHT];
+    int write_count;
+    struct render_write writes[MAX_WRITES];
+    int page_record_count;
+    struct ppu_page_record page_records[MAX_PAGE_RECORDS];
+};
+
+struct render_thread {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct render_job *pending;     /* handed to the worker, not taken yet */
+    bool busy;
+    bool done;                      /* a drawn frame not copied out yet */
+    bool quit;
+
+    /* emulation thread */
+    struct render_job jobs[2];
+    int filling;
+    bool logging;                   /* lines are logged from line 0 on */
+
+    /* worker: the PPU memories as of the job being drawn */
+    struct ppu shadow;
+    const uint8_t *vram;
+    const uint8_t *chr_base;
+    uint8_t *chr;                   /* copy of the CHR RAM, NULL if ROM */
+    size_t chr_size;
+    uint8_t *frame;
+};
+
+static size_t pixel_size(pixel_format_t format)
+{
+    switch (format) {
+    case PIXEL_INDEXED8:
+        return 1;
+    case PIXEL_RGB565:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+/* a page of the emulated PPU to the same page in the worker's memories */
+static uint8_t *translate(struct render_thread *rt, uint8_t *page)
+{
+    if (page >= rt->vram && page < rt->vram + sizeof(rt->shadow.vram))
+        return rt->shadow.vram + (page - rt->vram);
+    if (rt->chr && page >= rt->chr_base && page < rt->chr_base + rt->chr_size)
+        return rt->chr + (page - rt->chr_base);
+    return page;
+}
+
+static void map_pages(struct render_thread *rt, uint8_t *const *pages)
+{
+    struct ppu *ppu = &rt->shadow;
+    uint8_t *page;
+
+    for (int i = 0; i < 12; i++) {
+        page = translate(rt, pages[i]);
+        if (i < 8 && ppu->page[i] != page)
+            tilecache_invalidate_page(ppu, i);
+        ppu->page[i] = page;
+    }
+    for (int i = 12; i < 16; i++)
+        ppu->page[i] = ppu->page[i - 4];
+}
+
+static void apply(struct render_thread *rt, const struct render_write *w)
+{
+    struct ppu *ppu = &rt->shadow;
+    const uint8_t *bank;
+
+    switch (w->type) {
+    case RENDER_WRITE_VRAM:
+        ppu->vram[w->addr] = w->val;
+        if ((w->addr & 0x3ff) >= 0x3c0)
+            ppu_update_attr_cache(ppu, w->addr >> 10, w->addr & 0x3ff);
+        break;
+    case RENDER_WRITE_CHR:
+        rt->chr[w->addr] = w->val;
+        bank = rt->chr + (w->addr & ~0x3ff);
+        for (int i = 0; i < 8; i++) {
+            if (ppu->page[i] == bank) {
+                ppu->tiles.valid[0][i] &= ~(1ULL << ((w->addr >> 4) & 0x3f));
+                ppu->tiles.valid[1][i] &= ~(1ULL << ((w->addr >> 4) & 0x3f));
+            }
+        }
+        break;
+    case RENDER_WRITE_PALETTE:
+        ppu->palette[w->addr] = w->val;
+        break;
+    case RENDER_WRITE_OAM:
+        ppu->oam[w->addr] = w->val;
+        ppu->sprite_index.dirty = true;
+        break;
+    }
+}
+
+/* the worker's memories from the ones of the job's vblank */
+static void resync(struct render_thread *rt, const struct render_job *job)
+{
+    struct ppu *ppu = &rt->shadow;
+
+    memcpy(ppu->vram, job->vram, sizeof(ppu->vram));
+    memcpy(ppu->palette, job->palette, sizeof(ppu->palette));
+    memcpy(ppu->oam, job->oam, sizeof(ppu->oam));
+    if (rt->chr)
+        memcpy(rt->chr, job->chr, rt->chr_size);
+    ppu_build_attr_cache(ppu);
+    tilecache_invalidate_all(ppu);
+    ppu->sprite_index.dirty = true;
+}
+
+static void draw(struct render_thread *rt, const struct render_job *job)
+{
+    struct ppu *ppu = &rt->shadow;
+    const struct render_job_line *line;
+    const struct ppu_page_record *rec;
+    int w = 0;
+
+    if (job->resync)
+        resync(rt, job);
+    if (job->video)
+        ppu->lut = job->lut;
+    for (int i = 0; i < job->line_count && job->video; i++) {
+        line = &job->lines[i];
+        for (; w < line->writes; w++)
+            apply(rt, &job->writes[w]);
+        map_pages(rt, line->page);
+        ppu->scanlines = line->scanline;
+        ppu->v = line->v;
+        ppu->ppuctrl = line->ppuctrl;
+        ppu->line_start = line->line_start;
+        memcpy(ppu->write_log, line->write_log, line->write_log_len * sizeof(line->write_log[0]));
+        ppu->write_log_len = line->write_log_len;
+        for (int j = 0; j < line->page_log_len; j++) {
+            rec = &job->page_records[line->page_records + j];
+            ppu->page_log[j].cycle = rec->cycle;
+            for (int k = 0; k < 12; k++)
+                ppu->page_log[j].page[k] = translate(rt, rec->page[k]);
+        }
+        ppu->page_log_len = line->page_log_len;
+        render_line(ppu, true);
+    }
+    for (; w < job->write_count; w++)
+        apply(rt, &job->writes[w]);
+    if (job->video)
+        render_frame_done(ppu);
+}
+
+static void *worker(void *arg)
+{
+    struct render_thread *rt = arg;
+    struct render_job *job;
+
+    pthread_mutex_lock(&rt->lock);
+    for (;;) {
+        while (!rt->pending && !rt->quit)
+            pthread_cond_wait(&rt->cond, &rt->lock);
+        if (!rt->pending)
+            break;
+        job = rt->pending;
+        rt->pending = NULL;
+        pthread_mutex_unlock(&rt->lock);
+
+        draw(rt, job);
+
+        pthread_mutex_lock(&rt->lock);
+        rt->busy = false;
+        rt->done = job->video;
+        pthread_cond_broadcast(&rt->cond);
+    }
+    pthread_mutex_unlock(&rt->lock);
+    return NULL;
+}
+
+/* with the lock held: wait for the worker and copy out its frame, only the
+   bands that changed */
+static void collect(struct render_thread *rt, struct ppu *ppu)
+{
+    size_t band_size;
+
+    while (rt->busy)
+        pthread_cond_wait(&rt->cond, &rt->lock);
+    band_size = SCREEN_WIDTH * DIRTY_BAND_LINES * pixel_size(rt->shadow.lut.format);
+    ppu->dirty_bands = 0;
+    if (!rt->done)
+        return;
+    rt->done = false;
+    ppu->frame_hash = rt->shadow.frame_hash;
+    ppu->dirty_bands = rt->shadow.dirty_bands;
+    memcpy(ppu->emphasis, rt->shadow.emphasis, sizeof(ppu->emphasis));
+    if (!ppu->framebuffer)
+        return;
+    for (int band = 0; band < SCREEN_HEIGHT / DIRTY_BAND_LINES; band++)
+        if ((ppu->dirty_bands >> band) & 0x01)
+            memcpy((uint8_t *)ppu->framebuffer + band * band_size, rt->frame + band * band_size,
+                   band_size);
+}
+
+void render_thread_write(struct ppu *ppu, enum RENDER_WRITE type, uint16_t addr, uint8_t val)
+{
+    struct render_job *job = &ppu->render_thread->jobs[ppu->render_thread->filling];
+
+    if (job->write_count == MAX_WRITES) {
+        job->overflow = true;
+        return;
+    }
+    job->writes[job->write_count++] = (struct render_write){ addr, type, val };
+}
+
+void render_thread_line(struct ppu *ppu)
+{
+    struct render_thread *rt = ppu->render_thread;
+    struct render_job *job = &rt->jobs[rt->filling];
+    struct render_job_line *line;
+
+    if (!rt->logging && ppu->scanlines)
+        return;
+    rt->logging = true;
+    line = &job->lines[job->line_count++];
+    line->writes = job->write_count;
+    line->scanline = ppu->scanlines;
+    line->v = ppu->v;
+    line->ppuctrl = ppu->ppuctrl;
+    line->line_start = ppu->line_start;
+    memcpy(line->write_log, ppu->write_log, ppu->write_log_len * sizeof(ppu->write_log[0]));
+    line->write_log_len = ppu->write_log_len;
+    line->page_records = job->page_record_count;
+    line->page_log_len = 0;
+    if (job->page_record_count + ppu->page_log_len <= MAX_PAGE_RECORDS) {
+        memcpy(job->page_records + job->page_record_count, ppu->page_log,
+               ppu->page_log_len * sizeof(ppu->page_log[0]));
+        job->page_record_count += ppu->page_log_len;
+        line->page_log_len = ppu->page_log_len;
+    } else {
+        job->overflow = true;
+    }
+    memcpy(line->page, ppu->page, sizeof(line->page));
+}
+
+/* vblank: the previous frame comes out, this one goes to the worker */
+void render_thread_frame(struct ppu *ppu)
+{
+    struct render_thread *rt = ppu->render_thread;
+    struct render_job *job = &rt->jobs[rt->filling], *next = &rt->jobs[rt->filling ^ 1];
+
+    if (job->overflow)
+        fprintf(stderr, "Render thread: frame %llu has too many PPU writes, it's dropped\n",
+                (unsigned long long)ppu->frames);
+    job->video = job->line_count == SCREEN_HEIGHT && !job->overflow;
+    if (job->video)
+        job->lut = ppu->lut;
+
+    pthread_mutex_lock(&rt->lock);
+    collect(rt, ppu);
+    rt->pending = job;
+    rt->busy = true;
+    pthread_cond_broadcast(&rt->cond);
+    pthread_mutex_unlock(&rt->lock);
+
+    // the worker is done with the other job
+    next->line_count = 0;
+    next->write_count = 0;
+    next->page_record_count = 0;
+    next->overflow = false;
+    next->resync = job->overflow;
+    if (next->resync) {
+        memcpy(next->vram, ppu->vram, sizeof(next->vram));
+        memcpy(next->palette, ppu->palette, sizeof(next->palette));
+        memcpy(next->oam, ppu->oam, sizeof(next->oam));
+        if (rt->chr)
+            memcpy(next->chr, rt->chr_base, rt->chr_size);
+    }
+    rt->filling ^= 1;
+}
+
+static void destroy(struct render_thread *rt)
+{
+    for (int i = 0; i < 2; i++)
+        free(rt->jobs[i].chr);
+    free(rt->chr);
+    free(rt->frame);
+    free(rt);
+}
+
+int render_thread_start(struct nes *nes)
+{
+    struct render_thread *rt;
+
+    if (nes->ppu.render_thread)
+        return 0;
+    if (nes->ppu.render_mode != RENDER_SCANLINE) {
+        fprintf(stderr, "Render thread: only the scanline renderer can run on it\n");
+        return -1;
+    }
+    if (!(rt = calloc(1, sizeof(*rt))) || !(rt->frame = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 4)))
+        goto fail;
+    rt->vram = nes->ppu.vram;
+    if (nes->cart.chr_ram) {
+        rt->chr_base = nes->cart.chr_rom;
+        rt->chr_size = nes->cart.info.chr_size;
+        if (!(rt->chr = malloc(rt->chr_size)) || !(rt->jobs[0].chr = malloc(rt->chr_size)) ||
+            !(rt->jobs[1].chr = malloc(rt->chr_size)))
+            goto fail;
+        memcpy(rt->chr, rt->chr_base, rt->chr_size);
+    }
+
+    rt->shadow = nes->ppu;
+    rt->shadow.framebuffer = rt->frame;
+    rt->shadow.frame_no_video = false;
+    tilecache_invalidate_all(&rt->shadow);
+    rt->shadow.sprite_index.dirty = true;
+    map_pages(rt, nes->ppu.page);
+
+    pthread_mutex_init(&rt->lock, NULL);
+    pthread_cond_init(&rt->cond, NULL);
+    if (pthread_create(&rt->thread, NULL, worker, rt)) {
+        pthread_mutex_destroy(&rt->lock);
+        pthread_cond_destroy(&rt->cond);
+        goto fail;
+    }
+    nes->ppu.render_thread = rt;
+    return 0;
+
+fail:
+    fprintf(stderr, "Render thread: failed to start\n");
+    if (rt)
+        destroy(rt);
+    return -1;
+}
+
+/* the last frame drawn is copied out, the one being logged is dropped */
+void render_thread_stop(struct nes *nes)
+{
+    struct render_thread *rt = nes->ppu.render_thread;
+
+    if (!rt)
+        return;
+    pthread_mutex_lock(&rt->lock);
+    collect(rt, &nes->ppu);
+    // the inline renderer goes on from what is in the framebuffer now
+    memcpy(nes->ppu.line_hash, rt->shadow.line_hash, sizeof(nes->ppu.line_hash));
+    rt->quit = true;
+    pthread_cond_broadcast(&rt->cond);
+    pthread_mutex_unlock(&rt->lock);
+    pthread_join(rt->thread, NULL);
+    pthread_mutex_destroy(&rt->lock);
+    pthread_cond_destroy(&rt->cond);
+    nes->ppu.render_thread = NULL;
+    destroy(rt);
+}
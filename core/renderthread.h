@@ -0,0 +1,40 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+/* Scanline rendering on a worker thread, one frame behind.
+
+   The emulation thread keeps computing everything the CPU can see(sprite 0
+   hit, overflow) and logs, for each line, what the renderer needs: the
+   register writes of the line, the pattern table and nametable mapping(and
+   the one before each bank switch in the line), and every VRAM, CHR RAM,
+   palette and OAM write in between. On vblank the frame is handed to the
+   worker, which replays it on its own copy of the PPU memories while the
+   CPU runs the next one. The frame drawn by the worker is copied to
+   ppu.framebuffer(with its emphasis, hash and dirty bands) on the
+   following vblank, when the worker is done with it. A frame with more
+   writes than a job holds is dropped and the worker's memories are copied
+   again on the next vblank.
+*/
+enum RENDER_WRITE {
+    RENDER_WRITE_VRAM,      /* addr is the offset in ppu.vram */
+    RENDER_WRITE_CHR,       /* offset in the CHR RAM */
+    RENDER_WRITE_PALETTE,   /* palette RAM index */
+    RENDER_WRITE_OAM,       /* OAM address */
+};
+
+int render_thread_start(struct nes *nes);
+void render_thread_stop(struct nes *nes);
+
+/* emulation thread side, called by the PPU */
+void render_thread_write(struct ppu *ppu, enum RENDER_WRITE type, uint16_t addr, uint8_t val);
+void render_thread_line(struct ppu *ppu);
+void render_thread_frame(struct ppu *ppu);
+
+#ifdef __cplusplus
+}
+#endif
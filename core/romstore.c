@@ -0,0 +1,271 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "romstore.h"
+#include "inflate.h"
+
+static struct rom_image *images;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return TO_U16(p[0], p[1]);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return ((uint32_t)get_u16(p + 2) << 16) | get_u16(p);
+}
+
+/* inflate an archive member straight into the image buffer */
+static int inflate_member(struct rom_image *image, const uint8_t *src, size_t len,
+                          uint32_t crc, size_t size)
+{
+    size_t out;
+
+    image->data = malloc(size ? size : 1);
+    if (!image->data) {
+        fprintf(stderr, "can't allocate %zu bytes for %s\n", size, image->path);
+        return 1;
+    }
+    if (inflate_raw(src, len, image->data, size, &out) || out != size ||
+        inflate_crc32(0, image->data, size) != crc) {
+        fprintf(stderr, "%s is corrupted\n", image->path);
+        free(image->data);
+        return 1;
+    }
+    image->size = size;
+    return 0;
+}
+
+/* gzip(RFC 1952)
+
+   10 byte header, optional extra/name/comment/header CRC fields, the
+   deflate data, then CRC32 and the uncompressed size(mod 2^32).
+*/
+static int load_gzip(struct rom_image *image, const uint8_t *src, size_t len)
+{
+    size_t pos = 10;
+    uint8_t flags;
+
+    if (len < 18 || src[2] != 8)
+        return 1;
+    flags = src[3];
+    if ((flags & 0x04) && pos + 2 <= len)
+        pos += 2 + get_u16(src + pos);
+    if (flags & 0x08)
+        while (pos < len && src[pos++]);
+    if (flags & 0x10)
+        while (pos < len && src[pos++]);
+    if (flags & 0x02)
+        pos += 2;
+    if (pos + 8 > len)
+        return 1;
+    return inflate_member(image, src + pos, len - pos - 8, get_u32(src + len - 8),
+                          get_u32(src + len - 4));
+}
+
+static bool is_nes_name(const uint8_t *name, int len)
+{
+    return len > 4 && !strncasecmp((const char *)name + len - 4, ".nes", 4);
+}
+
+/* zip
+
+   The central directory at the end of the file lists every member with
+   its sizes(local headers may not have them). The first member named *.nes
+   is loaded, or the first member if none is. Stored and deflated members
+   are supported.
+*/
+static int load_zip(struct rom_image *image, const uint8_t *src, size_t len)
+{
+    size_t eocd, pos, entry = 0, data;
+    const uint8_t *local;
+    uint32_t csize, usize;
+    int entries, name_len;
+    bool found = false;
+
+    // end of central directory record: 22 bytes + up to 64 KB of comment
+    if (len < 22)
+        return 1;
+    for (eocd = len - 22; get_u32(src + eocd) != 0x06054b50; eocd--)
+        if (!eocd || len - eocd > 22 + 0xffff)
+            return 1;
+
+    entries = get_u16(src + eocd + 10);
+    pos = get_u32(src + eocd + 16);
+    for (int i = 0; i < entries; i++) {
+        if (pos + 46 > len || get_u32(src + pos) != 0x02014b50)
+            return 1;
+        name_len = get_u16(src + pos + 28);
+        if (pos + 46 + name_len > len)
+            return 1;
+        if (!i || (!found && is_nes_name(src + pos + 46, name_len))) {
+            entry = pos;
+            found = is_nes_name(src + pos + 46, name_len);
+        }
+        pos += 46 + name_len + get_u16(src + pos + 30) + get_u16(src + pos + 32);
+    }
+    if (!entries)
+        return 1;
+
+    csize = get_u32(src + entry + 20);
+    usize = get_u32(src + entry + 24);
+    pos = get_u32(src + entry + 42);
+    if (pos + 30 > len || get_u32(src + pos) != 0x04034b50)
+        return 1;
+    local = src + pos;
+    data = pos + 30 + get_u16(local + 26) + get_u16(local + 28);
+    if (data + csize > len)
+        return 1;
+
+    switch (get_u16(src + entry + 10)) {
+    case 0:
+        if (csize != usize || !(image->data = malloc(usize ? usize : 1)))
+            return 1;
+        memcpy(image->data, src + data, usize);
+        image->size = usize;
+        return 0;
+    case 8:
+        return inflate_member(image, src + data, csize, get_u32(src + entry + 16), usize);
+    default:
+        fprintf(stderr, "%s: unsupported compression method\n", image->path);
+        return 1;
+    }
+}
+
+static struct rom_image *load_image(const char *path)
+{
+    struct rom_image *image = calloc(1, sizeof(*image));
+    struct stat st;
+    uint8_t *src;
+    int fd, ret;
+
+    if (!image || !(image->path = strdup(path)))
+        goto error;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        goto error;
+    if (fstat(fd, &st) || !st.st_size) {
+        close(fd);
+        goto error;
+    }
+    src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (src == MAP_FAILED)
+        goto error;
+
+    if (st.st_size >= 2 && src[0] == 0x1f && src[1] == 0x8b) {
+        ret = load_gzip(image, src, st.st_size);
+    } else if (st.st_size >= 4 && get_u32(src) == 0x04034b50) {
+        ret = load_zip(image, src, st.st_size);
+    } else {
+        // plain image, the mapping itself is the ROM
+        image->data = src;
+        image->size = st.st_size;
+        image->mapped = true;
+        return image;
+    }
+    munmap(src, st.st_size);
+    if (ret)
+        goto error;
+    return image;
+
+error:
+    if (image)
+        free(image->path);
+    free(image);
+    return NULL;
+}
+
+static void free_image(struct rom_image *image)
+{
+    if (image->mapped)
+        munmap(image->data, image->size);
+    else
+        free(image->data);
+    free(image->path);
+    free(image);
+}
+
+const struct rom_image *romstore_open(const char *path)
+{
+    struct rom_image *image, *loaded;
+    char key[PATH_MAX];
+
+    if (!realpath(path, key))
+        return NULL;
+
+    pthread_mutex_lock(&lock);
+    for (image = images; image; image = image->next) {
+        if (!strcmp(image->path, key)) {
+            image->refs++;
+            pthread_mutex_unlock(&lock);
+            return image;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    // load without holding the lock, other threads may open other ROMs
+    loaded = load_image(key);
+    if (!loaded)
+        return NULL;
+
+    pthread_mutex_lock(&lock);
+    for (image = images; image; image = image->next)
+        if (!strcmp(image->path, key))
+            break;
+    if (image) {
+        // somebody else was faster
+        free_image(loaded);
+    } else {
+        image = loaded;
+        image->next = images;
+        images = image;
+    }
+    image->refs++;
+    pthread_mutex_unlock(&lock);
+    return image;
+}
+
+/* Plain images are unmapped with their last user, the page cache keeps
+   them warm anyway. Inflated ones stay until romstore_flush().
+*/
+void romstore_close(const struct rom_image *image)
+{
+    struct rom_image **p;
+
+    if (!image)
+        return;
+    pthread_mutex_lock(&lock);
+    for (p = &images; *p; p = &(*p)->next) {
+        if (*p == image) {
+            if (!--(*p)->refs && (*p)->mapped) {
+                *p = image->next;
+                free_image((struct rom_image *)image);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void romstore_flush(void)
+{
+    struct rom_image **p = &images, *image;
+
+    pthread_mutex_lock(&lock);
+    while ((image = *p)) {
+        if (!image->refs) {
+            *p = image->next;
+            free_image(image);
+        } else {
+            p = &image->next;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "common.h"
+
+/* A ROM image(iNES header included) shared by every cart loaded from the
+   same path in this process. Plain files are mapped read-only and unmapped
+   with their last user. .gz and .zip files are inflated once into memory
+   and stay cached until romstore_flush(), even when no cart uses them.
+*/
+struct rom_image {
+    char *path;
+    uint8_t *data;
+    size_t size;
+    bool mapped;
+    int refs;
+    struct rom_image *next;
+};
+
+const struct rom_image *romstore_open(const char *path);
+void romstore_close(const struct rom_image *image);
+void romstore_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+#include "tilecache.h"
+#include "pixel.h"
+
+/* 2bpp planar to one byte per pixel, only done on the first use of a tile
+   after it was mapped or written */
+void tilecache_decode(struct ppu *ppu, int page, int tile, bool flip)
+{
+    pixel_decode_tile(ppu->page[page] + tile * 16, ppu->tiles.pixels[flip][page][tile], flip);
+    ppu->tiles.valid[flip][page] |= 1ULL << tile;
+}
+
+/* a CHR bank switch */
+void tilecache_invalidate_page(struct ppu *ppu, int page)
+{
+    ppu->tiles.valid[0][page] = ppu->tiles.valid[1][page] = 0;
+    ppu->tiles.version++;
+    ppu->view_dirty.chr = true;
+}
+
+/* a CHR RAM write, in every window the written bank is mapped to */
+void tilecache_invalidate_tile(struct ppu *ppu, uint16_t addr)
+{
+    const uint8_t *bank = ppu->page[(addr >> 10) & 0x07];
+    uint64_t bit = ~(1ULL << ((addr >> 4) & 0x3f));
+
+    ppu->tiles.version++;
+    ppu->view_dirty.chr = true;
+    for (int i = 0; i < 8; i++) {
+        if (ppu->page[i] == bank) {
+            ppu->tiles.valid[0][i] &= bit;
+            ppu->tiles.valid[1][i] &= bit;
+        }
+    }
+}
+
+void tilecache_invalidate_all(struct ppu *ppu)
+{
+    memset(ppu->tiles.valid, 0, sizeof(ppu->tiles.valid));
+    ppu->tiles.version++;
+    ppu->view_dirty.chr = true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+void tilecache_decode(struct ppu *ppu, int page, int tile, bool flip);
+void tilecache_invalidate_page(struct ppu *ppu, int page);
+void tilecache_invalidate_tile(struct ppu *ppu, uint16_t addr);
+void tilecache_invalidate_all(struct ppu *ppu);
+
+/* The pattern table tile at addr($0000-$1fff, the low 4 bits are ignored)
+   as 8 rows of 8 pixels(0-3), mirrored left to right if flip.
+*/
+static inline const uint8_t *tilecache_tile(struct ppu *ppu, uint16_t addr, bool flip)
+{
+    int page = (addr >> 10) & 0x07, tile = (addr >> 4) & 0x3f;
+
+    if (!((ppu->tiles.valid[flip][page] >> tile) & 0x01))
+        tilecache_decode(ppu, page, tile, flip);
+    return ppu->tiles.pixels[flip][page][tile];
+}
+
+/* a tile through colors[] into 8 rows of dst, pitch pixels apart */
+static inline void tilecache_blit(struct ppu *ppu, uint16_t addr, bool flip_x, bool flip_y, const uint32_t *colors,
+                                  uint32_t *dst, int pitch)
+{
+    const uint8_t *pixels = tilecache_tile(ppu, addr, flip_x), *row;
+
+    for (int y = 0; y < 8; y++, dst += pitch) {
+        row = pixels + ((flip_y) ? 7 - y : y) * 8;
+        for (int x = 0; x < 8; x++)
+            dst[x] = colors[row[x]];
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,262 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "upscale.h"
+#include "pixel.h"
+
+/* a line of the padded frame: 16 bytes on each side keep it aligned */
+#define PAD             16
+#define PADDED_PITCH    (PAD + SCREEN_WIDTH + PAD)
+
+struct upscaler {
+    enum UPSCALE_FILTER filter;
+    int scale;
+    uint32_t colors[8][64];
+
+    /* upscale_frame()'s: the frame with a border of its edge pixels, the
+       kernels read one past each side, and the lines in between */
+    uint8_t padded[SCREEN_HEIGHT + 2][PADDED_PITCH];
+    uint8_t lines[3][SCREEN_WIDTH * 3];
+    uint32_t rgba[SCREEN_WIDTH * 2];
+
+    pthread_t thread;
+    sem_t wake;
+    _Atomic bool busy;
+    _Atomic bool quit;
+    uint8_t frame[SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint8_t emphasis[SCREEN_HEIGHT];
+
+    /* the worker's output, fresh until upscale_unlock() */
+    pthread_mutex_t lock;
+    uint32_t *pixels;
+    bool fresh;
+
+    uint64_t frames;
+    uint64_t dropped;
+    _Atomic uint64_t upscaled;
+    _Atomic uint64_t last_ns;
+    _Atomic uint64_t total_ns;
+};
+
+static void pad(struct upscaler *up, const uint8_t *frame)
+{
+    uint8_t *line;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        line = up->padded[y + 1] + PAD;
+        memcpy(line, frame + y * SCREEN_WIDTH, SCREEN_WIDTH);
+        line[-1] = line[0];
+        line[SCREEN_WIDTH] = line[SCREEN_WIDTH - 1];
+    }
+    memcpy(up->padded[0], up->padded[1], PADDED_PITCH);
+    memcpy(up->padded[SCREEN_HEIGHT + 1], up->padded[SCREEN_HEIGHT], PADDED_PITCH);
+}
+
+static uint32_t *output_row(uint32_t *pixels, int pitch, int y)
+{
+    return (uint32_t *)((uint8_t *)pixels + (size_t)y * pitch);
+}
+
+/* the line through the LUT once, then repeated sideways and down */
+static void nearest(struct upscaler *up, const uint8_t *line, const uint32_t *colors, int scale, uint32_t *pixels,
+                    int pitch, int y)
+{
+    const struct pixel_kernels *k = pixel_kernels();
+    uint32_t *out = output_row(pixels, pitch, y);
+
+    if (scale == 1) {
+        k->to_rgba(line, colors, out, SCREEN_WIDTH);
+        return;
+    }
+    k->to_rgba(line, colors, up->rgba, SCREEN_WIDTH);
+    for (int x = 0; x < SCREEN_WIDTH; x++)
+        for (int i = 0; i < scale; i++)
+            out[x * scale + i] = up->rgba[x];
+    for (int i = 1; i < scale; i++)
+        memcpy(output_row(pixels, pitch, y + i), out, SCREEN_WIDTH * scale * sizeof(*out));
+}
+
+/* The whole frame into pixels(upscale_width() x upscale_height(), pitch in
+   bytes), on the calling thread: not while frames are submitted. Each line
+   takes the colors of its emphasis. */
+void upscale_frame(struct upscaler *up, const uint8_t *frame, const uint8_t *emphasis, uint32_t *pixels,
+                   int pitch)
+{
+    const struct pixel_kernels *k = pixel_kernels();
+    uint8_t *lines[3] = { up->lines[0], up->lines[1], up->lines[2] };
+    const uint8_t *rows[3];
+    const uint32_t *colors;
+    uint32_t *out;
+    int scale = up->scale;
+
+    pad(up, frame);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int r = 0; r < 3; r++)
+            rows[r] = up->padded[y + r] + PAD;
+        colors = up->colors[emphasis[y] & 0x07];
+        switch (up->filter) {
+        case UPSCALE_NEAREST:
+            nearest(up, rows[1], colors, scale, pixels, pitch, y * scale);
+            break;
+        case UPSCALE_SCALE2X:
+        case UPSCALE_SCALE3X:
+            if (up->filter == UPSCALE_SCALE2X)
+                k->scale2x(rows, lines, SCREEN_WIDTH);
+            else
+                k->scale3x(rows, lines, SCREEN_WIDTH);
+            for (int r = 0; r < scale; r++)
+                k->to_rgba(lines[r], colors, output_row(pixels, pitch, y * scale + r), SCREEN_WIDTH * scale);
+            break;
+        case UPSCALE_XBR2X:
+            // the pixels doubled, then half of the color of each corner
+            k->xbr2x(rows, lines, SCREEN_WIDTH);
+            nearest(up, rows[1], colors, 2, pixels, pitch, y * 2);
+            for (int r = 0; r < 2; r++) {
+                out = output_row(pixels, pitch, y * 2 + r);
+                k->to_rgba(lines[r], colors, up->rgba, SCREEN_WIDTH * 2);
+                k->blend(out, up->rgba, out, SCREEN_WIDTH * 2);
+            }
+            break;
+        }
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *worker(void *arg)
+{
+    struct upscaler *up = arg;
+    uint64_t start, ns;
+
+    for (;;) {
+        sem_wait(&up->wake);
+        if (atomic_load_explicit(&up->quit, memory_order_acquire))
+            break;
+        pthread_mutex_lock(&up->lock);
+        start = now_ns();
+        upscale_frame(up, up->frame, up->emphasis, up->pixels, upscale_width(up) * sizeof(uint32_t));
+        ns = now_ns() - start;
+        up->fresh = true;
+        atomic_store_explicit(&up->last_ns, ns, memory_order_relaxed);
+        atomic_fetch_add_explicit(&up->total_ns, ns, memory_order_relaxed);
+        atomic_fetch_add_explicit(&up->upscaled, 1, memory_order_relaxed);
+        // idle before the frame is handed out: whoever locks it can submit
+        // the next one
+        atomic_store_explicit(&up->busy, false, memory_order_release);
+        pthread_mutex_unlock(&up->lock);
+    }
+    return NULL;
+}
+
+/* scale is the nearest filter's, the others have their own. They average
+   whole bytes, the LUT must be RGBA8888 or ARGB8888, its colors are
+   copied. */
+struct upscaler *upscale_create(enum UPSCALE_FILTER filter, int scale, const struct palette_lut *lut)
+{
+    struct upscaler *up;
+
+    if (filter == UPSCALE_SCALE2X || filter == UPSCALE_XBR2X)
+        scale = 2;
+    else if (filter == UPSCALE_SCALE3X)
+        scale = 3;
+    if (filter > UPSCALE_XBR2X || scale < 1 || scale > UPSCALE_MAX_SCALE ||
+        (lut->format != PIXEL_RGBA8888 && lut->format != PIXEL_ARGB8888)) {
+        fprintf(stderr, "upscaler %d at %dx on format %d isn't supported\n", filter, scale, lut->format);
+        return NULL;
+    }
+    if (!(up = calloc(1, sizeof(*up))) ||
+        !(up->pixels = malloc((size_t)SCREEN_WIDTH * SCREEN_HEIGHT * scale * scale * sizeof(uint32_t)))) {
+        fprintf(stderr, "upscaler: out of memory\n");
+        free(up);
+        return NULL;
+    }
+    up->filter = filter;
+    up->scale = scale;
+    memcpy(up->colors, lut->colors, sizeof(up->colors));
+    pthread_mutex_init(&up->lock, NULL);
+    sem_init(&up->wake, 0, 0);
+    if (pthread_create(&up->thread, NULL, worker, up)) {
+        fprintf(stderr, "upscaler: failed to start the worker\n");
+        sem_destroy(&up->wake);
+        pthread_mutex_destroy(&up->lock);
+        free(up->pixels);
+        free(up);
+        return NULL;
+    }
+    return up;
+}
+
+void upscale_destroy(struct upscaler *up)
+{
+    if (!up)
+        return;
+    atomic_store_explicit(&up->quit, true, memory_order_release);
+    sem_post(&up->wake);
+    pthread_join(up->thread, NULL);
+    sem_destroy(&up->wake);
+    pthread_mutex_destroy(&up->lock);
+    free(up->pixels);
+    free(up);
+}
+
+int upscale_width(const struct upscaler *up)
+{
+    return SCREEN_WIDTH * up->scale;
+}
+
+int upscale_height(const struct upscaler *up)
+{
+    return SCREEN_HEIGHT * up->scale;
+}
+
+/* emulation thread, never waits: false if the frame was dropped */
+bool upscale_submit(struct upscaler *up, const uint8_t *frame, const uint8_t *emphasis)
+{
+    up->frames++;
+    if (atomic_load_explicit(&up->busy, memory_order_acquire)) {
+        up->dropped++;
+        return false;
+    }
+    memcpy(up->frame, frame, sizeof(up->frame));
+    memcpy(up->emphasis, emphasis, sizeof(up->emphasis));
+    atomic_store_explicit(&up->busy, true, memory_order_release);
+    sem_post(&up->wake);
+    return true;
+}
+
+/* GUI thread, upscale_width() pixels a row */
+const uint32_t *upscale_lock(struct upscaler *up)
+{
+    if (pthread_mutex_trylock(&up->lock))
+        return NULL;
+    if (!up->fresh) {
+        pthread_mutex_unlock(&up->lock);
+        return NULL;
+    }
+    return up->pixels;
+}
+
+void upscale_unlock(struct upscaler *up)
+{
+    up->fresh = false;
+    pthread_mutex_unlock(&up->lock);
+}
+
+void upscale_get_stats(struct upscaler *up, struct upscale_stats *stats)
+{
+    uint64_t upscaled = atomic_load_explicit(&up->upscaled, memory_order_relaxed);
+    uint64_t total_ns = atomic_load_explicit(&up->total_ns, memory_order_relaxed);
+
+    stats->frames = up->frames;
+    stats->dropped = up->dropped;
+    stats->upscaled = upscaled;
+    stats->last_ms = atomic_load_explicit(&up->last_ns, memory_order_relaxed) / 1e6;
+    stats->average_ms = (upscaled) ? total_ns / 1e6 / upscaled : 0;
+}
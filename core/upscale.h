@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "nes.h"
+
+#define UPSCALE_MAX_SCALE       8
+
+/* Pixel art upscalers for indexed frames(see PIXEL_INDEXED8), on a worker
+   thread. They work on the color indexes, 16 or 32 at a time with the
+   pixel kernels(see pixel.h), and only the output goes through the LUT.
+
+   UPSCALE_NEAREST     every pixel scale x scale times, scale 1-8
+   UPSCALE_SCALE2X     Scale2x(AdvMAME2x): 2x2, a corner of a pixel takes
+                       the color of the two neighbors it touches when they
+                       are equal and the other two aren't
+   UPSCALE_SCALE3X     Scale3x(AdvMAME3x): 3x3, the same corners and edges
+                       that follow them
+   UPSCALE_XBR2X       xBR-lite: 2x2, the Scale2x corners blended half and
+                       half with the pixel instead of replacing it, and left
+                       alone where the pixel goes on diagonally(a 1 pixel
+                       line through the corner)
+
+   upscale_submit() is called by the emulation thread, once a frame: it
+   copies the frame for the worker when it's idle and drops it when it's
+   busy, the emulation never waits. upscale_lock() hands the last upscaled
+   frame to the front end, NULL while the worker writes it or if it's
+   already been handed.
+*/
+enum UPSCALE_FILTER {
+    UPSCALE_NEAREST,
+    UPSCALE_SCALE2X,
+    UPSCALE_SCALE3X,
+    UPSCALE_XBR2X,
+};
+
+struct upscale_stats {
+    uint64_t frames;            /* submitted */
+    uint64_t dropped;           /* the worker was busy */
+    uint64_t upscaled;
+    double last_ms;             /* the worker's time for the last one */
+    double average_ms;
+};
+
+struct upscaler;
+
+struct upscaler *upscale_create(enum UPSCALE_FILTER filter, int scale, const struct palette_lut *lut);
+void upscale_destroy(struct upscaler *up);
+int upscale_width(const struct upscaler *up);
+int upscale_height(const struct upscaler *up);
+void upscale_frame(struct upscaler *up, const uint8_t *frame, const uint8_t *emphasis, uint32_t *pixels,
+                   int pitch);
+bool upscale_submit(struct upscaler *up, const uint8_t *frame, const uint8_t *emphasis);
+const uint32_t *upscale_lock(struct upscaler *up);
+void upscale_unlock(struct upscaler *up);
+void upscale_get_stats(struct upscaler *up, struct upscale_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,6 +4,7 @@
 #include "nes.h"
 #include "cpu.h"
 #include "cart.h"
+#include "palette.h"
 #include "render.h"
 #include "utils.h"
 #include <SDL2/SDL.h>
@@ -16,6 +17,8 @@ int main(int argc, char*argv[])
 {
     struct gui gui;
     struct nes nes;
+    static uint8_t frame[SCREEN_WIDTH * SCREEN_HEIGHT];
+    static struct palette_lut screen_lut;
 
     sdl_setup(&gui);
     gui_setup(&gui);
@@ -23,8 +26,19 @@ int main(int argc, char*argv[])
     // setup NES system
     cpu_at_power_up(&nes);
     ppu_at_power_up(&nes);
-    cart_load(&nes, argv[1]);
+    palette_reset(&screen_lut, PIXEL_RGBA8888);     // the screen texture
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <rom> [palette.pal]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (cart_load(&nes, argv[1]) || (argc > 2 && palette_load(&screen_lut, argv[2])))
+        return EXIT_FAILURE;
     cart_print_info(&nes.cart.info);
+    gui.view = ppuview_create(&screen_lut);
+    gui.screen_lut = &screen_lut;
+    nes.ppu.render_mode = RENDER_SCANLINE;
+    nes.ppu.framebuffer = frame;
+    uint64_t frames = 0;
     nes.cache_size = 0;
     nes.step = false;
     nes.cpu.pc = 0xc000;
@@ -50,17 +64,50 @@ int main(int argc, char*argv[])
             cpu_step(&nes);
         }
  
-        for (int y = 0; y < 16; y++) {
-            for (int x = 0; x < 32; x++) {
-                parse_pattern_table_entry(&nes, gui.debug_buffer, x, y);
+        // only the 16 line bands that changed since the last frame
+        if (nes.ppu.frames != frames) {
+            uint16_t bands = (gui.refresh_screen) ? (1 << (SCREEN_HEIGHT / DIRTY_BAND_LINES)) - 1 :
+                                                    nes.ppu.dirty_bands;
+            gui.refresh_screen = false;
+            if (gui.ntsc) {
+                ntsc_update(&gui, frame, nes.ppu.emphasis, nes.ppu.frames, bands);
+            } else if (gui.upscaler) {
+                // the whole frame on the upscaler's worker, again next time if it was dropped
+                if (bands && !upscale_submit(gui.upscaler, frame, nes.ppu.emphasis))
+                    gui.refresh_screen = true;
+            } else {
+                for (int band = 0; band < SCREEN_HEIGHT / DIRTY_BAND_LINES; band++) {
+                    if (!((bands >> band) & 0x01))
+                        continue;
+                    int y = band * DIRTY_BAND_LINES;
+                    SDL_Rect rect = { 0, y, SCREEN_WIDTH, DIRTY_BAND_LINES };
+                    for (int line = y; line < y + DIRTY_BAND_LINES; line++)
+                        palette_convert(&screen_lut, frame + line * SCREEN_WIDTH, nes.ppu.emphasis[line],
+                                        gui.screen_buffer, line * SCREEN_WIDTH, SCREEN_WIDTH);
+                    SDL_UpdateTexture(gui.screen_texture, &rect, gui.screen_buffer + y * SCREEN_WIDTH,
+                                      SCREEN_WIDTH * 4);
+                }
             }
+            if (gui.capture)
+                capture_frame(gui.capture, frame, nes.ppu.emphasis);
+            frames = nes.ppu.frames;
+            if (gui.view)
+                ppuview_submit(gui.view, &nes.ppu);
+        } else if (gui.view && nes.run_mode != NORMAL) {
+            // stepping: the writes of every instruction
+            ppuview_submit(gui.view, &nes.ppu);
         }
-        SDL_UpdateTexture(gui.debug_texture, NULL, gui.debug_buffer, PATTERN_TABLE_WIDTH * 4);
+
+        pattern_table_update(&gui, &nes, &screen_lut);
 
         disassemble(&nes, gui.instr_table);
         render(&gui, &nes);
     }
 
+    if (gui.capture)
+        capture_close(gui.capture, NULL);
+    render_thread_stop(&nes);
+    cart_unload(&nes);
     gui_destroy();
     sdl_destroy(&gui);
     return 0;
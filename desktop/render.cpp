@@ -56,10 +56,41 @@ void sdl_setup(struct gui *gui)
         printf("Malloc error\n");
         return;
     }
+
+    gui->nametable_texture = SDL_CreateTexture(gui->renderer, SDL_PIXELFORMAT_RGBA8888,
+                            SDL_TEXTUREACCESS_STREAMING, PPUVIEW_NAMETABLE_WIDTH, PPUVIEW_NAMETABLE_HEIGHT);
+    gui->sprite_texture = SDL_CreateTexture(gui->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                            PPUVIEW_SPRITES_WIDTH, PPUVIEW_SPRITES_HEIGHT);
+    gui->palette_texture = SDL_CreateTexture(gui->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                            16, 2);
+    if (!gui->nametable_texture || !gui->sprite_texture || !gui->palette_texture) {
+        SDL_Log("Error - SDL_CreateTexture: %s\n", SDL_GetError());
+        return;
+    }
+    SDL_SetTextureBlendMode(gui->sprite_texture, SDL_BLENDMODE_BLEND);
 }
 
 void gui_setup(struct gui *gui)
 {
+    gui->capture = NULL;
+    gui->ntsc = NULL;
+    gui->ntsc_texture = NULL;
+    gui->ntsc_scale = 2;
+    gui->ntsc_merge_fields = true;
+    gui->upscaler = NULL;
+    gui->upscale_texture = NULL;
+    gui->upscale_filter = 0;
+    gui->upscale_scale = 3;
+    gui->upscale_ready = false;
+    gui->screen_lut = NULL;
+    gui->refresh_screen = false;
+    gui->pattern_palette = -1;
+    gui->pattern_drawn = false;
+    gui->view = NULL;
+    memset(gui->view_oam, 0, sizeof(gui->view_oam));
+    gui->view_scroll_x = 0;
+    gui->view_scroll_y = 0;
+
     // setup Dear ImGui context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -90,11 +121,183 @@ void gui_destroy(void)
 
 void sdl_destroy(struct gui *gui)
 {
+    ntsc_destroy(gui->ntsc);
+    if (gui->ntsc_texture)
+        SDL_DestroyTexture(gui->ntsc_texture);
+    upscale_destroy(gui->upscaler);
+    if (gui->upscale_texture)
+        SDL_DestroyTexture(gui->upscale_texture);
+    ppuview_destroy(gui->view);
+    SDL_DestroyTexture(gui->nametable_texture);
+    SDL_DestroyTexture(gui->sprite_texture);
+    SDL_DestroyTexture(gui->palette_texture);
     SDL_DestroyRenderer(gui->renderer);
     SDL_DestroyWindow(gui->window);
     SDL_Quit();
 }
 
+/* a filter and a texture for the current options, none if off */
+static void ntsc_setup(struct gui *gui, bool on)
+{
+    ntsc_destroy(gui->ntsc);
+    gui->ntsc = NULL;
+    if (gui->ntsc_texture)
+        SDL_DestroyTexture(gui->ntsc_texture);
+    gui->ntsc_texture = NULL;
+    // the texture shown next missed the frames in between
+    gui->refresh_screen = true;
+    if (!on)
+        return;
+    gui->ntsc = ntsc_create(gui->ntsc_scale, gui->ntsc_merge_fields, PIXEL_RGBA8888);
+    if (!gui->ntsc)
+        return;
+    gui->ntsc_texture = SDL_CreateTexture(gui->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                          ntsc_width(gui->ntsc), SCREEN_HEIGHT);
+    if (!gui->ntsc_texture) {
+        SDL_Log("Error - SDL_CreateTexture: %s\n", SDL_GetError());
+        ntsc_destroy(gui->ntsc);
+        gui->ntsc = NULL;
+    }
+}
+
+/* Filters the bands that changed straight into the locked texture. Without
+   merged fields the phase changes every frame and so does every band. */
+void ntsc_update(struct gui *gui, const uint8_t *frame, const uint8_t *emphasis, uint64_t frames,
+                 uint16_t bands)
+{
+    void *pixels;
+    int pitch;
+
+    if (!ntsc_merge_fields(gui->ntsc))
+        bands = (1 << (SCREEN_HEIGHT / DIRTY_BAND_LINES)) - 1;
+    for (int band = 0; band < SCREEN_HEIGHT / DIRTY_BAND_LINES; band++) {
+        if (!((bands >> band) & 0x01))
+            continue;
+        SDL_Rect rect = { 0, band * DIRTY_BAND_LINES, ntsc_width(gui->ntsc), DIRTY_BAND_LINES };
+        if (SDL_LockTexture(gui->ntsc_texture, &rect, &pixels, &pitch))
+            continue;
+        ntsc_filter_lines(gui->ntsc, frame, emphasis, frames, rect.y, DIRTY_BAND_LINES, pixels, pitch);
+        SDL_UnlockTexture(gui->ntsc_texture);
+    }
+}
+
+/* an upscaler and a texture for the current options, none if off */
+static void upscale_setup(struct gui *gui)
+{
+    upscale_destroy(gui->upscaler);
+    gui->upscaler = NULL;
+    if (gui->upscale_texture)
+        SDL_DestroyTexture(gui->upscale_texture);
+    gui->upscale_texture = NULL;
+    gui->upscale_ready = false;
+    // the next frame goes to the upscaler, or back to the screen texture
+    gui->refresh_screen = true;
+    if (!gui->upscale_filter)
+        return;
+    gui->upscaler = upscale_create((enum UPSCALE_FILTER)(gui->upscale_filter - 1), gui->upscale_scale,
+                                   gui->screen_lut);
+    if (!gui->upscaler)
+        return;
+    gui->upscale_texture = SDL_CreateTexture(gui->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                             upscale_width(gui->upscaler), upscale_height(gui->upscaler));
+    if (!gui->upscale_texture) {
+        SDL_Log("Error - SDL_CreateTexture: %s\n", SDL_GetError());
+        upscale_destroy(gui->upscaler);
+        gui->upscaler = NULL;
+        return;
+    }
+    // shown 1:1, or whole multiples of it
+    SDL_SetTextureScaleMode(gui->upscale_texture, SDL_ScaleModeNearest);
+}
+
+/* Uploads the upscaler's last frame, unless its worker is writing it right
+   now: then it's done on the next GUI frame. */
+static void upscale_update(struct gui *gui)
+{
+    const uint32_t *pixels;
+
+    if (!gui->upscaler || !(pixels = upscale_lock(gui->upscaler)))
+        return;
+    SDL_UpdateTexture(gui->upscale_texture, NULL, pixels, upscale_width(gui->upscaler) * 4);
+    upscale_unlock(gui->upscaler);
+    gui->upscale_ready = true;
+}
+
+/* Uploads what the view's worker redrew since the last time, unless it's
+   drawing right now: then it's done on the next GUI frame. */
+static void ppuview_update(struct gui *gui)
+{
+    struct ppu_view_images *images;
+    uint64_t rows;
+    int first;
+
+    if (!gui->view || !(images = ppuview_lock(gui->view)))
+        return;
+    // runs of 8 line rows in one go
+    rows = images->nametable_rows;
+    for (int row = 0; row < PPUVIEW_NAMETABLE_HEIGHT / 8; row++) {
+        if (!((rows >> row) & 0x01))
+            continue;
+        for (first = row; row + 1 < PPUVIEW_NAMETABLE_HEIGHT / 8 && ((rows >> (row + 1)) & 0x01); row++)
+            ;
+        SDL_Rect rect = { 0, first * 8, PPUVIEW_NAMETABLE_WIDTH, (row - first + 1) * 8 };
+        SDL_UpdateTexture(gui->nametable_texture, &rect, images->nametables[first * 8],
+                          PPUVIEW_NAMETABLE_WIDTH * 4);
+    }
+    if (images->sprites_changed)
+        SDL_UpdateTexture(gui->sprite_texture, NULL, images->sprites, PPUVIEW_SPRITES_WIDTH * 4);
+    if (images->palette_changed)
+        SDL_UpdateTexture(gui->palette_texture, NULL, images->palette, 16 * 4);
+    memcpy(gui->view_oam, images->oam, sizeof(gui->view_oam));
+    gui->view_scroll_x = images->scroll_x;
+    gui->view_scroll_y = images->scroll_y;
+    ppuview_unlock(gui->view);
+}
+
+/* the 4 nametables with the screen's viewport, wrapping around */
+static void nametable_window(struct gui *gui)
+{
+    ImGui::Begin("Nametables");
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::Image((ImTextureID)gui->nametable_texture, ImVec2(PPUVIEW_NAMETABLE_WIDTH, PPUVIEW_NAMETABLE_HEIGHT));
+    ImDrawList *draw_list = ImGui::GetWindowDrawList();
+    for (int dy = 0; dy < 2; dy++) {
+        for (int dx = 0; dx < 2; dx++) {
+            int x = gui->view_scroll_x - dx * PPUVIEW_NAMETABLE_WIDTH;
+            int y = gui->view_scroll_y - dy * PPUVIEW_NAMETABLE_HEIGHT;
+            int x0 = (x > 0) ? x : 0, y0 = (y > 0) ? y : 0;
+            int x1 = (x + SCREEN_WIDTH < PPUVIEW_NAMETABLE_WIDTH) ? x + SCREEN_WIDTH : PPUVIEW_NAMETABLE_WIDTH;
+            int y1 = (y + SCREEN_HEIGHT < PPUVIEW_NAMETABLE_HEIGHT) ? y + SCREEN_HEIGHT : PPUVIEW_NAMETABLE_HEIGHT;
+            if (x0 < x1 && y0 < y1)
+                draw_list->AddRect(ImVec2(origin.x + x0, origin.y + y0), ImVec2(origin.x + x1, origin.y + y1),
+                                   IM_COL32(155, 188, 15, 255));
+        }
+    }
+    ImGui::Text("scroll %d, %d", gui->view_scroll_x, gui->view_scroll_y);
+    ImGui::End();
+}
+
+static void sprite_window(struct gui *gui)
+{
+    const uint8_t *oam;
+
+    ImGui::Begin("Sprites");
+    ImGui::Image((ImTextureID)gui->sprite_texture, ImVec2(PPUVIEW_SPRITES_WIDTH * 3, PPUVIEW_SPRITES_HEIGHT * 3));
+    ImGui::SameLine();
+    ImGui::BeginChild("OAM", ImVec2(0, PPUVIEW_SPRITES_HEIGHT * 3));
+    for (int i = 0; i < 64; i++) {
+        oam = gui->view_oam + i * 4;
+        ImGui::Text("%2d: x %3d y %3d tile %02x pal %d %s%s%s", i, oam[3], oam[0], oam[1], oam[2] & 0x03,
+                    (oam[2] & 0x20) ? "B" : "-", (oam[2] & 0x40) ? "H" : "-", (oam[2] & 0x80) ? "V" : "-");
+    }
+    ImGui::EndChild();
+    ImGui::End();
+
+    ImGui::Begin("Palette");
+    ImGui::Image((ImTextureID)gui->palette_texture, ImVec2(16 * 16, 2 * 16));
+    ImGui::End();
+}
+
 void render(struct gui *gui, struct nes *nes)
 {
     static int pause = 0;
@@ -113,11 +316,26 @@ void render(struct gui *gui, struct nes *nes)
     // PPU pattern table    
     ImGui::Begin("Pattern table");
     ImGui::Image((ImTextureID)gui->debug_texture, ImVec2(512, 256));
+    ImGui::SliderInt("palette", &gui->pattern_palette, -1, 7, (gui->pattern_palette < 0) ? "default" : "%d");
     ImGui::End();
 
+    ppuview_update(gui);
+    nametable_window(gui);
+    sprite_window(gui);
+
     // PPU screen
+    upscale_update(gui);
     ImGui::Begin("Screen");
-    ImGui::Image((ImTextureID)gui->screen_texture, ImVec2(512, 480));
+    if (gui->upscaler && gui->upscale_ready) {
+        struct upscale_stats stats;
+        upscale_get_stats(gui->upscaler, &stats);
+        ImGui::Image((ImTextureID)gui->upscale_texture,
+                     ImVec2(upscale_width(gui->upscaler), upscale_height(gui->upscaler)));
+        ImGui::Text("upscale %.2f ms/frame(%.2f average), %llu dropped", stats.last_ms, stats.average_ms,
+                    (unsigned long long)stats.dropped);
+    } else {
+        ImGui::Image((ImTextureID)((gui->ntsc) ? gui->ntsc_texture : gui->screen_texture), ImVec2(512, 480));
+    }
     ImGui::End();
 
     ImGui::Begin("CPU debug");
@@ -138,6 +356,62 @@ void render(struct gui *gui, struct nes *nes)
             nes->run_mode = NORMAL;
     }
 
+    bool dot_renderer = nes->ppu.render_mode == RENDER_DOT;
+    if (ImGui::Checkbox("dot accurate PPU", &dot_renderer)) {
+        render_thread_stop(nes);
+        nes->ppu.render_mode = (dot_renderer) ? RENDER_DOT : RENDER_SCANLINE;
+    }
+    bool threaded = nes->ppu.render_thread != NULL;
+    if (!dot_renderer && ImGui::Checkbox("render on a thread", &threaded)) {
+        if (threaded)
+            render_thread_start(nes);
+        else
+            render_thread_stop(nes);
+    }
+    bool ntsc = gui->ntsc != NULL;
+    bool ntsc_changed = ImGui::Checkbox("NTSC filter", &ntsc);
+    if (ntsc) {
+        ImGui::SameLine();
+        ntsc_changed |= ImGui::Checkbox("merge fields", &gui->ntsc_merge_fields);
+        ImGui::SameLine();
+        ntsc_changed |= ImGui::RadioButton("512", &gui->ntsc_scale, 2);
+        ImGui::SameLine();
+        ntsc_changed |= ImGui::RadioButton("1024", &gui->ntsc_scale, 4);
+    }
+    if (ntsc_changed) {
+        // one filter at a time
+        if (ntsc && gui->upscaler) {
+            gui->upscale_filter = 0;
+            upscale_setup(gui);
+        }
+        ntsc_setup(gui, ntsc);
+    }
+    bool upscale_changed = ImGui::Combo("upscaler", &gui->upscale_filter,
+                                        "off\0nearest\0scale2x\0scale3x\0xBR-lite\0");
+    if (gui->upscale_filter == UPSCALE_NEAREST + 1)
+        upscale_changed |= ImGui::SliderInt("scale", &gui->upscale_scale, 1, UPSCALE_MAX_SCALE);
+    if (upscale_changed) {
+        if (gui->upscale_filter && gui->ntsc)
+            ntsc_setup(gui, false);
+        upscale_setup(gui);
+    }
+    bool capturing = gui->capture != NULL;
+    if (ImGui::Checkbox("capture to capture.nesv", &capturing)) {
+        if (capturing)
+            gui->capture = capture_open("capture.nesv", CAPTURE_DELTA, 64, &nes->ppu.lut);
+        else {
+            capture_close(gui->capture, NULL);
+            gui->capture = NULL;
+        }
+    }
+    if (gui->capture) {
+        struct capture_stats stats;
+        capture_get_stats(gui->capture, &stats);
+        ImGui::SameLine();
+        ImGui::Text("%llu frames, %llu dropped", (unsigned long long)stats.written,
+                    (unsigned long long)stats.dropped);
+    }
+
     ImGui::SeparatorText("registers");
     ImGui::Text("PC: %04x A: %02x X:%02x Y:%02x P:%02x SP:%02x",
                 nes->cpu.pc, nes->cpu.a, nes->cpu.x, nes->cpu.y, nes->cpu.p, nes->cpu.sp);
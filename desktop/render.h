@@ -6,6 +6,10 @@
 #include <SDL2/SDL.h>
 #include "nes.h"
 #include "cpu.h"
+#include "capture.h"
+#include "ntsc.h"
+#include "ppuview.h"
+#include "upscale.h"
 #include "utils.h"
 
 #define PATTERN_TABLE_WIDTH     256
@@ -28,6 +32,44 @@ struct gui {
 
     /* disassembler */
     char instr_table[14][20];
+
+    /* pattern table viewer: palette 0-7 or -1 for the default colors, and
+       the versions of CHR and the palette it was drawn with */
+    int pattern_palette;
+    int pattern_drawn_palette;
+    bool pattern_drawn;
+    uint32_t pattern_chr_version;
+    uint32_t pattern_palette_version;
+
+    /* every band of the screen on the next frame */
+    bool refresh_screen;
+
+    /* video capture, NULL when off */
+    struct capture *capture;
+
+    /* NTSC filter, NULL when off, into its own texture */
+    struct ntsc_filter *ntsc;
+    SDL_Texture *ntsc_texture;
+    int ntsc_scale;
+    bool ntsc_merge_fields;
+
+    /* pixel art upscaler, NULL when off, into its own texture: filter 0 is
+       off, then UPSCALE_FILTER + 1, and the scale of the nearest one */
+    struct upscaler *upscaler;
+    SDL_Texture *upscale_texture;
+    int upscale_filter;
+    int upscale_scale;
+    bool upscale_ready;
+    const struct palette_lut *screen_lut;
+
+    /* nametable, sprite and palette viewers, drawn on the view's worker */
+    struct ppu_view *view;
+    SDL_Texture *nametable_texture;
+    SDL_Texture *sprite_texture;
+    SDL_Texture *palette_texture;
+    uint8_t view_oam[256];
+    int view_scroll_x;
+    int view_scroll_y;
 };
 
 void sdl_setup(struct gui *gui);
@@ -35,3 +77,5 @@ void gui_setup(struct gui *gui);
 void gui_destroy(void);
 void sdl_destroy(struct gui *gui);
 void render(struct gui *gui, struct nes *nes);
+void ntsc_update(struct gui *gui, const uint8_t *frame, const uint8_t *emphasis, uint64_t frames,
+                 uint16_t bands);
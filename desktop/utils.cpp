@@ -76,18 +76,29 @@ void disassemble(struct nes *nes, char instr_str[13][20])
     nes->cpu.pc = start_pc;
 }
 
-void parse_pattern_table_entry(struct nes *nes, uint32_t *buffer, int x, int y)
+/* Both pattern tables side by side, redrawn only when the CHR they show
+   (contents or banks) or the palette they're drawn in changed: the core
+   bumps a version on every change of either. */
+void pattern_table_update(struct gui *gui, struct nes *nes, const struct palette_lut *lut)
 {
-    uint32_t a, b, offset;
+    int x, y, palette = gui->pattern_palette;
+    uint32_t colors[4];
 
-    offset = (x > 15) ? 4096 - 16 * 16 : 0;
-    for (int i = 0; i < 8; i++) {
-        uint8_t plane_0 = nes->cart.chr_rom[x * 16 + y * 256 + offset + i];
-        uint8_t plane_1 = nes->cart.chr_rom[x * 16 + y * 256 + offset + i + 8];
-        for (int j = 0; j < 8; j++) {
-            uint8_t lb = (plane_1 >> (7 - j)) & 0x01;
-            uint8_t hb = (plane_0 >> (7 - j)) & 0x01;
-            buffer[j + i * PATTERN_TABLE_WIDTH + x * 8 + y * 8 * PATTERN_TABLE_WIDTH] = default_color[(hb << 1) | lb];
-        }
+    if (gui->pattern_drawn && gui->pattern_chr_version == nes->ppu.tiles.version &&
+        gui->pattern_drawn_palette == palette &&
+        (palette < 0 || gui->pattern_palette_version == nes->ppu.palette_version))
+        return;
+    for (int i = 0; i < 4; i++)
+        colors[i] = (palette < 0) ? default_color[i] : lut->colors[0][nes->ppu.palette[ppu_palette_index(palette * 4 + i)]];
+    for (int tile = 0; tile < 512; tile++) {
+        x = (tile >> 8) * 16 + (tile & 0x0f);
+        y = (tile >> 4) & 0x0f;
+        tilecache_blit(&nes->ppu, tile * 16, false, false, colors,
+                       gui->debug_buffer + y * 8 * PATTERN_TABLE_WIDTH + x * 8, PATTERN_TABLE_WIDTH);
     }
+    SDL_UpdateTexture(gui->debug_texture, NULL, gui->debug_buffer, PATTERN_TABLE_WIDTH * 4);
+    gui->pattern_drawn = true;
+    gui->pattern_chr_version = nes->ppu.tiles.version;
+    gui->pattern_palette_version = nes->ppu.palette_version;
+    gui->pattern_drawn_palette = palette;
 }
\ No newline at end of file
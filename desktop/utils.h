@@ -2,7 +2,8 @@
 
 #include "nes.h"
 #include "cpu.h"
+#include "tilecache.h"
 #include "render.h"
 
 void disassemble(struct nes *nes, char instr_str[13][20]);
-void parse_pattern_table_entry(struct nes *nes, uint32_t *buffer, int x, int y);
\ No newline at end of file
+void pattern_table_update(struct gui *gui, struct nes *nes, const struct palette_lut *lut);
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include <unistd.h>
+#include <time.h>
+#include "nes.h"
+#include "palette.h"
+#include "capture.h"
+#include "pixel.h"
+
+#define FRAME_PIXELS    (SCREEN_WIDTH * SCREEN_HEIGHT)
+#define RAW_FRAME       (FRAME_PIXELS + SCREEN_HEIGHT)
+
+static char dir[] = "/tmp/nesla_capture_test_XXXXXX";
+static char path[64];
+static uint8_t frame[FRAME_PIXELS], emphasis[SCREEN_HEIGHT];
+static struct palette_lut lut;
+
+void fail(const char *msg, long long a, long long b)
+{
+    printf("%s: %lld, expected %lld\n", msg, a, b);
+    exit(EXIT_FAILURE);
+}
+
+/* a frame tagged with n in every pixel and line, the raw capture keeps
+   the high bits in the first pixel */
+void make_frame(int n)
+{
+    memset(frame, n & 0x3f, sizeof(frame));
+    memset(emphasis, n & 0x07, sizeof(emphasis));
+    frame[0] = n >> 6;
+}
+
+/* a status bar over a background scrolling a pixel every 4 frames, 8
+   sprites moving every frame and the emphasis changing now and then */
+void make_game_frame(int n)
+{
+    int x0;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            x0 = x + n / 4;
+            frame[y * SCREEN_WIDTH + x] = (y < 32) ? 0x0f : (((x0 >> 4) ^ (y >> 4)) & 0x03) ? 0x21 :
+                                          0x19 + ((x0 ^ y) & 0x01);
+        }
+    }
+    for (int s = 0; s < 8; s++)
+        for (int y = 0; y < 8; y++)
+            memset(frame + (64 + s * 20 + y) * SCREEN_WIDTH + (n * (s + 1)) % 248, 0x16 + s, 8);
+    memset(emphasis, (n / 100) & 0x07, sizeof(emphasis));
+}
+
+uint8_t *read_file(long *size)
+{
+    FILE *fp = fopen(path, "rb");
+    uint8_t *data;
+
+    if (!fp)
+        fail("can't open the capture", 0, 0);
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    rewind(fp);
+    data = malloc(*size + 1);
+    if (fread(data, 1, *size, fp) != *size)
+        fail("short read", 0, *size);
+    fclose(fp);
+    return data;
+}
+
+void test_raw(void)
+{
+    struct capture *cap = capture_open(path, CAPTURE_RAW, 16, &lut);
+    struct capture_stats stats;
+    uint8_t *data;
+    long size;
+
+    for (int n = 0; n < 16; n++) {
+        make_frame(n);
+        frame[100 + n] = 0x3f;
+        if (!capture_frame(cap, frame, emphasis))
+            fail("raw: frame dropped with free slots", n, -1);
+    }
+    if (capture_close(cap, &stats) || stats.written != 16 || stats.dropped)
+        fail("raw: frames written", stats.written, 16);
+    data = read_file(&size);
+    if (size != 16 * RAW_FRAME)
+        fail("raw: size", size, 16 * RAW_FRAME);
+    for (int n = 0; n < 16; n++) {
+        make_frame(n);
+        frame[100 + n] = 0x3f;
+        if (memcmp(data + n * RAW_FRAME, frame, FRAME_PIXELS) ||
+            memcmp(data + n * RAW_FRAME + FRAME_PIXELS, emphasis, SCREEN_HEIGHT))
+            fail("raw: frame differs", n, n);
+    }
+    free(data);
+}
+
+/* white($30) and black($0f) halves, Y/U/V from BT.601 */
+void test_y4m(void)
+{
+    static const char header[] = "YUV4MPEG2 W256 H240 F39375000:655171 Ip A8:7 C444\nFRAME\n";
+    struct capture *cap = capture_open(path, CAPTURE_Y4M, 4, &lut);
+    const uint8_t *planes, *rgb;
+    uint8_t *data;
+    long size;
+    int y, u;
+
+    memset(frame, 0x30, FRAME_PIXELS / 2);
+    memset(frame + FRAME_PIXELS / 2, 0x0f, FRAME_PIXELS / 2);
+    memset(emphasis, 0, sizeof(emphasis));
+    capture_frame(cap, frame, emphasis);
+    capture_frame(cap, frame, emphasis);
+    if (capture_close(cap, NULL))
+        fail("y4m: close", -1, 0);
+    data = read_file(&size);
+    if (size != 2 * (FRAME_PIXELS * 3 + 6) + sizeof(header) - 7)
+        fail("y4m: size", size, 2 * (FRAME_PIXELS * 3 + 6) + sizeof(header) - 7);
+    if (memcmp(data, header, sizeof(header) - 1))
+        fail("y4m: header", 0, 0);
+    planes = data + sizeof(header) - 1;
+    rgb = lut.rgb[0][0x30];
+    y = ((66 * rgb[0] + 129 * rgb[1] + 25 * rgb[2] + 128) >> 8) + 16;
+    if (planes[0] != y || planes[FRAME_PIXELS - 1] != 16)
+        fail("y4m: luma", planes[0], y);
+    u = ((-38 * rgb[0] - 74 * rgb[1] + 112 * rgb[2] + 128) >> 8) + 128;
+    if (planes[FRAME_PIXELS] != u || planes[2 * FRAME_PIXELS - 1] != 128)
+        fail("y4m: chroma", planes[FRAME_PIXELS], u);
+    free(data);
+}
+
+/* A 2 frame ring fed as fast as possible: whatever doesn't fit is dropped
+   rather than waited for, what is written is whole frames in order. */
+void test_drops(void)
+{
+    struct capture *cap = capture_open(path, CAPTURE_RAW, 2, &lut);
+    struct capture_stats stats;
+    struct timespec start, end;
+    double worst = 0, us;
+    uint8_t *data, *frame_data;
+    long size;
+    int last = -1;
+
+    for (int n = 0; n < 500; n++) {
+        make_frame(n);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        capture_frame(cap, frame, emphasis);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        if (us > worst)
+            worst = us;
+    }
+    capture_close(cap, &stats);
+    if (stats.frames != 500 || stats.written + stats.dropped != 500)
+        fail("drops: written + dropped", stats.written + stats.dropped, 500);
+    data = read_file(&size);
+    if (size != stats.written * RAW_FRAME)
+        fail("drops: size", size, stats.written * RAW_FRAME);
+    for (long i = 0; i < stats.written; i++) {
+        frame_data = data + i * RAW_FRAME;
+        for (int p = 2; p < RAW_FRAME; p++)
+            if ((frame_data[p] ^ frame_data[1]) & ((p < FRAME_PIXELS) ? 0x3f : 0x07))
+                fail("drops: torn frame", i, p);
+        if (frame_data[0] * 64 + frame_data[1] <= last)
+            fail("drops: frame out of order", frame_data[0] * 64 + frame_data[1], last);
+        last = frame_data[0] * 64 + frame_data[1];
+    }
+    free(data);
+    printf("500 frames into 2 slots: %llu written, %llu dropped, capture_frame() <= %.1f us\n",
+           (unsigned long long)stats.written, (unsigned long long)stats.dropped, worst);
+}
+
+/* 700 frames: keyframes at 0, 300 and 600, seeks to and in between */
+void test_delta(void)
+{
+    static const int seeks[] = { 0, 1, 299, 300, 301, 650, 42 };
+    static uint8_t decoded[FRAME_PIXELS], decoded_emphasis[SCREEN_HEIGHT];
+    static uint8_t data[DELTA_MAX_RECORD], state[DELTA_FRAME_SIZE];
+    static struct delta_encoder encoder;
+    struct capture *cap = capture_open(path, CAPTURE_DELTA, 64, &lut);
+    struct capture_stats stats;
+    struct delta_reader *reader;
+    int n, ret;
+    long size;
+
+    for (n = 0; n < 700; n++) {
+        make_game_frame(n);
+        while (!capture_frame(cap, frame, emphasis))
+            usleep(100);
+    }
+    if (capture_close(cap, &stats) || stats.written != 700)
+        fail("delta: frames written", stats.written, 700);
+    free(read_file(&size));
+    if (size * 20 > 700L * RAW_FRAME)
+        fail("delta: size", size, 700L * RAW_FRAME / 20);
+
+    if (!(reader = delta_open(path)))
+        fail("delta: open", -1, 0);
+    if (delta_keyframe_interval(reader) != DELTA_KEYFRAME_INTERVAL)
+        fail("delta: keyframe interval", delta_keyframe_interval(reader), DELTA_KEYFRAME_INTERVAL);
+    for (n = 0; (ret = delta_read(reader, decoded, decoded_emphasis)) == 1; n++) {
+        make_game_frame(n);
+        if (memcmp(decoded, frame, FRAME_PIXELS) || memcmp(decoded_emphasis, emphasis, SCREEN_HEIGHT))
+            fail("delta: frame differs", n, n);
+    }
+    if (ret || n != 700)
+        fail("delta: frames read", n, 700);
+    for (int i = 0; i < sizeof(seeks) / sizeof(seeks[0]); i++) {
+        make_game_frame(seeks[i]);
+        if (delta_seek(reader, seeks[i]) || delta_read(reader, decoded, decoded_emphasis) != 1 ||
+            memcmp(decoded, frame, FRAME_PIXELS))
+            fail("delta: seek", seeks[i], seeks[i]);
+        make_game_frame(seeks[i] + 1);
+        if (delta_read(reader, decoded, NULL) != 1 || memcmp(decoded, frame, FRAME_PIXELS))
+            fail("delta: read after seek", seeks[i] + 1, seeks[i] + 1);
+    }
+    if (!delta_seek(reader, 700))
+        fail("delta: seek past the end", 700, -1);
+    delta_close(reader);
+
+    // a frame that doesn't compress, then cut short
+    for (int i = 0; i < FRAME_PIXELS; i++)
+        frame[i] = rand() & 0x3f;
+    delta_encoder_init(&encoder, 0);
+    size = delta_encode(&encoder, frame, emphasis, data);
+    if (size > DELTA_MAX_RECORD)
+        fail("delta: record size", size, DELTA_MAX_RECORD);
+    if (!delta_decode(data + DELTA_RECORD_HEADER_SIZE, size - DELTA_RECORD_HEADER_SIZE - 1, state))
+        fail("delta: truncated data decoded", 0, -1);
+}
+
+void bench_delta(void)
+{
+    static uint8_t frames[60][RAW_FRAME], state[DELTA_FRAME_SIZE];
+    static uint8_t records[60][DELTA_MAX_RECORD];
+    static struct delta_encoder encoder;
+    struct timespec start, end;
+    size_t sizes[60], total = 0;
+    double encode, decode;
+    int rounds = 10;
+
+    for (int n = 0; n < 60; n++) {
+        make_game_frame(n);
+        memcpy(frames[n], frame, FRAME_PIXELS);
+        memcpy(frames[n] + FRAME_PIXELS, emphasis, SCREEN_HEIGHT);
+    }
+    delta_encoder_init(&encoder, 60);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++)
+        for (int n = 0; n < 60; n++)
+            sizes[n] = delta_encode(&encoder, frames[n], frames[n] + FRAME_PIXELS, records[n]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    encode = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        for (int n = 0; n < 60; n++) {
+            if (records[n][0] == 'K')
+                memset(state, 0, sizeof(state));
+            delta_decode(records[n] + DELTA_RECORD_HEADER_SIZE, sizes[n] - DELTA_RECORD_HEADER_SIZE, state);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    decode = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (memcmp(state, frames[59], RAW_FRAME))
+        fail("delta: benchmark frames differ", 0, 0);
+    for (int n = 0; n < 60; n++)
+        total += sizes[n];
+    printf("delta(%s) encode %7.1f frames/s, decode %7.1f frames/s, %.1f:1\n", pixel_kernels()->name,
+           60 * rounds / encode, 60 * rounds / decode, (double)RAW_FRAME * 60 / total);
+}
+
+void bench_capture(capture_format_t format, const char *name)
+{
+    struct capture *cap = capture_open(path, format, 64, &lut);
+    struct capture_stats stats;
+    struct timespec start, end;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int n = 0; n < 600; n++) {
+        make_frame(n);
+        while (!capture_frame(cap, frame, emphasis))
+            usleep(100);
+    }
+    capture_close(cap, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-4s capture %7.1f frames/s\n", name, stats.written / secs);
+}
+
+int main(int argc, char *argv[])
+{
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Can't create %s\n", dir);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, sizeof(path), "%s/capture", dir);
+    palette_reset(&lut, PIXEL_RGBA8888);
+    test_raw();
+    printf("Test raw capture ok\n");
+    test_y4m();
+    printf("Test y4m capture ok\n");
+    test_drops();
+    printf("Test dropped frames ok\n");
+    test_delta();
+    printf("Test delta coded capture ok\n");
+    bench_delta();
+    bench_capture(CAPTURE_RAW, "raw");
+    bench_capture(CAPTURE_Y4M, "y4m");
+    bench_capture(CAPTURE_DELTA, "nesv");
+    unlink(path);
+    rmdir(dir);
+    printf("*******************************************************************\n");
+    return 0;
+}
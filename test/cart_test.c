@@ -0,0 +1,355 @@
+#include <unistd.h>
+#include "nes.h"
+#include "cpu.h"
+#include "cart.h"
+
+static struct nes nes;
+static char dir[] = "/tmp/nesla_cart_test_XXXXXX";
+
+/* the write_rom(path, 0, 0x00) image, gzipped and zipped(with a readme.txt
+   member first) */
+static const uint8_t rom_gz[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xed, 0xcf,
+    0xd7, 0x22, 0x16, 0x00, 0x00, 0x80, 0x51, 0xbf, 0xa2, 0x9d, 0xb4, 0x14,
+    0x19, 0x69, 0x4f, 0x94, 0x22, 0x2b, 0x23, 0x4a, 0x43, 0x45, 0xa5, 0xa4,
+    0x92, 0x96, 0x48, 0xc8, 0xc8, 0x26, 0x14, 0x0d, 0x5a, 0x4a, 0x46, 0xc3,
+    0x48, 0xd1, 0xb2, 0x52, 0x69, 0x2f, 0x94, 0xa6, 0x96, 0x86, 0xec, 0x8a,
+    0xac, 0x50, 0xf6, 0xb8, 0xec, 0x05, 0x5c, 0x7e, 0xe7, 0x0d, 0x8e, 0x91,
+    0xbe, 0x89, 0xa4, 0x40, 0x20, 0xf4, 0x5f, 0xaf, 0x81, 0xc3, 0x46, 0x8d,
+    0x99, 0xac, 0xa4, 0x3a, 0xd7, 0x60, 0xc9, 0x8a, 0xb5, 0x96, 0xdb, 0xed,
+    0x77, 0x7b, 0xef, 0x3d, 0x74, 0x3c, 0x22, 0xfa, 0xe2, 0xb5, 0xf4, 0xbb,
+    0x4f, 0x72, 0x72, 0x3f, 0x17, 0xfe, 0xac, 0xfe, 0xdb, 0xd6, 0xa3, 0xaf,
+    0xf8, 0x08, 0xd9, 0xf1, 0xd3, 0x94, 0xd5, 0x75, 0x0d, 0x97, 0x99, 0xae,
+    0xdf, 0xb2, 0xc3, 0xd1, 0x7d, 0x4f, 0xd0, 0xe1, 0x93, 0xa7, 0xe3, 0x2e,
+    0xa5, 0xdc, 0x7a, 0x90, 0xf5, 0xea, 0xc3, 0xb7, 0x92, 0x8a, 0x3f, 0x4d,
+    0x9d, 0xa2, 0x03, 0x86, 0x4a, 0xc9, 0x4f, 0x52, 0x54, 0xd1, 0xd2, 0x5f,
+    0x6c, 0x62, 0xb6, 0xd1, 0xca, 0xce, 0xc5, 0x2b, 0xe0, 0xe0, 0xb1, 0xf0,
+    0x73, 0x17, 0xae, 0x5e, 0xbf, 0xf3, 0xf8, 0xf9, 0xdb, 0xbc, 0x82, 0x1f,
+    0x55, 0x0d, 0xad, 0xc2, 0x7d, 0x06, 0x49, 0xc8, 0x8c, 0x9b, 0x3a, 0x53,
+    0x4d, 0x67, 0xc1, 0xd2, 0x55, 0xeb, 0x36, 0xdb, 0xec, 0x72, 0xf3, 0x0d,
+    0x0c, 0x39, 0x11, 0x15, 0x9b, 0x98, 0x7c, 0xf3, 0x7e, 0xe6, 0xcb, 0xf7,
+    0x5f, 0x8b, 0xcb, 0x6b, 0x1b, 0x3b, 0x44, 0xfa, 0x0f, 0x91, 0x1c, 0x3d,
+    0x51, 0x61, 0xb6, 0xe6, 0xbc, 0x45, 0xc6, 0x6b, 0x2c, 0xb6, 0xed, 0x74,
+    0xf6, 0xf4, 0x3f, 0x70, 0xf4, 0xd4, 0xd9, 0xf8, 0x2b, 0x69, 0xb7, 0x1f,
+    0x3d, 0x7b, 0xf3, 0xe9, 0x7b, 0x59, 0x65, 0x7d, 0x8b, 0xa0, 0xb7, 0xd8,
+    0x70, 0xe9, 0xb1, 0x53, 0x66, 0xcc, 0xd1, 0x9e, 0x6f, 0xb4, 0xd2, 0x7c,
+    0x93, 0xb5, 0x83, 0xab, 0xcf, 0xbe, 0xe0, 0xd0, 0xc8, 0x98, 0x84, 0xa4,
+    0x1b, 0xf7, 0x9e, 0xbe, 0x78, 0xf7, 0xa5, 0xe8, 0x57, 0xcd, 0xbf, 0xf6,
+    0x9e, 0xfd, 0x06, 0x8f, 0x94, 0x9b, 0x30, 0x7d, 0x96, 0x86, 0xde, 0xc2,
+    0xe5, 0xab, 0x37, 0x6c, 0xb5, 0x75, 0xf2, 0xf0, 0xdb, 0x7f, 0x24, 0xec,
+    0xcc, 0xf9, 0xcb, 0xa9, 0x19, 0x0f, 0xb3, 0x5f, 0x7f, 0xcc, 0x2f, 0xfd,
+    0x5d, 0xd7, 0xcc, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf,
+    0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f,
+    0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9,
+    0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf,
+    0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f,
+    0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9,
+    0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf,
+    0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f,
+    0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9,
+    0x77, 0xc7, 0xbf, 0x0b, 0x5d, 0x07, 0x46, 0xc8, 0x10, 0x60, 0x00, 0x00,
+};
+
+static const uint8_t rom_zip[] = {
+    0x50, 0x4b, 0x03, 0x04, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x21, 0x00, 0x7a, 0x7a, 0x6f, 0xed, 0x03, 0x00, 0x00, 0x00, 0x03, 0x00,
+    0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x72, 0x65, 0x61, 0x64, 0x6d, 0x65,
+    0x2e, 0x74, 0x78, 0x74, 0x68, 0x69, 0x0a, 0x50, 0x4b, 0x03, 0x04, 0x14,
+    0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x21, 0x00, 0x5d, 0x07, 0x46,
+    0xc8, 0xc2, 0x01, 0x00, 0x00, 0x10, 0x60, 0x00, 0x00, 0x08, 0x00, 0x00,
+    0x00, 0x67, 0x61, 0x6d, 0x65, 0x2e, 0x6e, 0x65, 0x73, 0xed, 0xcf, 0xd7,
+    0x22, 0x16, 0x00, 0x00, 0x80, 0x51, 0xbf, 0xa2, 0x9d, 0xb4, 0x14, 0x19,
+    0x69, 0x4f, 0x94, 0x22, 0x2b, 0x23, 0x4a, 0x43, 0x45, 0xa5, 0xa4, 0x92,
+    0x96, 0x48, 0xc8, 0xc8, 0x26, 0x14, 0x0d, 0x5a, 0x4a, 0x46, 0xc3, 0x48,
+    0xd1, 0xb2, 0x52, 0x69, 0x2f, 0x94, 0xa6, 0x96, 0x86, 0xec, 0x8a, 0xac,
+    0x50, 0xf6, 0xb8, 0xec, 0x05, 0x5c, 0x7e, 0xe7, 0x0d, 0x8e, 0x91, 0xbe,
+    0x89, 0xa4, 0x40, 0x20, 0xf4, 0x5f, 0xaf, 0x81, 0xc3, 0x46, 0x8d, 0x99,
+    0xac, 0xa4, 0x3a, 0xd7, 0x60, 0xc9, 0x8a, 0xb5, 0x96, 0xdb, 0xed, 0x77,
+    0x7b, 0xef, 0x3d, 0x74, 0x3c, 0x22, 0xfa, 0xe2, 0xb5, 0xf4, 0xbb, 0x4f,
+    0x72, 0x72, 0x3f, 0x17, 0xfe, 0xac, 0xfe, 0xdb, 0xd6, 0xa3, 0xaf, 0xf8,
+    0x08, 0xd9, 0xf1, 0xd3, 0x94, 0xd5, 0x75, 0x0d, 0x97, 0x99, 0xae, 0xdf,
+    0xb2, 0xc3, 0xd1, 0x7d, 0x4f, 0xd0, 0xe1, 0x93, 0xa7, 0xe3, 0x2e, 0xa5,
+    0xdc, 0x7a, 0x90, 0xf5, 0xea, 0xc3, 0xb7, 0x92, 0x8a, 0x3f, 0x4d, 0x9d,
+    0xa2, 0x03, 0x86, 0x4a, 0xc9, 0x4f, 0x52, 0x54, 0xd1, 0xd2, 0x5f, 0x6c,
+    0x62, 0xb6, 0xd1, 0xca, 0xce, 0xc5, 0x2b, 0xe0, 0xe0, 0xb1, 0xf0, 0x73,
+    0x17, 0xae, 0x5e, 0xbf, 0xf3, 0xf8, 0xf9, 0xdb, 0xbc, 0x82, 0x1f, 0x55,
+    0x0d, 0xad, 0xc2, 0x7d, 0x06, 0x49, 0xc8, 0x8c, 0x9b, 0x3a, 0x53, 0x4d,
+    0x67, 0xc1, 0xd2, 0x55, 0xeb, 0x36, 0xdb, 0xec, 0x72, 0xf3, 0x0d, 0x0c,
+    0x39, 0x11, 0x15, 0x9b, 0x98, 0x7c, 0xf3, 0x7e, 0xe6, 0xcb, 0xf7, 0x5f,
+    0x8b, 0xcb, 0x6b, 0x1b, 0x3b, 0x44, 0xfa, 0x0f, 0x91, 0x1c, 0x3d, 0x51,
+    0x61, 0xb6, 0xe6, 0xbc, 0x45, 0xc6, 0x6b, 0x2c, 0xb6, 0xed, 0x74, 0xf6,
+    0xf4, 0x3f, 0x70, 0xf4, 0xd4, 0xd9, 0xf8, 0x2b, 0x69, 0xb7, 0x1f, 0x3d,
+    0x7b, 0xf3, 0xe9, 0x7b, 0x59, 0x65, 0x7d, 0x8b, 0xa0, 0xb7, 0xd8, 0x70,
+    0xe9, 0xb1, 0x53, 0x66, 0xcc, 0xd1, 0x9e, 0x6f, 0xb4, 0xd2, 0x7c, 0x93,
+    0xb5, 0x83, 0xab, 0xcf, 0xbe, 0xe0, 0xd0, 0xc8, 0x98, 0x84, 0xa4, 0x1b,
+    0xf7, 0x9e, 0xbe, 0x78, 0xf7, 0xa5, 0xe8, 0x57, 0xcd, 0xbf, 0xf6, 0x9e,
+    0xfd, 0x06, 0x8f, 0x94, 0x9b, 0x30, 0x7d, 0x96, 0x86, 0xde, 0xc2, 0xe5,
+    0xab, 0x37, 0x6c, 0xb5, 0x75, 0xf2, 0xf0, 0xdb, 0x7f, 0x24, 0xec, 0xcc,
+    0xf9, 0xcb, 0xa9, 0x19, 0x0f, 0xb3, 0x5f, 0x7f, 0xcc, 0x2f, 0xfd, 0x5d,
+    0xd7, 0xcc, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f,
+    0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe,
+    0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3,
+    0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f,
+    0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe,
+    0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3,
+    0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f,
+    0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe,
+    0xfc, 0xf9, 0xf3, 0xe7, 0xcf, 0x9f, 0x3f, 0x7f, 0xfe, 0xfc, 0xf9, 0x77,
+    0xc7, 0xbf, 0x0b, 0x50, 0x4b, 0x01, 0x02, 0x14, 0x03, 0x14, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x21, 0x00, 0x7a, 0x7a, 0x6f, 0xed, 0x03,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x72, 0x65, 0x61, 0x64, 0x6d, 0x65, 0x2e, 0x74, 0x78, 0x74, 0x50,
+    0x4b, 0x01, 0x02, 0x14, 0x03, 0x14, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00,
+    0x00, 0x21, 0x00, 0x5d, 0x07, 0x46, 0xc8, 0xc2, 0x01, 0x00, 0x00, 0x10,
+    0x60, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x80, 0x01, 0x2b, 0x00, 0x00, 0x00, 0x67, 0x61, 0x6d,
+    0x65, 0x2e, 0x6e, 0x65, 0x73, 0x50, 0x4b, 0x05, 0x06, 0x00, 0x00, 0x00,
+    0x00, 0x02, 0x00, 0x02, 0x00, 0x6e, 0x00, 0x00, 0x00, 0x13, 0x02, 0x00,
+    0x00, 0x00, 0x00,
+};
+
+/* a 16 KB PRG / 8 KB CHR image with the given header flags */
+void write_rom(const char *path, uint8_t mapper, uint8_t flags6)
+{
+    uint8_t header[16] = { 'N', 'E', 'S', 0x1a, 1, 1, (mapper << 4) | flags6, mapper & 0xf0 };
+    static uint8_t data[24 * KB];
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        fprintf(stderr, "Can't create %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < sizeof(data); i++)
+        data[i] = i * 7;
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(data, 1, sizeof(data), fp);
+    fclose(fp);
+}
+
+void expect(const char *name, uint16_t addr, uint8_t val)
+{
+    uint8_t ret = mmu_read(&nes, addr);
+
+    if (ret != val) {
+        printf("%s: $%04x = %02x, expected %02x\n", name, addr, ret, val);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void load(char *path)
+{
+    memset(&nes, 0, sizeof(nes));
+    if (cart_load(&nes, path)) {
+        printf("can't load %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void test_prg_ram(void)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "%s/ram.nes", dir);
+    write_rom(path, 1, 0x00);
+    load(path);
+    mmu_write(&nes, 0x6000, 0x12);
+    mmu_write(&nes, 0x7fff, 0x34);
+    expect("PRG RAM", 0x6000, 0x12);
+    expect("PRG RAM", 0x7fff, 0x34);
+    expect("open bus", 0x5000, 0xff);
+
+    // MMC1: bit 4 of the PRG bank register disables the RAM
+    for (int i = 0; i < 5; i++)
+        mmu_write(&nes, 0xe000, (0x10 >> i) & 0x01);
+    expect("PRG RAM disabled", 0x6000, 0xff);
+    cart_unload(&nes);
+
+    snprintf(path, sizeof(path), "%s/ram.sav", dir);
+    if (!access(path, F_OK)) {
+        printf("PRG RAM: save file created for a cart without battery\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, sizeof(path), "%s/ram.nes", dir);
+    unlink(path);
+}
+
+void test_battery(void)
+{
+    char path[64], save_path[64];
+    uint8_t save[8 * KB];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/battery.nes", dir);
+    snprintf(save_path, sizeof(save_path), "%s/battery.sav", dir);
+    write_rom(path, 0, 0x02);
+    load(path);
+    for (int i = 0; i < 8 * KB; i++)
+        mmu_write(&nes, 0x6000 + i, i ^ 0x5a);
+    // the vblank flush
+    cart_sync(&nes, false);
+    cart_unload(&nes);
+
+    fp = fopen(save_path, "r");
+    if (!fp || fread(save, 1, sizeof(save), fp) != sizeof(save)) {
+        printf("battery: no %d byte save file\n", 8 * KB);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    for (int i = 0; i < 8 * KB; i++) {
+        if (save[i] != (uint8_t)(i ^ 0x5a)) {
+            printf("battery: save file byte %d = %02x\n", i, save[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    load(path);
+    expect("battery reload", 0x6000, 0x5a);
+    expect("battery reload", 0x7fff, (uint8_t)(0x1fff ^ 0x5a));
+    cart_unload(&nes);
+    unlink(save_path);
+
+    // saved unless a headless tool says otherwise, even in a struct nes
+    // that isn't zeroed
+    memset(&nes, 0xa5, sizeof(nes));
+    cpu_at_power_up(&nes);
+    if (nes.cart.no_save) {
+        printf("battery: no_save set at power up\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // headless tools keep the battery RAM in memory
+    memset(&nes, 0, sizeof(nes));
+    nes.cart.no_save = true;
+    if (cart_load(&nes, path) || nes.cart.prg_ram_mapped || !access(save_path, F_OK)) {
+        printf("battery: save file with no_save\n");
+        exit(EXIT_FAILURE);
+    }
+    cart_unload(&nes);
+    unlink(path);
+}
+
+/* A, B, Select, Start, Up, Down, Left, Right out of $4016 after a strobe,
+   then 1s. While the strobe is set A is read again and again. */
+void test_controller(void)
+{
+    memset(&nes, 0, sizeof(nes));
+    nes.pad[0].buttons = BUTTON_A | BUTTON_START | BUTTON_RIGHT;
+    nes.pad[1].buttons = BUTTON_B;
+    mmu_write(&nes, 0x4016, 1);
+    nes.pad[0].buttons = 0;
+    expect("controller strobe", 0x4016, 0x40);
+    nes.pad[0].buttons = BUTTON_A | BUTTON_START | BUTTON_RIGHT;
+    mmu_write(&nes, 0x4016, 0);
+    nes.pad[0].buttons = 0;
+    for (int i = 0; i < 10; i++)
+        expect("controller 1", 0x4016, 0x40 | (i == 0 || i == 3 || i >= 7));
+    for (int i = 0; i < 10; i++)
+        expect("controller 2", 0x4017, 0x40 | (i == 1 || i >= 8));
+}
+
+void write_blob(const char *path, const uint8_t *blob, size_t size)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        fprintf(stderr, "Can't create %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(blob, 1, size, fp);
+    fclose(fp);
+}
+
+/* MMC1 with 32 KB of PRG RAM(SXROM): CHR bank 0 bits 2-3 select the 8 KB
+   at $6000 */
+void test_prg_ram_banks(void)
+{
+    static uint8_t blob[16 + 24 * KB] = { 'N', 'E', 'S', 0x1a, 1, 1, 0x10, 0x00, 4 };
+    char path[64];
+
+    snprintf(path, sizeof(path), "%s/sxrom.nes", dir);
+    write_blob(path, blob, sizeof(blob));
+    load(path);
+    for (int bank = 0; bank < 4; bank++) {
+        for (int i = 0; i < 5; i++)
+            mmu_write(&nes, 0xa000, ((bank << 2) >> i) & 0x01);
+        mmu_write(&nes, 0x6000 + bank, 0x10 + bank);
+    }
+    for (int bank = 3; bank >= 0; bank--) {
+        for (int i = 0; i < 5; i++)
+            mmu_write(&nes, 0xa000, ((bank << 2) >> i) & 0x01);
+        for (int j = 0; j < 4; j++)
+            expect("PRG RAM bank", 0x6000 + j, (j == bank) ? 0x10 + bank : 0x00);
+    }
+    cart_unload(&nes);
+    unlink(path);
+}
+
+/* 0 PRG ROM banks in the header is refused at load time */
+void test_no_prg_rom(void)
+{
+    uint8_t blob[16 + 8 * KB] = { 'N', 'E', 'S', 0x1a, 0, 1 };
+    char path[64];
+
+    snprintf(path, sizeof(path), "%s/noprg.nes", dir);
+    write_blob(path, blob, sizeof(blob));
+    memset(&nes, 0, sizeof(nes));
+    if (!cart_load(&nes, path)) {
+        printf("loaded a cart without PRG ROM\n");
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);
+}
+
+void test_archive(const char *name, const uint8_t *blob, size_t size)
+{
+    char path[64];
+    uint8_t *prg_rom;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    write_blob(path, blob, size);
+    load(path);
+    expect(name, 0x8000, 0x00);
+    expect(name, 0x8001, 0x07);
+    expect(name, 0xffff, (uint8_t)(0x3fff * 7));
+    if (nes.cart.chr_rom[0x1fff] != (uint8_t)(0x5fff * 7)) {
+        printf("%s: CHR ROM $1fff = %02x\n", name, nes.cart.chr_rom[0x1fff]);
+        exit(EXIT_FAILURE);
+    }
+    prg_rom = nes.cart.prg_rom;
+    cart_unload(&nes);
+
+    // inflated once, reloading reuses the cached image
+    load(path);
+    if (nes.cart.prg_rom != prg_rom) {
+        printf("%s: the image was inflated again\n", name);
+        exit(EXIT_FAILURE);
+    }
+    cart_unload(&nes);
+    romstore_flush();
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Can't create %s\n", dir);
+        exit(EXIT_FAILURE);
+    }
+    test_prg_ram();
+    printf("Test PRG RAM ok\n");
+    test_battery();
+    printf("Test battery save ok\n");
+    test_controller();
+    printf("Test controllers ok\n");
+    test_prg_ram_banks();
+    printf("Test PRG RAM banks ok\n");
+    test_no_prg_rom();
+    printf("Test header without PRG ROM ok\n");
+    test_archive("game.nes.gz", rom_gz, sizeof(rom_gz));
+    test_archive("game.zip", rom_zip, sizeof(rom_zip));
+    printf("Test compressed carts ok\n");
+    rmdir(dir);
+    printf("*******************************************************************\n");
+    return 0;
+}
@@ -0,0 +1,314 @@
+#include <time.h>
+#include "nes.h"
+#include "cpu.h"
+#include "cart.h"
+#include "ppu.h"
+
+#define PRG_SIZE        (256 * KB)
+#define CHR_SIZE        (64 * KB)
+#define BENCH_READS     (16 * 1024 * 1024)
+
+static struct nes nes;
+static uint8_t prg_rom[PRG_SIZE];
+static uint8_t chr_rom[CHR_SIZE];
+
+/* every 8 KB PRG page starts with its page number, every 1 KB CHR page
+   too, so a read tells which part of the ROM a window points at
+*/
+void setup_cart(uint8_t mapper, uint32_t prg_size, uint32_t chr_size)
+{
+    memset(&nes, 0, sizeof(nes));
+    for (uint32_t i = 0; i < prg_size; i++)
+        prg_rom[i] = (i % (8 * KB)) ? 0xff : i / (8 * KB);
+    for (uint32_t i = 0; i < chr_size; i++)
+        chr_rom[i] = (i % KB) ? 0xff : i / KB;
+    nes.cart.prg_rom = prg_rom;
+    nes.cart.chr_rom = chr_rom;
+    nes.cart.info.prg_size = prg_size;
+    nes.cart.info.chr_size = chr_size;
+    nes.cart.info.mapper = mapper;
+    if (mapper_init(&nes)) {
+        fprintf(stderr, "mapper %03d: init failed\n", mapper);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void expect_prg(const char *name, int slot, uint8_t page)
+{
+    uint8_t val = mmu_read(&nes, 0x8000 + slot * 0x2000);
+
+    if (val != page) {
+        printf("%s: $%04x maps PRG page %d, expected %d\n", name, 0x8000 + slot * 0x2000, val, page);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void expect_chr(const char *name, int slot, uint8_t page)
+{
+    const uint8_t *pixels = tilecache_tile(&nes.ppu, slot * 0x400, false);
+
+    if (nes.ppu.page[slot][0] != page) {
+        printf("%s: PPU $%04x maps CHR page %d, expected %d\n", name, slot * 0x400,
+                nes.ppu.page[slot][0], page);
+        exit(EXIT_FAILURE);
+    }
+    // the decoded copy follows the bank switch: row 0 is the page number
+    // over a solid high plane
+    for (int i = 0; i < 8; i++) {
+        if (pixels[i] != (((page >> (7 - i)) & 0x01) | 0x02)) {
+            printf("%s: stale decoded tile at PPU $%04x\n", name, slot * 0x400);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void expect_prg_16k(const char *name, uint8_t bank_8000, uint8_t bank_c000)
+{
+    expect_prg(name, 0, bank_8000 * 2);
+    expect_prg(name, 1, bank_8000 * 2 + 1);
+    expect_prg(name, 2, bank_c000 * 2);
+    expect_prg(name, 3, bank_c000 * 2 + 1);
+}
+
+void expect_chr_4k(const char *name, uint8_t bank_0000, uint8_t bank_1000)
+{
+    for (int i = 0; i < 4; i++) {
+        expect_chr(name, i, bank_0000 * 4 + i);
+        expect_chr(name, i + 4, bank_1000 * 4 + i);
+    }
+}
+
+void expect_mirroring(const char *name, enum MIRRORING mirroring)
+{
+    if (nes.cart.info.mirroring != mirroring) {
+        printf("%s: mirroring %d, expected %d\n", name, nes.cart.info.mirroring, mirroring);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void mmc1_write(uint16_t addr, uint8_t val)
+{
+    for (int i = 0; i < 5; i++)
+        mmu_write(&nes, addr, (val >> i) & 0x01);
+}
+
+void test_nrom(void)
+{
+    setup_cart(0, 16 * KB, 8 * KB);
+    expect_prg_16k("NROM-128", 0, 0);
+    setup_cart(0, 32 * KB, 8 * KB);
+    expect_prg_16k("NROM-256", 0, 1);
+    expect_chr_4k("NROM-256", 0, 1);
+}
+
+void test_mmc1(void)
+{
+    setup_cart(1, PRG_SIZE, CHR_SIZE);
+    // power up: PRG mode 3, last bank fixed at $c000
+    expect_prg_16k("MMC1 power up", 0, 15);
+
+    mmc1_write(0xe000, 5);
+    expect_prg_16k("MMC1 PRG mode 3", 5, 15);
+
+    mmc1_write(0x8000, 0x0b);   // PRG mode 2, horizontal
+    mmc1_write(0xe000, 6);
+    expect_prg_16k("MMC1 PRG mode 2", 0, 6);
+    expect_mirroring("MMC1 control", HORIZONTAL);
+
+    mmc1_write(0x8000, 0x02);   // PRG mode 0, vertical
+    mmc1_write(0xe000, 7);
+    expect_prg_16k("MMC1 PRG mode 0", 6, 7);
+    expect_mirroring("MMC1 control", VERTICAL);
+
+    mmc1_write(0xa000, 5);
+    expect_chr_4k("MMC1 CHR mode 0", 4, 5);
+
+    mmc1_write(0x8000, 0x10);   // CHR mode 1, one screen
+    mmc1_write(0xa000, 3);
+    mmc1_write(0xc000, 9);
+    expect_chr_4k("MMC1 CHR mode 1", 3, 9);
+    expect_mirroring("MMC1 control", SINGLE_SCREEN_LOW);
+
+    // a write with bit 7 set drops the partial value and restores mode 3
+    mmu_write(&nes, 0xe000, 0x01);
+    mmu_write(&nes, 0xe000, 0x01);
+    mmu_write(&nes, 0x8000, 0x80);
+    mmc1_write(0xe000, 2);
+    expect_prg_16k("MMC1 reset", 2, 15);
+}
+
+void test_uxrom(void)
+{
+    setup_cart(2, PRG_SIZE, 8 * KB);
+    expect_prg_16k("UxROM power up", 0, 15);
+    // bus conflict: the written value is ANDed with the ROM byte ($ff)
+    mmu_write(&nes, 0x8001, 9);
+    expect_prg_16k("UxROM switch", 9, 15);
+    // bank numbers past the end wrap around
+    mmu_write(&nes, 0x8001, 19);
+    expect_prg_16k("UxROM wrap", 3, 15);
+}
+
+void test_cnrom(void)
+{
+    setup_cart(3, 32 * KB, 32 * KB);
+    expect_chr_4k("CNROM power up", 0, 1);
+    mmu_write(&nes, 0x8001, 2);
+    expect_chr_4k("CNROM switch", 4, 5);
+    expect_prg_16k("CNROM PRG", 0, 1);
+}
+
+void test_axrom(void)
+{
+    setup_cart(7, PRG_SIZE, 8 * KB);
+    expect_prg_16k("AxROM power up", 0, 1);
+    mmu_write(&nes, 0x8000, 0x13);
+    expect_prg_16k("AxROM switch", 6, 7);
+    expect_mirroring("AxROM one screen", SINGLE_SCREEN_HIGH);
+    mmu_write(&nes, 0x8000, 0x02);
+    expect_mirroring("AxROM one screen", SINGLE_SCREEN_LOW);
+}
+
+void test_mmc3(void)
+{
+    setup_cart(4, PRG_SIZE, CHR_SIZE);
+    expect_prg("MMC3 power up", 2, 30);
+    expect_prg("MMC3 power up", 3, 31);
+
+    for (int i = 0; i < 8; i++) {
+        mmu_write(&nes, 0x8000, i);
+        mmu_write(&nes, 0x8001, 10 + i);
+    }
+    expect_prg("MMC3 PRG mode 0", 0, 16);
+    expect_prg("MMC3 PRG mode 0", 1, 17);
+    expect_prg("MMC3 PRG mode 0", 2, 30);
+    expect_chr("MMC3 CHR mode 0", 0, 10);
+    expect_chr("MMC3 CHR mode 0", 1, 11);
+    expect_chr("MMC3 CHR mode 0", 2, 10);
+    expect_chr("MMC3 CHR mode 0", 3, 11);
+    expect_chr("MMC3 CHR mode 0", 4, 12);
+    expect_chr("MMC3 CHR mode 0", 7, 15);
+
+    mmu_write(&nes, 0x8000, 0xc0);
+    expect_prg("MMC3 PRG mode 1", 0, 30);
+    expect_prg("MMC3 PRG mode 1", 2, 16);
+    expect_chr("MMC3 CHR mode 1", 0, 12);
+    expect_chr("MMC3 CHR mode 1", 4, 10);
+
+    mmu_write(&nes, 0xa000, 1);
+    expect_mirroring("MMC3 mirroring", HORIZONTAL);
+}
+
+/* run from the pre-render line until the mapper pulls IRQ low */
+void mmc3_run_irq(const char *name, uint8_t ppuctrl, int line, int dot)
+{
+    setup_cart(4, PRG_SIZE, CHR_SIZE);
+    ppu_at_power_up(&nes);
+    nes.cpu.irq = 1;
+    memset(nes.ppu.oam, 0xff, sizeof(nes.ppu.oam));
+    nes.ppu.ppuctrl = ppuctrl;
+    nes.ppu.ppumask = 0x18;
+    nes.ppu.scanlines = 260;
+    nes.ppu.cycles = 340;
+
+    mmu_write(&nes, 0xc000, 9);
+    mmu_write(&nes, 0xc001, 0);
+    mmu_write(&nes, 0xe001, 0);
+    for (int i = 0; i < 341 * 262 && nes.cpu.irq; i++)
+        ppu_tick(&nes);
+    // ppu_tick has already moved on to the next dot
+    if (nes.cpu.irq || nes.ppu.scanlines != line || nes.ppu.cycles - 1 != dot) {
+        printf("%s: IRQ at line %d dot %d, expected line %d dot %d\n", name,
+                nes.ppu.scanlines, nes.ppu.cycles - 1, line, dot);
+        exit(EXIT_FAILURE);
+    }
+    mmu_write(&nes, 0xe000, 0);
+    if (!nes.cpu.irq) {
+        printf("%s: IRQ not acknowledged\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void test_mmc3_irq(void)
+{
+    // scheduled: sprites at $1000 -> dot 260, background at $1000 -> dot 324
+    mmc3_run_irq("MMC3 IRQ sprites $1000", 0x08, 8, 260);
+    mmc3_run_irq("MMC3 IRQ background $1000", 0x10, 8, 324);
+    // edge tracked: 8x16 sprites, the empty slots fetch tile $ff at $1000
+    mmc3_run_irq("MMC3 IRQ 8x16 sprites", 0x20, 8, 261);
+}
+
+/* PPU dots per second with an MMC3 IRQ every 8 lines */
+void bench_mmc3_irq(const char *name, uint8_t ppuctrl)
+{
+    struct timespec start, end;
+    double elapsed;
+    int frames = 300, irqs = 0;
+
+    setup_cart(4, PRG_SIZE, CHR_SIZE);
+    ppu_at_power_up(&nes);
+    nes.ppu.ppuctrl = ppuctrl;
+    nes.ppu.ppumask = 0x18;
+    mmu_write(&nes, 0xc000, 7);
+    mmu_write(&nes, 0xe001, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 341 * 262 * frames; i++) {
+        ppu_tick(&nes);
+        if (!nes.cpu.irq) {
+            irqs++;
+            mmu_write(&nes, 0xe000, 0);
+            mmu_write(&nes, 0xe001, 0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-6s %7.1f M dots/s (%d IRQs/frame)\n", name,
+            341.0 * 262 * frames / elapsed / 1e6, irqs / frames);
+}
+
+/* read throughput through the CPU bus, with a bank switch every 4 KB */
+void bench(const char *name, uint8_t mapper, uint16_t switch_addr)
+{
+    struct timespec start, end;
+    uint32_t sum = 0;
+    double elapsed;
+
+    setup_cart(mapper, PRG_SIZE, CHR_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < BENCH_READS; i++) {
+        if (switch_addr && !(i & 0xfff))
+            mmu_write(&nes, switch_addr, (i >> 12) & 0x07);
+        sum += mmu_read(&nes, 0x8000 | (i * 97 & 0x7fff));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-6s %7.1f M reads/s (checksum %08x)\n", name, BENCH_READS / elapsed / 1e6, sum);
+}
+
+int main(int argc, char *argv[])
+{
+    test_nrom();
+    printf("Test mapper 000 ok\n");
+    test_mmc1();
+    printf("Test mapper 001 ok\n");
+    test_uxrom();
+    printf("Test mapper 002 ok\n");
+    test_cnrom();
+    printf("Test mapper 003 ok\n");
+    test_mmc3();
+    test_mmc3_irq();
+    printf("Test mapper 004 ok\n");
+    test_axrom();
+    printf("Test mapper 007 ok\n");
+    printf("*******************************************************************\n");
+
+    bench("NROM", 0, 0);
+    bench("MMC1", 1, 0);
+    bench("UxROM", 2, 0x8001);
+    bench("CNROM", 3, 0x8001);
+    bench("MMC3", 4, 0x8001);
+    bench("AxROM", 7, 0x8001);
+    bench_mmc3_irq("MMC3 scheduled IRQ", 0x08);
+    bench_mmc3_irq("MMC3 tracked IRQ", 0x28);
+    return 0;
+}
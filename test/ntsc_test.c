@@ -0,0 +1,146 @@
+#include <time.h>
+#include "nes.h"
+#include "ntsc.h"
+#include "pixel.h"
+#include "renderer.h"
+
+#define FRAME_PIXELS    (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+static const char *names[] = { "scalar", "ssse3", "avx2" };
+static uint8_t frame[FRAME_PIXELS], emphasis[SCREEN_HEIGHT];
+static uint32_t out[FRAME_PIXELS * 4], out2[FRAME_PIXELS * 4];
+
+void fail(const char *msg, long long a, long long b)
+{
+    printf("%s: %lld, expected %lld\n", msg, a, b);
+    exit(EXIT_FAILURE);
+}
+
+int channel(uint32_t rgba, int c)
+{
+    return (rgba >> (24 - c * 8)) & 0xff;
+}
+
+/* A frame of one color away from the edges decodes close to the 2C02
+   palette, the same every 3 pixels and lines(a subcarrier cycle) with
+   merged fields. */
+void test_flat(int scale)
+{
+    struct ntsc_filter *ntsc = ntsc_create(scale, true, PIXEL_RGBA8888);
+    int width = SCREEN_WIDTH * scale, worst = 0, diff;
+    uint32_t pixel;
+
+    memset(emphasis, 0, sizeof(emphasis));
+    for (int color = 0; color < 64; color++) {
+        // no reference for the grays of $xd-$xf, they're black
+        if ((color & 0x0f) >= 0x0d)
+            continue;
+        memset(frame, color, sizeof(frame));
+        ntsc_filter_lines(ntsc, frame, emphasis, 0, 0, SCREEN_HEIGHT, out, width * 4);
+        for (int y = 0; y < 3; y++) {
+            pixel = out[(100 + y) * width + width / 2];
+            if ((pixel & 0xff) != 0xff)
+                fail("ntsc: alpha", pixel & 0xff, 0xff);
+            for (int c = 0; c < 3; c++) {
+                diff = abs(channel(pixel, c) - channel(ppu_palette_rgba[color], c));
+                worst = (diff > worst) ? diff : worst;
+            }
+            if (pixel != out[(100 + y + 3) * width + width / 2 + 3 * scale])
+                fail("ntsc: flat color varies", color, y);
+        }
+    }
+    if (worst > 48)
+        fail("ntsc: color off the palette by", worst, 48);
+    ntsc_destroy(ntsc);
+}
+
+/* Dot crawl: the same frame differs between odd and even frames unless
+   the fields are merged. A band filtered alone matches the whole frame. */
+void test_fields(void)
+{
+    struct ntsc_filter *crawl = ntsc_create(2, false, PIXEL_RGBA8888);
+    struct ntsc_filter *merged = ntsc_create(2, true, PIXEL_RGBA8888);
+    int size = FRAME_PIXELS * 2 * 4;
+
+    for (int i = 0; i < FRAME_PIXELS; i++)
+        frame[i] = ((i / 3) & 0x01) ? 0x16 : 0x30;
+    ntsc_filter_lines(crawl, frame, emphasis, 0, 0, SCREEN_HEIGHT, out, SCREEN_WIDTH * 2 * 4);
+    ntsc_filter_lines(crawl, frame, emphasis, 1, 0, SCREEN_HEIGHT, out2, SCREEN_WIDTH * 2 * 4);
+    if (!memcmp(out, out2, size))
+        fail("ntsc: no dot crawl", 0, 1);
+    ntsc_filter_lines(crawl, frame, emphasis, 2, 0, SCREEN_HEIGHT, out2, SCREEN_WIDTH * 2 * 4);
+    if (memcmp(out, out2, size))
+        fail("ntsc: frames 0 and 2 differ", 2, 0);
+
+    ntsc_filter_lines(merged, frame, emphasis, 0, 0, SCREEN_HEIGHT, out, SCREEN_WIDTH * 2 * 4);
+    ntsc_filter_lines(merged, frame, emphasis, 1, 0, SCREEN_HEIGHT, out2, SCREEN_WIDTH * 2 * 4);
+    if (memcmp(out, out2, size))
+        fail("ntsc: merged fields differ", 1, 0);
+    memset(out2, 0, size);
+    ntsc_filter_lines(merged, frame, emphasis, 0, 16, 16, out2 + 16 * SCREEN_WIDTH * 2, SCREEN_WIDTH * 2 * 4);
+    if (memcmp(out + 16 * SCREEN_WIDTH * 2, out2 + 16 * SCREEN_WIDTH * 2, 16 * SCREEN_WIDTH * 2 * 4))
+        fail("ntsc: band", 16, 16);
+    ntsc_destroy(crawl);
+    ntsc_destroy(merged);
+}
+
+/* red emphasis on white leaves red the brightest, ARGB has the same
+   channels */
+void test_emphasis_format(void)
+{
+    struct ntsc_filter *rgba = ntsc_create(4, true, PIXEL_RGBA8888);
+    struct ntsc_filter *argb = ntsc_create(4, true, PIXEL_ARGB8888);
+    uint32_t pixel;
+
+    memset(frame, 0x30, sizeof(frame));
+    memset(emphasis, 0x01, sizeof(emphasis));
+    ntsc_filter_lines(rgba, frame, emphasis, 0, 100, 1, out, 0);
+    ntsc_filter_lines(argb, frame, emphasis, 0, 100, 1, out2, 0);
+    pixel = out[512];
+    if (channel(pixel, 0) <= channel(pixel, 1) || channel(pixel, 0) <= channel(pixel, 2))
+        fail("ntsc: red emphasis", channel(pixel, 0), channel(pixel, 1));
+    if (out2[512] != ((pixel >> 8) | (pixel << 24)))
+        fail("ntsc: ARGB", out2[512], (pixel >> 8) | (pixel << 24));
+    if (ntsc_create(3, true, PIXEL_RGBA8888) || ntsc_create(2, true, PIXEL_RGB565))
+        fail("ntsc: unsupported options accepted", 1, 0);
+    memset(emphasis, 0, sizeof(emphasis));
+    ntsc_destroy(rgba);
+    ntsc_destroy(argb);
+}
+
+void bench_ntsc(const char *name, int scale)
+{
+    struct ntsc_filter *ntsc = ntsc_create(scale, false, PIXEL_RGBA8888);
+    int rounds = 200;
+    struct timespec start, end;
+    double us;
+
+    for (int i = 0; i < FRAME_PIXELS; i++)
+        frame[i] = rand() & 0x3f;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++)
+        ntsc_filter_lines(ntsc, frame, emphasis, r, 0, SCREEN_HEIGHT, out, SCREEN_WIDTH * scale * 4);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    us = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / rounds;
+    printf("%-7s %4d wide %7.1f us/frame\n", name, SCREEN_WIDTH * scale, us);
+    ntsc_destroy(ntsc);
+}
+
+int main(int argc, char *argv[])
+{
+    test_flat(2);
+    test_flat(4);
+    printf("Test NTSC colors ok\n");
+    test_fields();
+    printf("Test NTSC fields ok\n");
+    test_emphasis_format();
+    printf("Test NTSC emphasis and formats ok\n");
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (pixel_select(names[i]))
+            continue;
+        bench_ntsc(names[i], 2);
+        bench_ntsc(names[i], 4);
+    }
+    printf("*******************************************************************\n");
+    return 0;
+}
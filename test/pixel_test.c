@@ -0,0 +1,292 @@
+#include <time.h>
+#include "pixel.h"
+#include "renderer.h"
+
+static const char *names[] = { "scalar", "ssse3", "avx2" };
+static uint8_t chr[8 * KB];
+
+/* the plain per-bit code every kernel set must match */
+void reference_decode(const uint8_t *chr, uint8_t *out, bool flip)
+{
+    int bit;
+
+    for (int row = 0; row < 8; row++) {
+        for (int x = 0; x < 8; x++) {
+            bit = (flip) ? x : 7 - x;
+            out[row * 8 + x] = ((chr[row] >> bit) & 0x01) | (((chr[row + 8] >> bit) & 0x01) << 1);
+        }
+    }
+}
+
+/* background/sprite priority, index of the first sprite 0 hit or -1 */
+int reference_composite(const uint8_t *bg, const uint8_t *spr, uint8_t *out, int n)
+{
+    int hit = -1;
+    bool bg_opaque, spr_opaque;
+
+    for (int i = 0; i < n; i++) {
+        bg_opaque = bg[i] != 0;
+        spr_opaque = (spr[i] & 0x03) != 0;
+        if (bg_opaque && (spr[i] & SPRITE_0) && hit == -1)
+            hit = i;
+        if (spr_opaque && (!bg_opaque || !(spr[i] & BEHIND_BG)))
+            out[i] = spr[i] & 0x1f;
+        else
+            out[i] = bg[i];
+    }
+    return hit;
+}
+
+/* Scale2x/Scale3x as written in their description(xbr2x the Scale2x
+   corners unless the diagonal pixel is E), on a 3 line window with the
+   edges repeated */
+void reference_upscale(const uint8_t *win, int width, int x, uint8_t *out)
+{
+    uint8_t a = win[x], b = win[x + 1], c = win[x + 2];
+    uint8_t d = win[width + x], e = win[width + x + 1], f = win[width + x + 2];
+    uint8_t g = win[2 * width + x], h = win[2 * width + x + 1], i = win[2 * width + x + 2];
+
+    // scale2x
+    out[0] = (b == d && b != f && d != h) ? d : e;
+    out[1] = (b == f && b != d && h != f) ? f : e;
+    out[2] = (d == h && b != d && h != f) ? d : e;
+    out[3] = (h == f && d != h && b != f) ? f : e;
+    // scale3x
+    out[4] = out[0];
+    out[5] = ((b == d && b != f && d != h && e != c) || (b == f && b != d && h != f && e != a)) ? b : e;
+    out[6] = out[1];
+    out[7] = ((b == d && b != f && d != h && e != g) || (d == h && b != d && h != f && e != a)) ? d : e;
+    out[8] = e;
+    out[9] = ((b == f && b != d && h != f && e != i) || (h == f && d != h && b != f && e != c)) ? f : e;
+    out[10] = out[2];
+    out[11] = ((d == h && b != d && h != f && e != i) || (h == f && d != h && b != f && e != g)) ? h : e;
+    out[12] = out[3];
+    // xbr2x
+    out[13] = (out[0] != e && a != e) ? d : e;
+    out[14] = (out[1] != e && c != e) ? f : e;
+    out[15] = (out[2] != e && g != e) ? d : e;
+    out[16] = (out[3] != e && i != e) ? f : e;
+}
+
+void fail(const char *set, const char *kernel, int i)
+{
+    printf("%s %s: mismatch at %d\n", set, kernel, i);
+    exit(EXIT_FAILURE);
+}
+
+/* random taps around the clamping range, both scales, against the
+   scalar sum */
+void test_ntsc(const struct pixel_kernels *set)
+{
+    static int16_t taps[16][3 * 4 * 4];
+    static uint32_t out[33 * 4], ref[33 * 4];
+    const int16_t *entries[35];
+    int v;
+
+    for (int i = 0; i < 16; i++)
+        for (int j = 0; j < 3 * 4 * 4; j++)
+            taps[i][j] = (rand() % 2400 - 800) * 4;
+    for (int scale = 2; scale <= 4; scale += 2) {
+        for (int i = 0; i < 35; i++)
+            entries[i] = taps[rand() % 16];
+        set->ntsc(entries, scale, out, 33);
+        for (int i = 0; i < 33 * scale * 4; i++) {
+            v = (entries[i / (scale * 4)][2 * scale * 4 + i % (scale * 4)] +
+                 entries[i / (scale * 4) + 1][scale * 4 + i % (scale * 4)] +
+                 entries[i / (scale * 4) + 2][i % (scale * 4)]) >> NTSC_FRAC_BITS;
+            ((uint8_t *)ref)[i] = (v < 0) ? 0 : (v > 255) ? 255 : v;
+        }
+        if (memcmp(out, ref, 33 * scale * 4))
+            fail(set->name, "ntsc", scale);
+    }
+}
+
+/* Random lines of 3 colors, so that every condition is met somewhere. An
+   odd width for the scalar tails. */
+void test_upscale(const struct pixel_kernels *set)
+{
+    enum { WIDTH = 259 };
+    static uint8_t win[3][WIDTH + 2], out[3][WIDTH * 3], ref[17];
+    static uint32_t a[WIDTH], b[WIDTH], blended[WIDTH];
+    const uint8_t *rows[3] = { win[0] + 1, win[1] + 1, win[2] + 1 };
+    uint8_t *lines[3] = { out[0], out[1], out[2] };
+    uint32_t v;
+
+    for (int r = 0; r < 200; r++) {
+        for (int i = 0; i < sizeof(win); i++)
+            win[i / (WIDTH + 2)][i % (WIDTH + 2)] = rand() % 3;
+        set->scale2x(rows, lines, WIDTH);
+        for (int x = 0; x < WIDTH; x++) {
+            reference_upscale(&win[0][0], WIDTH + 2, x, ref);
+            if (out[0][x * 2] != ref[0] || out[0][x * 2 + 1] != ref[1] || out[1][x * 2] != ref[2] ||
+                out[1][x * 2 + 1] != ref[3])
+                fail(set->name, "scale2x", x);
+        }
+        set->scale3x(rows, lines, WIDTH);
+        for (int x = 0; x < WIDTH; x++) {
+            reference_upscale(&win[0][0], WIDTH + 2, x, ref);
+            for (int i = 0; i < 9; i++)
+                if (out[i / 3][x * 3 + i % 3] != ref[4 + i])
+                    fail(set->name, "scale3x", x);
+        }
+        set->xbr2x(rows, lines, WIDTH);
+        for (int x = 0; x < WIDTH; x++) {
+            reference_upscale(&win[0][0], WIDTH + 2, x, ref);
+            if (out[0][x * 2] != ref[13] || out[0][x * 2 + 1] != ref[14] || out[1][x * 2] != ref[15] ||
+                out[1][x * 2 + 1] != ref[16])
+                fail(set->name, "xbr2x", x);
+        }
+    }
+
+    for (int i = 0; i < WIDTH; i++) {
+        a[i] = rand() ^ ((uint32_t)rand() << 16);
+        b[i] = rand() ^ ((uint32_t)rand() << 16);
+    }
+    set->blend(a, b, blended, WIDTH);
+    for (int i = 0; i < WIDTH; i++) {
+        v = 0;
+        for (int j = 0; j < 32; j += 8)
+            v |= ((((a[i] >> j) & 0xff) + ((b[i] >> j) & 0xff) + 1) >> 1) << j;
+        if (blended[i] != v)
+            fail(set->name, "blend", i);
+    }
+}
+
+void test_kernels(const struct pixel_kernels *set)
+{
+    uint8_t tile[16], in[259], table[32], out[259], ref[64], pixels[64];
+    uint8_t bg[259], spr[259], ref_out[259];
+    int hit;
+    uint32_t rgba[259];
+
+    // every (low, high) plane pair, 8 per tile
+    for (int i = 0; i < 0x10000; i += 8) {
+        for (int row = 0; row < 8; row++) {
+            tile[row] = (i + row) & 0xff;
+            tile[row + 8] = (i + row) >> 8;
+        }
+        for (int flip = 0; flip < 2; flip++) {
+            reference_decode(tile, ref, flip);
+            set->decode_tile(tile, pixels, flip);
+            if (memcmp(ref, pixels, 64))
+                fail(set->name, "decode_tile", i);
+        }
+    }
+
+    for (int i = 0; i < 32; i++)
+        table[i] = rand() & 0x3f;
+    // odd length for the scalar tails
+    for (int n = 0; n < sizeof(in); n++)
+        in[n] = rand();
+    set->lookup(in, table, out, sizeof(in));
+    for (int i = 0; i < sizeof(in); i++)
+        if (out[i] != table[in[i] & 0x1f])
+            fail(set->name, "lookup", i);
+    set->to_rgba(in, ppu_palette_rgba, rgba, sizeof(in));
+    for (int i = 0; i < sizeof(in); i++)
+        if (rgba[i] != ppu_palette_rgba[in[i] & 0x3f])
+            fail(set->name, "to_rgba", i);
+
+    // random lines, half of the pixels clear, a few sprite 0 pixels
+    for (int r = 0; r < 1000; r++) {
+        for (int i = 0; i < sizeof(bg); i++) {
+            bg[i] = (rand() & 1) ? rand() & 0x1f : 0;
+            spr[i] = rand() & (0x5f | ((rand() % 64) ? 0 : SPRITE_0));
+        }
+        hit = reference_composite(bg, spr, ref_out, sizeof(bg));
+        if (set->composite(bg, spr, out, sizeof(bg)) != hit)
+            fail(set->name, "composite hit", hit);
+        if (memcmp(ref_out, out, sizeof(bg)))
+            fail(set->name, "composite", r);
+    }
+    // a single hit at every position, and a sprite 0 pixel over clear
+    // background before it
+    memset(bg, 0x01, sizeof(bg));
+    for (int i = 0; i < sizeof(bg); i++) {
+        memset(spr, 0, sizeof(spr));
+        spr[i] = SPRITE_0 | 0x11;
+        if (i) {
+            bg[i - 1] = 0;
+            spr[i - 1] = SPRITE_0 | 0x11;
+        }
+        if (set->composite(bg, spr, out, sizeof(bg)) != i)
+            fail(set->name, "composite hit", i);
+        if (i)
+            bg[i - 1] = 0x01;
+    }
+
+    // deltas leave cur in prev
+    for (int i = 0; i < sizeof(in); i++) {
+        bg[i] = rand();
+        ref_out[i] = spr[i] = rand();
+    }
+    set->delta(bg, spr, out, sizeof(bg));
+    for (int i = 0; i < sizeof(bg); i++)
+        if (out[i] != (bg[i] ^ ref_out[i]) || spr[i] != bg[i])
+            fail(set->name, "delta", i);
+    // a run ending at every position, or at the end of every length
+    memset(in, 0x2a, sizeof(in));
+    for (int i = 1; i < sizeof(in); i++) {
+        in[i] = 0x2b;
+        if (set->run(in, sizeof(in)) != i)
+            fail(set->name, "run", i);
+        if (i > 1 && set->run(in + 1, i - 1) != i - 1)
+            fail(set->name, "run to the end", i);
+        in[i] = 0x2a;
+    }
+
+    test_ntsc(set);
+    test_upscale(set);
+}
+
+/* the whole chain of a line: decode, add the attribute bits, composite
+   with sprites, palette RAM lookup, RGBA */
+void bench_kernels(const struct pixel_kernels *set)
+{
+    static uint8_t pixels[512 * 64], sprites[512 * 64], colors[512 * 64];
+    static uint32_t rgba[512 * 64];
+    uint8_t palette[32];
+    int rounds = 200;
+    clock_t start;
+    double secs;
+
+    for (int i = 0; i < 32; i++)
+        palette[i] = i;
+    for (int i = 0; i < sizeof(sprites); i++)
+        sprites[i] = (i & 0x100) ? 0x10 | BEHIND_BG | (i & 0x0f) : 0;
+    start = clock();
+    for (int r = 0; r < rounds; r++) {
+        for (int t = 0; t < 512; t++)
+            set->decode_tile(chr + t * 16, pixels + t * 64, t & 1);
+        for (int i = 0; i < sizeof(pixels); i++)
+            pixels[i] |= (i >> 6) & 0x0c;
+        set->composite(pixels, sprites, colors, sizeof(pixels));
+        set->lookup(colors, palette, colors, sizeof(pixels));
+        set->to_rgba(colors, ppu_palette_rgba, rgba, sizeof(pixels));
+    }
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%-7s %7.1f M pixels/s (checksum %08x)\n", set->name,
+           (double)sizeof(pixels) * rounds / secs / 1e6, rgba[12345] ^ rgba[777]);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct pixel_kernels *set;
+
+    for (int i = 0; i < sizeof(chr); i++)
+        chr[i] = rand();
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (!(set = pixel_kernels_by_name(names[i]))) {
+            printf("Skip %s kernels(unsupported)\n", names[i]);
+            continue;
+        }
+        test_kernels(set);
+        printf("Test %s kernels ok\n", names[i]);
+    }
+    printf("default: %s\n", pixel_kernels()->name);
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if ((set = pixel_kernels_by_name(names[i])))
+            bench_kernels(set);
+    printf("*******************************************************************\n");
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <time.h>
+#include <unistd.h>
+#include "deflate.h"
+#include "inflate.h"
+#include "png.h"
+
+#define MAX_SIZE    (200 * KB)
+
+static uint8_t src[MAX_SIZE], coded[MAX_SIZE * 2], out[MAX_SIZE];
+
+void fail(const char *msg, long long a, long long b)
+{
+    printf("%s: %lld, expected %lld\n", msg, a, b);
+    exit(EXIT_FAILURE);
+}
+
+uint32_t get32be(const uint8_t *in)
+{
+    return ((uint32_t)in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+}
+
+/* deflate_raw() within its bound and back through inflate_raw() */
+size_t round_trip(const char *name, size_t size)
+{
+    size_t coded_size = deflate_raw(src, size, coded), out_size;
+    int ret;
+
+    if (coded_size > deflate_bound(size))
+        fail(name, coded_size, deflate_bound(size));
+    if ((ret = inflate_raw(coded, coded_size, out, sizeof(out), &out_size)))
+        fail(name, ret, INFLATE_OK);
+    if (out_size != size || memcmp(src, out, size))
+        fail(name, out_size, size);
+    return coded_size;
+}
+
+void test_deflate(void)
+{
+    size_t size;
+
+    for (size = 0; size < 4; size++) {
+        memset(src, 0x90 + size, size);
+        round_trip("deflate: tiny", size);
+    }
+    memset(src, 0, MAX_SIZE);
+    if ((size = round_trip("deflate: zeros", MAX_SIZE)) > MAX_SIZE / 100)
+        fail("deflate: zeros don't compress", size, MAX_SIZE / 100);
+    // random bytes are stored, in more than one block
+    for (int i = 0; i < MAX_SIZE; i++)
+        src[i] = rand();
+    if ((size = round_trip("deflate: random", MAX_SIZE)) > MAX_SIZE + 5 * (MAX_SIZE / 65535 + 1))
+        fail("deflate: random isn't stored", size, MAX_SIZE + 5 * (MAX_SIZE / 65535 + 1));
+    // every match length and distances up to the window size
+    for (int i = 0; i < MAX_SIZE; i++)
+        src[i] = (i % 1000 < 500) ? src[i % 32768] : (i * 7) / (i % 300 + 1);
+    round_trip("deflate: matches", MAX_SIZE);
+    for (int i = 0; i < MAX_SIZE; i++)
+        src[i] = (i / 3) % 0xfe;
+    round_trip("deflate: long matches", MAX_SIZE);
+
+    if (deflate_adler32(1, (const uint8_t *)"Wikipedia", 9) != 0x11e60398)
+        fail("adler32", deflate_adler32(1, (const uint8_t *)"Wikipedia", 9), 0x11e60398);
+}
+
+/* A written PNG is the signature, IHDR, IDAT and IEND with good CRCs, its
+   zlib stream inflates to the unfiltered rows. */
+void test_png(void)
+{
+    char path[] = "/tmp/nesla_png_test.png";
+    int width = 128, height = 120, pitch = 400;
+    size_t size, pos = 8, len, raw_size;
+    uint8_t *file = coded;
+    FILE *fp;
+
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < pitch; x++)
+            src[y * pitch + x] = (x < width * 3) ? ((x / 24) ^ (y / 8)) * 37 + (x % 3) * 80 : 0xee;
+    if (png_write(path, src, width, height, pitch))
+        fail("png: write", -1, 0);
+    fp = fopen(path, "rb");
+    size = fread(file, 1, sizeof(coded), fp);
+    fclose(fp);
+    unlink(path);
+    if (size < 8 || memcmp(file, "\x89PNG\r\n\x1a\n", 8))
+        fail("png: signature", size, 8);
+
+    for (int chunk = 0; chunk < 3; chunk++) {
+        len = get32be(file + pos);
+        if (pos + 12 + len > size || memcmp(file + pos + 4, &"IHDRIDATIEND"[chunk * 4], 4))
+            fail("png: chunk", chunk, pos);
+        if (inflate_crc32(0, file + pos + 4, len + 4) != get32be(file + pos + 8 + len))
+            fail("png: CRC", chunk, get32be(file + pos + 8 + len));
+        if (chunk == 0 && (get32be(file + pos + 8) != width || get32be(file + pos + 12) != height ||
+                           file[pos + 16] != 8 || file[pos + 17] != 2))
+            fail("png: IHDR", get32be(file + pos + 8), width);
+        if (chunk == 1) {
+            if (file[pos + 8] != 0x78 || (file[pos + 8] * 256 + file[pos + 9]) % 31)
+                fail("png: zlib header", file[pos + 8], 0x78);
+            if (inflate_raw(file + pos + 10, len - 6, out, sizeof(out), &raw_size) ||
+                raw_size != (1 + width * 3) * height)
+                fail("png: IDAT", raw_size, (1 + width * 3) * height);
+            if (deflate_adler32(1, out, raw_size) != get32be(file + pos + 4 + len))
+                fail("png: adler32", get32be(file + pos + 4 + len), deflate_adler32(1, out, raw_size));
+            for (int y = 0; y < height; y++)
+                if (out[y * (1 + width * 3)] || memcmp(out + y * (1 + width * 3) + 1, src + y * pitch, width * 3))
+                    fail("png: row", y, 0);
+        }
+        pos += 12 + len;
+    }
+    if (pos != size)
+        fail("png: trailing bytes", size - pos, 0);
+}
+
+/* RGB 256x240 frames: a tiled background, what a game screen looks like */
+void bench_deflate(void)
+{
+    int rounds = 200, size = SCREEN_WIDTH * SCREEN_HEIGHT * 3;
+    struct timespec start, end;
+    size_t coded_size = 0;
+    double us;
+
+    for (int i = 0; i < size; i++)
+        src[i] = (((i / 3 % SCREEN_WIDTH) / 8 * 5 + (i / 3 / SCREEN_WIDTH) / 8 * 3) % 7) * 36;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++)
+        coded_size = deflate_raw(src, size, coded);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    us = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / rounds;
+    printf("deflate %d bytes to %zu in %.1f us, %.1f MB/s\n", size, coded_size, us, size / us);
+}
+
+int main(int argc, char *argv[])
+{
+    test_deflate();
+    printf("Test deflate ok\n");
+    test_png();
+    printf("Test PNG ok\n");
+    bench_deflate();
+    printf("*******************************************************************\n");
+    return 0;
+}
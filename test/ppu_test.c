@@ -0,0 +1,793 @@
+#include "nes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include <time.h>
+
+static struct nes nes;
+static uint8_t prg_rom[32 * KB];
+static uint8_t chr_rom[8 * KB];
+static uint32_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];    /* any format */
+
+void setup_ppu(enum MIRRORING mirroring, bool chr_ram)
+{
+    memset(&nes, 0, sizeof(nes));
+    for (int i = 0; i < sizeof(chr_rom); i++)
+        chr_rom[i] = i >> 4;
+    nes.cart.prg_rom = prg_rom;
+    nes.cart.chr_rom = chr_rom;
+    nes.cart.chr_ram = chr_ram;
+    nes.cart.info.prg_size = sizeof(prg_rom);
+    nes.cart.info.chr_size = sizeof(chr_rom);
+    nes.cart.info.mirroring = mirroring;
+    ppu_at_power_up(&nes);
+    mapper_init(&nes);
+}
+
+void set_addr(uint16_t addr)
+{
+    mmu_read(&nes, 0x2002);
+    mmu_write(&nes, 0x2006, addr >> 8);
+    mmu_write(&nes, 0x2006, addr & 0xff);
+}
+
+void vram_write(uint16_t addr, uint8_t val)
+{
+    set_addr(addr);
+    mmu_write(&nes, 0x2007, val);
+}
+
+/* buffered read: the first PPUDATA read returns the stale buffer */
+uint8_t vram_read(uint16_t addr)
+{
+    set_addr(addr);
+    mmu_read(&nes, 0x2007);
+    return mmu_read(&nes, 0x2007);
+}
+
+void expect(const char *name, uint16_t addr, uint8_t val)
+{
+    uint8_t ret = vram_read(addr);
+
+    if (ret != val) {
+        printf("%s: PPU $%04x = %02x, expected %02x\n", name, addr, ret, val);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void test_mirroring(void)
+{
+    static const struct {
+        const char *name;
+        enum MIRRORING mirroring;
+        uint8_t layout[4];
+    } tests[] = {
+        { "horizontal", HORIZONTAL, { 0, 0, 1, 1 } },
+        { "vertical", VERTICAL, { 0, 1, 0, 1 } },
+        { "single screen low", SINGLE_SCREEN_LOW, { 0, 0, 0, 0 } },
+        { "single screen high", SINGLE_SCREEN_HIGH, { 1, 1, 1, 1 } },
+        { "four screen", FOUR_SCREEN, { 0, 1, 2, 3 } },
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        setup_ppu(tests[i].mirroring, false);
+        // tag every quadrant, later writes overwrite the mirrored ones
+        for (int nt = 0; nt < 4; nt++)
+            vram_write(0x2000 + nt * 0x400 + 0x155, 0x10 + nt);
+        for (int nt = 0; nt < 4; nt++) {
+            uint8_t last = 0;
+            for (int j = 0; j < 4; j++)
+                if (tests[i].layout[j] == tests[i].layout[nt])
+                    last = 0x10 + j;
+            expect(tests[i].name, 0x2000 + nt * 0x400 + 0x155, last);
+            // $3000-$3eff mirrors $2000-$2eff
+            expect(tests[i].name, 0x3000 + nt * 0x400 + 0x155, last);
+        }
+    }
+}
+
+/* the attribute cache against the attribute fetch, for every v */
+void test_attributes(void)
+{
+    static const enum MIRRORING mirrorings[] = { HORIZONTAL, VERTICAL, FOUR_SCREEN };
+    uint8_t attr, expected;
+
+    for (int i = 0; i < sizeof(mirrorings) / sizeof(mirrorings[0]); i++) {
+        setup_ppu(mirrorings[i], false);
+        for (int nt = 0; nt < 4; nt++)
+            for (int j = 0; j < 64; j++)
+                vram_write(0x23c0 + nt * 0x400 + j, rand());
+        for (uint16_t v = 0; v < 0x1000; v++) {
+            attr = vram_read(0x23c0 | (v & 0x0c00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+            expected = ((attr >> (((v >> 4) & 0x04) | (v & 0x02))) & 0x03) << 2;
+            if (ppu_attr_bits(&nes.ppu, v) != expected) {
+                printf("attributes: v = $%04x, palette select %02x, expected %02x\n", v,
+                       ppu_attr_bits(&nes.ppu, v), expected);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+void expect_color(const char *name, uint32_t color, uint32_t expected)
+{
+    if (color != expected) {
+        printf("%s: %08x, expected %08x\n", name, color, expected);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* the output LUT in every format, with emphasis and from a .pal file */
+void test_palette_lut(void)
+{
+    struct palette_lut *lut = &nes.ppu.lut;
+    char path[] = "/tmp/ppu_test_XXXXXX";
+    uint8_t pal[64 * 3] = { 0 };
+    FILE *fp;
+
+    setup_ppu(HORIZONTAL, false);
+    for (int i = 0; i < 64; i++)
+        expect_color("indexed", lut->colors[7][i], i);
+    palette_set_format(lut, PIXEL_RGBA8888);
+    for (int i = 0; i < 64; i++)
+        expect_color("RGBA8888", lut->colors[0][i], ppu_palette_rgba[i]);
+    // $21 = ec/4c/9a/ec
+    palette_set_format(lut, PIXEL_ARGB8888);
+    expect_color("ARGB8888", lut->colors[0][0x21], 0xff4c9aec);
+    palette_set_format(lut, PIXEL_RGB565);
+    expect_color("RGB565", lut->colors[0][0x21], (0x4c >> 3) << 11 | (0x9a >> 2) << 5 | (0xec >> 3));
+    // red emphasis keeps red, darkens green and blue
+    palette_set_format(lut, PIXEL_RGBA8888);
+    if (lut->rgb[1][0x21][0] != 0x4c || lut->rgb[1][0x21][1] >= 0x9a || lut->rgb[1][0x21][2] >= 0xec) {
+        printf("emphasis: $21 = %02x%02x%02x\n", lut->rgb[1][0x21][0], lut->rgb[1][0x21][1],
+               lut->rgb[1][0x21][2]);
+        exit(EXIT_FAILURE);
+    }
+
+    pal[0x21 * 3] = 0x12;
+    pal[0x21 * 3 + 1] = 0x34;
+    pal[0x21 * 3 + 2] = 0x56;
+    fp = fdopen(mkstemp(path), "wb");
+    fwrite(pal, 1, sizeof(pal), fp);
+    fclose(fp);
+    if (palette_load(lut, path)) {
+        printf("palette: failed to load %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    remove(path);
+    expect_color(".pal file", lut->colors[0][0x21], 0x123456ff);
+    expect_color(".pal file", lut->colors[0][0x20], 0x000000ff);
+}
+
+void test_palette(void)
+{
+    uint8_t val;
+
+    setup_ppu(VERTICAL, false);
+    vram_write(0x3f10, 0x2a);
+    vram_write(0x3f05, 0x15);
+    vram_write(0x2f00, 0x77);
+    // palette reads aren't buffered
+    set_addr(0x3f00);
+    val = mmu_read(&nes, 0x2007) & 0x3f;
+    if (val != 0x2a) {
+        printf("palette: $3f00 = %02x, expected 2a ($3f10 mirror)\n", val);
+        exit(EXIT_FAILURE);
+    }
+    set_addr(0x3f25);
+    val = mmu_read(&nes, 0x2007) & 0x3f;
+    if (val != 0x15) {
+        printf("palette: $3f25 = %02x, expected 15 ($3f05 mirror)\n", val);
+        exit(EXIT_FAILURE);
+    }
+    // ...but they fill the buffer with the nametable byte underneath
+    set_addr(0x3f00);
+    mmu_read(&nes, 0x2007);
+    set_addr(0x0000);
+    val = mmu_read(&nes, 0x2007);
+    if (val != 0x77) {
+        printf("palette: buffer = %02x, expected 77 from $2f00\n", val);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void expect_tile_row(const char *name, uint16_t addr, bool flip, uint8_t lo, uint8_t hi)
+{
+    const uint8_t *pixels = tilecache_tile(&nes.ppu, addr, flip) + (addr & 0x07) * 8;
+    uint8_t color;
+
+    for (int i = 0; i < 8; i++) {
+        color = ((lo >> (7 - i)) & 0x01) | (((hi >> (7 - i)) & 0x01) << 1);
+        if (pixels[(flip) ? 7 - i : i] != color) {
+            printf("%s: decoded tile row $%04x pixel %d = %d, expected %d\n", name, addr,
+                   i, pixels[(flip) ? 7 - i : i], color);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void test_pattern(void)
+{
+    setup_ppu(VERTICAL, false);
+    expect("CHR ROM", 0x1230, 0x23);
+    vram_write(0x1230, 0x99);
+    expect("CHR ROM write", 0x1230, 0x23);
+    expect_tile_row("CHR ROM", 0x1230, false, 0x23, 0x23);
+
+    setup_ppu(VERTICAL, true);
+    expect_tile_row("CHR RAM", 0x1230, false, 0x23, 0x23);
+    expect_tile_row("CHR RAM", 0x1230, true, 0x23, 0x23);
+    vram_write(0x1230, 0x99);
+    expect("CHR RAM write", 0x1230, 0x99);
+    expect_tile_row("CHR RAM write", 0x1230, false, 0x99, 0x23);
+    expect_tile_row("CHR RAM write", 0x1230, true, 0x99, 0x23);
+    chr_rom[0x1230] = 0x23;
+}
+
+/* what viewers redraw on: CHR writes and palette writes bump their
+   version, nametable writes neither */
+void fail_version(const char *name, int val)
+{
+    printf("versions: %s (%d)\n", name, val);
+    exit(EXIT_FAILURE);
+}
+
+void test_versions(void)
+{
+    static const uint32_t colors[4] = { 0x10, 0x20, 0x30, 0x40 };
+    uint32_t chr, palette, out[8 * 12];
+    const uint8_t *pixels;
+
+    setup_ppu(VERTICAL, true);
+    chr = nes.ppu.tiles.version;
+    palette = nes.ppu.palette_version;
+    vram_write(0x2000, 0x55);
+    if (nes.ppu.tiles.version != chr || nes.ppu.palette_version != palette)
+        fail_version("nametable write", nes.ppu.tiles.version - chr);
+    vram_write(0x0123, 0x55);
+    if (nes.ppu.tiles.version == chr || nes.ppu.palette_version != palette)
+        fail_version("CHR RAM write", nes.ppu.tiles.version - chr);
+    chr = nes.ppu.tiles.version;
+    vram_write(0x3f11, 0x2a);
+    if (nes.ppu.tiles.version != chr || nes.ppu.palette_version == palette)
+        fail_version("palette write", nes.ppu.palette_version - palette);
+
+    // the shared blit is the cached tile, flipped either way
+    for (int flip = 0; flip < 4; flip++) {
+        memset(out, 0, sizeof(out));
+        tilecache_blit(&nes.ppu, 0x0120, flip & 0x01, flip & 0x02, colors, out + 2, 12);
+        pixels = tilecache_tile(&nes.ppu, 0x0120, flip & 0x01);
+        for (int y = 0; y < 8; y++)
+            for (int x = 0; x < 12; x++)
+                if (out[y * 12 + x] != ((x >= 2 && x < 10) ?
+                                        colors[pixels[((flip & 0x02) ? 7 - y : y) * 8 + x - 2]] : 0))
+                    fail_version("tile blit", flip);
+    }
+}
+
+void run_until(int scanline, int cycle)
+{
+    while (nes.ppu.scanlines != scanline || nes.ppu.cycles != cycle)
+        ppu_tick(&nes);
+}
+
+void run_frame(void)
+{
+    uint64_t frames = nes.ppu.frames;
+
+    while (nes.ppu.frames == frames)
+        ppu_tick(&nes);
+}
+
+void expect_pixel(const char *name, int x, int y, uint8_t color)
+{
+    uint8_t ret = ((const uint8_t *)framebuffer)[y * SCREEN_WIDTH + x];
+
+    if (ret != color) {
+        printf("%s: pixel (%d, %d) = %02x, expected %02x\n", name, x, y, ret, color);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Nametable 0 full of tile $f0(4 opaque, 4 clear pixels with this CHR),
+   white on black. Scroll is set in vblank like a game would.
+*/
+void setup_screen(render_mode_t mode)
+{
+    setup_ppu(HORIZONTAL, false);
+    nes.ppu.render_mode = mode;
+    nes.ppu.framebuffer = framebuffer;
+    set_addr(0x2000);
+    for (int i = 0; i < 0x3c0; i++)
+        mmu_write(&nes, 0x2007, 0xf0);
+    vram_write(0x3f00, 0x0f);
+    vram_write(0x3f03, 0x30);
+    vram_write(0x3f13, 0x16);
+    run_until(241, 10);
+    mmu_write(&nes, 0x2000, 0x00);
+    mmu_write(&nes, 0x2005, 0x02);
+    mmu_write(&nes, 0x2005, 0x00);
+    mmu_write(&nes, 0x2001, 0x1e);
+}
+
+void test_render(render_mode_t mode)
+{
+    setup_screen(mode);
+    // sprites made of tile $ff(all opaque) on lines 50-57, the second one
+    // cut by the right edge
+    mmu_write(&nes, 0x2003, 0x00);
+    for (int i = 0; i < 2; i++) {
+        mmu_write(&nes, 0x2004, 49);
+        mmu_write(&nes, 0x2004, 0xff);
+        mmu_write(&nes, 0x2004, 0x00);
+        mmu_write(&nes, 0x2004, (i) ? 252 : 40);
+    }
+    run_frame();
+    for (int y = 0; y < SCREEN_HEIGHT; y += 7) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            if (y >= 50 && y < 58 && ((x >= 40 && x < 48) || x >= 252))
+                expect_pixel("sprite", x, y, 0x16);
+            else
+                expect_pixel("background", x, y, (((x + 2) & 0x07) < 4) ? 0x30 : 0x0f);
+        }
+    }
+    if (!nes.ppu.SPR) {
+        printf("sprite 0 hit not set\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // raster split: background off from the middle of line 100
+    run_until(100, 129);
+    mmu_write(&nes, 0x2001, 0x16);
+    run_until(101, 0);
+    mmu_write(&nes, 0x2001, 0x1e);
+    run_frame();
+    for (int x = 0; x < SCREEN_WIDTH; x++)
+        expect_pixel("split", x, 100, (x < 128 && ((x + 2) & 0x07) < 4) ? 0x30 : 0x0f);
+    expect_pixel("split", 0, 101, 0x30);
+}
+
+/* MMC1 in 4 KB CHR mode switching the background bank in the middle of
+   line 100: the tiles fetched after the write come from the new bank,
+   where tile $f0 is opaque. */
+void mmc1_write(uint16_t addr, uint8_t val)
+{
+    for (int i = 0; i < 5; i++)
+        mmu_write(&nes, addr, (val >> i) & 0x01);
+}
+
+void test_bank_switch(render_mode_t mode)
+{
+    setup_screen(mode);
+    memset(chr_rom + 0x1f00, 0xff, 16);
+    nes.cart.info.mapper = 1;
+    mapper_init(&nes);
+    mmc1_write(0x8000, 0x1f);
+    // a sprite of tile $f0 from line 100, its pattern of the line is
+    // fetched before the switch
+    mmu_write(&nes, 0x2003, 0x00);
+    mmu_write(&nes, 0x2004, 99);
+    mmu_write(&nes, 0x2004, 0xf0);
+    mmu_write(&nes, 0x2004, 0x00);
+    mmu_write(&nes, 0x2004, 200);
+    run_frame();
+    run_until(100, 129);
+    mmc1_write(0xa000, 0x01);
+    run_frame();
+    mmc1_write(0xa000, 0x00);
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        expect_pixel("bank switch", x, 99, (((x + 2) & 0x07) < 4) ? 0x30 : 0x0f);
+        if (x >= 200 && x < 204)
+            expect_pixel("sprite before the bank switch", x, 100, 0x16);
+        else
+            expect_pixel("bank switch", x, 100, (x >= 142 || ((x + 2) & 0x07) < 4) ? 0x30 : 0x0f);
+        if (x >= 200 && x < 208)
+            expect_pixel("sprite after the bank switch", x, 101, 0x16);
+    }
+}
+
+/* blue emphasis from the middle of line 60 into a RGB565 framebuffer */
+void test_emphasis(render_mode_t mode)
+{
+    const uint16_t *pixels = (const uint16_t *)framebuffer;
+    const struct palette_lut *lut = &nes.ppu.lut;
+    uint16_t expected;
+
+    setup_screen(mode);
+    palette_set_format(&nes.ppu.lut, PIXEL_RGB565);
+    run_until(60, 65);
+    mmu_write(&nes, 0x2001, 0x9e);
+    run_frame();
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        expected = lut->colors[(x < 64) ? 0 : 4][(((x + 2) & 0x07) < 4) ? 0x30 : 0x0f];
+        if (pixels[60 * SCREEN_WIDTH + x] != expected) {
+            printf("emphasis: pixel (%d, 60) = %04x, expected %04x\n", x,
+                   pixels[60 * SCREEN_WIDTH + x], expected);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* the default indexed output, expanded to RGBA afterwards with the
+   emphasis of each line */
+void test_indexed(render_mode_t mode)
+{
+    static uint32_t rgba[SCREEN_WIDTH * SCREEN_HEIGHT];
+    const uint8_t *frame = (const uint8_t *)framebuffer;
+    struct palette_lut lut;
+    int i;
+
+    setup_screen(mode);
+    palette_reset(&lut, PIXEL_RGBA8888);
+    run_until(100, 0);
+    mmu_write(&nes, 0x2001, 0x3e);
+    run_frame();
+    palette_expand(&lut, frame, nes.ppu.emphasis, rgba);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        if (nes.ppu.emphasis[y] != ((y < 100) ? 0 : 1)) {
+            printf("indexed: line %d emphasis %d\n", y, nes.ppu.emphasis[y]);
+            exit(EXIT_FAILURE);
+        }
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            i = y * SCREEN_WIDTH + x;
+            expect_pixel("indexed", x, y, (((x + 2) & 0x07) < 4) ? 0x30 : 0x0f);
+            if (rgba[i] != lut.colors[nes.ppu.emphasis[y]][frame[i]]) {
+                printf("indexed: RGBA pixel (%d, %d) = %08x\n", x, y, rgba[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+/* A still picture leaves no dirty band, a tile changed on lines 48-55
+   dirties band 3 only. The hash is the same with both renderers. */
+uint64_t test_frame_hash(render_mode_t mode)
+{
+    uint64_t hash;
+
+    setup_screen(mode);
+    run_frame();
+    run_frame();
+    hash = nes.ppu.frame_hash;
+    run_frame();
+    if (nes.ppu.dirty_bands || nes.ppu.frame_hash != hash) {
+        printf("frame hash: still frame, dirty %04x, hash %016llx -> %016llx\n", nes.ppu.dirty_bands,
+               (unsigned long long)hash, (unsigned long long)nes.ppu.frame_hash);
+        exit(EXIT_FAILURE);
+    }
+    vram_write(0x2000 + 6 * 32 + 10, 0xff);
+    mmu_write(&nes, 0x2005, 0x02);
+    mmu_write(&nes, 0x2005, 0x00);
+    run_frame();
+    if (nes.ppu.dirty_bands != 1 << 3 || nes.ppu.frame_hash == hash) {
+        printf("frame hash: changed tile, dirty %04x, hash %016llx\n", nes.ppu.dirty_bands,
+               (unsigned long long)nes.ppu.frame_hash);
+        exit(EXIT_FAILURE);
+    }
+    return hash;
+}
+
+/* 9 sprites on lines 100-107 put in OAM by DMA: the 9th isn't drawn and
+   sets the overflow flag, unless rendering is off while they're
+   evaluated */
+void test_sprite_overflow(render_mode_t mode)
+{
+    setup_screen(mode);
+    for (int i = 0; i < 9; i++) {
+        nes.cpu.mem[0x0200 + i * 4] = 99;
+        nes.cpu.mem[0x0201 + i * 4] = 0xff;
+        nes.cpu.mem[0x0202 + i * 4] = 0x00;
+        nes.cpu.mem[0x0203 + i * 4] = i * 16 + 4;
+    }
+    memset(&nes.cpu.mem[0x0224], 0xff, 256 - 36);
+    mmu_write(&nes, 0x2003, 0x00);
+    mmu_write(&nes, 0x4014, 0x02);
+    run_frame();
+    if (!nes.ppu.O) {
+        printf("overflow: flag not set\n");
+        exit(EXIT_FAILURE);
+    }
+    expect_pixel("overflow", 7 * 16 + 6, 100, 0x16);
+    expect_pixel("overflow", 8 * 16 + 6, 100, 0x30);
+    expect_pixel("overflow", 7 * 16 + 6, 99, 0x30);
+
+    run_until(90, 0);
+    mmu_write(&nes, 0x2001, 0x00);
+    run_until(110, 0);
+    mmu_write(&nes, 0x2001, 0x1e);
+    run_frame();
+    if (nes.ppu.O) {
+        printf("overflow: flag set with rendering off\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // move the 9th sprite away: the index is rebuilt on the OAMDATA write
+    mmu_write(&nes, 0x2003, 8 * 4);
+    mmu_write(&nes, 0x2004, 0xf0);
+    run_frame();
+    if (nes.ppu.O) {
+        printf("overflow: flag still set\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* The PPU state seen by the CPU and the mapper on every dot of 3 frames
+   with sprite 0 hit, overflow and a split, with and without video. The
+   frames without video must not touch the framebuffer. */
+#define TRACE_DOTS      (3 * 262 * 341)
+
+/* Traces the PPU state dot by dot, or every 3 dots through ppu_run() like
+   the CPU drives it: the dots in between are left at UINT64_MAX. */
+void trace_frames(render_mode_t mode, bool no_video, int step, uint64_t *trace)
+{
+    int n;
+
+    setup_screen(mode);
+    for (int i = 0; i < 9; i++) {
+        nes.cpu.mem[0x0200 + i * 4] = (i) ? 99 : 49;
+        nes.cpu.mem[0x0201 + i * 4] = 0xff;
+        nes.cpu.mem[0x0202 + i * 4] = 0x00;
+        nes.cpu.mem[0x0203 + i * 4] = i * 16 + 4;
+    }
+    memset(&nes.cpu.mem[0x0224], 0xff, 256 - 36);
+    mmu_write(&nes, 0x2003, 0x00);
+    mmu_write(&nes, 0x4014, 0x02);
+    nes.ppu.no_video = no_video;
+    run_until(261, 0);
+    memset(framebuffer, 0xee, sizeof(framebuffer));
+    for (int i = 0; i < TRACE_DOTS; i += n) {
+        if (nes.ppu.scanlines == 120 && nes.ppu.cycles == 100)
+            mmu_write(&nes, 0x2001, 0x16);
+        else if (nes.ppu.scanlines == 121 && nes.ppu.cycles == 0)
+            mmu_write(&nes, 0x2001, 0x1e);
+        n = (step < TRACE_DOTS - i) ? step : TRACE_DOTS - i;
+        // stop on the dots of the writes
+        if (nes.ppu.scanlines == 120 && nes.ppu.cycles < 100 && nes.ppu.cycles + n > 100)
+            n = 100 - nes.ppu.cycles;
+        else if (nes.ppu.scanlines == 120 && nes.ppu.cycles + n > 341)
+            n = 341 - nes.ppu.cycles;
+        if (step == 1)
+            ppu_tick(&nes);
+        else
+            ppu_run(&nes, n);
+        for (int j = i; j < i + n - 1; j++)
+            trace[j] = UINT64_MAX;
+        trace[i + n - 1] = nes.ppu.v | ((uint64_t)nes.ppu.ppustatus << 16) | ((uint64_t)nes.ppu.nmi_occured << 24) |
+                   ((uint64_t)nes.ppu.sprite_count << 32) | ((uint64_t)nes.ppu.oamaddr << 40);
+    }
+    if (no_video) {
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+            if (framebuffer[i] != 0xeeeeeeee) {
+                printf("no video: pixel %d written\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+void test_no_video(render_mode_t mode, uint64_t *video)
+{
+    static uint64_t no_video[TRACE_DOTS];
+
+    trace_frames(mode, false, 1, video);
+    trace_frames(mode, true, 1, no_video);
+    for (int i = 0; i < TRACE_DOTS; i++) {
+        if (video[i] != no_video[i]) {
+            printf("no video: dot %d of line %d(frame %d) %012llx, expected %012llx\n",
+                   i % 341, ((i / 341) + 261) % 262, i / (262 * 341), (unsigned long long)no_video[i],
+                   (unsigned long long)video[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (!(video[TRACE_DOTS - 1] & (0x60ULL << 16))) {
+        printf("no video: no sprite 0 hit or overflow to compare\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* sprite 0 hit and overflow come on the same dots with both renderers */
+void test_status_dots(const uint64_t *scanline, const uint64_t *dot)
+{
+    uint64_t flags = 0x60ULL << 16;
+
+    for (int i = 0; i < TRACE_DOTS; i++) {
+        if ((scanline[i] & flags) != (dot[i] & flags)) {
+            printf("status: dot %d of line %d(frame %d) %02llx, expected %02llx\n", i % 341,
+                   ((i / 341) + 261) % 262, i / (262 * 341), (unsigned long long)(scanline[i] & flags) >> 16,
+                   (unsigned long long)(dot[i] & flags) >> 16);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* ppu_run() skipping the dots with nothing to do in scanline mode leaves
+   the same state and pixels as ticking every dot */
+void test_batched_dots(const uint64_t *scanline)
+{
+    static uint64_t batched[TRACE_DOTS];
+    static uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+    int compared = 0;
+
+    trace_frames(RENDER_SCANLINE, false, 1, batched);
+    memcpy(pixels, framebuffer, sizeof(pixels));
+    trace_frames(RENDER_SCANLINE, false, 3, batched);
+    for (int i = 0; i < TRACE_DOTS; i++) {
+        if (batched[i] == UINT64_MAX)
+            continue;
+        if (batched[i] != scanline[i]) {
+            printf("batched dots: dot %d of line %d(frame %d) %012llx, expected %012llx\n", i % 341,
+                   ((i / 341) + 261) % 262, i / (262 * 341), (unsigned long long)batched[i],
+                   (unsigned long long)scanline[i]);
+            exit(EXIT_FAILURE);
+        }
+        compared++;
+    }
+    if (compared < TRACE_DOTS / 3 || memcmp(pixels, framebuffer, sizeof(pixels))) {
+        printf("batched dots: frames differ\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Frames changing between and within themselves: tiles, palette and CHR
+   RAM written in vblank, a sprite moved by DMA, a mid-line split and an
+   AxROM nametable switch. The render thread draws the same pixels one
+   frame later. */
+#define SCRIPT_FRAMES   8
+
+void run_script(bool threaded, uint8_t frames[][SCREEN_WIDTH * SCREEN_HEIGHT], uint64_t *hashes)
+{
+    setup_ppu(HORIZONTAL, true);
+    nes.cart.info.mapper = 7;
+    mapper_init(&nes);
+    nes.ppu.framebuffer = framebuffer;
+    set_addr(0x2000);
+    for (int i = 0; i < 0x3c0; i++)
+        mmu_write(&nes, 0x2007, 0xf0);
+    vram_write(0x3f00, 0x0f);
+    vram_write(0x3f03, 0x30);
+    vram_write(0x3f13, 0x16);
+    if (threaded && render_thread_start(&nes)) {
+        printf("render thread: failed to start\n");
+        exit(EXIT_FAILURE);
+    }
+    run_frame();
+    for (int f = 0; f < SCRIPT_FRAMES; f++) {
+        // more writes than the render thread logs in a frame, the frame is
+        // dropped and the next one starts from the PPU memories
+        for (int i = 0; f == 2 && i < 9000; i++)
+            vram_write(0x2000 + i % 0x3c0, (i >= 9000 - 0x3c0 && !(i & 0x03)) ? 0xf1 : 0xf0);
+        vram_write(0x2000 + f * 64 + f, 0xf1);
+        vram_write(0x23c0 + f, 0x55);
+        vram_write(0x3f01 + (f & 0x01), 0x21 + f);
+        vram_write(0x0f10 + f, 0x3c);   // CHR RAM, tile $f1
+        nes.cpu.mem[0x0200] = 40 + f * 8;
+        nes.cpu.mem[0x0201] = 0xf1;
+        nes.cpu.mem[0x0202] = 0x00;
+        nes.cpu.mem[0x0203] = 20 + f * 16;
+        mmu_write(&nes, 0x2003, 0x00);
+        mmu_write(&nes, 0x4014, 0x02);
+        mmu_write(&nes, 0x2000, 0x00);
+        mmu_write(&nes, 0x2005, f);
+        mmu_write(&nes, 0x2005, 0x00);
+        mmu_write(&nes, 0x2001, 0x1e);
+        run_until(60 + f, 65 + f * 8);
+        mmu_write(&nes, 0x8000, 0x10);
+        run_until(100 + f, 129);
+        mmu_write(&nes, 0x2001, 0x16);
+        run_until(101 + f, 0);
+        mmu_write(&nes, 0x2001, 0x1e);
+        run_frame();
+        mmu_write(&nes, 0x8000, 0x00);
+        memcpy(frames[f], framebuffer, SCREEN_WIDTH * SCREEN_HEIGHT);
+        hashes[f] = nes.ppu.frame_hash;
+    }
+    render_thread_stop(&nes);
+}
+
+void test_render_thread(void)
+{
+    static uint8_t inline_frames[SCRIPT_FRAMES][SCREEN_WIDTH * SCREEN_HEIGHT];
+    static uint8_t thread_frames[SCRIPT_FRAMES][SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint64_t inline_hashes[SCRIPT_FRAMES], thread_hashes[SCRIPT_FRAMES];
+
+    run_script(false, inline_frames, inline_hashes);
+    run_script(true, thread_frames, thread_hashes);
+    for (int f = 0; f + 1 < SCRIPT_FRAMES; f++) {
+        if (f == 2)
+            continue;
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+            if (inline_frames[f][i] != thread_frames[f + 1][i]) {
+                printf("render thread: frame %d pixel (%d, %d) = %02x, expected %02x\n", f,
+                       i % SCREEN_WIDTH, i / SCREEN_WIDTH, thread_frames[f + 1][i], inline_frames[f][i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (inline_hashes[f] != thread_hashes[f + 1]) {
+            printf("render thread: frame %d hash differs\n", f);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // the last frame comes out when the thread stops
+    if (memcmp(framebuffer, inline_frames[SCRIPT_FRAMES - 1], SCREEN_WIDTH * SCREEN_HEIGHT)) {
+        printf("render thread: last frame not copied out on stop\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void bench_render(const char *name, render_mode_t mode, bool no_video, bool threaded)
+{
+    int frames = 600;
+    struct timespec start, end;
+    double secs;
+
+    setup_screen(mode);
+    nes.ppu.no_video = no_video;
+    if (threaded)
+        render_thread_start(&nes);
+    // wall clock, the render thread runs next to this one
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // 3 dots at a time like the CPU, so that scanline mode skips the quiet ones
+    for (uint64_t end = nes.ppu.frames + frames; nes.ppu.frames < end;)
+        ppu_run(&nes, 3);
+    render_thread_stop(&nes);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (threaded)
+        name = "threaded";
+    printf("%-10s renderer%-10s %6.1f us/frame  %6.1f M dots/s\n", name, (no_video) ? ", no video" : "",
+           secs * 1e6 / frames, 341.0 * 262 * frames / secs / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint64_t scanline_trace[TRACE_DOTS], dot_trace[TRACE_DOTS];
+
+    test_mirroring();
+    printf("Test nametable mirroring ok\n");
+    test_attributes();
+    printf("Test attribute cache ok\n");
+    test_palette();
+    printf("Test palette ok\n");
+    test_palette_lut();
+    printf("Test palette LUT ok\n");
+    test_pattern();
+    printf("Test pattern tables ok\n");
+    test_versions();
+    printf("Test CHR and palette versions ok\n");
+    test_render(RENDER_SCANLINE);
+    printf("Test scanline renderer ok\n");
+    test_render(RENDER_DOT);
+    printf("Test dot renderer ok\n");
+    test_bank_switch(RENDER_SCANLINE);
+    test_bank_switch(RENDER_DOT);
+    printf("Test mid-line bank switch ok\n");
+    test_emphasis(RENDER_SCANLINE);
+    test_emphasis(RENDER_DOT);
+    printf("Test color emphasis ok\n");
+    if (test_frame_hash(RENDER_SCANLINE) != test_frame_hash(RENDER_DOT)) {
+        printf("frame hash: scanline and dot renderers differ\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("Test frame hash ok\n");
+    test_indexed(RENDER_SCANLINE);
+    test_indexed(RENDER_DOT);
+    printf("Test indexed output ok\n");
+    test_sprite_overflow(RENDER_SCANLINE);
+    test_sprite_overflow(RENDER_DOT);
+    printf("Test sprite overflow ok\n");
+    test_no_video(RENDER_SCANLINE, scanline_trace);
+    test_no_video(RENDER_DOT, dot_trace);
+    printf("Test frames without video ok\n");
+    test_status_dots(scanline_trace, dot_trace);
+    printf("Test sprite 0 hit and overflow dots ok\n");
+    test_batched_dots(scanline_trace);
+    printf("Test batched scanline dots ok\n");
+    test_render_thread();
+    printf("Test render thread ok\n");
+    bench_render("scanline", RENDER_SCANLINE, false, false);
+    bench_render("scanline", RENDER_SCANLINE, true, false);
+    bench_render("scanline", RENDER_SCANLINE, false, true);
+    bench_render("dot", RENDER_DOT, false, false);
+    bench_render("dot", RENDER_DOT, true, false);
+    printf("*******************************************************************\n");
+    return 0;
+}
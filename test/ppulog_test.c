@@ -0,0 +1,194 @@
+#include <time.h>
+#include <unistd.h>
+#include "nes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "ppulog.h"
+
+#define FRAMES      60
+
+static struct nes nes;
+static uint8_t prg_rom[32 * KB];
+static uint8_t chr_rom[32 * KB];
+static uint8_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+static uint64_t hashes[FRAMES];
+
+void fail(const char *msg, long long a, long long b)
+{
+    printf("%s: %lld, expected %lld\n", msg, a, b);
+    exit(EXIT_FAILURE);
+}
+
+/* CNROM, so there are CHR bank switches to log */
+void setup(enum RENDER_MODE mode)
+{
+    memset(&nes, 0, sizeof(nes));
+    memset(prg_rom, 0xff, sizeof(prg_rom));
+    for (int i = 0; i < sizeof(chr_rom); i++)
+        chr_rom[i] = (i >> 4) * 5 + (i >> 13) * 3 + (i & 0x07);
+    nes.cart.prg_rom = prg_rom;
+    nes.cart.chr_rom = chr_rom;
+    nes.cart.info.prg_size = sizeof(prg_rom);
+    nes.cart.info.chr_size = sizeof(chr_rom);
+    nes.cart.info.mapper = 3;
+    nes.cart.info.mirroring = HORIZONTAL;
+    cpu_at_power_up(&nes);
+    ppu_at_power_up(&nes);
+    mapper_init(&nes);
+    nes.ppu.render_mode = mode;
+    nes.ppu.framebuffer = framebuffer;
+}
+
+/* CPU cycles that don't touch the PPU until a dot */
+void wait_for(int scanline, int cycle)
+{
+    while (nes.ppu.scanlines != scanline || nes.ppu.cycles < cycle || nes.ppu.cycles >= cycle + 3)
+        cpu_read(&nes, 0x0000);
+}
+
+/* What a game does in vblank(nametables, palette, OAM DMA, scroll) and a
+   scroll split and a CHR bank switch in the middle of the screen. */
+void session(void)
+{
+    for (int frame = 0; frame < FRAMES; frame++) {
+        wait_for(241, 10);
+        cpu_read(&nes, 0x2002);
+        cpu_write(&nes, 0x2006, 0x20 + (frame & 0x07));
+        cpu_write(&nes, 0x2006, frame * 7);
+        for (int i = 0; i < 40; i++)
+            cpu_write(&nes, 0x2007, frame + i * 3);
+        cpu_read(&nes, 0x2007);
+        cpu_write(&nes, 0x2006, 0x3f);
+        cpu_write(&nes, 0x2006, frame & 0x1f);
+        cpu_write(&nes, 0x2007, frame + 0x11);
+        for (int i = 0; i < 256; i++)
+            nes.cpu.mem[0x200 + i] = (i & 0x03) ? frame * 3 + i : (frame * 5 + i) & 0x7f;
+        cpu_write(&nes, 0x2003, 0x00);
+        cpu_write(&nes, 0x4014, 0x02);
+        cpu_write(&nes, 0x2000, (frame & 0x04) ? 0x18 : 0x00);
+        cpu_write(&nes, 0x2005, frame * 3);
+        cpu_write(&nes, 0x2005, frame & 0x3f);
+        cpu_write(&nes, 0x2001, 0x1e);
+        wait_for(100, 250);
+        cpu_write(&nes, 0x2005, frame * 11);
+        cpu_write(&nes, 0x8000, frame & 0x03);
+        wait_for(240, 0);
+        hashes[frame] = nes.ppu.frame_hash;
+    }
+}
+
+/* A log recorded with either renderer replays with both: they draw the
+   same frames. */
+void test_log(enum RENDER_MODE mode)
+{
+    char path[] = "/tmp/nesla_ppulog_test.nesp";
+    struct ppu_replay replay;
+    static struct ppu ppu;
+    int64_t ret;
+    FILE *fp;
+
+    setup(mode);
+    if (!(nes.ppu_log = ppulog_open(path, &nes)))
+        fail("ppulog: open", -1, 0);
+    session();
+    if (ppulog_close(nes.ppu_log, nes.ppu.clock))
+        fail("ppulog: close", -1, 0);
+    nes.ppu_log = NULL;
+    memcpy(&ppu, &nes.ppu, sizeof(ppu));
+
+    if (ppulog_load(&replay, path))
+        fail("ppulog: load", -1, 0);
+    if (replay.frames != FRAMES || replay.dots != ppu.clock || replay.rom_crc != ppulog_rom_crc(&nes.cart))
+        fail("ppulog: header", replay.frames, FRAMES);
+    // the OAM DMA is one
+    if (replay.accesses != FRAMES * 55)
+        fail("ppulog: accesses", replay.accesses, FRAMES * 55);
+    for (int i = 0; i < FRAMES; i++)
+        if (replay.hashes[i] != hashes[i])
+            fail("ppulog: frame hash", i, replay.hashes[i]);
+
+    // the same PPU without the CPU, with each renderer: v only with the
+    // one that recorded, the scanline one doesn't step it through the line
+    for (int replay_mode = RENDER_SCANLINE; replay_mode <= RENDER_DOT; replay_mode++) {
+        setup(replay_mode);
+        if ((ret = ppulog_replay(&nes, &replay)))
+            fail("ppulog: replay", ret, 0);
+        if (nes.ppu.clock != ppu.clock || memcmp(nes.ppu.vram, ppu.vram, sizeof(ppu.vram)) ||
+            memcmp(nes.ppu.oam, ppu.oam, sizeof(ppu.oam)) ||
+            memcmp(nes.ppu.palette, ppu.palette, sizeof(ppu.palette)) ||
+            (replay_mode == mode && nes.ppu.v != ppu.v) || nes.ppu.page[0] != ppu.page[0])
+            fail("ppulog: PPU after the replay", nes.ppu.clock, ppu.clock);
+    }
+
+    // a wrong hash is the frame it's in
+    replay.hashes[37] ^= 1;
+    setup(mode);
+    if ((ret = ppulog_replay(&nes, &replay)) != 38)
+        fail("ppulog: mismatch", ret, 38);
+    ppulog_free(&replay);
+
+    // cut short
+    if (truncate(path, 5000) || !ppulog_load(&replay, path))
+        fail("ppulog: truncated log loaded", 0, -1);
+    fp = fopen(path, "wb");
+    fclose(fp);
+    if (!ppulog_load(&replay, path))
+        fail("ppulog: empty log loaded", 0, -1);
+    unlink(path);
+}
+
+/* replay speed of each renderer, on the same log */
+void bench(void)
+{
+    char path[] = "/tmp/nesla_ppulog_bench.nesp";
+    struct ppu_replay replay;
+    struct timespec start, end;
+    int rounds = 20;
+    int64_t ret;
+    double secs;
+
+    setup(RENDER_SCANLINE);
+    nes.ppu_log = ppulog_open(path, &nes);
+    session();
+    ppulog_close(nes.ppu_log, nes.ppu.clock);
+    nes.ppu_log = NULL;
+    ppulog_load(&replay, path);
+    unlink(path);
+    for (int mode = RENDER_SCANLINE; mode <= RENDER_DOT; mode++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            setup(mode);
+            if ((ret = ppulog_replay(&nes, &replay)))
+                fail("ppulog: bench replay", ret, 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("ppulog: %s replay %.1f M dots/s, %zu bytes for %d frames\n",
+               (mode == RENDER_SCANLINE) ? "scanline" : "dot     ", replay.dots * rounds / secs / 1e6,
+               replay.size, FRAMES);
+    }
+    ppulog_free(&replay);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint64_t scanline_hashes[FRAMES];
+
+    // the desktop's struct nes isn't zeroed, the power up clears the log
+    memset(&nes, 0xa5, sizeof(nes));
+    cpu_at_power_up(&nes);
+    ppu_at_power_up(&nes);
+    if (nes.ppu_log)
+        fail("ppulog: log set at power up", -1, 0);
+
+    test_log(RENDER_SCANLINE);
+    memcpy(scanline_hashes, hashes, sizeof(hashes));
+    test_log(RENDER_DOT);
+    for (int i = 0; i < FRAMES; i++)
+        if (hashes[i] != scanline_hashes[i])
+            fail("ppulog: dot renderer frame hash", i, -1);
+    printf("Test PPU log ok\n");
+    bench();
+    printf("*******************************************************************\n");
+    return 0;
+}
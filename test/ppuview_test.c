@@ -0,0 +1,299 @@
+#include <time.h>
+#include <unistd.h>
+#include "nes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "ppuview.h"
+
+static struct nes nes;
+static uint8_t prg_rom[32 * KB];
+static uint8_t chr_rom[8 * KB];
+static struct palette_lut lut;
+static uint32_t colors[64];
+
+void fail(const char *msg, long long a, long long b)
+{
+    printf("%s: %lld, expected %lld\n", msg, a, b);
+    exit(EXIT_FAILURE);
+}
+
+void setup_ppu(enum MIRRORING mirroring)
+{
+    memset(&nes, 0, sizeof(nes));
+    for (int i = 0; i < sizeof(chr_rom); i++)
+        chr_rom[i] = (i >> 4) * 7 + (i & 0x07);
+    nes.cart.prg_rom = prg_rom;
+    nes.cart.chr_rom = chr_rom;
+    nes.cart.info.prg_size = sizeof(prg_rom);
+    nes.cart.info.chr_size = sizeof(chr_rom);
+    nes.cart.info.mirroring = mirroring;
+    ppu_at_power_up(&nes);
+    mapper_init(&nes);
+    palette_reset(&lut, PIXEL_INDEXED8);
+    for (int i = 0; i < 64; i++)
+        colors[i] = (lut.rgb[0][i][0] << 24) | (lut.rgb[0][i][1] << 16) | (lut.rgb[0][i][2] << 8) | 0xff;
+}
+
+void vram_write(uint16_t addr, uint8_t val)
+{
+    mmu_read(&nes, 0x2002);
+    mmu_write(&nes, 0x2006, addr >> 8);
+    mmu_write(&nes, 0x2006, addr & 0xff);
+    mmu_write(&nes, 0x2007, val);
+}
+
+void oam_write(uint8_t addr, uint8_t val)
+{
+    mmu_write(&nes, 0x2003, addr);
+    mmu_write(&nes, 0x2004, val);
+}
+
+/* the images once the worker drew frames, locked */
+struct ppu_view_images *wait_for(struct ppu_view *view, uint64_t frames)
+{
+    struct ppu_view_images *images;
+
+    for (int i = 0; i < 10000; i++) {
+        if ((images = ppuview_lock(view)) && images->frames == frames)
+            return images;
+        if (images)
+            ppuview_unlock(view);
+        usleep(100);
+    }
+    fail("ppuview: frame never drawn", 0, frames);
+    return NULL;
+}
+
+/* a frame went by and the view was given it */
+struct ppu_view_images *submit(struct ppu_view *view)
+{
+    nes.ppu.frames++;
+    ppuview_submit(view, &nes.ppu);
+    return wait_for(view, nes.ppu.frames);
+}
+
+/* every pixel of the 4 screens against the PPU's own tiles and palette */
+void check_nametables(const struct ppu_view_images *images)
+{
+    const uint8_t *pixels;
+    uint16_t addr;
+    uint8_t tile, attr, pixel, color;
+
+    for (int y = 0; y < PPUVIEW_NAMETABLE_HEIGHT; y++) {
+        for (int x = 0; x < PPUVIEW_NAMETABLE_WIDTH; x++) {
+            addr = 0x2000 + (y / SCREEN_HEIGHT) * 0x800 + (x / SCREEN_WIDTH) * 0x400;
+            tile = ppu_bus_read(&nes.ppu, addr + (y % SCREEN_HEIGHT) / 8 * 32 + (x % SCREEN_WIDTH) / 8);
+            attr = ppu_attr_bits(&nes.ppu, addr + (y % SCREEN_HEIGHT) / 8 * 32 + (x % SCREEN_WIDTH) / 8);
+            pixels = tilecache_tile(&nes.ppu, ((nes.ppu.BG) ? 0x1000 : 0) + tile * 16, false);
+            pixel = pixels[(y % 8) * 8 + x % 8];
+            color = nes.ppu.palette[(pixel) ? attr | pixel : 0];
+            if (images->nametables[y][x] != colors[color])
+                fail("ppuview: nametable pixel", images->nametables[y][x], colors[color]);
+        }
+    }
+}
+
+void test_nametables(struct ppu_view *view)
+{
+    struct ppu_view_images *images;
+
+    setup_ppu(VERTICAL);
+    for (int i = 0; i < 32; i++)
+        vram_write(0x3f00 + i, i * 3 + 1);
+    for (int i = 0; i < 2 * KB; i++)
+        vram_write(0x2000 + (i & 0x3ff) + (i >> 10) * 0x400, (i * 13) >> 2);
+    mmu_write(&nes, 0x2000, 0x10);
+    images = submit(view);
+    check_nametables(images);
+    if (images->nametable_rows != (1ULL << 60) - 1 || images->sprites_changed != ~0ULL ||
+        !images->palette_changed)
+        fail("ppuview: first frame not drawn whole", images->nametable_rows, (1ULL << 60) - 1);
+    ppuview_unlock(view);
+
+    // nothing written, nothing drawn
+    images = submit(view);
+    if (images->nametable_rows || images->sprites_changed || images->palette_changed)
+        fail("ppuview: unchanged frame drawn", images->nametable_rows, 0);
+    ppuview_unlock(view);
+
+    // $2000 row 5 shows in screens 0 and 2(vertical mirroring)
+    vram_write(0x2000 + 5 * 32 + 7, 0x42);
+    images = submit(view);
+    check_nametables(images);
+    if (images->nametable_rows != ((1ULL << 5) | (1ULL << 35)))
+        fail("ppuview: rows of a tile write", images->nametable_rows, (1ULL << 5) | (1ULL << 35));
+    ppuview_unlock(view);
+
+    // an attribute byte covers 4 rows
+    vram_write(0x2400 + 0x3c0 + 2 * 8 + 3, 0xe4);
+    images = submit(view);
+    check_nametables(images);
+    if (images->nametable_rows != ((0x0fULL << 8) | (0x0fULL << 38)))
+        fail("ppuview: rows of an attribute write", images->nametable_rows, (0x0fULL << 8) | (0x0fULL << 38));
+    ppuview_unlock(view);
+
+    // the background pattern table and the palette change everything
+    mmu_write(&nes, 0x2000, 0x00);
+    images = submit(view);
+    check_nametables(images);
+    if (images->nametable_rows != (1ULL << 60) - 1)
+        fail("ppuview: pattern table switch", images->nametable_rows, (1ULL << 60) - 1);
+    ppuview_unlock(view);
+    vram_write(0x3f01, 0x2a);
+    images = submit(view);
+    check_nametables(images);
+    if (images->nametable_rows != (1ULL << 60) - 1 || images->palette[1] != colors[0x2a])
+        fail("ppuview: palette write", images->palette[1], colors[0x2a]);
+    ppuview_unlock(view);
+}
+
+/* a sprite write redraws that sprite, flipped tiles are the PPU's */
+void test_sprites(struct ppu_view *view)
+{
+    struct ppu_view_images *images;
+    const uint8_t *pixels;
+    uint32_t expected;
+
+    images = submit(view);
+    ppuview_unlock(view);
+    oam_write(9 * 4 + 1, 0x21);
+    oam_write(9 * 4 + 2, 0x42);
+    images = submit(view);
+    if (images->sprites_changed != 1ULL << 9 || images->oam[9 * 4 + 1] != 0x21)
+        fail("ppuview: sprites of an OAM write", images->sprites_changed, 1ULL << 9);
+    pixels = tilecache_tile(&nes.ppu, 0x21 * 16, true);
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 8; x++) {
+            expected = (y < 8 && pixels[y * 8 + x]) ? colors[nes.ppu.palette[0x18 + pixels[y * 8 + x]]] : 0;
+            if (images->sprites[16 + y][8 + x] != expected)
+                fail("ppuview: sprite pixel", images->sprites[16 + y][8 + x], expected);
+        }
+    }
+    ppuview_unlock(view);
+
+    // 8x16: tile $21 is $20 then $21 from $1000, flipped $21 then $20
+    oam_write(9 * 4 + 2, 0x80);
+    mmu_write(&nes, 0x2000, 0x20);
+    images = submit(view);
+    if (images->sprites_changed != ~0ULL)
+        fail("ppuview: sprite size switch", images->sprites_changed, ~0ULL);
+    for (int y = 0; y < 16; y++) {
+        pixels = tilecache_tile(&nes.ppu, 0x1000 + (0x20 + (y < 8)) * 16, false);
+        for (int x = 0; x < 8; x++) {
+            expected = colors[nes.ppu.palette[0x10 + pixels[(7 - y % 8) * 8 + x]]];
+            if (!pixels[(7 - y % 8) * 8 + x])
+                expected = 0;
+            if (images->sprites[16 + y][8 + x] != expected)
+                fail("ppuview: 8x16 sprite pixel", y, x);
+        }
+    }
+    ppuview_unlock(view);
+    mmu_write(&nes, 0x2000, 0x00);
+}
+
+/* While the worker draws, submitting returns at once and the changes
+   wait in the PPU for the next frame. */
+void test_busy(struct ppu_view *view)
+{
+    struct ppu_view_images *images;
+
+    // holding the images keeps the worker busy with the next frame
+    submit(view);
+    nes.ppu.frames++;
+    ppuview_submit(view, &nes.ppu);
+    vram_write(0x2000 + 29 * 32, 0x11);
+    nes.ppu.frames++;
+    ppuview_submit(view, &nes.ppu);
+    if (!nes.ppu.view_dirty.vram_rows[0])
+        fail("ppuview: changes lost while busy", 0, 1);
+    ppuview_unlock(view);
+    wait_for(view, nes.ppu.frames - 1);
+    ppuview_unlock(view);
+    images = submit(view);
+    if (images->nametable_rows != ((1ULL << 29) | (1ULL << 59)))
+        fail("ppuview: changes of a busy frame", images->nametable_rows, (1ULL << 29) | (1ULL << 59));
+    check_nametables(images);
+    ppuview_unlock(view);
+}
+
+/* the viewport is where the pre-render line put v */
+void test_scroll(struct ppu_view *view)
+{
+    struct ppu_view_images *images;
+    uint64_t frames = nes.ppu.frames;
+
+    mmu_write(&nes, 0x2000, 0x03);
+    mmu_write(&nes, 0x2005, 0x2d);
+    mmu_write(&nes, 0x2005, 0x5b);
+    mmu_write(&nes, 0x2001, 0x08);
+    while (nes.ppu.scanlines != 261)
+        ppu_tick(&nes);
+    while (nes.ppu.scanlines != 0)
+        ppu_tick(&nes);
+    nes.ppu.frames = frames;
+    images = submit(view);
+    if (images->scroll_x != 256 + 0x2d || images->scroll_y != 240 + 0x5b)
+        fail("ppuview: scroll", images->scroll_x * 1000 + images->scroll_y, (256 + 0x2d) * 1000 + 240 + 0x5b);
+    ppuview_unlock(view);
+    mmu_write(&nes, 0x2001, 0x00);
+}
+
+double elapsed_us(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e6 + (end.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/* what the emulation thread pays per frame and how long the worker takes
+   for a whole redraw and for a frame with a tile row and a sprite */
+void bench(struct ppu_view *view)
+{
+    int rounds = 500;
+    struct timespec start, submitted;
+    double submit_us = 0, full_us, row_us;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        vram_write(0x3f01, r & 0x3f);
+        submit(view);
+        ppuview_unlock(view);
+    }
+    full_us = elapsed_us(&start) / rounds;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        vram_write(0x2000 + (r % 30) * 32, r);
+        oam_write(r & 0xff, r);
+        nes.ppu.frames++;
+        clock_gettime(CLOCK_MONOTONIC, &submitted);
+        ppuview_submit(view, &nes.ppu);
+        submit_us += elapsed_us(&submitted);
+        wait_for(view, nes.ppu.frames);
+        ppuview_unlock(view);
+    }
+    row_us = elapsed_us(&start) / rounds;
+    printf("ppuview: whole redraw %.1f us, a row and a sprite %.1f us, ppuview_submit() %.2f us\n", full_us,
+           row_us, submit_us / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+    struct ppu_view *view;
+
+    setup_ppu(VERTICAL);
+    if (!(view = ppuview_create(&lut)))
+        fail("ppuview: create", 0, 1);
+    test_nametables(view);
+    printf("Test nametable view ok\n");
+    test_sprites(view);
+    printf("Test sprite view ok\n");
+    test_busy(view);
+    printf("Test busy worker ok\n");
+    test_scroll(view);
+    printf("Test scroll viewport ok\n");
+    bench(view);
+    ppuview_destroy(view);
+    printf("*******************************************************************\n");
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <time.h>
+#include "upscale.h"
+#include "pixel.h"
+#include "palette.h"
+
+static const char *names[] = { "scalar", "ssse3", "avx2" };
+static struct palette_lut lut;
+static uint8_t frame[SCREEN_WIDTH * SCREEN_HEIGHT];
+static uint8_t emphasis[SCREEN_HEIGHT];
+static uint32_t pixels[SCREEN_HEIGHT * UPSCALE_MAX_SCALE][SCREEN_WIDTH * UPSCALE_MAX_SCALE];
+static uint32_t ref[SCREEN_HEIGHT * 3][SCREEN_WIDTH * 3];
+
+#define BG      0x0f
+#define FG      0x30
+#define LINE    0x16
+
+void fail(const char *msg, int x, int y)
+{
+    printf("upscale: %s at %d, %d\n", msg, x, y);
+    exit(EXIT_FAILURE);
+}
+
+/* a rectangle and a 1 pixel diagonal line on a flat background, a few
+   lines with emphasis */
+void draw(void)
+{
+    memset(frame, BG, sizeof(frame));
+    for (int y = 50; y < 90; y++)
+        memset(frame + y * SCREEN_WIDTH + 100, FG, 40);
+    for (int i = 0; i < 40; i++)
+        frame[(150 + i) * SCREEN_WIDTH + 20 + i] = LINE;
+    memset(emphasis, 0, sizeof(emphasis));
+    for (int y = 200; y < 210; y++)
+        emphasis[y] = y & 0x07;
+}
+
+uint32_t color(int x, int y)
+{
+    return lut.colors[emphasis[y]][frame[y * SCREEN_WIDTH + x]];
+}
+
+uint32_t blend(uint32_t a, uint32_t b)
+{
+    uint32_t v = 0;
+
+    for (int i = 0; i < 32; i += 8)
+        v |= ((((a >> i) & 0xff) + ((b >> i) & 0xff) + 1) >> 1) << i;
+    return v;
+}
+
+struct upscaler *create(enum UPSCALE_FILTER filter, int scale)
+{
+    struct upscaler *up = upscale_create(filter, scale, &lut);
+
+    if (!up)
+        fail("create", filter, scale);
+    return up;
+}
+
+/* Every pixel scale x scale times, with the emphasis of its line. The
+   filters leave flat areas alone, they're the nearest at their scale. */
+void test_nearest(void)
+{
+    struct upscaler *up;
+    int scale;
+
+    for (int filter = UPSCALE_NEAREST; filter <= UPSCALE_XBR2X; filter++) {
+        for (int s = 1; s <= ((filter == UPSCALE_NEAREST) ? UPSCALE_MAX_SCALE : 1); s++) {
+            up = create(filter, s);
+            scale = upscale_width(up) / SCREEN_WIDTH;
+            if (upscale_height(up) != SCREEN_HEIGHT * scale)
+                fail("size", upscale_width(up), upscale_height(up));
+            upscale_frame(up, frame, emphasis, &pixels[0][0], sizeof(pixels[0]));
+            for (int y = 0; y < SCREEN_HEIGHT * scale; y++) {
+                for (int x = 0; x < SCREEN_WIDTH * scale; x++) {
+                    // the shapes and the lines around them
+                    if (filter != UPSCALE_NEAREST && ((x / scale >= 19 && x / scale <= 141 &&
+                                                       y / scale >= 49 && y / scale <= 190)))
+                        continue;
+                    if (pixels[y][x] != color(x / scale, y / scale))
+                        fail((filter == UPSCALE_NEAREST) ? "nearest" : "flat area", x, y);
+                }
+            }
+            upscale_destroy(up);
+        }
+    }
+}
+
+/* The rectangle's corners are rounded off: the outer corner of each
+   corner pixel at 2x, and its 2 neighbors too at 3x. xBR-lite blends them
+   half and half instead. */
+void test_corners(void)
+{
+    int corners[4][2] = { { 100, 50 }, { 139, 50 }, { 100, 89 }, { 139, 89 } };
+    uint32_t fg = color(100, 50), bg = color(0, 0);
+    struct upscaler *up;
+    int s, x, y, cx, cy;
+
+    for (int filter = UPSCALE_SCALE2X; filter <= UPSCALE_XBR2X; filter++) {
+        up = create(filter, 0);
+        s = upscale_width(up) / SCREEN_WIDTH;
+        upscale_frame(up, frame, emphasis, &pixels[0][0], sizeof(pixels[0]));
+        for (int c = 0; c < 4; c++) {
+            // the outer corner of the block, and the way in
+            cx = corners[c][0] * s + ((c & 1) ? s - 1 : 0);
+            cy = corners[c][1] * s + ((c & 2) ? s - 1 : 0);
+            x = (c & 1) ? -1 : 1;
+            y = (c & 2) ? -1 : 1;
+            if (pixels[cy][cx] != ((filter == UPSCALE_XBR2X) ? blend(fg, bg) : bg))
+                fail("corner", cx, cy);
+            if (pixels[cy + y][cx + x] != fg)
+                fail("inside of the corner", cx + x, cy + y);
+            if ((filter == UPSCALE_SCALE3X) != (pixels[cy][cx + x] == bg && pixels[cy + y][cx] == bg))
+                fail("next to the corner", cx + x, cy);
+        }
+        // the rest of the edges is untouched
+        if (pixels[70 * s][100 * s] != fg || pixels[70 * s][100 * s - 1] != bg)
+            fail("edge", 100 * s, 70 * s);
+        upscale_destroy(up);
+    }
+}
+
+/* Scale2x fills the steps of a 1 pixel diagonal line in, xBR-lite leaves
+   it as it is: the background goes on across the corner. */
+void test_diagonal(void)
+{
+    uint32_t line = color(20, 150), bg = color(0, 0);
+    struct upscaler *up;
+    int x, y;
+
+    for (int filter = UPSCALE_SCALE2X; filter <= UPSCALE_XBR2X; filter += UPSCALE_XBR2X - UPSCALE_SCALE2X) {
+        up = create(filter, 0);
+        upscale_frame(up, frame, emphasis, &pixels[0][0], sizeof(pixels[0]));
+        for (int i = 1; i < 39; i++) {
+            // bottom left corner of the pixel right of the line
+            x = (21 + i) * 2;
+            y = (150 + i) * 2 + 1;
+            if (pixels[y][x] != ((filter == UPSCALE_SCALE2X) ? line : bg))
+                fail("diagonal", x, y);
+            if (pixels[y][x - 1] != line || pixels[y][x + 1] != bg)
+                fail("around the diagonal", x, y);
+        }
+        upscale_destroy(up);
+    }
+}
+
+/* waits for the worker's frame */
+const uint32_t *wait_for_frame(struct upscaler *up)
+{
+    struct timespec ms = { 0, 1000000 };
+    const uint32_t *out;
+
+    for (int i = 0; i < 2000; i++) {
+        if ((out = upscale_lock(up)))
+            return out;
+        nanosleep(&ms, NULL);
+    }
+    fail("no frame from the worker", 0, 0);
+    return NULL;
+}
+
+/* The worker's frames are upscale_frame()'s, handed once. A frame
+   submitted while the worker is busy(here waiting for the lock) is
+   dropped. The worker is idle by the time its frame can be locked, so
+   holding the lock keeps it from starting the next one. */
+void test_worker(void)
+{
+    struct upscaler *up = create(UPSCALE_SCALE3X, 0);
+    size_t size = (size_t)upscale_width(up) * upscale_height(up) * sizeof(uint32_t);
+    struct upscale_stats stats;
+    const uint32_t *out;
+
+    upscale_frame(up, frame, emphasis, &ref[0][0], sizeof(ref[0]));
+    if (!upscale_submit(up, frame, emphasis))
+        fail("submit to an idle worker", 0, 0);
+    out = wait_for_frame(up);
+    if (memcmp(out, ref, size))
+        fail("worker frame", 0, 0);
+
+    // a second frame to the idle worker, which then waits for the lock:
+    // busy until it's released, the third one is dropped
+    frame[0] = FG;
+    if (!upscale_submit(up, frame, emphasis))
+        fail("submit while the frame is locked", 0, 0);
+    frame[0] = LINE;
+    if (upscale_submit(up, frame, emphasis))
+        fail("submit to a busy worker", 0, 0);
+    upscale_unlock(up);
+    out = wait_for_frame(up);
+    if (out[0] != lut.colors[0][FG])
+        fail("the frame after the lock", 0, 0);
+    upscale_unlock(up);
+    if (upscale_lock(up))
+        fail("the same frame twice", 0, 0);
+    frame[0] = BG;
+
+    upscale_get_stats(up, &stats);
+    if (stats.frames != 3 || stats.dropped != 1 || stats.upscaled != 2 || stats.average_ms <= 0)
+        fail("stats", stats.frames, stats.dropped);
+    upscale_destroy(up);
+
+    if (upscale_create(UPSCALE_NEAREST, UPSCALE_MAX_SCALE + 1, &lut) ||
+        upscale_create(UPSCALE_NEAREST, 0, &lut))
+        fail("scale out of range", 0, 0);
+    palette_set_format(&lut, PIXEL_RGB565);
+    if (upscale_create(UPSCALE_SCALE2X, 0, &lut))
+        fail("RGB565", 0, 0);
+    palette_set_format(&lut, PIXEL_RGBA8888);
+}
+
+/* time per frame of each filter with each kernel set, on a frame of tiles
+   that has edges everywhere */
+void bench(void)
+{
+    const char *filters[] = { "nearest 3x", "scale2x", "scale3x", "xbr2x" };
+    struct upscaler *up;
+    int rounds = 100;
+    clock_t start;
+    double ms;
+
+    for (int i = 0; i < sizeof(frame); i++)
+        frame[i] = (((i % SCREEN_WIDTH) / 8 + (i / SCREEN_WIDTH) / 8) & 0x03) ? ((i * 7) >> 5) & 0x3f : BG;
+    for (int n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        if (pixel_select(names[n]))
+            continue;
+        printf("%-7s", names[n]);
+        for (int filter = UPSCALE_NEAREST; filter <= UPSCALE_XBR2X; filter++) {
+            up = create(filter, 3);
+            start = clock();
+            for (int r = 0; r < rounds; r++)
+                upscale_frame(up, frame, emphasis, &pixels[0][0], sizeof(pixels[0]));
+            ms = (double)(clock() - start) / CLOCKS_PER_SEC * 1000 / rounds;
+            printf(" %s %.3f ms", filters[filter], ms);
+            upscale_destroy(up);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    palette_reset(&lut, PIXEL_RGBA8888);
+    draw();
+    for (int n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        if (pixel_select(names[n])) {
+            printf("Skip %s kernels(unsupported)\n", names[n]);
+            continue;
+        }
+        test_nearest();
+        test_corners();
+        test_diagonal();
+        printf("Test upscale with %s kernels ok\n", names[n]);
+    }
+    test_worker();
+    printf("Test upscale worker ok\n");
+    bench();
+    printf("*******************************************************************\n");
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include <unistd.h>
+#include <time.h>
+#include "nes.h"
+#include "palette.h"
+#include "capture.h"
+#include "deltacodec.h"
+
+/* nesla-play: decodes a .nesv capture as it's read, to a Y4M stream for a
+   video player or encoder, e.g.
+
+       nesla-play capture.nesv - | ffplay -
+       nesla-play capture.nesv out.y4m 3600
+
+   Without an output it only decodes and reports the speed. */
+int main(int argc, char *argv[])
+{
+    static uint8_t frame[SCREEN_WIDTH * SCREEN_HEIGHT], emphasis[SCREEN_HEIGHT];
+    static struct palette_lut lut;
+    struct delta_reader *reader;
+    struct capture *cap = NULL;
+    struct timespec start, end;
+    uint64_t frames = 0;
+    double secs;
+    int ret;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <capture.nesv> [out.y4m|-] [first frame] [palette.pal]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    palette_reset(&lut, PIXEL_RGBA8888);
+    if (!(reader = delta_open(argv[1])) || (argc > 3 && delta_seek(reader, strtoull(argv[3], NULL, 0))) ||
+        (argc > 4 && palette_load(&lut, argv[4])))
+        return EXIT_FAILURE;
+    if (argc > 2 && !(cap = capture_open(strcmp(argv[2], "-") ? argv[2] : "/dev/stdout", CAPTURE_Y4M, 8, &lut)))
+        return EXIT_FAILURE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((ret = delta_read(reader, frame, emphasis)) == 1) {
+        // the writer is the slow side, a player waits for it
+        while (cap && !capture_frame(cap, frame, emphasis))
+            usleep(1000);
+        frames++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    delta_close(reader);
+    if (cap && capture_close(cap, NULL))
+        ret = -1;
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%llu frames, %.1f frames/s\n", (unsigned long long)frames, frames / secs);
+    return (ret) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#include <unistd.h>
+#include <time.h>
+#include "nes.h"
+#include "cpu.h"
+#include "cart.h"
+#include "ppu.h"
+#include "ppulog.h"
+
+/* rounds of the log with one renderer, the best and the total time in
+   *best and *total: 0 if every frame hash matched, the first frame that
+   didn't if not, -1 on errors */
+static int64_t replay_rounds(const struct ppu_replay *replay, const char *log_path, char *rom_path,
+                             render_mode_t mode, int rounds, double *best, double *total)
+{
+    static uint8_t frame[SCREEN_WIDTH * SCREEN_HEIGHT];
+    static struct nes nes;
+    struct timespec start, end;
+    int64_t mismatch = 0;
+    double secs;
+
+    *best = *total = 0;
+    for (int r = 0; r < rounds && !mismatch; r++) {
+        memset(&nes, 0, sizeof(nes));
+        cpu_at_power_up(&nes);
+        ppu_at_power_up(&nes);
+        nes.cart.no_save = true;
+        if (cart_load(&nes, rom_path))
+            return -1;
+        if (ppulog_rom_crc(&nes.cart) != replay->rom_crc) {
+            fprintf(stderr, "%s wasn't recorded with %s\n", log_path, rom_path);
+            cart_unload(&nes);
+            return -1;
+        }
+        nes.ppu.render_mode = mode;
+        nes.ppu.framebuffer = frame;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        mismatch = ppulog_replay(&nes, replay);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        cart_unload(&nes);
+        secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        *total += secs;
+        *best = (!r || secs < *best) ? secs : *best;
+    }
+    return mismatch;
+}
+
+/* nesla-ppu-bench: replays a PPU log(see ppulog.h, nesla-snap -r records
+   them) on the PPU alone, no CPU, and reports its speed, e.g.
+
+       nesla-snap -r -n 1800 -i start.txt -o logs smb.nes
+       nesla-ppu-bench logs/smb.nesp smb.nes 10
+
+   Every round checks the frame hashes against the recording, it fails on
+   the first frame that differs. Both renderers are run unless one is
+   given, and both must draw the recorded frames. */
+int main(int argc, char *argv[])
+{
+    const char *names[] = { "scanline", "dot" };
+    struct ppu_replay replay;
+    double best, total;
+    int rounds = (argc > 3) ? atoi(argv[3]) : 5;
+    int first = RENDER_SCANLINE, last = RENDER_DOT;
+    int64_t mismatch = 0;
+
+    if (argc < 3 || rounds < 1 || (argc > 4 && strcmp(argv[4], "scanline") && strcmp(argv[4], "dot"))) {
+        fprintf(stderr, "usage: %s <log.nesp> <rom> [rounds] [scanline|dot]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (ppulog_load(&replay, argv[1]))
+        return EXIT_FAILURE;
+    if (argc > 4)
+        first = last = (strcmp(argv[4], "dot")) ? RENDER_SCANLINE : RENDER_DOT;
+
+    printf("%llu frames, %llu dots, %llu accesses, %zu bytes\n", (unsigned long long)replay.frames,
+           (unsigned long long)replay.dots, (unsigned long long)replay.accesses, replay.size);
+    for (int mode = first; mode <= last && !mismatch; mode++) {
+        mismatch = replay_rounds(&replay, argv[1], argv[2], mode, rounds, &best, &total);
+        if (mismatch > 0)
+            printf("%-8s renderer: frame %lld differs from the recording\n", names[mode], (long long)mismatch);
+        else if (!mismatch)
+            printf("%-8s renderer: %.1f M dots/s(best of %d, %.1f M average), %.0f frames/s, frame hashes ok\n",
+                   names[mode], replay.dots / best / 1e6, rounds, replay.dots * rounds / total / 1e6,
+                   replay.frames / best);
+    }
+    ppulog_free(&replay);
+    return (mismatch) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
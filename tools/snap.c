@@ -0,0 +1,381 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include "nes.h"
+#include "cpu.h"
+#include "cart.h"
+#include "palette.h"
+#include "png.h"
+#include "ppulog.h"
+
+#define MAX_PATH        4096
+#define MAX_JOBS        64
+
+/* pad 1 holds buttons from a frame on, until the next step */
+struct input_step {
+    uint64_t frame;
+    uint8_t buttons;
+};
+
+struct snap {
+    char *rom;
+    char *thumbnail;
+    const char *status;
+    int mapper;
+    uint64_t frame_hash;
+    double ms;
+};
+
+static struct {
+    uint64_t frames;
+    int divisor;
+    bool record;
+    const char *dir;
+    struct input_step *script;
+    int script_len;
+    struct palette_lut lut;
+    struct snap *snaps;
+    int count;
+    int size;
+    atomic_int next;
+} run = { .frames = 300, .divisor = 2, .dir = "." };
+
+static const char *button_names[8] = { "a", "b", "select", "start", "up", "down", "left", "right" };
+
+/* "<frame> <buttons>" lines, buttons like start or right+a, - for none */
+static int load_script(const char *path)
+{
+    char line[256], *name, *save;
+    unsigned long long frame;
+    struct input_step *step;
+    int n = 0, b;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r"))) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        n++;
+        if (line[strspn(line, " \t\r\n")] == '#' || !line[strspn(line, " \t\r\n")])
+            continue;
+        if (!(step = realloc(run.script, (run.script_len + 1) * sizeof(*run.script))))
+            goto script_error;
+        run.script = step;
+        step = &run.script[run.script_len++];
+        if (sscanf(line, "%llu", &frame) != 1 || (run.script_len > 1 && frame < step[-1].frame)) {
+            fprintf(stderr, "%s:%d: not a <frame> <buttons> line after the ones before\n", path, n);
+            goto script_error;
+        }
+        step->frame = frame;
+        step->buttons = 0;
+        strtok_r(line, " \t\r\n", &save);
+        for (name = strtok_r(NULL, "+ \t\r\n", &save); name; name = strtok_r(NULL, "+ \t\r\n", &save)) {
+            for (b = 0; b < 8 && strcmp(name, button_names[b]); b++)
+                ;
+            if (b == 8 && strcmp(name, "-")) {
+                fprintf(stderr, "%s:%d: no button %s\n", path, n, name);
+                goto script_error;
+            }
+            step->buttons |= (b < 8) ? 1U << b : 0;
+        }
+    }
+    fclose(fp);
+    return 0;
+
+script_error:
+    fclose(fp);
+    return -1;
+}
+
+/* the buttons held on a frame */
+static uint8_t script_buttons(uint64_t frame)
+{
+    uint8_t buttons = 0;
+
+    for (int i = 0; i < run.script_len && run.script[i].frame <= frame; i++)
+        buttons = run.script[i].buttons;
+    return buttons;
+}
+
+/* box filter of divisor x divisor pixels, in the colors of each line's
+   emphasis */
+static void downscale(const uint8_t *frame, const uint8_t *emphasis, uint8_t *rgb)
+{
+    int d = run.divisor, width = SCREEN_WIDTH / d, sum[3];
+    const uint8_t *color;
+
+    for (int y = 0; y < SCREEN_HEIGHT / d; y++) {
+        for (int x = 0; x < width; x++) {
+            sum[0] = sum[1] = sum[2] = 0;
+            for (int j = y * d; j < (y + 1) * d; j++) {
+                for (int i = x * d; i < (x + 1) * d; i++) {
+                    color = run.lut.rgb[emphasis[j] & 0x07][frame[j * SCREEN_WIDTH + i] & 0x3f];
+                    for (int c = 0; c < 3; c++)
+                        sum[c] += color[c];
+                }
+            }
+            for (int c = 0; c < 3; c++)
+                rgb[(y * width + x) * 3 + c] = (sum[c] + d * d / 2) / (d * d);
+        }
+    }
+}
+
+/* Only the last frame is drawn, the ones before are run without video:
+   unless a PPU log is recorded, it has the hash of every frame. */
+static void snap_rom(struct nes *nes, uint8_t *frame, uint8_t *rgb, struct snap *snap)
+{
+    char log_path[MAX_PATH];
+    struct timespec start, end;
+    uint64_t frames = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(nes, 0, sizeof(*nes));
+    cpu_at_power_up(nes);
+    ppu_at_power_up(nes);
+    nes->cart.no_save = true;
+    if (cart_load(nes, snap->rom)) {
+        snap->status = "load error";
+        return;
+    }
+    snap->mapper = nes->cart.info.mapper;
+    nes->ppu.framebuffer = frame;
+    nes->ppu.no_video = run.frames > 1 && !run.record;
+    if (run.record) {
+        // next to the thumbnail, .png -> .nesp
+        snprintf(log_path, sizeof(log_path), "%.*s.nesp", (int)strlen(snap->thumbnail) - 4, snap->thumbnail);
+        if (!(nes->ppu_log = ppulog_open(log_path, nes))) {
+            cart_unload(nes);
+            snap->status = "log error";
+            return;
+        }
+    }
+    nes->cpu.pc = TO_U16(mmu_read(nes, RESET_VECTOR_BASE), mmu_read(nes, RESET_VECTOR_BASE + 1));
+    nes->run_mode = NORMAL;
+    nes->pad[0].buttons = script_buttons(0);
+    while (nes->ppu.frames < run.frames) {
+        cpu_step(nes);
+        if (nes->ppu.frames != frames) {
+            frames = nes->ppu.frames;
+            nes->pad[0].buttons = script_buttons(frames);
+            nes->ppu.no_video = frames + 1 < run.frames && !run.record;
+        }
+    }
+    if (nes->ppu_log && ppulog_close(nes->ppu_log, nes->ppu.clock)) {
+        nes->ppu_log = NULL;
+        cart_unload(nes);
+        snap->status = "log error";
+        return;
+    }
+    nes->ppu_log = NULL;
+    snap->frame_hash = nes->ppu.frame_hash;
+    downscale(frame, nes->ppu.emphasis, rgb);
+    cart_unload(nes);
+    snap->status = (png_write(snap->thumbnail, rgb, SCREEN_WIDTH / run.divisor, SCREEN_HEIGHT / run.divisor,
+                              SCREEN_WIDTH / run.divisor * 3)) ? "write error" : "ok";
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    snap->ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static void *worker(void *arg)
+{
+    static const char *alloc_error = "out of memory";
+    struct nes *nes = malloc(sizeof(*nes));
+    uint8_t *frame = malloc(SCREEN_WIDTH * SCREEN_HEIGHT), *rgb = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * 3);
+    int i;
+
+    while ((i = atomic_fetch_add(&run.next, 1)) < run.count) {
+        if (nes && frame && rgb)
+            snap_rom(nes, frame, rgb, &run.snaps[i]);
+        else
+            run.snaps[i].status = alloc_error;
+    }
+    free(nes);
+    free(frame);
+    free(rgb);
+    return NULL;
+}
+
+/* dir/<name without .nes, .gz or .zip>.png, -2, -3... for names already
+   taken by an earlier ROM */
+static int name_thumbnail(int n)
+{
+    static const char *suffixes[] = { ".gz", ".zip", ".nes" };
+    const char *base = strrchr(run.snaps[n].rom, '/');
+    char name[MAX_PATH];
+    int len, taken = 1;
+    size_t l;
+
+    base = (base) ? base + 1 : run.snaps[n].rom;
+    len = strlen(base);
+    for (int i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        l = strlen(suffixes[i]);
+        if (len > l && !strncasecmp(base + len - l, suffixes[i], l))
+            len -= l;
+    }
+    snprintf(name, sizeof(name), "%s/%.*s.png", run.dir, len, base);
+    for (int i = 0; i < n; i++) {
+        if (strcmp(run.snaps[i].thumbnail, name))
+            continue;
+        snprintf(name, sizeof(name), "%s/%.*s-%d.png", run.dir, len, base, ++taken);
+        i = -1;
+    }
+    return (run.snaps[n].thumbnail = strdup(name)) ? 0 : -1;
+}
+
+static int add_rom(const char *path)
+{
+    struct snap *snaps = run.snaps;
+
+    if (run.count == run.size) {
+        run.size = (run.size) ? run.size * 2 : 256;
+        if (!(snaps = realloc(run.snaps, run.size * sizeof(*snaps))))
+            return -1;
+        run.snaps = snaps;
+    }
+    memset(&snaps[run.count], 0, sizeof(*snaps));
+    if (!(snaps[run.count].rom = strdup(path)))
+        return -1;
+    return name_thumbnail(run.count++);
+}
+
+/* ROM paths, one per line */
+static int read_list(FILE *fp)
+{
+    char line[MAX_PATH];
+
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] && add_rom(line))
+            return -1;
+    }
+    return 0;
+}
+
+static int write_index(void)
+{
+    char path[MAX_PATH];
+    FILE *fp;
+    int ret;
+
+    snprintf(path, sizeof(path), "%s/index.tsv", run.dir);
+    if (!(fp = fopen(path, "w"))) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return -1;
+    }
+    fprintf(fp, "rom\tthumbnail\tstatus\tmapper\tframes\tframe_hash\tms\n");
+    for (int i = 0; i < run.count; i++) {
+        struct snap *snap = &run.snaps[i];
+        bool ok = !strcmp(snap->status, "ok");
+
+        fprintf(fp, "%s\t%s\t%s\t%d\t%llu\t%016llx\t%.1f\n", snap->rom, (ok) ? snap->thumbnail : "",
+                snap->status, snap->mapper, (unsigned long long)run.frames,
+                (unsigned long long)snap->frame_hash, snap->ms);
+    }
+    ret = (ferror(fp)) ? -1 : 0;
+    if (fclose(fp) || ret) {
+        fprintf(stderr, "can't write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n frames] [-d 1|2|4|8] [-j jobs] [-i input] [-p palette.pal] [-o dir] [-r] "
+            "<rom|-> ...\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/* nesla-snap: runs ROMs headless and writes a thumbnail of their last
+   frame, with dir/index.tsv listing every ROM, e.g.
+
+       nesla-snap -n 600 -o thumbs smb.nes zelda.nes.gz
+       find roms -name '*.zip' | nesla-snap -i start.txt -o thumbs -
+
+   ROMs are run in parallel(a job per core by default), the same ROM
+   listed twice is mapped once. The input script holds pad 1's buttons
+   from a frame on, a line each:
+
+       # frame  buttons
+       120      start
+       125      -
+       300      right+a
+
+   -r also records what the CPU does to the PPU next to each thumbnail,
+   <name>.nesp, to replay with nesla-ppu-bench.
+*/
+int main(int argc, char *argv[])
+{
+    pthread_t threads[MAX_JOBS];
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN), opt, ok = 0;
+    struct timespec start, end;
+    double secs;
+
+    palette_reset(&run.lut, PIXEL_RGBA8888);
+    while ((opt = getopt(argc, argv, "n:d:j:i:p:o:r")) != -1) {
+        switch (opt) {
+        case 'n':
+            run.frames = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            run.divisor = atoi(optarg);
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'i':
+            if (load_script(optarg))
+                return EXIT_FAILURE;
+            break;
+        case 'p':
+            if (palette_load(&run.lut, optarg))
+                return EXIT_FAILURE;
+            break;
+        case 'o':
+            run.dir = optarg;
+            break;
+        case 'r':
+            run.record = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc || !run.frames || (run.divisor != 1 && run.divisor != 2 && run.divisor != 4 &&
+                                          run.divisor != 8))
+        usage(argv[0]);
+    jobs = (jobs < 1) ? 1 : (jobs > MAX_JOBS) ? MAX_JOBS : jobs;
+    for (int i = optind; i < argc; i++) {
+        if ((strcmp(argv[i], "-")) ? add_rom(argv[i]) : read_list(stdin)) {
+            fprintf(stderr, "can't allocate the ROM list\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    jobs = (jobs > run.count) ? run.count : jobs;
+    for (int i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, worker, NULL)) {
+            fprintf(stderr, "can't start job %d\n", i);
+            jobs = i;
+            break;
+        }
+    }
+    // with no job started at all, the ROMs are done here
+    if (!jobs)
+        worker(NULL);
+    for (int i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    romstore_flush();
+
+    for (int i = 0; i < run.count; i++)
+        ok += !strcmp(run.snaps[i].status, "ok");
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%d/%d ROMs in %.2f s, %d jobs, %.0f frames/s\n", ok, run.count, secs, jobs,
+            run.count * run.frames / secs);
+    return (write_index() || ok != run.count) ? EXIT_FAILURE : EXIT_SUCCESS;
+}